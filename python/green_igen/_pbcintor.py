@@ -14,10 +14,43 @@
 # limitations under the License.
 
 import ctypes
+import math
 import numpy
+from pyscf import gto
 from .misc import load_library
 
 libpbc = load_library('libpbc0')
+
+def multipole_rr_near(precision, lmax):
+    '''Near-field radii rr_near[L], L = 0 ... lmax, of the multipole
+    expansion of the Coulomb lattice sums (see src/multipole.c).
+
+    The order n term of the expansion of two charge distributions at distance
+    R is n!/R^{n+1} times their Hermite coefficients. Its error, the tail of
+    the Boys function, is bounded by 2^n x^{2n-1} exp(-x^2) / (sqrt(pi) n!)
+    relative to that term, x^2 = R^2 / (1/p + 1/q). rr_near[L] is the x^2
+    for which this bound, times n+1, is below precision for all orders
+    n <= L. The integrals of shells of total angular momentum L (li+lj+lk or
+    li+lj) farther apart than that are then accurate to precision relative
+    to the magnitude of their multipole terms, for any L.
+    '''
+    log_prec = -numpy.log(precision)
+    n = numpy.arange(lmax+1)
+    logc = (n * numpy.log(2) - .5 * numpy.log(numpy.pi) + numpy.log(n+1) -
+            numpy.array([math.lgamma(i+1) for i in n]))
+    rr_near = numpy.empty(lmax+1)
+    for L in n:
+        # x^2 = -log(precision) + max_n log(prefactor(n, x)), a fixed point
+        # in x^2 which converges in a few iterations
+        x2 = log_prec
+        for i in range(50):
+            x2, x2_last = log_prec + max(0, (logc[:L+1] + (n[:L+1]-.5) *
+                                             numpy.log(x2)).max()), x2
+            if abs(x2 - x2_last) < 1e-8:
+                break
+        rr_near[L] = x2
+    return rr_near
+
 def _fpointer(name):
     return ctypes.addressof(getattr(libpbc, name))
 
@@ -44,6 +77,62 @@ class PBCOpt(object):
                                 cell._env.ctypes.data_as(ctypes.c_void_p))
         return self
 
+    def init_pair_images(self, cell, Ls, precision=None):
+        '''Per shell-pair image lists for the lattice sum over Ls. Only the
+        images within the overlap range of each shell pair are visited.'''
+        if precision is None: precision = cell.precision
+        Ls = numpy.asarray(Ls, order='C')
+        Ts = numpy.linalg.solve(cell.lattice_vectors().T, Ls.T).T
+        Ts = numpy.asarray(numpy.rint(Ts), dtype=numpy.int32, order='C')
+        libpbc.PBCset_pair_images(self._this,
+                                  Ls.ctypes.data_as(ctypes.c_void_p),
+                                  Ts.ctypes.data_as(ctypes.c_void_p),
+                                  ctypes.c_int(len(Ls)), ctypes.c_double(precision),
+                                  cell._atm.ctypes.data_as(ctypes.c_void_p),
+                                  ctypes.c_int(cell.natm),
+                                  cell._bas.ctypes.data_as(ctypes.c_void_p),
+                                  ctypes.c_int(cell.nbas),
+                                  cell._env.ctypes.data_as(ctypes.c_void_p))
+        return self
+
+    def init_multipole(self, cell, precision=None, cart=None):
+        '''Multipoles of the shells of cell for the far-field part of the
+        Coulomb lattice sums (int3c2e, int2c2e). The near-field radius of two
+        charge distributions of exponents p and q and total angular momentum
+        L is sqrt(rr_near[L] * (1/p + 1/q)) (see multipole_rr_near).'''
+        if precision is None: precision = cell.precision
+        if cart is None: cart = cell.cart
+        lmax = cell._bas[:,gto.ANG_OF].max()
+        rr_near = multipole_rr_near(precision, lmax*3)
+        libpbc.PBCset_multipole(self._this, rr_near.ctypes.data_as(ctypes.c_void_p),
+                                ctypes.c_int(cart),
+                                cell._atm.ctypes.data_as(ctypes.c_void_p),
+                                ctypes.c_int(cell._atm.shape[0]),
+                                cell._bas.ctypes.data_as(ctypes.c_void_p),
+                                ctypes.c_int(cell._bas.shape[0]),
+                                cell._env.ctypes.data_as(ctypes.c_void_p))
+        return self
+
+    def init_pair_mask(self, mask):
+        '''Shell pairs (ish, jsh) of the unit cell with mask[ish,jsh] == False
+        are skipped by the 3c lattice sum (see df.significant_pairs).'''
+        mask = numpy.asarray(mask, dtype=numpy.int8, order='C')
+        libpbc.PBCset_pair_mask(self._this, mask.ctypes.data_as(ctypes.c_void_p),
+                                ctypes.c_int(mask.shape[0]))
+        return self
+
+    def del_pair_mask(self):
+        libpbc.PBCdel_pair_mask(self._this)
+        return self
+
+    def del_multipole(self):
+        libpbc.PBCdel_multipole(self._this)
+        return self
+
+    def del_pair_images(self):
+        libpbc.PBCdel_pair_images(self._this)
+        return self
+
     def del_rcut_cond(self):
         self._this.contents.fprescreen = _fpointer('PBCnoscreen')
         return self
@@ -56,5 +145,24 @@ class PBCOpt(object):
 
 class _CPBCOpt(ctypes.Structure):
     _fields_ = [('rrcut', ctypes.c_void_p),
-                ('fprescreen', ctypes.c_void_p)]
+                ('fprescreen', ctypes.c_void_p),
+                ('img_nbas', ctypes.c_int),
+                ('nimgs', ctypes.c_int),
+                ('img_loc', ctypes.c_void_p),
+                ('img_idx', ctypes.c_void_p),
+                ('img_T', ctypes.c_void_p),
+                ('img_table', ctypes.c_void_p),
+                ('img_tmin', ctypes.c_int*3),
+                ('img_tdim', ctypes.c_int*3),
+                ('mp_nbas', ctypes.c_int),
+                ('mp_cart', ctypes.c_int),
+                ('mp_lmax', ctypes.c_int),
+                ('mp_dmax', ctypes.c_int),
+                ('mp_rr_near', ctypes.c_void_p),
+                ('mp_ainv', ctypes.c_void_p),
+                ('mp_loc', ctypes.c_void_p),
+                ('mp_moments', ctypes.c_void_p),
+                ('mp_hidx', ctypes.c_void_p),
+                ('pair_nbas', ctypes.c_int),
+                ('pair_mask', ctypes.c_void_p)]
 
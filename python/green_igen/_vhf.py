@@ -677,6 +677,91 @@ def rdirect_bindm(intor, aosym, jkdescript,
         vjk = vjk.reshape(vjk.shape[1:])
     return vjk
 
+_HESS_INDEX = {'i': 0, 'j': 1, 'k': 2, 'l': 3}
+def hess_jk(intor, terms, dm_ket, dm_bra, ncomp, natm, atm, bas, env,
+            aosym='s1', vhfopt=None, cintopt=None, shls_slice=None):
+    '''Nuclear Hessian contractions of the derivative integrals of intor,
+    accumulated per atom. Each quartet is evaluated once for all components,
+    densities and terms.
+
+    Args:
+        terms : list of str
+            'pq,rs->a' or 'pq,rs->ab'. (ij|kl) is contracted with dm_ket[pq]
+            and dm_bra[rs]; the result is accumulated on the atom(s) of the
+            derivative center(s) a (and b). E.g. for ipip1 of hessian/rhf.py,
+            'lk,ij->i' (J) and 'jk,il->i' (K).
+        aosym : 's1' or 's2kl'
+            's2kl' if intor is symmetric in k and l (ipip1, ipvip1).
+
+    Returns:
+        A list of arrays for terms, each of shape [n_dm,natm,ncomp] or
+        [n_dm,natm,natm,ncomp]
+    '''
+    assert aosym in ('s1', 's2kl')
+    intor = ascint3(intor)
+    c_atm = numpy.asarray(atm, dtype=numpy.int32, order='C')
+    c_bas = numpy.asarray(bas, dtype=numpy.int32, order='C')
+    c_env = numpy.asarray(env, dtype=numpy.double, order='C')
+    dm_ket = numpy.asarray(dm_ket, order='C')
+    dm_bra = numpy.asarray(dm_bra, order='C')
+    if dm_ket.ndim == 2:
+        dm_ket = dm_ket[numpy.newaxis]
+        dm_bra = dm_bra[numpy.newaxis]
+    n_dm = len(dm_ket)
+    assert dm_bra.shape == dm_ket.shape
+
+    if isinstance(terms, str):
+        terms = (terms,)
+    desc = []
+    shapes = []
+    for term in terms:
+        dms, centers = term.split('->')
+        ket, bra = dms.split(',')
+        desc.extend([_HESS_INDEX[x] for x in ket+bra])
+        desc.append(_HESS_INDEX[centers[0]])
+        if len(centers) == 2:
+            desc.append(_HESS_INDEX[centers[1]])
+            shapes.append((n_dm,natm,natm,ncomp))
+        else:
+            desc.append(-1)
+            shapes.append((n_dm,natm,ncomp))
+    desc = numpy.asarray(desc, dtype=numpy.int32)
+    out = numpy.zeros(sum(numpy.prod(shape) for shape in shapes))
+
+    if vhfopt is None:
+        cintor = _fpointer(intor)
+        cvhfopt = lib.c_null_ptr()
+    else:
+        vhfopt.set_dm(dm_ket, atm, bas, env)
+        cvhfopt = vhfopt._this
+        cintopt = vhfopt._cintopt
+        cintor = getattr(libcvhf, vhfopt._intor)
+    if cintopt is None:
+        cintopt = make_cintopt(c_atm, c_bas, c_env, intor)
+    if shls_slice is None:
+        shls_slice = (0, c_bas.shape[0])*4
+    ao_loc = make_loc(bas, intor)
+
+    libcvhf.CVHFhess_jk_drv(
+        cintor, out.ctypes.data_as(ctypes.c_void_p),
+        dm_ket.ctypes.data_as(ctypes.c_void_p),
+        dm_bra.ctypes.data_as(ctypes.c_void_p),
+        ctypes.c_int(n_dm), ctypes.c_int(ncomp),
+        desc.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(shapes)),
+        ctypes.c_int(aosym == 's2kl'), (ctypes.c_int*8)(*shls_slice),
+        ao_loc.ctypes.data_as(ctypes.c_void_p), cintopt, cvhfopt,
+        c_atm.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(natm),
+        c_bas.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(c_bas.shape[0]),
+        c_env.ctypes.data_as(ctypes.c_void_p))
+
+    vs = []
+    p0 = 0
+    for shape in shapes:
+        p1 = p0 + numpy.prod(shape)
+        vs.append(out[p0:p1].reshape(shape))
+        p0 = p1
+    return vs
+
 # 'a4ij': anti-symm between ij, symm between kl
 # 'a4kl': anti-symm between kl, symm between ij
 # 'a2ij': anti-symm between ij,
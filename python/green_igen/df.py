@@ -43,15 +43,22 @@ from pyscf import gto
 from pyscf.lib import logger
 from pyscf.df import addons
 from pyscf.df.outcore import _guess_shell_ranges
+from pyscf.ao2mo.outcore import balance_segs
 #from pyscf.pbc.gto.cell import _estimate_rcut
 from pyscf.pbc import tools
 from . import outcore
+from . import incore
+from ._pbcintor import libpbc
+from . import df_jk as stream_jk
+from .scipy_helper import pivoted_cholesky
 from pyscf.pbc.df import ft_ao
 from pyscf.pbc.df import aft
 from pyscf.pbc.df import df_jk
 from pyscf.pbc.df import df_ao2mo
 from pyscf.pbc.df.aft import get_nuc
 from pyscf.pbc.df.df_jk import zdotCN
+from pyscf.pbc.df.df_jk import (_format_dms, _format_kpts_band, _format_jks,
+                                _ewald_exxdiv_for_G0)
 from pyscf.pbc.lib.kpts_helper import (is_zero, gamma_point, member, unique, unique_with_wrap_around,
                                        KPT_DIFF_TOL)
 from pyscf.pbc.df.aft import _sub_df_jk_
@@ -65,6 +72,14 @@ INTEGRAL_PRECISION = getattr(__config__, 'pbc_gto_cell_Cell_precision', 1e-8)
 PRECISION = getattr(__config__, 'pbc_df_aft_estimate_eta_precision', 1e-8)
 # cutoff penalty due to lattice summation
 LATTICE_SUM_PENALTY = 1e-1
+# Calibrated kernel throughputs of the eta cost model (see estimate_eta_cost).
+# Seconds per (shell pair, aux shell, image pair) of the real-space lattice sum
+# and per (AO pair, plane wave, k-point pair) of the AO-pair Fourier transform.
+COST_INT3C = getattr(__config__, 'pbc_df_df_cost_int3c', 2e-7)
+COST_FT_AOPAIR = getattr(__config__, 'pbc_df_df_cost_ft_aopair', 1.5e-8)
+# Atoms may move this far (in Bohr) from the reference geometry before the
+# cached lattice vectors of a reuse plan are regenerated
+REUSE_PLAN_MARGIN = getattr(__config__, 'pbc_df_df_DF_reuse_plan_margin', 1.)
 
 def make_auxmol(mol, auxbasis):
     '''Generate a fake Mole object which uses the density fitting auxbasis as
@@ -184,8 +199,7 @@ def make_modchg_basis(auxcell, smooth_eta):
     # _estimate_rcut is based on the integral overlap. It's likely too tight for
     # rcut of the model charge. Using the value of functions at rcut seems enough
     # chgcell.rcut = _estimate_rcut(smooth_eta, l_max, 1., auxcell.precision)
-    rcut = 15.
-    chgcell.rcut = (numpy.log(4*numpy.pi*rcut**2/auxcell.precision) / smooth_eta)**.5
+    chgcell.rcut = _modchg_rcut(smooth_eta, auxcell.precision)
 
     logger.debug1(auxcell, 'make compensating basis, num shells = %d, num cGTOs = %d',
                   chgcell.nbas, chgcell.nao_nr())
@@ -198,6 +212,8 @@ def _make_j3c(ggdf, cell, auxcell, kptij_lst, cderi_file):
     from pyscf.pbc import df as gdf
     GDF.weighted_coulG = gdf.GDF.weighted_coulG
     mydf = GDF(ggdf.cell, ggdf.kpts)
+    if isinstance(ggdf, GDF):
+        mydf.eta, mydf.mesh = ggdf.eta, ggdf.mesh
     t1 = (logger.process_clock(), logger.perf_counter())
     log = logger.Logger(mydf.stdout, mydf.verbose)
     max_memory = max(2000, mydf.max_memory-lib.current_memory()[0])
@@ -206,7 +222,11 @@ def _make_j3c(ggdf, cell, auxcell, kptij_lst, cderi_file):
     #if mydf.mesh is None:
     #    mydf.eta, mydf.mesh, cutoff = _guess_eta(auxcell, mydf.kpts)
     fused_cell, fuse = fuse_auxcell(mydf, auxcell)
-
+    plan = _get_build_plan(ggdf, cell, auxcell, kptij_lst, ggdf.mesh)
+    def cached(key, fn):
+        if plan is None:
+            return fn()
+        return plan.get(key, fn)
 
     # The ideal way to hold the temporary integrals is to store them in the
     # cderi_file and overwrite them inplace in the second pass.  The current
@@ -221,18 +241,10 @@ def _make_j3c(ggdf, cell, auxcell, kptij_lst, cderi_file):
     # Unlink swapfile to avoid trash
     swapfile = None
 
-    outcore._aux_e2(cell, fused_cell, fswap, 'int3c2e', aosym='s2',
-                    kptij_lst=kptij_lst, dataname='j3c-junk', max_memory=max_memory)
-    t1 = log.timer_debug1('3c2e', *t1)
-
-    nao = cell.nao_nr()
-    naux = auxcell.nao_nr()
-    mesh = mydf.mesh
-    Gv, Gvbase, kws = cell.get_Gv_weights(mesh)
-    b = cell.reciprocal_vectors()
-    gxyz = lib.cartesian_prod([numpy.arange(len(x)) for x in Gvbase])
-    ngrids = gxyz.shape[0]
-
+    if plan is None:
+        int3c_opts = {}
+    else:
+        int3c_opts = plan.int3c_opts(cell, fused_cell)
     kptis = kptij_lst[:,0]
     kptjs = kptij_lst[:,1]
     kpt_ji = kptjs - kptis
@@ -241,73 +253,76 @@ def _make_j3c(ggdf, cell, auxcell, kptij_lst, cderi_file):
 
     log.debug('Num uniq kpts %d', len(uniq_kpts))
     log.debug2('uniq_kpts %s', uniq_kpts)
-    # j2c ~ (-kpt_ji | kpt_ji)
-    # Generally speaking, the int2c2e integrals with lattice sum applied on
-    # |j> are not necessary hermitian because int2c2e cannot be made converged
-    # with regular lattice sum unless the lattice sum vectors (from
-    # cell.get_lattice_Ls) are symmetric. After adding the planewaves
-    # contributions and fuse(fuse(j2c)), the output matrix is hermitian.
-    j2c = fused_cell.pbc_intor('int2c2e', hermi=0, kpts=uniq_kpts)
-    max_memory = max(2000, mydf.max_memory - lib.current_memory()[0])
-    blksize = max(2048, int(max_memory*.5e6/16/fused_cell.nao_nr()))
-    log.debug2('max_memory %s (MB)  blocksize %s', max_memory, blksize)
-    for k, kpt in enumerate(uniq_kpts):
-        coulG = mydf.weighted_coulG(kpt, False, mesh)
-        for p0, p1 in lib.prange(0, ngrids, blksize):
-            aoaux = ft_ao.ft_ao(fused_cell, Gv[p0:p1], None, b, gxyz[p0:p1], Gvbase, kpt).T
-            LkR = numpy.asarray(aoaux.real, order='C')
-            LkI = numpy.asarray(aoaux.imag, order='C')
-            aoaux = None
 
-            if is_zero(kpt):  # kpti == kptj
-                j2c_p  = lib.ddot(LkR[naux:]*coulG[p0:p1], LkR.T)
-                j2c_p += lib.ddot(LkI[naux:]*coulG[p0:p1], LkI.T)
-            else:
-                j2cR, j2cI = zdotCN(LkR[naux:]*coulG[p0:p1],
-                                    LkI[naux:]*coulG[p0:p1], LkR.T, LkI.T)
-                j2c_p = j2cR + j2cI * 1j
-            j2c[k][naux:] -= j2c_p
-            j2c[k][:naux,naux:] -= j2c_p[:,:naux].conj().T
-            j2c_p = LkR = LkI = None
-        # Symmetrizing the matrix is not must if the integrals converged.
-        # Since symmetry cannot be enforced in the pbc_intor('int2c2e'),
-        # the aggregated j2c here may have error in hermitian if the range of
-        # lattice sum is not big enough.
-        j2c[k] = (j2c[k] + j2c[k].conj().T) * .5
-        fswap['j2c/%d'%k] = fuse(fuse(j2c[k]).T).T
-    j2c = coulG = None
+    # The AO-pair column blocks of the second pass (make_kpt), for the
+    # kpti == kptj pairs (s2) and the others (s1). _aux_e2 stores j3c-junk
+    # in these blocks, aux-major, so that each block is read back in one
+    # contiguous piece.
+    nao = cell.nao_nr()
+    naux = auxcell.nao_nr()
+    nkptj_max = numpy.bincount(uniq_inverse).max()
+    def pair_shranges(aosym):
+        if aosym == 's2':
+            nao_pair = nao*(nao+1)//2
+        else:
+            nao_pair = nao**2
+        # nkptj for 3c-coulomb arrays plus 1 Lpq array
+        buflen = min(max(int(max_memory*.38e6/16/naux/(nkptj_max+1)), 1), nao_pair)
+        return cached(('shranges', buflen, aosym),
+                      lambda: _guess_shell_ranges(cell, buflen, aosym))
+    shranges_s2 = pair_shranges('s2')
+    shranges_s1 = pair_shranges('s1')
+    pair_blocks = [numpy.append(0, numpy.cumsum([x[2] for x in shranges]))
+                   for shranges in (shranges_s2, shranges_s1)]
+
+    # Pair-sparse DF tensor of the gamma point. Only the AO pairs of the
+    # significant shell pairs are computed and stored. The s2 blocks then
+    # count the stored columns; dense_locs_s2 are the blocks of all AO pairs.
+    dense_locs_s2 = pair_blocks[0]
+    pair_idx = None
+    if getattr(ggdf, 'pair_sparse', False):
+        if gamma_point(kptij_lst):
+            shl_mask, pair_idx = significant_pairs(cell, ggdf.pair_sparse_threshold)
+            int3c_opts = dict(int3c_opts, pair_mask=shl_mask)
+            pair_blocks[0] = numpy.searchsorted(pair_idx, dense_locs_s2)
+            log.debug('pair-sparse j3c: %d of %d AO pairs',
+                      len(pair_idx), nao*(nao+1)//2)
+        else:
+            log.warn('pair_sparse is only available for the gamma point. '
+                     'All AO pairs of j3c are stored.')
+
+    outcore._aux_e2(cell, fused_cell, fswap, 'int3c2e', aosym='s2',
+                    kptij_lst=kptij_lst, dataname='j3c-junk', max_memory=max_memory,
+                    pair_blocks=pair_blocks, pair_idx=pair_idx, **int3c_opts)
+    t1 = log.timer_debug1('3c2e', *t1)
+
+    mesh = mydf.mesh
+    Gv, Gvbase, kws = cached('Gv', lambda: cell.get_Gv_weights(mesh))
+    b = cell.reciprocal_vectors()
+    gxyz = cached('gxyz', lambda: lib.cartesian_prod([numpy.arange(len(x)) for x in Gvbase]))
+    ngrids = gxyz.shape[0]
+    # Plane waves are ordered by |G| so that the G-space correction of each
+    # auxiliary function can be truncated at its own cutoff (see make_kpt)
+    Gsort = cached('Gsort', lambda: numpy.argsort(lib.norm(Gv, axis=1), kind='stable'))
+    Gv = Gv[Gsort]
+    gxyz = gxyz[Gsort]
+
+    def get_coulG(k):
+        coulG = cached(('coulG', k), lambda: mydf.weighted_coulG(uniq_kpts[k], False, mesh))
+        return coulG[Gsort]
+    for k, j2c in _make_j2c(mydf, fused_cell, fuse, naux, uniq_kpts,
+                            Gv, Gvbase, gxyz, get_coulG):
+        fswap['j2c/%d'%k] = j2c
+    j2c = None
 
     def cholesky_decomposed_metric(uniq_kptji_id):
         j2c = numpy.asarray(fswap['j2c/%d'%uniq_kptji_id])
-        j2c_negative = None
-        try:
-            j2c = scipy.linalg.cholesky(j2c, lower=True)
-            j2ctag = 'CD'
-        except scipy.linalg.LinAlgError:
-            #msg =('===================================\n'
-            #      'J-metric not positive definite.\n'
-            #      'It is likely that mesh is not enough.\n'
-            #      '===================================')
-            #log.error(msg)
-            #raise scipy.linalg.LinAlgError('\n'.join([str(e), msg]))
-            w, v = scipy.linalg.eigh(j2c)
-            log.debug('DF metric linear dependency for kpt %s', uniq_kptji_id)
-            log.debug('cond = %.4g, drop %d bfns',
-                      w[-1]/w[0], numpy.count_nonzero(w<mydf.linear_dep_threshold))
-            v1 = v[:,w>mydf.linear_dep_threshold].conj().T
-            v1 /= numpy.sqrt(w[w>mydf.linear_dep_threshold]).reshape(-1,1)
-            j2c = v1
-            if cell.dimension == 2 and cell.low_dim_ft_type != 'inf_vacuum':
-                idx = numpy.where(w < -mydf.linear_dep_threshold)[0]
-                if len(idx) > 0:
-                    j2c_negative = (v[:,idx]/numpy.sqrt(-w[idx])).conj().T
-            w = v = None
-            j2ctag = 'eig'
-        return j2c, j2c_negative, j2ctag
+        return _decompose_j2c(mydf, cell, j2c, uniq_kptji_id, log)
 
     feri = h5py.File(cderi_file, 'w')
     feri['j3c-kptij'] = kptij_lst
-    nsegs = len(fswap['j3c-junk/0'])
+    if pair_idx is not None:
+        feri['j3c-pairs'] = pair_idx
     def make_kpt(uniq_kptji_id, cholesky_j2c):
         kpt = uniq_kpts[uniq_kptji_id]  # kpt = kptj - kpti
         log.debug1('kpt = %s', kpt)
@@ -316,34 +331,55 @@ def _make_j3c(ggdf, cell, auxcell, kptij_lst, cderi_file):
         nkptj = len(adapted_kptjs)
         log.debug1('adapted_ji_idx = %s', adapted_ji_idx)
 
-        j2c, j2c_negative, j2ctag = cholesky_j2c
+        j2c, j2c_negative, j2ctag, j2c_piv = cholesky_j2c
+        if j2ctag == 'PCD':
+            for ji in adapted_ji_idx:
+                feri['j3c-piv/%d'%ji] = j2c_piv
 
         shls_slice = (auxcell.nbas, fused_cell.nbas)
         Gaux = ft_ao.ft_ao(fused_cell, Gv, shls_slice, b, gxyz, Gvbase, kpt)
-        wcoulG = mydf.weighted_coulG(kpt, False, mesh)
-        Gaux *= wcoulG.reshape(-1,1)
-        kLR = Gaux.real.copy('C')
-        kLI = Gaux.imag.copy('C')
+        wcoulG = cached(('coulG', uniq_kptji_id),
+                        lambda: mydf.weighted_coulG(kpt, False, mesh))
+        Gaux *= wcoulG[Gsort].reshape(-1,1)
+        # Order the smooth functions by the number of plane waves they need.
+        # In the G-block [p0:p1] only the first count(ng_aux > p0) functions
+        # are contracted and G-blocks beyond all cutoffs are not evaluated.
+        ng_aux = _aux_ngrids(Gaux, cell.precision)
+        aux_order = numpy.argsort(-ng_aux, kind='stable')
+        ng_aux = ng_aux[aux_order]
+        ngrids_kpt = ng_aux[0] if ng_aux.size > 0 else 0
+        log.debug1('G-space correction uses %d of %d PWs', ngrids_kpt, ngrids)
+        kLR = numpy.asarray(Gaux.real[:ngrids_kpt,aux_order], order='C')
+        kLI = numpy.asarray(Gaux.imag[:ngrids_kpt,aux_order], order='C')
         Gaux = None
 
         if is_zero(kpt):  # kpti == kptj
             aosym = 's2'
-            nao_pair = nao*(nao+1)//2
-
+            shranges = shranges_s2
+
+            if getattr(ggdf, 'cache_int1e', False):
+                # Overlap and kinetic integrals of the diagonal k-points are
+                # computed in one lattice sweep and kept in cderi_file
+                ovlp, kin = incore.lattice_int2c_multi(
+                    cell, ('int1e_ovlp', 'int1e_kin'), hermi=1, kpts=adapted_kptjs)
+                feri['int1e-kpts'] = adapted_kptjs
+                feri['int1e_ovlp'] = numpy.asarray(ovlp, dtype=numpy.complex128)
+                feri['int1e_kin'] = numpy.asarray(kin, dtype=numpy.complex128)
+                kin = None
+            elif cell.dimension == 3:
+                ovlp = incore.lattice_int2c(cell, 'int1e_ovlp', hermi=1, kpts=adapted_kptjs)
             if cell.dimension == 3:
                 vbar = fuse(auxbar(fused_cell))
-                ovlp = cell.pbc_intor('int1e_ovlp', hermi=1, kpts=adapted_kptjs)
                 ovlp = [lib.pack_tril(s) for s in ovlp]
+                if pair_idx is not None:
+                    ovlp = [s[pair_idx] for s in ovlp]
         else:
             aosym = 's1'
-            nao_pair = nao**2
+            shranges = shranges_s1
 
         mem_now = lib.current_memory()[0]
         log.debug2('memory = %s', mem_now)
         max_memory = max(2000, mydf.max_memory-mem_now)
-        # nkptj for 3c-coulomb arrays plus 1 Lpq array
-        buflen = min(max(int(max_memory*.38e6/16/naux/(nkptj+1)), 1), nao_pair)
-        shranges = _guess_shell_ranges(cell, buflen, aosym)
         buflen = max([x[2] for x in shranges])
         # +1 for a pqkbuf
         if aosym == 's2':
@@ -352,13 +388,12 @@ def _make_j3c(ggdf, cell, auxcell, kptij_lst, cderi_file):
             Gblksize = max(16, int(max_memory*.2e6/16/buflen/(nkptj+1)))
         Gblksize = min(Gblksize, ngrids, 16384)
 
-        def load(aux_slice):
-            col0, col1 = aux_slice
+        def load(task):
+            istep, (col0, col1) = task
             j3cR = []
             j3cI = []
             for k, idx in enumerate(adapted_ji_idx):
-                v = numpy.vstack([fswap['j3c-junk/%d/%d'%(idx,i)][0,col0:col1].T
-                                  for i in range(nsegs)])
+                v = fswap['j3c-junk/%d/%d'%(idx,istep)][0]
                 # vbar is the interaction between the background charge
                 # and the auxiliary basis.  0D, 1D, 2D do not have vbar.
                 if is_zero(kpt) and cell.dimension == 3:
@@ -376,9 +411,11 @@ def _make_j3c(ggdf, cell, auxcell, kptij_lst, cderi_file):
         pqkIbuf = numpy.empty(buflen*Gblksize)
         # buf for ft_aopair
         buf = numpy.empty(nkptj*buflen*Gblksize, dtype=numpy.complex128)
-        cols = [sh_range[2] for sh_range in shranges]
-        locs = numpy.append(0, numpy.cumsum(cols))
-        tasks = zip(locs[:-1], locs[1:])
+        if aosym == 's2':
+            locs = pair_blocks[0]
+        else:
+            locs = pair_blocks[1]
+        tasks = enumerate(zip(locs[:-1], locs[1:]))
         for istep, (j3cR, j3cI) in enumerate(lib.map_with_prefetch(load, tasks)):
             bstart, bend, ncol = shranges[istep]
             log.debug1('int3c2e [%d/%d], AO [%d:%d], ncol = %d',
@@ -387,24 +424,40 @@ def _make_j3c(ggdf, cell, auxcell, kptij_lst, cderi_file):
                 shls_slice = (bstart, bend, 0, bend)
             else:
                 shls_slice = (bstart, bend, 0, cell.nbas)
+            if aosym == 's2' and pair_idx is not None:
+                # the stored AO-pair columns of the block
+                sel = pair_idx[locs[istep]:locs[istep+1]] - dense_locs_s2[istep]
+            else:
+                sel = None
 
-            for p0, p1 in lib.prange(0, ngrids, Gblksize):
+            # the smooth-function rows of j3c in the order of aux_order
+            j3cLR = [v[naux:][aux_order] for v in j3cR]
+            j3cLI = [None if v is None else v[naux:][aux_order] for v in j3cI]
+            for p0, p1 in lib.prange(0, ngrids_kpt, Gblksize):
                 dat = ft_ao.ft_aopair_kpts(cell, Gv[p0:p1], shls_slice, aosym,
                                            b, gxyz[p0:p1], Gvbase, kpt,
                                            adapted_kptjs, out=buf)
                 nG = p1 - p0
+                nL = numpy.count_nonzero(ng_aux > p0)
                 for k, ji in enumerate(adapted_ji_idx):
                     aoao = dat[k].reshape(nG,ncol)
-                    pqkR = numpy.ndarray((ncol,nG), buffer=pqkRbuf)
-                    pqkI = numpy.ndarray((ncol,nG), buffer=pqkIbuf)
+                    if sel is not None:
+                        aoao = aoao[:,sel]
+                    pqkR = numpy.ndarray(aoao.shape[::-1], buffer=pqkRbuf)
+                    pqkI = numpy.ndarray(aoao.shape[::-1], buffer=pqkIbuf)
                     pqkR[:] = aoao.real.T
                     pqkI[:] = aoao.imag.T
 
-                    lib.dot(kLR[p0:p1].T, pqkR.T, -1, j3cR[k][naux:], 1)
-                    lib.dot(kLI[p0:p1].T, pqkI.T, -1, j3cR[k][naux:], 1)
+                    lib.dot(kLR[p0:p1,:nL].T, pqkR.T, -1, j3cLR[k][:nL], 1)
+                    lib.dot(kLI[p0:p1,:nL].T, pqkI.T, -1, j3cLR[k][:nL], 1)
                     if not (is_zero(kpt) and gamma_point(adapted_kptjs[k])):
-                        lib.dot(kLR[p0:p1].T, pqkI.T, -1, j3cI[k][naux:], 1)
-                        lib.dot(kLI[p0:p1].T, pqkR.T,  1, j3cI[k][naux:], 1)
+                        lib.dot(kLR[p0:p1,:nL].T, pqkI.T, -1, j3cLI[k][:nL], 1)
+                        lib.dot(kLI[p0:p1,:nL].T, pqkR.T,  1, j3cLI[k][:nL], 1)
+            for k in range(nkptj):
+                j3cR[k][naux+aux_order] = j3cLR[k]
+                if j3cLI[k] is not None:
+                    j3cI[k][naux+aux_order] = j3cLI[k]
+            j3cLR = j3cLI = None
 
             for k, ji in enumerate(adapted_ji_idx):
                 if is_zero(kpt) and gamma_point(adapted_kptjs[k]):
@@ -414,6 +467,10 @@ def _make_j3c(ggdf, cell, auxcell, kptij_lst, cderi_file):
                 if j2ctag == 'CD':
                     v = scipy.linalg.solve_triangular(j2c, v, lower=True, overwrite_b=True)
                     feri['j3c/%d/%d'%(ji,istep)] = v
+                elif j2ctag == 'PCD':
+                    v = scipy.linalg.solve_triangular(j2c, v[j2c_piv], lower=True,
+                                                      overwrite_b=True)
+                    feri['j3c/%d/%d'%(ji,istep)] = v
                 else:
                     feri['j3c/%d/%d'%(ji,istep)] = lib.dot(j2c, v)
 
@@ -433,11 +490,11 @@ def _make_j3c(ggdf, cell, auxcell, kptij_lst, cderi_file):
     # may have inconsistent dimension due to the numerial noise when handling
     # linear dependency of j2c.
     def conj_j2c(cholesky_j2c):
-        j2c, j2c_negative, j2ctag = cholesky_j2c
+        j2c, j2c_negative, j2ctag, j2c_piv = cholesky_j2c
         if j2c_negative is None:
-            return j2c.conj(), None, j2ctag
+            return j2c.conj(), None, j2ctag, j2c_piv
         else:
-            return j2c.conj(), j2c_negative.conj(), j2ctag
+            return j2c.conj(), j2c_negative.conj(), j2ctag, j2c_piv
 
     a = cell.lattice_vectors() / (2*numpy.pi)
     def kconserve_indices(kpt):
@@ -478,12 +535,783 @@ def _make_j3c(ggdf, cell, auxcell, kptij_lst, cderi_file):
         done[uniq_kptji_ids] = True
 
     feri.close()
+    if plan is not None:
+        plan.cderi = cderi_file
+        plan.cderi_coords = cell.atom_coords()
+
+
+def _make_j2c(mydf, fused_cell, fuse, naux, uniq_kpts, Gv, Gvbase, gxyz, get_coulG):
+    '''The metric j2c ~ (-kpt | kpt) of the fused auxiliary basis for each of
+    uniq_kpts, including the G-space correction of the smooth functions.
+    Gv and gxyz are sorted in the order of get_coulG(k).
+
+    Yields:
+        k, j2c
+    '''
+    log = logger.Logger(mydf.stdout, mydf.verbose)
+    b = fused_cell.reciprocal_vectors()
+    ngrids = len(Gv)
+    # Generally speaking, the int2c2e integrals with lattice sum applied on
+    # |j> are not necessary hermitian because int2c2e cannot be made converged
+    # with regular lattice sum unless the lattice sum vectors (from
+    # cell.get_lattice_Ls) are symmetric. After adding the planewaves
+    # contributions and fuse(fuse(j2c)), the output matrix is hermitian.
+    j2c = incore.lattice_int2c(fused_cell, 'int2c2e', hermi=0, kpts=uniq_kpts)
+    max_memory = max(2000, mydf.max_memory - lib.current_memory()[0])
+    blksize = max(2048, int(max_memory*.5e6/16/fused_cell.nao_nr()))
+    log.debug2('max_memory %s (MB)  blocksize %s', max_memory, blksize)
+    for k, kpt in enumerate(uniq_kpts):
+        coulG = get_coulG(k)
+        for p0, p1 in lib.prange(0, ngrids, blksize):
+            aoaux = ft_ao.ft_ao(fused_cell, Gv[p0:p1], None, b, gxyz[p0:p1], Gvbase, kpt).T
+            LkR = numpy.asarray(aoaux.real, order='C')
+            LkI = numpy.asarray(aoaux.imag, order='C')
+            aoaux = None
+
+            if is_zero(kpt):  # kpti == kptj
+                j2c_p  = lib.ddot(LkR[naux:]*coulG[p0:p1], LkR.T)
+                j2c_p += lib.ddot(LkI[naux:]*coulG[p0:p1], LkI.T)
+            else:
+                j2cR, j2cI = zdotCN(LkR[naux:]*coulG[p0:p1],
+                                    LkI[naux:]*coulG[p0:p1], LkR.T, LkI.T)
+                j2c_p = j2cR + j2cI * 1j
+            j2c[k][naux:] -= j2c_p
+            j2c[k][:naux,naux:] -= j2c_p[:,:naux].conj().T
+            j2c_p = LkR = LkI = None
+        # Symmetrizing the matrix is not must if the integrals converged.
+        # Since symmetry cannot be enforced in the pbc_intor('int2c2e'),
+        # the aggregated j2c here may have error in hermitian if the range of
+        # lattice sum is not big enough.
+        j2c[k] = (j2c[k] + j2c[k].conj().T) * .5
+        yield k, fuse(fuse(j2c[k]).T).T
+        j2c[k] = None
+
+def _decompose_j2c(mydf, cell, j2c, label, log):
+    '''Cholesky factor of the fused metric j2c. If j2c is not positive
+    definite, the eigenvectors (2D) or the pivoted Cholesky factor of the
+    linearly independent aux functions.
+
+    Returns:
+        j2c, j2c_negative, j2ctag, j2c_piv as used by make_kpt of _make_j3c
+    '''
+    j2c_negative = None
+    j2c_piv = None
+    try:
+        j2c = scipy.linalg.cholesky(j2c, lower=True)
+        j2ctag = 'CD'
+    except scipy.linalg.LinAlgError:
+        #msg =('===================================\n'
+        #      'J-metric not positive definite.\n'
+        #      'It is likely that mesh is not enough.\n'
+        #      '===================================')
+        #log.error(msg)
+        #raise scipy.linalg.LinAlgError('\n'.join([str(e), msg]))
+        if cell.dimension == 2 and cell.low_dim_ft_type != 'inf_vacuum':
+            # The negative eigenvalues of the 2D metric are kept in
+            # j3c-, which needs the eigenvectors
+            w, v = scipy.linalg.eigh(j2c)
+            log.debug('DF metric linear dependency for kpt %s', label)
+            log.debug('cond = %.4g, drop %d bfns',
+                      w[-1]/w[0], numpy.count_nonzero(w<mydf.linear_dep_threshold))
+            v1 = v[:,w>mydf.linear_dep_threshold].conj().T
+            v1 /= numpy.sqrt(w[w>mydf.linear_dep_threshold]).reshape(-1,1)
+            j2c = v1
+            idx = numpy.where(w < -mydf.linear_dep_threshold)[0]
+            if len(idx) > 0:
+                j2c_negative = (v[:,idx]/numpy.sqrt(-w[idx])).conj().T
+            w = v = None
+            j2ctag = 'eig'
+        else:
+            # P^T j2c P = L L^H. The aux functions beyond the rank are
+            # linearly dependent on the pivoted ones within
+            # linear_dep_threshold and are dropped from the fitting.
+            j2c, j2c_piv, rank = pivoted_cholesky(j2c, mydf.linear_dep_threshold,
+                                                  lower=True)
+            log.debug('DF metric linear dependency for kpt %s', label)
+            log.debug('rank = %d, drop %d bfns', rank, len(j2c_piv) - rank)
+            j2c = numpy.asarray(j2c[:rank,:rank], order='C')
+            j2c_piv = numpy.asarray(j2c_piv[:rank], dtype=numpy.int32)
+            j2ctag = 'PCD'
+    return j2c, j2c_negative, j2ctag, j2c_piv
+
+
+class _DirectJ3c(object):
+    '''Blocks of aux rows of the 3c integrals of GDF(direct=True). A block
+    is the lattice sum (PBCnr3c_drv) over a range of aux shells, minus the
+    compensating charges with their G-space correction (fuse) and the vbar
+    term, i.e. the tensor of make_kpt in _make_j3c before the metric solve.
+    The metric of each k-point difference is factorized once and kept here
+    as the matrix M of the fitted rows M V.
+    '''
+    def __init__(self, mydf, cell, auxcell):
+        if auxcell.cart:
+            raise NotImplementedError('GDF direct mode for cartesian auxiliary basis')
+        from pyscf.pbc import df as gdf
+        GDF.weighted_coulG = gdf.GDF.weighted_coulG
+        self.mydf = mydf
+        self.cell = cell
+        self.auxcell = auxcell
+        self.fused_cell, self.fuse = fused_cell, fuse = fuse_auxcell(mydf, auxcell)
+        self.naux = naux = auxcell.nao_nr()
+        self.nchg = nchg = fused_cell.nao_nr() - naux
+        # The compensating function which fuse subtracts from each aux
+        # function, -1 if there is none
+        chg = numpy.vstack([numpy.zeros((naux,nchg)), numpy.eye(nchg)])
+        chg = -fuse(chg)
+        self.chg_row = numpy.where(chg.any(axis=1), chg.argmax(axis=1), -1)
+        self.vbar = None
+        if cell.dimension == 3:
+            self.vbar = fuse(auxbar(fused_cell))
+
+        self.mesh = mydf.mesh
+        Gv, Gvbase, kws = cell.get_Gv_weights(self.mesh)
+        gxyz = lib.cartesian_prod([numpy.arange(len(x)) for x in Gvbase])
+        self.Gsort = numpy.argsort(lib.norm(Gv, axis=1), kind='stable')
+        self.Gv = Gv[self.Gsort]
+        self.gxyz = gxyz[self.Gsort]
+        self.Gvbase = Gvbase
+        self.b = cell.reciprocal_vectors()
+
+        rcut = max(cell.rcut, fused_cell.rcut)
+        cintopt, pbcopt = incore.make_int3c_opt(cell, fused_cell)
+        self.int3c_opts = {'Ls': incore.get_lattice_Ls(cell, rcut=rcut),
+                           'cintopt': cintopt, 'pbcopt': pbcopt}
+        # [(kpt, M, M_neg)]
+        self._metric = []
+
+    def coulG(self, kpt):
+        return self.mydf.weighted_coulG(kpt, False, self.mesh)[self.Gsort]
+
+    def _symmetry(self, kpt, kpt0):
+        '''1 if (kpt - kpt0) * a = 2n pi, -1 if (kpt + kpt0) * a = 2n pi,
+        otherwise 0'''
+        a = self.cell.lattice_vectors() / (2*numpy.pi)
+        for sign in (1, -1):
+            kdif = a.dot(kpt - sign * kpt0)
+            if abs(kdif - numpy.rint(kdif)).sum() < KPT_DIFF_TOL:
+                return sign
+        return 0
+
+    def _find_metric(self, kpt):
+        for kpt0, M, M_neg in self._metric:
+            sign = self._symmetry(kpt, kpt0)
+            if sign == 1:
+                return M, M_neg
+            elif sign == -1:
+                # The metric of -kpt0 is the conjugate (see conj_j2c of
+                # _make_j3c)
+                return M.conj(), None if M_neg is None else M_neg.conj()
+        return None
+
+    def build_metric(self, kpts):
+        '''Factorize the metric of the k-point differences kpts which are not
+        yet known, with one lattice sum of j2c for all of them'''
+        new_kpts = []
+        for kpt in kpts:
+            if (self._find_metric(kpt) is None and
+                    not any(self._symmetry(kpt, k0) for k0 in new_kpts)):
+                new_kpts.append(kpt)
+        if not new_kpts:
+            return self
+
+        log = logger.Logger(self.mydf.stdout, self.mydf.verbose)
+        new_kpts = numpy.asarray(new_kpts)
+        j2cs = _make_j2c(self.mydf, self.fused_cell, self.fuse, self.naux, new_kpts,
+                         self.Gv, self.Gvbase, self.gxyz,
+                         lambda k: self.coulG(new_kpts[k]))
+        for k, j2c in j2cs:
+            j2c, M_neg, j2ctag, j2c_piv = _decompose_j2c(self.mydf, self.cell,
+                                                        j2c, new_kpts[k], log)
+            if j2ctag == 'CD':
+                M = scipy.linalg.solve_triangular(j2c, numpy.eye(self.naux), lower=True)
+            elif j2ctag == 'PCD':
+                rank = len(j2c_piv)
+                M = numpy.zeros((rank,self.naux), dtype=j2c.dtype)
+                M[:,j2c_piv] = scipy.linalg.solve_triangular(j2c, numpy.eye(rank),
+                                                             lower=True)
+            else:
+                M = j2c
+            self._metric.append((new_kpts[k], M, M_neg))
+        return self
+
+    def metric(self, kpt):
+        '''M, M_neg of the fitted rows M V (and the rows M_neg V of the
+        negative part of the 2D metric) of the k-point difference kpt'''
+        metric = self._find_metric(kpt)
+        if metric is None:
+            self.build_metric([kpt])
+            metric = self._find_metric(kpt)
+        return metric
+
+    def generator(self, kpt, kptij_lst, max_memory=2000):
+        '''gen(sh0, sh1) of the 3c blocks of the aux shells [sh0:sh1] of the
+        k-point pairs kptij_lst, which all have kptj - kpti = kpt. The blocks
+        are (len(kptij_lst),nrow,ncol) arrays, ncol the packed AO pairs for
+        kpt = 0.
+        '''
+        cell = self.cell
+        fused_cell = self.fused_cell
+        auxcell = self.auxcell
+        nchg = self.nchg
+        nbas = cell.nbas
+        nao = cell.nao_nr()
+        kptij_lst = numpy.asarray(kptij_lst).reshape(-1,2,3)
+        kptjs = kptij_lst[:,1]
+        nkptij = len(kptij_lst)
+        if is_zero(kpt):
+            aosym = 's2'
+            ncol = nao*(nao+1)//2
+        else:
+            aosym = 's1'
+            ncol = nao**2
+        if gamma_point(kptij_lst):
+            dtype = numpy.double
+        else:
+            dtype = numpy.complex128
+        int3c = incore.wrap_int3c(cell, fused_cell, 'int3c2e', aosym, 1, kptij_lst,
+                                  **self.int3c_opts)
+
+        # the compensating charges, with the G-space correction over the
+        # plane waves that each of them needs (see make_kpt of _make_j3c)
+        buf = numpy.empty(nkptij*ncol*nchg, dtype=dtype)
+        mat = numpy.ndarray((nkptij,1,ncol,nchg), dtype=dtype, buffer=buf)
+        int3c((0, nbas, 0, nbas, auxcell.nbas, fused_cell.nbas), mat)
+        chg = numpy.empty((nkptij,nchg,ncol), dtype=dtype)
+        for k in range(nkptij):
+            chg[k] = mat[k,0].T
+        mat = buf = None
+
+        shls_slice = (auxcell.nbas, fused_cell.nbas)
+        Gaux = ft_ao.ft_ao(fused_cell, self.Gv, shls_slice, self.b, self.gxyz,
+                           self.Gvbase, kpt)
+        Gaux *= self.coulG(kpt).reshape(-1,1)
+        ng_aux = _aux_ngrids(Gaux, cell.precision)
+        aux_order = numpy.argsort(-ng_aux, kind='stable')
+        ng_aux = ng_aux[aux_order]
+        ngrids_kpt = ng_aux[0] if ng_aux.size > 0 else 0
+        Gaux = numpy.asarray(Gaux[:ngrids_kpt,aux_order].conj(), order='C')
+        Gblksize = max(16, int(max_memory*.2e6/16/(nkptij*ncol)))
+        Gblksize = max(1, min(Gblksize, ngrids_kpt, 16384))
+        buf = numpy.empty(nkptij*ncol*Gblksize, dtype=numpy.complex128)
+        for p0, p1 in lib.prange(0, ngrids_kpt, Gblksize):
+            dat = ft_ao.ft_aopair_kpts(cell, self.Gv[p0:p1], (0, nbas, 0, nbas), aosym,
+                                       self.b, self.gxyz[p0:p1], self.Gvbase, kpt,
+                                       kptjs, out=buf)
+            nL = numpy.count_nonzero(ng_aux > p0)
+            idx = aux_order[:nL]
+            for k in range(nkptij):
+                v = lib.dot(Gaux[p0:p1,:nL].T, dat[k].reshape(p1-p0,ncol))
+                if dtype == numpy.double:
+                    v = v.real
+                chg[k,idx] -= v
+            dat = v = None
+        Gaux = buf = None
+
+        ovlp = None
+        if is_zero(kpt) and cell.dimension == 3:
+            ovlp = incore.lattice_int2c(cell, 'int1e_ovlp', hermi=1, kpts=kptjs)
+            ovlp = [lib.pack_tril(s) for s in ovlp]
+            vbar_idx = numpy.where(self.vbar != 0)[0]
+
+        aux_loc = auxcell.ao_loc_nr()
+        def gen(sh0, sh1):
+            p0, p1 = aux_loc[sh0], aux_loc[sh1]
+            nrow = p1 - p0
+            mat = numpy.empty((nkptij,1,ncol,nrow), dtype=dtype)
+            int3c((0, nbas, 0, nbas, sh0, sh1), mat)
+            out = numpy.empty((nkptij,nrow,ncol), dtype=dtype)
+            rows = self.chg_row[p0:p1]
+            mask = rows >= 0
+            for k in range(nkptij):
+                v = lib.transpose(mat[k,0], out=out[k])
+                v[mask] -= chg[k,rows[mask]]
+                # vbar is the interaction between the background charge
+                # and the auxiliary basis.  0D, 1D, 2D do not have vbar.
+                if ovlp is not None:
+                    for i in vbar_idx[(vbar_idx >= p0) & (vbar_idx < p1)]:
+                        v[i-p0] -= self.vbar[i] * ovlp[k]
+            return out
+        return gen
+
+
+def get_jk_direct(mydf, dm_kpts, hermi=1, kpts=numpy.zeros((1,3)), kpts_band=None,
+                  with_j=True, with_k=True, exxdiv=None):
+    '''Integral-direct DF J/K of GDF(direct=True).
+
+    The fitted rows of the DF tensor of a group of k-point pairs are formed
+    one block of aux functions at a time from the 3c blocks of _DirectJ3c
+    and the metric M, contracted with the density matrices by the kernels of
+    df_jk.c and discarded. The fitted block needs the 3c blocks with nonzero
+    elements in its rows of M, e.g. the blocks up to its own for the
+    Cholesky factor. These are regenerated for each fitted block. The block
+    size follows max_memory and usually covers all aux functions, so that
+    each 3c block is generated once per k-point pair.
+
+    vj is assembled from the 3c blocks of (kb,kb) and the coefficients
+    M^T M rho of the 3c fitted density rho. These blocks are kept from the
+    K pass if they fit in memory, otherwise generated again.
+    '''
+    _check_full_j3c(mydf, 'get_jk_direct')
+    cell = mydf.cell
+    log = logger.Logger(mydf.stdout, mydf.verbose)
+    t1 = (logger.process_clock(), logger.perf_counter())
+    if mydf.auxcell is None:
+        mydf.build(with_j3c=False)
+    if mydf._direct_j3c is None:
+        mydf._direct_j3c = _DirectJ3c(mydf, cell, mydf.auxcell)
+    j3c = mydf._direct_j3c
+    naux = j3c.naux
+    aux_loc = mydf.auxcell.ao_loc_nr()
+    auxdims = aux_loc[1:] - aux_loc[:-1]
+
+    dms = _format_dms(dm_kpts, kpts)
+    nset, nkpts, nao = dms.shape[:3]
+    kpts_band, input_band = _format_kpts_band(kpts_band, kpts), kpts_band
+    nband = len(kpts_band)
+    nao2 = nao**2
+    npair = nao*(nao+1)//2
+    dm_real = not numpy.iscomplexobj(dms)
+    # density matrices and K matrices in the order (k,x,p,q)
+    dmsk = numpy.asarray(dms.transpose(1,0,2,3), dtype=numpy.complex128, order='C')
+    dmsk_real = None
+    if dm_real:
+        dmsk_real = numpy.asarray(dmsk.real, order='C')
+    vk = numpy.zeros((nband,nset,nao,nao), dtype=numpy.complex128)
+    vk_real = None
+    if with_j:
+        # rho[x,L] = \sum_{pq} L[L,p,q] dm[x,q,p] with the packed AO pairs
+        # (see PBCDFj_rho_s2)
+        dmA = lib.pack_tril(dmsk.transpose(0,1,3,2).reshape(-1,nao,nao))
+        dmB = lib.pack_tril(dmsk.reshape(-1,nao,nao))
+        diag = numpy.arange(nao)
+        dmB[:,diag*(diag+3)//2] = 0
+        dmA = dmA.reshape(nkpts,nset,npair)
+        dmB = dmB.reshape(nkpts,nset,npair)
+        rho = numpy.zeros((nset,naux), dtype=numpy.complex128)
+
+    kptij_lst = []
+    if with_k:
+        kptij_lst.extend([(ki, kj) for ki in kpts for kj in kpts_band])
+    if with_j:
+        kptij_lst.extend([(k, k) for k in kpts])
+        kptij_lst.extend([(k, k) for k in kpts_band])
+    kptij_lst = numpy.asarray(kptij_lst).reshape(-1,2,3)
+    kptij_lst = kptij_lst[numpy.sort(unique(kptij_lst.reshape(-1,6))[1])]
+
+    # The contributions of each k-point pair (ka,kb). The exchange of (kb,ka)
+    # is computed from the tensor of (ka,kb) (see PBCDFk_kpt).
+    k_done = numpy.zeros((nkpts,nband), dtype=bool)
+    rho_done = numpy.zeros(nkpts, dtype=bool)
+    vj_done = numpy.zeros(nband, dtype=bool)
+    jobs = []
+    for ka, kb in kptij_lst:
+        direct = []
+        swap = []
+        rho_k = []
+        vj_k = []
+        if with_k:
+            direct = [(i, b) for i in member(ka, kpts)
+                      for b in member(kb, kpts_band) if not k_done[i,b]]
+            for i, b in direct:
+                k_done[i,b] = True
+            if not is_zero(ka-kb):
+                swap = [(i, b) for i in member(kb, kpts)
+                        for b in member(ka, kpts_band) if not k_done[i,b]]
+                for i, b in swap:
+                    k_done[i,b] = True
+        if with_j and is_zero(ka-kb):
+            rho_k = [k for k in member(ka, kpts) if not rho_done[k]]
+            vj_k = [b for b in member(ka, kpts_band) if not vj_done[b]]
+            rho_done[rho_k] = True
+            vj_done[vj_k] = True
+        if direct or swap or rho_k or vj_k:
+            jobs.append(((ka, kb), direct, swap, rho_k, vj_k))
+
+    kpt_ji = numpy.asarray([job[0][1] - job[0][0] for job in jobs]).reshape(-1,3)
+    uniq_kpts, uniq_index, uniq_inverse = unique(kpt_ji)
+    j3c.build_metric(uniq_kpts)
+
+    max_memory = max(2000, mydf.max_memory - lib.current_memory()[0])
+    # The 3c blocks of (kb,kb) kept for vj
+    nvj = sum(len(job[4]) > 0 for job in jobs)
+    cache_vj = nvj * naux * npair * 16 < max_memory * .2e6
+    if cache_vj:
+        max_memory -= nvj * naux * npair * 16 / 1e6
+    # vj_rows[n,ib] is the 3c block ib of jobs[n]
+    vj_rows = {}
+    aux_parts = {}
+    log.debug('GDF direct: %d k-point pairs, %d k-point differences',
+              len(jobs), len(uniq_kpts))
+
+    def contract_k(job_lst, Lpq, sign):
+        nonlocal vk_real
+        cplx = int(Lpq.dtype == numpy.complex128)
+        nrow, ncol = Lpq.shape[1:]
+        s2 = int(ncol != nao2)
+        for k, (pair, direct, swap, rho_k, vj_k) in enumerate(job_lst):
+            v = Lpq[k]
+            if not cplx and dm_real:
+                if vk_real is None:
+                    vk_real = numpy.zeros((nband,nset,nao,nao))
+                for i, b in direct:
+                    libpbc.PBCDFk_gamma(
+                        vk_real[b].ctypes.data_as(ctypes.c_void_p),
+                        v.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(s2),
+                        dmsk_real[i].ctypes.data_as(ctypes.c_void_p),
+                        ctypes.c_double(sign), ctypes.c_int(nset),
+                        ctypes.c_int(nrow), ctypes.c_int(nao))
+                continue
+            null = lib.c_null_ptr()
+            for j in range(max(len(direct), len(swap))):
+                if j < len(direct):
+                    i, b = direct[j]
+                    pvk = vk[b].ctypes.data_as(ctypes.c_void_p)
+                    pdm = dmsk[i].ctypes.data_as(ctypes.c_void_p)
+                else:
+                    pvk = pdm = null
+                if j < len(swap):
+                    i, b = swap[j]
+                    pvk_swap = vk[b].ctypes.data_as(ctypes.c_void_p)
+                    pdm_swap = dmsk[i].ctypes.data_as(ctypes.c_void_p)
+                else:
+                    pvk_swap = pdm_swap = null
+                libpbc.PBCDFk_kpt(
+                    pvk, pvk_swap, v.ctypes.data_as(ctypes.c_void_p),
+                    ctypes.c_int(cplx), ctypes.c_int(s2),
+                    pdm, pdm_swap, ctypes.c_double(sign),
+                    ctypes.c_int(nset), ctypes.c_int(nrow), ctypes.c_int(nao))
+
+    for u, kpt in enumerate(uniq_kpts):
+        group = numpy.where(uniq_inverse == u)[0]
+        M, M_neg = j3c.metric(kpt)
+        fitted = [(M, 1)]
+        if M_neg is not None:
+            fitted.append((M_neg, -1))
+        ncol = npair if is_zero(kpt) else nao2
+        # Per k-point pair: the compensating charges, and per aux row the 3c
+        # block, its transpose in wrap_int3c and the fitted block. The
+        # gathered rows of PBCDFk_kpt are shared by the pairs.
+        mem = max_memory * .6e6 / 16
+        nbatch = max(1, min(len(group), int(mem / (ncol * (j3c.nchg + 3*naux)))))
+        blksize = max(1, int((mem - nbatch*ncol*j3c.nchg) / (3*nbatch*ncol + 2*nao2)))
+        aux_blocks = balance_segs(auxdims, blksize)
+        aux_offs = numpy.append(0, numpy.cumsum([x[2] for x in aux_blocks]))
+        blksize = max(x[2] for x in aux_blocks)
+        aux_parts[u] = aux_blocks, aux_offs
+        log.debug1('GDF direct kpt %s: %d pairs per batch, %d aux blocks',
+                   kpt, nbatch, len(aux_blocks))
+
+        for g0, g1 in lib.prange(0, len(group), nbatch):
+            job_lst = [jobs[n] for n in group[g0:g1]]
+            gen = j3c.generator(kpt, [job[0] for job in job_lst], max_memory*.2)
+            with_rho = any(job[3] for job in job_lst)
+            with_vj = cache_vj and any(job[4] for job in job_lst)
+            seen = numpy.zeros(len(aux_blocks), dtype=bool)
+
+            def load(ib):
+                sh0, sh1, nrow = aux_blocks[ib]
+                v = gen(sh0, sh1)
+                if seen[ib]:
+                    return v
+                seen[ib] = True
+                c0, c1 = aux_offs[ib], aux_offs[ib+1]
+                cplx = int(v.dtype == numpy.complex128)
+                for k, (pair, direct, swap, rho_k, vj_k) in enumerate(job_lst):
+                    if rho_k:
+                        r = numpy.zeros((nset,nrow), dtype=numpy.complex128)
+                        for i in rho_k:
+                            libpbc.PBCDFj_rho_s2(
+                                r.ctypes.data_as(ctypes.c_void_p),
+                                v[k].ctypes.data_as(ctypes.c_void_p),
+                                ctypes.c_int(cplx),
+                                dmA[i].ctypes.data_as(ctypes.c_void_p),
+                                dmB[i].ctypes.data_as(ctypes.c_void_p),
+                                ctypes.c_double(1), ctypes.c_int(nset),
+                                ctypes.c_int(nrow), ctypes.c_int(npair))
+                        rho[:,c0:c1] += r
+                    if vj_k and cache_vj:
+                        vj_rows[group[g0+k], ib] = v[k].copy()
+                return v
+
+            if any(job[1] or job[2] for job in job_lst):
+                for Mx, sign in fitted:
+                    for r0, r1 in lib.prange(0, Mx.shape[0], blksize):
+                        Lpq = None
+                        for ib in range(len(aux_blocks)):
+                            Mb = Mx[r0:r1,aux_offs[ib]:aux_offs[ib+1]]
+                            if not Mb.any():
+                                continue
+                            v = load(ib)
+                            if Lpq is None:
+                                dtype = numpy.result_type(Mb, v)
+                                Lpq = numpy.zeros((len(job_lst),r1-r0,ncol), dtype=dtype)
+                            for k in range(len(job_lst)):
+                                Lpq[k] += numpy.dot(Mb, v[k])
+                            v = None
+                        if Lpq is not None:
+                            contract_k(job_lst, Lpq, sign)
+                        Lpq = None
+            if with_rho or with_vj:
+                for ib in numpy.where(~seen)[0]:
+                    load(ib)
+            t1 = log.timer_debug1('GDF direct kpt %s pairs [%d:%d]' % (kpt, g0, g1), *t1)
+
+    vj = None
+    if with_j:
+        # the coefficients of the 3c rows of (kb,kb)
+        M, M_neg = j3c.metric(numpy.zeros(3))
+        coef = numpy.dot(numpy.dot(rho, M.T), M)
+        if M_neg is not None:
+            coef -= numpy.dot(numpy.dot(rho, M_neg.T), M_neg)
+        coef *= 1. / nkpts
+        vj_jobs = [(n, job) for n, job in enumerate(jobs) if job[4]]
+        vjL = numpy.zeros((nband,nset,npair), dtype=numpy.complex128)
+        vjU = None
+        if hermi != 1:
+            vjU = numpy.zeros((nband,nset,npair), dtype=numpy.complex128)
+
+        def contract_j(b, v, c0):
+            c = numpy.asarray(coef[:,c0:c0+v.shape[0]], order='C')
+            libpbc.PBCDFj_vj_s2(
+                vjL[b].ctypes.data_as(ctypes.c_void_p),
+                lib.c_null_ptr() if vjU is None else
+                vjU[b].ctypes.data_as(ctypes.c_void_p),
+                v.ctypes.data_as(ctypes.c_void_p),
+                ctypes.c_int(int(v.dtype == numpy.complex128)),
+                c.ctypes.data_as(ctypes.c_void_p),
+                ctypes.c_int(nset), ctypes.c_int(v.shape[0]), ctypes.c_int(npair))
+
+        if cache_vj:
+            u = member(numpy.zeros(3), uniq_kpts)[0]
+            aux_blocks, aux_offs = aux_parts[u]
+            for n, job in vj_jobs:
+                for ib in range(len(aux_blocks)):
+                    v = vj_rows.pop((n, ib))
+                    for b in job[4]:
+                        contract_j(b, v, aux_offs[ib])
+        else:
+            mem = max_memory * .6e6 / 16
+            nbatch = max(1, min(len(vj_jobs), int(mem / (npair * (j3c.nchg + 2*naux)))))
+            blksize = max(1, int((mem - nbatch*npair*j3c.nchg) / (2*nbatch*npair)))
+            aux_blocks = balance_segs(auxdims, blksize)
+            for g0, g1 in lib.prange(0, len(vj_jobs), nbatch):
+                job_lst = [job for n, job in vj_jobs[g0:g1]]
+                gen = j3c.generator(numpy.zeros(3), [job[0] for job in job_lst],
+                                    max_memory*.2)
+                for sh0, sh1, nrow in aux_blocks:
+                    v = gen(sh0, sh1)
+                    for k, job in enumerate(job_lst):
+                        for b in job[4]:
+                            contract_j(b, v[k], aux_loc[sh0])
+                    v = None
+        t1 = log.timer_debug1('GDF direct vj', *t1)
+
+        if hermi == 1:
+            vj = lib.unpack_tril(vjL.reshape(-1,npair), lib.HERMITIAN)
+        else:
+            vj = (numpy.tril(lib.unpack_tril(vjL.reshape(-1,npair), lib.SYMMETRIC)) +
+                  numpy.triu(lib.unpack_tril(vjU.reshape(-1,npair), lib.SYMMETRIC), 1))
+        vj = vj.reshape(nband,nset,nao,nao).transpose(1,0,2,3)
+        if is_zero(kpts_band) and dm_real:
+            vj = vj.real
+        vj = _format_jks(vj, dm_kpts, input_band, kpts)
+
+    if with_k:
+        if vk_real is not None:
+            vk += vk_real
+        vk = vk.transpose(1,0,2,3) * (1. / nkpts)
+        if exxdiv == 'ewald':
+            _ewald_exxdiv_for_G0(cell, kpts, dms, vk, kpts_band)
+        if gamma_point(kpts_band) and gamma_point(kpts) and dm_real:
+            vk = vk.real
+        vk = _format_jks(vk, dm_kpts, input_band, kpts)
+    else:
+        vk = None
+    return vj, vk
+
+
+class _BuildPlan(object):
+    '''Intermediates of _make_j3c which do not depend on the atomic
+    positions: lattice translation vectors, integral optimizers, plane-wave
+    grids, Coulomb kernels and shell partitions. They are kept in the GDF
+    object between builds when GDF.reuse_plan is set, e.g. for geometry
+    optimization or ab initio MD where only the coordinates change.
+
+    The lattice vectors are generated for rcut + margin so that they remain
+    complete while atoms stay within margin of the reference geometry.
+    '''
+    def __init__(self, key, cell, margin=REUSE_PLAN_MARGIN):
+        self.key = key
+        self.coords = cell.atom_coords()
+        self.margin = margin
+        self.cderi = None
+        self.cderi_coords = None
+        # the temporary file object of cderi, kept alive with the plan
+        self.cderi_file = None
+        self._cache = {}
+
+    def displacement(self, cell, ref_coords=None):
+        if ref_coords is None:
+            ref_coords = self.coords
+        return abs(cell.atom_coords() - ref_coords).max()
+
+    def is_valid(self, key, cell):
+        return self.key == key and self.displacement(cell) < self.margin
+
+    def get(self, key, fn):
+        if key not in self._cache:
+            self._cache[key] = fn()
+        return self._cache[key]
+
+    def int3c_opts(self, cell, auxcell):
+        def make_Ls():
+            rcut = max(cell.rcut, auxcell.rcut) + self.margin
+            return incore.get_lattice_Ls(cell, rcut=rcut)
+        cintopt, pbcopt = self.get('int3c_opt',
+                                   lambda: incore.make_int3c_opt(cell, auxcell))
+        return {'Ls': self.get('Ls', make_Ls),
+                'cintopt': cintopt, 'pbcopt': pbcopt}
+
+    def skip_error(self, cell, auxcell):
+        '''Estimated relative error of the integrals of the previous build
+        (self.cderi) for the geometry of cell.
+
+        A displacement d changes the primitive exp(-a r^2) by at most
+        d*sqrt(2a/e) of its maximum. The first order change of an integral
+        over two AO and one auxiliary primitive, relative to its magnitude,
+        is therefore about d*(2*sqrt(2*a_ao/e) + sqrt(2*a_aux/e)) with the
+        steepest exponents a_ao and a_aux. This is an estimate of the order
+        of the error, not a strict bound, and it also applies to the 2c
+        metric.
+        '''
+        if self.cderi_coords is None:
+            return numpy.inf
+        d = self.displacement(cell, self.cderi_coords)
+        a_ao = max(e.max() for e in cell.bas_exps())
+        a_aux = max(e.max() for e in auxcell.bas_exps())
+        return d * (2*numpy.sqrt(2*a_ao/numpy.e) + numpy.sqrt(2*a_aux/numpy.e))
+
+    def can_skip(self, key, cell, auxcell, tol):
+        '''Whether the integrals of the previous build can be used as they
+        are, i.e. skip_error is below tol'''
+        return (tol > 0 and self.key == key and self.cderi is not None and
+                os.path.isfile(self.cderi) and
+                self.skip_error(cell, auxcell) < tol)
+
+def fragment_shells(cell, orbs):
+    '''Shells which hold the AO indices orbs and the AO indices of these
+    shells (orbs expanded to whole shells)'''
+    ao_loc = cell.ao_loc_nr()
+    orbs = numpy.asarray(orbs, dtype=numpy.int32).ravel()
+    shls = numpy.unique(numpy.searchsorted(ao_loc, orbs, side='right') - 1)
+    ao_idx = numpy.hstack([numpy.arange(ao_loc[i], ao_loc[i+1]) for i in shls])
+    return shls, ao_idx
+
+def fragment_cell(cell, shls):
+    '''A shallow copy of cell whose basis is the subset shls of cell._bas.
+
+    _atm and _env are shared with cell, so the integral drivers which take
+    contiguous shls_slice ranges evaluate the integrals of an arbitrary list
+    of shells on this cell.  The lattice sum and the G-space terms of the
+    integrals between fragment shells are the same as for the full cell.
+    '''
+    fcell = copy.copy(cell)
+    fcell._bas = numpy.asarray(cell._bas[numpy.asarray(shls)], order='C')
+    return fcell
+
+def _check_full_j3c(mydf, method):
+    '''The j3c of a fragment only provides the AO pairs within the fragment.
+    Methods which need the integrals of all AOs reject it.'''
+    if getattr(mydf, 'frag_ao_idx', None) is not None:
+        raise NotImplementedError('%s with the j3c of a fragment. '
+                                  'Use sr_loop for the fragment integrals' % method)
+
+def significant_pairs(cell, threshold=None):
+    '''Shell pairs of cell whose lattice-summed overlap at the gamma point
+    exceeds threshold, and the packed (s2) indices of their AO pairs. The j3c
+    columns of the other AO pairs are negligible.
+
+    Returns:
+        shl_mask : (nbas,nbas) bool array
+        pair_idx : 1D int array, sorted
+    '''
+    if threshold is None:
+        threshold = cell.precision
+    ao_loc = cell.ao_loc_nr()
+    s = abs(incore.lattice_int2c(cell, 'int1e_ovlp', hermi=1, kpts=numpy.zeros(3)))
+    smax = numpy.maximum.reduceat(s, ao_loc[:-1], axis=0)
+    smax = numpy.maximum.reduceat(smax, ao_loc[:-1], axis=1)
+    s = None
+    shl_mask = smax > threshold
+    shl_mask[numpy.diag_indices(cell.nbas)] = True
+
+    pair_idx = []
+    for ish in range(cell.nbas):
+        j_ao = numpy.hstack([numpy.arange(ao_loc[j], ao_loc[j+1])
+                             for j in numpy.where(shl_mask[ish,:ish+1])[0]])
+        for i in range(ao_loc[ish], ao_loc[ish+1]):
+            pair_idx.append(i*(i+1)//2 + j_ao[j_ao <= i])
+    pair_idx = numpy.hstack(pair_idx)
+    return shl_mask, pair_idx
+
+def get_j_pair_sparse(mydf, dm):
+    '''Gamma point J of the pair-sparse DF tensor. Only the stored AO-pair
+    columns are loaded and contracted.'''
+    pairs = mydf.get_sparse_pairs()
+    dm = numpy.asarray(dm)
+    nao = dm.shape[-1]
+    dms = dm.reshape(-1,nao,nao)
+    idx = numpy.arange(nao)
+    dmtril = lib.pack_tril(dms + dms.transpose(0,2,1))
+    dmtril[:,idx*(idx+1)//2+idx] *= .5
+    dmtril = dmtril[:,pairs]
+
+    vj = numpy.zeros(dmtril.shape, dtype=dmtril.dtype)
+    for LpqR, LpqI, sign in mydf.sr_loop(compact=True, sparse=True):
+        rho = numpy.dot(dmtril, LpqR.T)
+        vj += sign * numpy.dot(rho, LpqR)
+    vjtril = numpy.zeros((len(dms),nao*(nao+1)//2), dtype=vj.dtype)
+    vjtril[:,pairs] = vj
+    return lib.unpack_tril(vjtril, 1).reshape(dm.shape)
+
+def _geometry_free_env(mol):
+    '''mol._env with the atomic coordinates removed'''
+    env = mol._env.copy()
+    ptr = mol._atm[:,gto.PTR_COORD]
+    env[ptr] = env[ptr+1] = env[ptr+2] = 0
+    return env
+
+def _build_plan_key(mydf, cell, auxcell, kptij_lst, mesh):
+    return (cell.lattice_vectors().tobytes(), cell._bas.tobytes(),
+            _geometry_free_env(cell).tobytes(), auxcell._bas.tobytes(),
+            _geometry_free_env(auxcell).tobytes(),
+            numpy.asarray(kptij_lst).tobytes(), tuple(mesh), mydf.eta,
+            cell.precision, cell.dimension)
+
+def _get_build_plan(mydf, cell, auxcell, kptij_lst, mesh):
+    '''The reuse plan of mydf, (re)generated if the basis sets, k-points or
+    mesh changed, or if atoms moved out of the plan's margin.'''
+    if not getattr(mydf, 'reuse_plan', False):
+        return None
+    key = _build_plan_key(mydf, cell, auxcell, kptij_lst, mesh)
+    plan = mydf._plan
+    if plan is None or not plan.is_valid(key, cell):
+        logger.debug(mydf, 'Generate GDF reuse plan')
+        cderi, cderi_coords, cderi_file = None, None, None
+        if plan is not None and plan.key == key:
+            cderi, cderi_coords, cderi_file = plan.cderi, plan.cderi_coords, plan.cderi_file
+        plan = mydf._plan = _BuildPlan(key, cell, mydf.reuse_plan_margin)
+        plan.cderi, plan.cderi_coords, plan.cderi_file = cderi, cderi_coords, cderi_file
+    else:
+        logger.debug(mydf, 'Reuse GDF plan, max displacement %g',
+                     plan.displacement(cell))
+    return plan
 
 
 class GDF(aft.AFTDF):
     '''Gaussian density fitting
     '''
-    def __init__(self, cell, kpts=numpy.zeros((1,3))):
+    def __init__(self, cell, kpts=numpy.zeros((1,3)), direct=None):
         self.cell = cell
         self.stdout = cell.stdout
         self.verbose = cell.verbose
@@ -534,6 +1362,61 @@ class GDF(aft.AFTDF):
 # If _cderi is specified, the 3C-integral tensor will be read from this file
         self._cderi = None
         self._rsh_df = {}  # Range separated Coulomb DF objects
+
+        # Keep the geometry independent intermediates of build() (see
+        # _BuildPlan) so that the next build after a geometry step reuses
+        # them. If reuse_tol > 0 and the estimated relative error of the
+        # previous DF integrals for the new geometry (_BuildPlan.skip_error)
+        # is below reuse_tol, they are used as they are. Each build writes a
+        # new file, so the integrals of the previous build are not
+        # overwritten while they may still be read.
+        self.reuse_plan = getattr(__config__, 'pbc_df_df_DF_reuse_plan', False)
+        self.reuse_plan_margin = REUSE_PLAN_MARGIN
+        self.reuse_tol = 0
+        self._plan = None
+        # Choose eta and mesh with the cost model of optimize_eta in build()
+        self.auto_eta = getattr(__config__, 'pbc_df_df_DF_auto_eta', False)
+        # AO indices of a fragment (e.g. the impurity orbitals of an
+        # embedding). If given, build() only computes the j3c columns of the
+        # AO pairs within the fragment. frag_ao_idx are the AOs of the stored
+        # columns (frag_orbs expanded to whole shells).
+        self.frag_orbs = None
+        self.frag_ao_idx = None
+        # Integral-direct J/K (see get_jk_direct). No DF tensor is stored,
+        # build() only prepares the auxiliary basis.
+        if direct is None:
+            direct = getattr(__config__, 'pbc_df_df_DF_direct', False)
+        self.direct = direct
+        self._direct_j3c = None
+        # Pair-sparse DF tensor of the gamma point (see significant_pairs).
+        # The j3c columns are computed and stored only for the AO pairs of
+        # the shell pairs whose overlap exceeds pair_sparse_threshold
+        # (cell.precision if None).
+        self.pair_sparse = getattr(__config__, 'pbc_df_df_DF_pair_sparse', False)
+        self.pair_sparse_threshold = None
+        # Store j3c of a k-point mesh in the BvK (translation) representation
+        # j3c-R (see _j3c_to_bvk). The elements below bvk_threshold
+        # (cell.precision if None) are dropped. j3c of the pairs of the mesh is
+        # Fourier transformed from j3c-R when it is loaded. The pairs of
+        # kpts_band stay in k-space. j3c-R is converted from the k-space j3c
+        # after the build: it shrinks the stored file, not the build time or
+        # the peak disk usage.
+        self.bvk_j3c = getattr(__config__, 'pbc_df_df_DF_bvk_j3c', False)
+        self.bvk_threshold = None
+        # Exchange of the ACE operator (see df_jk.get_j_ace_kpts). If
+        # ace_cycle > 0 and the density matrices carry mo_coeff and mo_occ,
+        # get_jk rebuilds the ACE operator from the orbitals every ace_cycle
+        # calls and returns its K matrices in between. Once the density
+        # matrices change by less than ace_dm_tol between calls, it is rebuilt
+        # in every call, so that the convergence test and the final energy
+        # use the exact K of the density matrices.
+        self.ace_cycle = getattr(__config__, 'pbc_df_df_DF_ace_cycle', 0)
+        self.ace_dm_tol = getattr(__config__, 'pbc_df_df_DF_ace_dm_tol', 1e-3)
+        self._ace = None
+        # Keep the overlap and kinetic integrals of the k-points in the CDERI
+        # file (see get_int1e). They are computed with the overlap that the
+        # j3c build needs anyway.
+        self.cache_int1e = getattr(__config__, 'pbc_df_df_DF_cache_int1e', False)
         self._keys = set(self.__dict__.keys())
 
     @property
@@ -551,8 +1434,15 @@ class GDF(aft.AFTDF):
             self.cell = cell
         self.auxcell = None
         self._cderi = None
-        self._cderi_to_save = tempfile.NamedTemporaryFile(dir=lib.param.TMPDIR)
+        if not self.reuse_plan:
+            # The integral file is kept for the reuse plan. build() reuses it
+            # for a small geometry change or writes the new integrals to a
+            # new file.
+            self._cderi_to_save = tempfile.NamedTemporaryFile(dir=lib.param.TMPDIR)
+            self._plan = None
         self._rsh_df = {}
+        self._ace = None
+        self._direct_j3c = None
         return self
 
     @property
@@ -575,6 +1465,8 @@ class GDF(aft.AFTDF):
             log.info('auxbasis = %s', self.auxcell.basis)
         log.info('eta = %s', self.eta)
         log.info('exp_to_discard = %s', self.exp_to_discard)
+        if self.reuse_plan:
+            log.info('reuse_plan = %s  reuse_tol = %g', self.reuse_plan, self.reuse_tol)
         if isinstance(self._cderi, str):
             log.info('_cderi = %s  where DF integrals are loaded (readonly).',
                      self._cderi)
@@ -592,7 +1484,9 @@ class GDF(aft.AFTDF):
     def check_sanity(self):
         return lib.StreamObject.check_sanity(self)
 
-    def build(self, j_only=None, with_j3c=True, kpts_band=None):
+    def build(self, j_only=None, with_j3c=True, kpts_band=None, frag_orbs=None):
+        if frag_orbs is not None:
+            self.frag_orbs = frag_orbs
         if self.kpts_band is not None:
             self.kpts_band = numpy.reshape(self.kpts_band, (-1,3))
         if kpts_band is not None:
@@ -604,9 +1498,20 @@ class GDF(aft.AFTDF):
 
         self.check_sanity()
         self.dump_flags()
+        self._ace = None
 
         self.auxcell = make_modrho_basis(self.cell, self.auxbasis,
                                          self.exp_to_discard)
+        if self.frag_orbs is None:
+            j3c_cell = self.cell
+            self.frag_ao_idx = None
+        else:
+            shls, self.frag_ao_idx = fragment_shells(self.cell, self.frag_orbs)
+            j3c_cell = fragment_cell(self.cell, shls)
+            logger.info(self, 'j3c of fragment: %d shells, %d AOs',
+                        len(shls), len(self.frag_ao_idx))
+            if self.bvk_j3c:
+                _check_full_j3c(self, 'BvK j3c')
 
         # Remove duplicated k-points. Duplicated kpts may lead to a buffer
         # located in incore.wrap_int3c larger than necessary. Integral code
@@ -629,7 +1534,17 @@ class GDF(aft.AFTDF):
             kptij_lst.extend([(ki, ki) for ki in kband_uniq])
             kptij_lst = numpy.asarray(kptij_lst)
 
-        if with_j3c:
+        if self.auto_eta and self.cell.dimension > 0:
+            best = optimize_eta(self.cell, self.auxcell, len(kptij_lst),
+                                verbose=self.verbose)
+            self.eta = best['eta']
+            self.mesh = best['mesh']
+
+        if with_j3c and self.direct:
+            logger.info(self, 'GDF direct mode. DF integrals are generated in get_jk')
+            self._cderi = None
+            self._direct_j3c = None
+        elif with_j3c:
             if isinstance(self._cderi_to_save, str):
                 cderi = self._cderi_to_save
             else:
@@ -643,10 +1558,30 @@ class GDF(aft.AFTDF):
                     logger.warn(self, 'Value of ._cderi is ignored. '
                                 'DF integrals will be saved in file %s .',
                                 cderi)
+            if self.reuse_plan and self._plan is not None:
+                key = _build_plan_key(self, j3c_cell, self.auxcell, kptij_lst,
+                                      self.mesh)
+                if self._plan.can_skip(key, j3c_cell, self.auxcell, self.reuse_tol):
+                    logger.info(self, 'Estimated error %g of the DF integrals '
+                                'in %s is below reuse_tol %g. Reuse them',
+                                self._plan.skip_error(j3c_cell, self.auxcell),
+                                self._plan.cderi, self.reuse_tol)
+                    self._cderi = self._plan.cderi
+                    return self
+                if (self._plan.cderi == cderi and
+                        not isinstance(self._cderi_to_save, str)):
+                    self._cderi_to_save = tempfile.NamedTemporaryFile(dir=lib.param.TMPDIR)
+                    cderi = self._cderi_to_save.name
             self._cderi = cderi
             t1 = (logger.process_clock(), logger.perf_counter())
-            self._make_j3c(self.cell, self.auxcell, kptij_lst, cderi)
+            self._make_j3c(j3c_cell, self.auxcell, kptij_lst, cderi)
             t1 = logger.timer_debug1(self, 'j3c', *t1)
+            if self._plan is not None:
+                # The file of the previous build is released here
+                self._plan.cderi_file = self._cderi_to_save
+            if self.bvk_j3c and not j_only and len(kpts) > 1:
+                _j3c_to_bvk(self, j3c_cell, kpts, cderi)
+                t1 = logger.timer_debug1(self, 'j3c BvK', *t1)
         return self
 
     _make_j3c = _make_j3c
@@ -699,16 +1634,60 @@ class GDF(aft.AFTDF):
         vbar *= numpy.pi/fused_cell.vol
         return vbar
 
+    def get_int1e(self, intor='int1e_ovlp', kpts=None):
+        '''Overlap (intor='int1e_ovlp') or kinetic (intor='int1e_kin')
+        integrals of kpts. With cache_int1e they are read from the CDERI
+        file, otherwise computed when requested.'''
+        if kpts is None:
+            kpts = self.kpts
+        kpts_lst = numpy.reshape(kpts, (-1,3))
+        if not self.cache_int1e:
+            mat = incore.lattice_int2c(self.cell, intor, hermi=1, kpts=kpts_lst)
+            if numpy.ndim(kpts) == 1:
+                mat = mat[0]
+            return mat
+
+        if self._cderi is None:
+            self.build()
+        with h5py.File(self._cderi, 'r') as feri:
+            if intor not in feri:
+                raise KeyError('%s not found in %s' % (intor, self._cderi))
+            kpts_cached = feri['int1e-kpts'][()]
+            dat = feri[intor]
+            mat = []
+            for kpt in kpts_lst:
+                k_id = member(kpt, kpts_cached)
+                if len(k_id) == 0:
+                    raise KeyError('kpt %s not found in %s' % (kpt, self._cderi))
+                v = dat[k_id[0]]
+                if gamma_point(kpt):
+                    v = v.real
+                mat.append(v)
+        if numpy.ndim(kpts) == 1:
+            mat = mat[0]
+        return mat
+
     def sr_loop(self, kpti_kptj=numpy.zeros((2,3)), max_memory=2000,
-                compact=True, blksize=None):
-        '''Short range part'''
+                compact=True, blksize=None, sparse=False):
+        '''Short range part
+
+        The columns of a pair-sparse DF tensor are expanded to all AO pairs.
+        With sparse=True, only the stored columns of the AO pairs
+        get_sparse_pairs() are returned.
+        '''
         if self._cderi is None:
+            if self.direct:
+                raise RuntimeError('DF integrals are not stored in GDF direct mode')
             self.build()
         cell = self.cell
         kpti, kptj = kpti_kptj
         unpack = is_zero(kpti-kptj) and not compact
         is_real = is_zero(kpti_kptj)
-        nao = cell.nao_nr()
+        if self.frag_ao_idx is None:
+            nao = cell.nao_nr()
+        else:
+            nao = len(self.frag_ao_idx)
+        pairs = None
         if blksize is None:
             if is_real:
                 blksize = max_memory*1e6/8/(nao**2*2)
@@ -722,6 +1701,10 @@ class GDF(aft.AFTDF):
             b0, b1 = aux_slice
             if is_real:
                 LpqR = numpy.asarray(j3c[b0:b1])
+                if pairs is not None:
+                    Lpq = numpy.zeros((LpqR.shape[0],nao*(nao+1)//2))
+                    Lpq[:,pairs] = LpqR
+                    LpqR, Lpq = Lpq, None
                 if unpack:
                     LpqR = lib.unpack_tril(LpqR).reshape(-1,nao**2)
                 LpqI = numpy.zeros_like(LpqR)
@@ -735,7 +1718,15 @@ class GDF(aft.AFTDF):
                     LpqI = lib.unpack_tril(LpqI, lib.ANTIHERMI).reshape(-1,nao**2)
             return LpqR, LpqI
 
-        with _load3c(self._cderi, 'j3c', kpti_kptj, 'j3c-kptij') as j3c:
+        loader = _load3c(self._cderi, 'j3c', kpti_kptj, 'j3c-kptij')
+        with loader as j3c:
+            # The stored columns of a pair-sparse tensor, read through the
+            # same file handle. They apply to the j3c- part as well.
+            if is_real and loader.pairs is not None:
+                if sparse:
+                    unpack = False
+                else:
+                    pairs = loader.pairs
             slices = lib.prange(0, j3c.shape[0], blksize)
             for LpqR, LpqI in lib.map_with_prefetch(load, slices):
                 yield LpqR, LpqI, 1
@@ -751,6 +1742,16 @@ class GDF(aft.AFTDF):
                     yield LpqR, LpqI, -1
                     LpqR = LpqI = None
 
+    def get_sparse_pairs(self):
+        '''Packed AO-pair indices of the stored j3c columns if the DF tensor
+        is pair-sparse, otherwise None'''
+        if self._cderi is None:
+            self.build()
+        with h5py.File(self._cderi, 'r') as feri:
+            if 'j3c-pairs' in feri:
+                return feri['j3c-pairs'][()]
+        return None
+
     weighted_coulG = aft.weighted_coulG
     _int_nuc_vloc = aft._int_nuc_vloc
     get_nuc = aft.get_nuc  # noqa: F811
@@ -763,6 +1764,19 @@ class GDF(aft.AFTDF):
     # post-HF methods.
     def get_jk(self, dm, hermi=1, kpts=None, kpts_band=None,
                with_j=True, with_k=True, omega=None, exxdiv=None):
+        _check_full_j3c(self, 'get_jk')
+        if self.direct and omega is None:
+            if kpts is None:
+                kpts = self.kpts
+            kpts = numpy.asarray(kpts)
+            if kpts.shape == (3,):
+                dm = numpy.asarray(dm)
+                kpts_band1 = kpts if kpts_band is None else kpts_band
+                vj, vk = get_jk_direct(self, dm[...,None,:,:], hermi, kpts.reshape(1,3),
+                                       kpts_band1, with_j, with_k, exxdiv)
+                return vj, vk
+            return get_jk_direct(self, dm, hermi, kpts, kpts_band,
+                                 with_j, with_k, exxdiv)
         if omega is not None:  # J/K for RSH functionals
             cell = self.cell
             # * AFT is computationally more efficient than GDF if the Coulomb
@@ -792,20 +1806,87 @@ class GDF(aft.AFTDF):
                 kpts = self.kpts
         kpts = numpy.asarray(kpts)
 
-        if kpts.shape == (3,):
-            return df_jk.get_jk(self, dm, hermi, kpts, kpts_band, with_j,
-                                with_k, exxdiv)
+        if (with_k and self.ace_cycle > 0 and kpts_band is None and
+                getattr(dm, 'mo_coeff', None) is not None):
+            return self.get_jk_ace(dm, hermi, kpts, with_j, exxdiv)
 
-        vj = vk = None
-        if with_k:
-            vk = df_jk.get_k_kpts(self, dm, hermi, kpts, kpts_band, exxdiv)
-        if with_j:
-            vj = df_jk.get_j_kpts(self, dm, hermi, kpts, kpts_band)
+        # J and K are built in one pass over the cderi file (see df_jk.py).
+        # The pair-sparse columns are contracted as they are stored.
+        if kpts.shape == (3,):
+            dm = numpy.asarray(dm)
+            kpts_band1 = kpts if kpts_band is None else kpts_band
+            return stream_jk.get_jk_kpts(self, dm[...,None,:,:], hermi,
+                                         kpts.reshape(1,3), kpts_band1,
+                                         with_j, with_k, exxdiv)
+        return stream_jk.get_jk_kpts(self, dm, hermi, kpts, kpts_band,
+                                     with_j, with_k, exxdiv)
+
+    def get_ace(self, mo_coeff_kpts, mo_occ_kpts, kpts=None, exxdiv=None):
+        '''ACE operator xi_k of the orbitals of kpts (see df_jk.get_j_ace_kpts)'''
+        _check_full_j3c(self, 'get_ace')
+        if kpts is None:
+            kpts = self.kpts
+        return stream_jk.get_ace_kpts(self, mo_coeff_kpts, mo_occ_kpts, kpts,
+                                      exxdiv)
+
+    def get_jk_ace(self, dm, hermi=1, kpts=None, with_j=True, exxdiv=None):
+        '''J of dm and the K matrices of the ACE operator of dm.mo_coeff and
+        dm.mo_occ. The operator is rebuilt, with J from the same pass over the
+        cderi file, every ace_cycle calls and in every call once dm changes by
+        less than ace_dm_tol.'''
+        _check_full_j3c(self, 'get_jk_ace')
+        if kpts is None:
+            kpts = self.kpts
+        kpts = numpy.asarray(kpts)
+        mo_coeff = dm.mo_coeff
+        mo_occ = dm.mo_occ
+        # orbitals and density matrices of each set, in the k-point list form
+        single_kpt = kpts.shape == (3,)
+        if dm.ndim == (2 if single_kpt else 3):
+            mo_coeff = [mo_coeff]
+            mo_occ = [mo_occ]
+        if single_kpt:
+            mo_coeff = [[c] for c in mo_coeff]
+            mo_occ = [[o] for o in mo_occ]
+        nao = dm.shape[-1]
+        dms = numpy.asarray(dm).reshape(len(mo_coeff),-1,nao,nao)
+        kpts = kpts.reshape(-1,3)
+
+        key = (kpts.tobytes(), exxdiv, dms.shape)
+        ace = self._ace
+        if (ace is None or ace['key'] != key or
+                ace['ncall'] % self.ace_cycle == 0 or
+                abs(dms - ace['dm_last']).max() < self.ace_dm_tol):
+            logger.debug(self, 'Build ACE operator')
+            vj, xi = stream_jk.get_j_ace_kpts(self, dms, mo_coeff, mo_occ, kpts,
+                                              hermi, with_j, exxdiv)
+            ace = self._ace = {'key': key, 'xi': xi, 'ncall': 0}
+        elif with_j:
+            vj = stream_jk.get_jk_kpts(self, dms, hermi, kpts, None, True, False)[0]
+        else:
+            vj = None
+        ace['ncall'] += 1
+        ace['dm_last'] = dms
+
+        vk = numpy.asarray([stream_jk.ace_to_vk(x) for x in ace['xi']])
+        vk = vk.reshape(dm.shape)
+        if vj is not None:
+            vj = numpy.asarray(vj).reshape(dm.shape)
         return vj, vk
 
-    get_eri = get_ao_eri = df_ao2mo.get_eri
-    ao2mo = get_mo_eri = df_ao2mo.general
-    ao2mo_7d = df_ao2mo.ao2mo_7d
+    def get_eri(self, *args, **kwargs):
+        _check_full_j3c(self, 'get_eri')
+        return df_ao2mo.get_eri(self, *args, **kwargs)
+    get_ao_eri = get_eri
+
+    def ao2mo(self, *args, **kwargs):
+        _check_full_j3c(self, 'ao2mo')
+        return df_ao2mo.general(self, *args, **kwargs)
+    get_mo_eri = ao2mo
+
+    def ao2mo_7d(self, *args, **kwargs):
+        _check_full_j3c(self, 'ao2mo_7d')
+        return df_ao2mo.ao2mo_7d(self, *args, **kwargs)
 
     def update_mp(self):
         mf = copy.copy(self)
@@ -841,6 +1922,10 @@ class GDF(aft.AFTDF):
 # object when self._cderi is provided.
         if self._cderi is None:
             self.build()
+        if isinstance(self._cderi, str):
+            with h5py.File(self._cderi, 'r') as feri:
+                if 'j3c-R' in feri:
+                    return feri['j3c-R'].shape[1]
         # self._cderi['j3c/k_id/seg_id']
         with addons.load(self._cderi, 'j3c/0') as feri:
             if isinstance(feri, h5py.Group):
@@ -897,28 +1982,6 @@ def cutoff_to_mesh(a, cutoff):
     mesh = numpy.ceil(numpy.sqrt(2*cutoff)/lib.norm(b, axis=1) * 2).astype(int)
     return mesh
 
-"""
-def estimate_eta_for_ke_cutoff(cell, ke_cutoff, precision=None):
-    '''Given ke_cutoff, the upper bound of eta to produce the required
-    precision in AFTDF Coulomb integrals.
-    '''
-    if precision is None:
-        precision = cell.precision
-    ai = numpy.hstack(cell.bas_exps()).max()
-    aij = ai * 2
-    ci = gto.gto_norm(0, ai)
-    norm_ang = (4*numpy.pi)**-1.5
-    c1 = ci**2 * norm_ang
-    fac = 64*numpy.pi**5*c1 * (aij*ke_cutoff*2)**-.5 / precision
-
-    eta = 4.
-    eta = 1./(numpy.log(fac * eta**-1.5)*2 / ke_cutoff - 1./aij)
-    if eta < 0:
-        eta = 4.
-    else:
-        eta = min(4., eta)
-    return eta
-"""
 def estimate_eta_for_ke_cutoff(cell, ke_cutoff, precision=PRECISION):
     '''Given ke_cutoff, the upper bound of eta to produce the required
     precision in AFTDF Coulomb integrals.
@@ -938,27 +2001,6 @@ def estimate_eta_for_ke_cutoff(cell, ke_cutoff, precision=PRECISION):
     eta = kmax**2/4 / (-log_eta - log_rest)
     return eta
 
-"""
-def estimate_ke_cutoff_for_eta(cell, eta, precision=None):
-    '''Given eta, the lower bound of ke_cutoff to produce the required
-    precision in AFTDF Coulomb integrals.
-    '''
-    if precision is None:
-        precision = cell.precision
-    ai = numpy.hstack(cell.bas_exps()).max()
-    aij = ai * 2
-    ci = gto.gto_norm(0, ai)
-    ck = gto.gto_norm(0, eta)
-    theta = 1./(1./aij + 1./eta)
-    Norm_ang = (4*numpy.pi)**-1.5
-    fac = 32*numpy.pi**5 * ci**2*ck*Norm_ang * (2*aij) / (aij*eta)**1.5
-    fac /= precision
-
-    Ecut = 20.
-    Ecut = numpy.log(fac * (Ecut*2)**(-.5)) * 2*theta
-    Ecut = numpy.log(fac * (Ecut*2)**(-.5)) * 2*theta
-    return Ecut
-"""
 def estimate_ke_cutoff_for_eta(cell, eta, precision=PRECISION):
     '''Given eta, the lower bound of ke_cutoff to produce the required
     precision in AFTDF Coulomb integrals.
@@ -982,6 +2024,91 @@ def estimate_ke_cutoff_for_eta(cell, eta, precision=PRECISION):
     Ecut = max(Ecut, .5)
     return Ecut
 
+def _mesh_for_eta(cell, eta, precision):
+    '''The mesh to converge the G-space part of the model charges of eta'''
+    ke_cutoff = estimate_ke_cutoff_for_eta(cell, eta, precision)
+    mesh = cutoff_to_mesh(cell.lattice_vectors(), ke_cutoff)
+    if cell.dimension < 2 or cell.low_dim_ft_type == 'inf_vacuum':
+        mesh[cell.dimension:] = cell.mesh[cell.dimension:]
+    return _round_off_to_odd_mesh(mesh)
+
+def estimate_eta_cost(cell, auxcell, eta, nkptij=1, precision=None):
+    '''Predicted cost (in seconds) of GDF._make_j3c for the model charge
+    exponent eta. A smaller eta needs fewer plane waves but the smooth
+    model charges extend over more lattice images. Both parts meet the
+    requested precision.
+
+    Returns:
+        A dict with eta, mesh, the number of images and plane waves, and the
+        predicted time of the real-space (t_int3c) and G-space (t_ft) parts.
+    '''
+    if precision is None:
+        precision = cell.precision
+    mesh = _mesh_for_eta(cell, eta, precision)
+    ngrids = numpy.prod(mesh)
+    rcut = max(cell.rcut, auxcell.rcut, _modchg_rcut(eta, precision))
+    nimgs = len(incore.get_lattice_Ls(cell, rcut=rcut))
+    # The image of the AO pair partner is limited by the AO overlap
+    nimgs_ao = len(incore.get_lattice_Ls(cell, rcut=cell.rcut))
+    nbas = cell.nbas
+    # aux shells plus one model charge per (atom, l)
+    nauxsh = auxcell.nbas + len(set(zip(auxcell._bas[:,gto.ATOM_OF],
+                                        auxcell._bas[:,gto.ANG_OF])))
+    nao = cell.nao_nr()
+    t_int3c = COST_INT3C * nimgs * nimgs_ao * nbas*(nbas+1)//2 * nauxsh * nkptij**.5
+    t_ft = COST_FT_AOPAIR * ngrids * nao*(nao+1)//2 * nkptij
+    return {'eta': eta, 'mesh': mesh, 'nimgs': nimgs, 'ngrids': ngrids,
+            't_int3c': t_int3c, 't_ft': t_ft, 'total': t_int3c + t_ft}
+
+def optimize_eta(cell, auxcell, nkptij=1, precision=None, neta=16, verbose=None):
+    '''Search the model charge exponent eta with the smallest predicted
+    build cost (estimate_eta_cost) in [ETA_MIN, 4*estimate_eta(cell)]'''
+    if precision is None:
+        precision = cell.precision
+    log = logger.new_logger(cell, verbose)
+    eta_max = max(4*estimate_eta(cell, precision), ETA_MIN*2)
+    etas = numpy.geomspace(ETA_MIN, eta_max, neta)
+    costs = [estimate_eta_cost(cell, auxcell, eta, nkptij, precision) for eta in etas]
+    for c in costs:
+        log.debug('eta %-8.4g mesh %s nimgs %d  t_int3c %.3g s  t_ft %.3g s  total %.3g s',
+                  c['eta'], c['mesh'], c['nimgs'], c['t_int3c'], c['t_ft'], c['total'])
+    best = min(costs, key=lambda c: c['total'])
+    log.info('Optimized eta = %.4g  mesh = %s  predicted time %.3g s '
+             '(real space %.3g s with %d images, G space %.3g s with %d PWs)',
+             best['eta'], best['mesh'], best['total'], best['t_int3c'],
+             best['nimgs'], best['t_ft'], best['ngrids'])
+    return best
+
+def calibrate_cost_model(cell, auxcell, kpts=numpy.zeros((1,3)), nsample=8):
+    '''Measure COST_INT3C and COST_FT_AOPAIR on a few shells of cell. The
+    results can be assigned to the module variables (or __config__).'''
+    nsh = min(nsample, cell.nbas)
+    naux = min(nsample, auxcell.nbas)
+    kptij_lst = numpy.hstack((kpts[:1], kpts[:1])).reshape(-1,2,3)
+    rcut = max(cell.rcut, auxcell.rcut)
+    Ls = incore.get_lattice_Ls(cell, rcut=rcut)
+    nimgs_ao = len(incore.get_lattice_Ls(cell, rcut=cell.rcut))
+    t0 = logger.perf_counter()
+    incore.aux_e2(cell, auxcell, 'int3c2e', aosym='s2', kptij_lst=kptij_lst,
+                  shls_slice=(0, nsh, 0, nsh, 0, naux), Ls=Ls)
+    t_int3c = logger.perf_counter() - t0
+    cost_int3c = t_int3c / (len(Ls) * nimgs_ao * nsh*(nsh+1)//2 * naux)
+
+    mesh = [min(n, 9) for n in cell.mesh]
+    Gv, Gvbase, kws = cell.get_Gv_weights(mesh)
+    gxyz = lib.cartesian_prod([numpy.arange(len(x)) for x in Gvbase])
+    b = cell.reciprocal_vectors()
+    ao_loc = cell.ao_loc_nr()
+    t0 = logger.perf_counter()
+    ft_ao.ft_aopair_kpts(cell, Gv, (0, nsh, 0, nsh), 's2', b, gxyz, Gvbase,
+                         numpy.zeros(3), kpts[:1])
+    t_ft = logger.perf_counter() - t0
+    npair = ao_loc[nsh]*(ao_loc[nsh]+1)//2
+    cost_ft = t_ft / (len(Gv) * npair)
+    logger.info(cell, 'Calibrated COST_INT3C = %.3g  COST_FT_AOPAIR = %.3g',
+                cost_int3c, cost_ft)
+    return cost_int3c, cost_ft
+
 def estimate_eta(cell, cutoff=CUTOFF):
     '''The exponent of the smooth gaussian model density, requiring that at
     boundary, density ~ 4pi rmax^2 exp(-eta/2*rmax^2) ~ 1e-12
@@ -1023,43 +2150,6 @@ def _guess_eta(cell, kpts=None, mesh=None):
     eta = estimate_eta_for_ke_cutoff(cell, ke_cutoff, cell.precision)
     return eta, mesh, ke_cutoff
 
-def auxbar(fused_cell):
-    r'''
-    Potential average = \sum_L V_L*Lpq
-
-    The coulomb energy is computed with chargeless density
-    \int (rho-C) V,  C = (\int rho) / vol = Tr(gamma,S)/vol
-    It is equivalent to removing the averaged potential from the short range V
-    vs = vs - (\int V)/vol * S
-    '''
-    aux_loc = fused_cell.ao_loc_nr()
-    naux = aux_loc[-1]
-    vbar = numpy.zeros(naux)
-    # SR ERI should not have contributions from backgound charge
-    if fused_cell.dimension < 2 or fused_cell.omega < 0:
-        return vbar
-
-    half_sph_norm = .5/numpy.sqrt(numpy.pi)
-    for i in range(fused_cell.nbas):
-        l = fused_cell.bas_angular(i)
-        if l == 0:
-            es = fused_cell.bas_exp(i)
-            if es.size == 1:
-                vbar[aux_loc[i]] = -1/es[0]
-            else:
-                # Remove the normalization to get the primitive contraction coeffcients
-                norms = half_sph_norm/gto.gaussian_int(2, es)
-                cs = numpy.einsum('i,ij->ij', 1/norms, fused_cell._libcint_ctr_coeff(i))
-                vbar[aux_loc[i]:aux_loc[i+1]] = numpy.einsum('in,i->n', cs, -1/es)
-    # TODO: fused_cell.cart and l%2 == 0: # 6d 10f ...
-    # Normalization coefficients are different in the same shell for cartesian
-    # basis. E.g. the d-type functions, the 5 d-type orbitals are normalized wrt
-    # the integral \int r^2 * r^2 e^{-a r^2} dr.  The s-type 3s orbital should be
-    # normalized wrt the integral \int r^0 * r^2 e^{-a r^2} dr. The different
-    # normalization was not built in the basis.
-    vbar *= numpy.pi/fused_cell.vol
-    return vbar
-
 def auxbar(fused_cell):
     r'''
     Potential average = \sum_L V_L*Lpq
@@ -1186,9 +2276,20 @@ class _load3c(object):
         self.kpti_kptj = kpti_kptj
         self.feri = None
         self.ignore_key_error = ignore_key_error
+        self.pairs = None
 
     def __enter__(self):
         self.feri = h5py.File(self.cderi, 'r')
+        if 'j3c-pairs' in self.feri:
+            self.pairs = self.feri['j3c-pairs'][()]
+        if self.label == 'j3c' and 'j3c-R' in self.feri:
+            # The pairs of the k-point mesh are in j3c-R, those of kpts_band
+            # in j3c
+            kpti_kptj = numpy.asarray(self.kpti_kptj)
+            kptij_lst = self.feri[self.kptij_label][()]
+            if (len(member(kpti_kptj, kptij_lst)) == 0 and
+                    len(member(kpti_kptj[[1,0]], kptij_lst)) == 0):
+                return _load_bvk(self.feri, kpti_kptj)
         if self.label not in self.feri:
             # Return a size-0 array to skip the loop in sr_loop
             if self.ignore_key_error:
@@ -1274,6 +2375,202 @@ class _load_and_unpack(object):
             return dat.shape
 
 
+def _bvk_translations(cell, kpts):
+    '''The k-point mesh of kpts and the lattice translations (integer, in
+    units of the lattice vectors) of its BvK supercell, centered at the
+    origin. kmesh is None if kpts is not a complete regular mesh.'''
+    scaled = numpy.dot(kpts, cell.lattice_vectors().T) / (2*numpy.pi)
+    kmesh = [len(numpy.unique(numpy.round(scaled[:,i] % 1, 6) % 1))
+             for i in range(3)]
+    if numpy.prod(kmesh) != len(kpts):
+        return None, None
+    Ts = lib.cartesian_prod([numpy.arange(-(n//2), n-n//2) for n in kmesh])
+    return kmesh, Ts
+
+def _load_j3c_rows(feri, kptij_lst, kpti, kptj, b0, b1, nao):
+    '''Rows [b0:b1] of j3c for (kpti,kptj) with all nao**2 AO-pair columns'''
+    k_id = member(numpy.asarray((kpti,kptj)), kptij_lst)
+    if len(k_id) > 0:
+        dat = feri['j3c/%d' % k_id[0]]
+        v = numpy.hstack([dat[str(i)][b0:b1] for i in range(len(dat))])
+    else:
+        k_id = member(numpy.asarray((kptj,kpti)), kptij_lst)
+        v = _load_and_unpack(feri['j3c/%d' % k_id[0]])[b0:b1]
+    if v.shape[1] != nao**2:
+        v = lib.unpack_tril(v, lib.HERMITIAN).reshape(-1,nao**2)
+    return v
+
+def _j3c_to_bvk(mydf, cell, kpts, cderi):
+    r'''Replace the j3c of the k-point pairs of the mesh kpts in cderi by the
+    BvK representation
+
+        j3c(ki,kj) = \sum_{R1,dR} exp(-i(ki-kj).R1 + i kj.dR) j3c-R[R1,dR]
+
+    This is a storage conversion of the fitted k-space j3c written by
+    _make_j3c. R1 is the translation of AO p and R1+dR the translation of
+    AO q, both in the BvK supercell of kpts (the aux function is in the cell
+    at the origin). j3c-R decays with |R1| and |dR|. The elements below
+    mydf.bvk_threshold are dropped: a (R1,dR) block is stored from the first
+    block of aux rows in which it has an element above the threshold, and
+    its rows before are zero.
+
+    The transform is exact on the mesh only. The pairs of kpts_band keep
+    their k-space j3c, listed in j3c-kptij. The metric L(ki-kj) is applied
+    before the transform, so the j3c of the eigenvector metric (2D systems)
+    and of the pivoted Cholesky metric (rank-deficient j2c), whose aux rows
+    are not a smooth function of ki-kj, is kept in k-space.
+    '''
+    _check_full_j3c(mydf, 'BvK j3c')
+    log = logger.new_logger(mydf)
+    kmesh, Ts = _bvk_translations(cell, kpts)
+    if kmesh is None:
+        log.warn('kpts is not a regular k-point mesh. j3c is kept in k-space')
+        return
+    if cell.dimension == 2 and cell.low_dim_ft_type != 'inf_vacuum':
+        log.warn('BvK j3c is not available for the eigenvector DF metric of '
+                 '2D systems. j3c is kept in k-space')
+        return
+    threshold = mydf.bvk_threshold
+    if threshold is None:
+        threshold = cell.precision
+    nk = len(kpts)
+    nao = cell.nao_nr()
+    nao2 = nao**2
+    Ls = numpy.dot(Ts, cell.lattice_vectors())
+    nR = len(Ls)
+    expkL = numpy.exp(1j * numpy.dot(kpts, Ls.T))
+
+    feri = h5py.File(cderi, 'r')
+    if 'j3c-piv' in feri:
+        log.warn('The DF metric is rank deficient at some k-points. '
+                 'j3c is kept in k-space')
+        feri.close()
+        return
+    kptij_lst = feri['j3c-kptij'][()]
+    band_ids = [n for n, (ki, kj) in enumerate(kptij_lst)
+                if len(member(ki, kpts)) == 0 or len(member(kj, kpts)) == 0]
+    mesh_id = [n for n in range(len(kptij_lst)) if n not in band_ids][0]
+    naux = feri['j3c/%d/0' % mesh_id].shape[0]
+
+    max_memory = max(2000, mydf.max_memory - lib.current_memory()[0])
+    # the rows of all nk**2 pairs and their transform over ki
+    blksize = max(1, min(naux, int(max_memory*.4e6/16/(2*nk**2*nao2))))
+    log.debug('BvK j3c: kmesh %s, aux blksize %d', kmesh, blksize)
+
+    bvkfile = tempfile.NamedTemporaryFile(dir=os.path.dirname(cderi), delete=False)
+    bvkfile.close()
+    fout = h5py.File(bvkfile.name, 'w')
+    for key in feri:
+        if key not in ('j3c', 'j3c-kptij'):
+            feri.copy(key, fout)
+    fout['j3c-kptij'] = kptij_lst[band_ids].reshape(-1,2,3)
+    for m, n in enumerate(band_ids):
+        feri.copy('j3c/%d' % n, fout, 'j3c/%d' % m)
+    fout['j3c-kmesh'] = kmesh
+    fout['j3c-R-kpts'] = kpts
+    dat = fout.create_dataset('j3c-R', (0,naux,nao2), 'c16',
+                              maxshape=(None,naux,nao2), chunks=(1,blksize,nao2))
+
+    # The stored (R1,dR) blocks. R1 = dR = 0 is always kept
+    slots = -numpy.ones((nR,nR), dtype=int)
+    r0 = numpy.where(abs(Ts).sum(axis=1) == 0)[0][0]
+    slots[r0,r0] = 0
+    blks = [(r0, r0)]
+    dat.resize(1, axis=0)
+    for b0, b1 in lib.prange(0, naux, blksize):
+        ncol = (b1 - b0) * nao2
+        v = numpy.empty((nk,nk,ncol), dtype=numpy.complex128)
+        for i, kpti in enumerate(kpts):
+            for j, kptj in enumerate(kpts):
+                v[i,j] = _load_j3c_rows(feri, kptij_lst, kpti, kptj, b0, b1, nao).ravel()
+        # sum over ki, then the phase exp(-i kj.R1), then sum over kj
+        v = lib.dot(expkL.T, v.reshape(nk,-1)).reshape(nR,nk,ncol)
+        v *= expkL.T.conj().reshape(nR,nk,1)
+        for r in range(nR):
+            w = lib.dot(expkL.T.conj(), v[r]) * (1./nk**2)
+            w = w.reshape(nR,b1-b0,nao2)
+            vmax = abs(w).reshape(nR,-1).max(axis=1)
+            for d in numpy.where((vmax > threshold) & (slots[r] < 0))[0]:
+                slots[r,d] = len(blks)
+                blks.append((r, d))
+            dat.resize(len(blks), axis=0)
+            for d in numpy.where(slots[r] >= 0)[0]:
+                dat[slots[r,d],b0:b1] = w[d]
+        v = w = None
+    feri.close()
+    fout['j3c-R-Ls'] = numpy.asarray([(Ls[r], Ls[d]) for r, d in blks])
+    fout.close()
+    log.info('BvK j3c: %d of %d (R1,dR) blocks stored, %d kpts_band pairs '
+             'in k-space', len(blks), nR**2, len(band_ids))
+    os.replace(bvkfile.name, cderi)
+
+def get_j3c_bvk(feri, kptij_lst, aux_slice=None):
+    '''j3c[npair,naux,nao**2] of the k-point pairs kptij_lst of the BvK mesh
+    from the blocks j3c-R, one read of the aux rows and one GEMM over the
+    (R1,dR) blocks for all pairs.'''
+    if aux_slice is None:
+        aux_slice = slice(None)
+    kptij_lst = numpy.reshape(kptij_lst, (-1,2,3))
+    Ls = feri['j3c-R-Ls'][()]
+    kpti = kptij_lst[:,0]
+    kptj = kptij_lst[:,1]
+    phase = numpy.exp(-1j * numpy.dot(kpti - kptj, Ls[:,0].T) +
+                      1j * numpy.dot(kptj, Ls[:,1].T))
+    dat = feri['j3c-R'][:,aux_slice]
+    nblk, nrow, nao2 = dat.shape
+    v = lib.dot(phase, dat.reshape(nblk,-1))
+    return v.reshape(len(kptij_lst),nrow,nao2)
+
+class _load_bvk(object):
+    '''j3c of one k-point pair of the BvK mesh, Fourier transformed from
+    j3c-R when the aux rows are loaded. The J/K builds of df_jk transform the
+    rows of all pairs from one read of j3c-R instead.'''
+    def __init__(self, feri, kpti_kptj):
+        self.feri = feri
+        self.kpti_kptj = numpy.asarray(kpti_kptj)
+        kpts = feri['j3c-R-kpts'][()]
+        if any(len(member(k, kpts)) == 0 for k in self.kpti_kptj):
+            raise RuntimeError('j3c for kpts %s is not initialized.\n'
+                               'You need to update the attribute .kpts then call '
+                               '.build() to initialize j3c.' % self.kpti_kptj)
+    def __getitem__(self, s):
+        kpti, kptj = self.kpti_kptj
+        v = get_j3c_bvk(self.feri, self.kpti_kptj, s)[0]
+        if is_zero(kpti-kptj):
+            nao = int(numpy.sqrt(v.shape[-1]))
+            v = lib.pack_tril(v.reshape(-1,nao,nao))
+        if gamma_point(self.kpti_kptj):
+            v = v.real
+        return v
+    def __array__(self):
+        return self[:]
+
+    @property
+    def shape(self):
+        naux, nao2 = self.feri['j3c-R'].shape[1:]
+        kpti, kptj = self.kpti_kptj
+        if is_zero(kpti-kptj):
+            nao = int(numpy.sqrt(nao2))
+            return (naux, nao*(nao+1)//2)
+        return (naux, nao2)
+
+
+def _modchg_rcut(eta, precision):
+    # _estimate_rcut is based on the integral overlap. It's likely too tight for
+    # rcut of the model charge. Using the value of functions at rcut seems enough
+    rcut = 15.
+    return (numpy.log(4*numpy.pi*rcut**2/precision) / eta)**.5
+
+def _aux_ngrids(Gaux, precision):
+    '''For plane waves sorted by |G|, the number of leading plane waves each
+    column of Gaux needs so that the neglected tail sum_G |Gaux(G)| is below
+    precision. Since |FT of an AO pair| <= 1 the tail bounds the error of the
+    G-space correction of each 3-center integral.'''
+    if Gaux.shape[0] == 0:
+        return numpy.zeros(Gaux.shape[1], dtype=int)
+    tail = numpy.cumsum(abs(Gaux[::-1]), axis=0)[::-1]
+    return numpy.count_nonzero(tail > precision, axis=0)
+
 def _gaussian_int(cell):
     r'''Regular gaussian integral \int g(r) dr^3'''
     return ft_ao.ft_ao(cell, numpy.zeros((1,3)))[0].real
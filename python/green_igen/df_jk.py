@@ -0,0 +1,553 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+'''
+Streaming J and K builders of GDF
+
+The cderi file is read once per call, in blocks of aux rows. The rows of
+each stored k-point pair are read from the HDF5 segments straight into one
+buffer, in the dtype and the AO-pair packing of the file, and passed to the
+kernels of df_jk.c:
+
+* the exchange of (ki,kj) and, through j3c(kj,ki) = j3c(ki,kj)^\\dagger,
+  of (kj,ki) from the same rows;
+* the fitted density of the block from the packed rows of all (k,k), then
+  the Coulomb matrices of the block from the same rows.
+
+The pairs of the BvK mesh of j3c-R (see df._j3c_to_bvk) are Fourier
+transformed together, from one read of each block of aux rows of j3c-R. The
+single-dataset layout of old cderi files is handled by pyscf.pbc.df.df_jk.
+
+get_j_ace_kpts builds the adaptively compressed exchange operator (Lin,
+J. Chem. Theory Comput. 12, 2242 (2016)) of the occupied orbitals in the
+same pass as J.
+'''
+
+import ctypes
+import numpy
+import h5py
+import scipy.linalg
+from pyscf import lib
+from pyscf.lib import logger
+from pyscf.pbc.df import df_jk
+from pyscf.pbc.df.df_jk import (_format_dms, _format_kpts_band, _format_jks,
+                                _ewald_exxdiv_for_G0)
+from pyscf.pbc.lib.kpts_helper import is_zero, gamma_point, member
+from ._pbcintor import libpbc
+from pyscf import __config__
+
+# The eigenvalues of C^\dagger K C below ACE_LINDEP (relative to the largest)
+# are dropped from the ACE operator
+ACE_LINDEP = getattr(__config__, 'pbc_df_df_jk_ace_lindep', 1e-12)
+
+
+def get_j_kpts(mydf, dm_kpts, hermi=1, kpts=numpy.zeros((1,3)), kpts_band=None):
+    return get_jk_kpts(mydf, dm_kpts, hermi, kpts, kpts_band, True, False)[0]
+
+def get_k_kpts(mydf, dm_kpts, hermi=1, kpts=numpy.zeros((1,3)), kpts_band=None,
+               exxdiv=None):
+    return get_jk_kpts(mydf, dm_kpts, hermi, kpts, kpts_band, False, True,
+                       exxdiv)[1]
+
+def _streamable(cderi):
+    with h5py.File(cderi, 'r') as feri:
+        return 'j3c-R' in feri or ('j3c-kptij' in feri and
+                                   isinstance(feri.get('j3c/0'), h5py.Group))
+
+def _read_rows(dat, b0, b1, out):
+    '''Rows [b0:b1] of the j3c of one k-point pair, read segment by segment
+    into the columns of out'''
+    c0 = 0
+    for i in range(len(dat)):
+        seg = dat[str(i)]
+        c1 = c0 + seg.shape[1]
+        seg.read_direct(out, numpy.s_[b0:b1], numpy.s_[:,c0:c1])
+        c0 = c1
+    return out
+
+def _bvk_rows(v, kpti_kptj, nao):
+    '''Rows of get_j3c_bvk in the dtype and the AO-pair packing of the
+    k-space j3c'''
+    kpti, kptj = kpti_kptj
+    if is_zero(kpti-kptj):
+        v = lib.pack_tril(v.reshape(-1,nao,nao))
+        if is_zero(kpti):
+            v = numpy.asarray(v.real, order='C')
+    return v
+
+def get_jk_kpts(mydf, dm_kpts, hermi=1, kpts=numpy.zeros((1,3)), kpts_band=None,
+                with_j=True, with_k=True, exxdiv=None):
+    '''J and K of the density matrices of kpts with one pass over the cderi
+    file of mydf'''
+    return _get_jk_kpts(mydf, dm_kpts, hermi, kpts, kpts_band,
+                        with_j, with_k, exxdiv)[:2]
+
+def _get_jk_kpts(mydf, dm_kpts, hermi=1, kpts=numpy.zeros((1,3)), kpts_band=None,
+                 with_j=True, with_k=True, exxdiv=None, ace_orbs=None):
+    '''get_jk_kpts, and with ace_orbs = (occ_orbs, proj_orbs) the W = K C of
+    the ACE operator of each set (see get_j_ace_kpts) in the same pass.
+
+    Returns:
+        vj, vk, W. W[x][k] is an (nao,nocc) array of the orbitals proj_orbs[x][k].
+    '''
+    if mydf._cderi is None:
+        mydf.build()
+    with_w = ace_orbs is not None
+    if not _streamable(mydf._cderi):
+        vj = vk = W = None
+        if with_k:
+            vk = df_jk.get_k_kpts(mydf, dm_kpts, hermi, kpts, kpts_band, exxdiv)
+        if with_j:
+            vj = df_jk.get_j_kpts(mydf, dm_kpts, hermi, kpts, kpts_band)
+        if with_w:
+            W = _ace_w_sr_loop(mydf, ace_orbs[0], ace_orbs[1], kpts)
+        return vj, vk, W
+
+    cell = mydf.cell
+    log = logger.Logger(mydf.stdout, mydf.verbose)
+    t1 = (logger.process_clock(), logger.perf_counter())
+
+    dms = _format_dms(dm_kpts, kpts)
+    nset, nkpts, nao = dms.shape[:3]
+    kpts_band, input_band = _format_kpts_band(kpts_band, kpts), kpts_band
+    nband = len(kpts_band)
+    nao2 = nao**2
+    npair = nao*(nao+1)//2
+    dm_real = not numpy.iscomplexobj(dms)
+    # density matrices and K matrices in the order (k,x,p,q)
+    dmsk = numpy.asarray(dms.transpose(1,0,2,3), dtype=numpy.complex128, order='C')
+    dmsk_real = None
+    if dm_real:
+        dmsk_real = numpy.asarray(dmsk.real, order='C')
+    vk = numpy.zeros((nband,nset,nao,nao), dtype=numpy.complex128)
+    vk_real = None
+    if with_j:
+        # rho[x,L] = \sum_{pq} L[L,p,q] dm[x,q,p] with the packed AO pairs
+        # (see PBCDFj_rho_s2)
+        dmA = lib.pack_tril(dmsk.transpose(0,1,3,2).reshape(-1,nao,nao))
+        dmB = lib.pack_tril(dmsk.reshape(-1,nao,nao))
+        diag = numpy.arange(nao)
+        dmB[:,diag*(diag+3)//2] = 0
+        dmA = dmA.reshape(nkpts,nset,npair)
+        dmB = dmB.reshape(nkpts,nset,npair)
+    if with_w:
+        occ_orbs, proj_orbs = ace_orbs
+        W = [[numpy.zeros((nao,c.shape[1]), dtype=numpy.complex128) for c in x]
+             for x in proj_orbs]
+        nocc = max([c.shape[1] for x in occ_orbs + proj_orbs for c in x] + [0])
+
+    with h5py.File(mydf._cderi, 'r') as feri:
+        kptij_lst = feri['j3c-kptij'][()].reshape(-1,2,3)
+        # The pairs [nfile:] of kptij_lst are those of the BvK mesh of j3c-R
+        nfile = len(kptij_lst)
+        naux_R = nblk_R = 0
+        if 'j3c-R' in feri:
+            kpts_R = feri['j3c-R-kpts'][()]
+            kptij_R = [(ki, kpts_R[j]) for i, ki in enumerate(kpts_R) for j in range(i+1)]
+            kptij_lst = numpy.vstack([kptij_lst, numpy.asarray(kptij_R)])
+            nblk_R, naux_R = feri['j3c-R'].shape[:2]
+            from .df import get_j3c_bvk
+        pairs = None
+        if 'j3c-pairs' in feri:
+            pairs = feri['j3c-pairs'][()]
+            if with_j:
+                dmA_sparse = numpy.asarray(dmA[:,:,pairs], order='C')
+                dmB_sparse = numpy.asarray(dmB[:,:,pairs], order='C')
+        labels = [('j3c', 1)]
+        if (cell.dimension == 2 and cell.low_dim_ft_type != 'inf_vacuum' and
+                'j3c-' in feri):
+            # Truncated Coulomb operator is not postive definite. The negative
+            # part of the CDERI tensor.
+            labels.append(('j3c-', -1))
+
+        # The contributions of each stored k-point pair (ka,kb)
+        k_done = numpy.zeros((nkpts,nband), dtype=bool)
+        rho_done = numpy.zeros(nkpts, dtype=bool)
+        vj_done = numpy.zeros(nband, dtype=bool)
+        jobs = []
+        for n, (ka, kb) in enumerate(kptij_lst):
+            direct = []
+            swap = []
+            rho_k = []
+            vj_k = []
+            if with_k or with_w:
+                direct = [(i, b) for i in member(ka, kpts)
+                          for b in member(kb, kpts_band) if not k_done[i,b]]
+                for i, b in direct:
+                    k_done[i,b] = True
+                if not is_zero(ka-kb):
+                    swap = [(i, b) for i in member(kb, kpts)
+                            for b in member(ka, kpts_band) if not k_done[i,b]]
+                    for i, b in swap:
+                        k_done[i,b] = True
+            if with_j and is_zero(ka-kb):
+                rho_k = [k for k in member(ka, kpts) if not rho_done[k]]
+                vj_k = [b for b in member(ka, kpts_band) if not vj_done[b]]
+                rho_done[rho_k] = True
+                vj_done[vj_k] = True
+            if direct or swap or rho_k or vj_k:
+                jobs.append((n, direct, swap, rho_k, vj_k))
+        if (((with_k or with_w) and not k_done.all()) or
+            (with_j and not (rho_done.all() and vj_done.all()))):
+            raise RuntimeError('j3c for kpts %s and kpts_band %s is not initialized.\n'
+                               'You need to update the attribute .kpts then call '
+                               '.build() to initialize j3c.' % (kpts, kpts_band))
+
+        ncache = sum(len(job[4]) > 0 and job[0] < nfile for job in jobs)
+        bvk_ids = [job[0] for job in jobs if job[0] >= nfile]
+        bvk_index = dict((n, m) for m, n in enumerate(bvk_ids))
+        max_memory = max(2000, mydf.max_memory - lib.current_memory()[0])
+        # Per aux row: the rows of one k-point pair, the rows of the (k,k)
+        # pairs kept for vj, the two nao**2 buffers of PBCDFk_kpt, the
+        # pair-sparse rows expanded to all AO pairs, and for W the unpacked
+        # and transposed rows and the occupied-AO blocks of _ace_accumulate
+        row_size = 16 * (nao2 + ncache * npair + (2 * nao2 if with_k else 0) +
+                         (npair if (with_k or with_w) and pairs is not None else 0) +
+                         (2 * nao2 + 2 * nocc * nao if with_w else 0) +
+                         # the rows of j3c-R and their transform
+                         ((nblk_R + len(bvk_ids)) * nao2 if bvk_ids else 0))
+        blksize = max(1, min(int(max_memory*.8e6/row_size), mydf.blockdim))
+        log.debug1('GDF J/K: %d k-point pairs, %d (k,k) pairs kept for vj, '
+                   'blksize %d', len(jobs), ncache, blksize)
+        buf = numpy.empty(blksize*nao2, dtype=numpy.complex128)
+        cachebuf = numpy.empty((ncache,blksize*npair), dtype=numpy.complex128)
+
+        if with_j:
+            vjL = {}
+            vjU = {}
+            for n, direct, swap, rho_k, vj_k in jobs:
+                if n >= nfile:
+                    ncol = npair
+                else:
+                    ncol = sum(seg.shape[1] for seg in feri['j3c/%d' % n].values())
+                for b in vj_k:
+                    vjL[b] = numpy.zeros((nset,ncol), dtype=numpy.complex128)
+                    if hermi != 1:
+                        vjU[b] = numpy.zeros((nset,ncol), dtype=numpy.complex128)
+
+        for label, sign in labels:
+            naux = max([feri['%s/%d/0' % (label, job[0])].shape[0] for job in jobs
+                        if '%s/%d' % (label, job[0]) in feri] + [0])
+            if label == 'j3c' and bvk_ids:
+                naux = max(naux, naux_R)
+            for b0 in range(0, naux, blksize):
+                rho = None
+                cached = []
+                icache = 0
+                Lbvk = None
+                if label == 'j3c' and bvk_ids and b0 < naux_R:
+                    Lbvk = get_j3c_bvk(feri, kptij_lst[bvk_ids],
+                                       slice(b0, min(b0+blksize, naux_R)))
+                for n, direct, swap, rho_k, vj_k in jobs:
+                    if n >= nfile:
+                        if Lbvk is None:
+                            continue
+                        Lpq = _bvk_rows(Lbvk[bvk_index[n]], kptij_lst[n], nao)
+                        nrow, ncol = Lpq.shape
+                        dtype = Lpq.dtype
+                    else:
+                        key = '%s/%d' % (label, n)
+                        if key not in feri:
+                            continue
+                        dat = feri[key]
+                        seg = dat['0']
+                        nrow = min(b0+blksize, seg.shape[0]) - b0
+                        if nrow <= 0:
+                            continue
+                        ncol = sum(dat[str(i)].shape[1] for i in range(len(dat)))
+                        dtype = seg.dtype
+                        if vj_k:
+                            out = cachebuf[icache]
+                            icache += 1
+                        else:
+                            out = buf
+                        Lpq = numpy.ndarray((nrow,ncol), dtype=dtype, buffer=out)
+                        _read_rows(dat, b0, b0+nrow, Lpq)
+                    cplx = int(dtype == numpy.complex128)
+                    sparse = pairs is not None and ncol == len(pairs) != npair
+
+                    if rho_k:
+                        if rho is None:
+                            rho = numpy.zeros((nset,nrow), dtype=numpy.complex128)
+                        if sparse:
+                            dA, dB = dmA_sparse, dmB_sparse
+                        else:
+                            dA, dB = dmA, dmB
+                        for k in rho_k:
+                            libpbc.PBCDFj_rho_s2(
+                                rho.ctypes.data_as(ctypes.c_void_p),
+                                Lpq.ctypes.data_as(ctypes.c_void_p),
+                                ctypes.c_int(cplx),
+                                dA[k].ctypes.data_as(ctypes.c_void_p),
+                                dB[k].ctypes.data_as(ctypes.c_void_p),
+                                ctypes.c_double(sign), ctypes.c_int(nset),
+                                ctypes.c_int(nrow), ctypes.c_int(ncol))
+                    if vj_k:
+                        cached.append((Lpq, cplx, vj_k))
+
+                    if direct or swap:
+                        s2 = ncol != nao2
+                        if sparse:
+                            Lpq_s2 = numpy.zeros((nrow,npair), dtype=dtype)
+                            Lpq_s2[:,pairs] = Lpq
+                            Lpq, ncol = Lpq_s2, npair
+                        if with_w:
+                            _ace_accumulate(W, Lpq, s2, nao, direct, swap,
+                                            occ_orbs, proj_orbs, sign)
+                        if with_k and not cplx and dm_real:
+                            if vk_real is None:
+                                vk_real = numpy.zeros((nband,nset,nao,nao))
+                            for i, b in direct:
+                                libpbc.PBCDFk_gamma(
+                                    vk_real[b].ctypes.data_as(ctypes.c_void_p),
+                                    Lpq.ctypes.data_as(ctypes.c_void_p),
+                                    ctypes.c_int(s2),
+                                    dmsk_real[i].ctypes.data_as(ctypes.c_void_p),
+                                    ctypes.c_double(sign), ctypes.c_int(nset),
+                                    ctypes.c_int(nrow), ctypes.c_int(nao))
+                        elif with_k:
+                            null = lib.c_null_ptr()
+                            for j in range(max(len(direct), len(swap))):
+                                if j < len(direct):
+                                    i, b = direct[j]
+                                    pvk = vk[b].ctypes.data_as(ctypes.c_void_p)
+                                    pdm = dmsk[i].ctypes.data_as(ctypes.c_void_p)
+                                else:
+                                    pvk = pdm = null
+                                if j < len(swap):
+                                    i, b = swap[j]
+                                    pvk_swap = vk[b].ctypes.data_as(ctypes.c_void_p)
+                                    pdm_swap = dmsk[i].ctypes.data_as(ctypes.c_void_p)
+                                else:
+                                    pvk_swap = pdm_swap = null
+                                libpbc.PBCDFk_kpt(
+                                    pvk, pvk_swap,
+                                    Lpq.ctypes.data_as(ctypes.c_void_p),
+                                    ctypes.c_int(cplx), ctypes.c_int(s2),
+                                    pdm, pdm_swap, ctypes.c_double(sign),
+                                    ctypes.c_int(nset), ctypes.c_int(nrow),
+                                    ctypes.c_int(nao))
+                    Lpq = Lpq_s2 = None
+
+                # the fitted density of the block is complete. vj of the rows
+                # kept in cachebuf.
+                for Lpq, cplx, vj_k in cached:
+                    nrow, ncol = Lpq.shape
+                    if rho is None:
+                        rho = numpy.zeros((nset,nrow), dtype=numpy.complex128)
+                    for b in vj_k:
+                        libpbc.PBCDFj_vj_s2(
+                            vjL[b].ctypes.data_as(ctypes.c_void_p),
+                            lib.c_null_ptr() if hermi == 1 else
+                            vjU[b].ctypes.data_as(ctypes.c_void_p),
+                            Lpq.ctypes.data_as(ctypes.c_void_p),
+                            ctypes.c_int(cplx), rho.ctypes.data_as(ctypes.c_void_p),
+                            ctypes.c_int(nset), ctypes.c_int(nrow),
+                            ctypes.c_int(ncol))
+                cached = Lpq = Lbvk = None
+                t1 = log.timer_debug1('GDF J/K %s [%d:%d]' % (label, b0, b0+blksize), *t1)
+
+    vj = None
+    if with_j:
+        vj = numpy.empty((nset,nband,nao,nao), dtype=numpy.complex128)
+        for b in range(nband):
+            vjs = []
+            for v in (vjL[b], vjU.get(b)):
+                if v is not None and v.shape[1] != npair:
+                    v1 = numpy.zeros((nset,npair), dtype=numpy.complex128)
+                    v1[:,pairs] = v
+                    v = v1
+                vjs.append(v)
+            if hermi == 1:
+                vj[:,b] = lib.unpack_tril(vjs[0], lib.HERMITIAN)
+            else:
+                vj[:,b] = (numpy.tril(lib.unpack_tril(vjs[0], lib.SYMMETRIC)) +
+                           numpy.triu(lib.unpack_tril(vjs[1], lib.SYMMETRIC), 1))
+        vj *= 1. / nkpts
+        if is_zero(kpts_band) and dm_real:
+            vj = vj.real
+        vj = _format_jks(vj, dm_kpts, input_band, kpts)
+
+    if with_w:
+        for x in W:
+            for w in x:
+                w *= 1. / nkpts
+    else:
+        W = None
+
+    if with_k:
+        if vk_real is not None:
+            vk += vk_real
+        vk = vk.transpose(1,0,2,3) * (1. / nkpts)
+        if exxdiv == 'ewald':
+            _ewald_exxdiv_for_G0(cell, kpts, dms, vk, kpts_band)
+        if gamma_point(kpts_band) and gamma_point(kpts) and dm_real:
+            vk = vk.real
+        vk = _format_jks(vk, dm_kpts, input_band, kpts)
+    else:
+        vk = None
+    return vj, vk, W
+
+
+def _ace_orbitals(mo_coeff_kpts, mo_occ_kpts):
+    '''The occupied orbitals of each k-point scaled by sqrt(occupation), whose
+    densities build K, and the occupied orbitals K is projected on'''
+    occ_orbs = []
+    proj_orbs = []
+    for c, occ in zip(mo_coeff_kpts, mo_occ_kpts):
+        occ = numpy.asarray(occ)
+        mask = occ > 0
+        c = numpy.asarray(c)[:,mask]
+        occ_orbs.append(c * numpy.sqrt(occ[mask]))
+        proj_orbs.append(c)
+    return occ_orbs, proj_orbs
+
+def _ace_accumulate(W, Lpq, s2, nao, direct, swap, occ_orbs, proj_orbs, sign):
+    r'''W[x][b] += sign * X^\dagger X c_b of the rows Lpq of one k-point pair,
+    with the occupied-AO blocks
+        X[i,L,s] = \sum_q conj(c_i[q,i]) j3c(ki,kb)[L,q,s]
+    of the direct pairs (i,b) and, through j3c(kb,ki)[L,q,s] = conj(L[L,s,q]),
+        X[i,L,s] = conj(\sum_q L[L,s,q] c_i[q,i])
+    of the swapped pairs.'''
+    nrow = Lpq.shape[0]
+    if s2:
+        Lpq = lib.unpack_tril(Lpq, lib.HERMITIAN)
+    Lpq = Lpq.reshape(nrow,nao,nao)
+    pLq = None
+    if direct:
+        pLq = Lpq.transpose(1,0,2).reshape(nao,-1)
+    for x in range(len(W)):
+        for pairs, swapped in ((direct, False), (swap, True)):
+            for i, b in pairs:
+                ci = occ_orbs[x][i]
+                cb = proj_orbs[x][b]
+                if ci.shape[1] == 0 or cb.shape[1] == 0:
+                    continue
+                if swapped:
+                    X = lib.dot(Lpq.reshape(-1,nao), ci).reshape(nrow,nao,-1)
+                    X = X.transpose(2,0,1).conj().reshape(-1,nao)
+                else:
+                    X = lib.dot(ci.conj().T, pLq).reshape(-1,nao)
+                W[x][b] += sign * lib.dot(X.conj().T, lib.dot(X, cb))
+                X = None
+
+def _ace_w_sr_loop(mydf, occ_orbs, proj_orbs, kpts):
+    '''W of _get_jk_kpts from the aux blocks of sr_loop, for the cderi files
+    that are not streamed'''
+    log = logger.Logger(mydf.stdout, mydf.verbose)
+    t1 = (logger.process_clock(), logger.perf_counter())
+    kpts = numpy.reshape(kpts, (-1,3))
+    nkpts = len(kpts)
+    nao = mydf.cell.nao_nr()
+    W = [[numpy.zeros((nao,c.shape[1]), dtype=numpy.complex128) for c in x]
+         for x in proj_orbs]
+    max_memory = max(2000, mydf.max_memory - lib.current_memory()[0])
+    for ki in range(nkpts):
+        for kj in range(nkpts):
+            direct = [(ki, kj)]
+            for LpqR, LpqI, sign in mydf.sr_loop((kpts[ki],kpts[kj]), max_memory, False):
+                nrow = LpqR.shape[0]
+                Lpq = (LpqR + LpqI * 1j).reshape(nrow,nao*nao)
+                _ace_accumulate(W, Lpq, False, nao, direct, [],
+                                occ_orbs, proj_orbs, sign)
+                LpqR = LpqI = Lpq = None
+        t1 = log.timer_debug1('ACE W of k-point %d' % ki, *t1)
+    for x in W:
+        for w in x:
+            w *= 1. / nkpts
+    return W
+
+def get_j_ace_kpts(mydf, dm_kpts, mo_coeff_sets, mo_occ_sets,
+                   kpts=numpy.zeros((1,3)), hermi=1, with_j=True, exxdiv=None):
+    r'''J of dm_kpts and the adaptively compressed exchange (ACE) operator
+    of the orbitals of each set, with one pass over the cderi file
+
+    K_k of the density matrices C_k n_k C_k^\dagger is projected on the
+    occupied orbitals C_k of each k-point,
+        W_k = K_k C_k,   C_k^\dagger W_k = U e U^\dagger
+    and compressed to xi_k = W_k U e^{-1/2}. K_k ~ xi_k xi_k^\dagger is
+    exact on the occupied space. W_k is assembled from the occupied-AO blocks
+        X[i,L,s] = \sum_q conj(c_k'[q,i]) j3c(k',k)[L,q,s]
+    of the aux blocks of the J pass, without forming K_k.
+
+    Args:
+        dm_kpts : the density matrices of J, (nset,nkpts,nao,nao). They are
+            the densities of the orbitals if None and with_j is False.
+        mo_coeff_sets, mo_occ_sets : the orbitals and occupations of each
+            k-point of each of the nset sets
+
+    Returns:
+        vj (None if with_j is False), and xi of each k-point of each set, an
+        (nao,nocc) array
+    '''
+    cell = mydf.cell
+    kpts = numpy.reshape(kpts, (-1,3))
+    nkpts = len(kpts)
+    orbs = [_ace_orbitals(c, o) for c, o in zip(mo_coeff_sets, mo_occ_sets)]
+    occ_orbs = [x[0] for x in orbs]
+    proj_orbs = [x[1] for x in orbs]
+    nao = proj_orbs[0][0].shape[0]
+    # The densities of the orbitals, for the G=0 correction of K
+    dms = numpy.asarray([[lib.dot(c, c.conj().T) for c in x] for x in occ_orbs])
+    if dm_kpts is None:
+        dm_kpts = dms
+
+    vj, _, W = _get_jk_kpts(mydf, dm_kpts, hermi, kpts, None, with_j, False,
+                            None, (occ_orbs, proj_orbs))
+
+    xi = []
+    for x in range(len(W)):
+        if exxdiv == 'ewald':
+            # madelung * S_k D_k S_k applied to C_k
+            vk0 = numpy.zeros((1,nkpts,nao,nao), dtype=numpy.complex128)
+            _ewald_exxdiv_for_G0(cell, kpts, dms[x].reshape(1,nkpts,nao,nao),
+                                 vk0, kpts)
+            for k in range(nkpts):
+                W[x][k] += lib.dot(vk0[0,k], proj_orbs[x][k])
+        orbs_real = gamma_point(kpts) and not numpy.iscomplexobj(proj_orbs[x][0])
+        xi.append([_ace_compress(w, c, orbs_real)
+                   for w, c in zip(W[x], proj_orbs[x])])
+    return vj, xi
+
+def _ace_compress(W, c, orbs_real):
+    '''xi = W U e^{-1/2} of C^\dagger W = U e U^\dagger'''
+    nao = W.shape[0]
+    if W.shape[1] == 0:
+        return numpy.zeros((nao,0))
+    m = lib.dot(c.conj().T, W)
+    e, u = scipy.linalg.eigh((m + m.conj().T) * .5)
+    mask = e > ACE_LINDEP * e[-1]
+    x = lib.dot(W, u[:,mask] / numpy.sqrt(e[mask]))
+    if orbs_real:
+        x = x.real
+    return x
+
+def get_ace_kpts(mydf, mo_coeff_kpts, mo_occ_kpts, kpts=numpy.zeros((1,3)),
+                 exxdiv=None):
+    '''ACE operator of the orbitals of one set (see get_j_ace_kpts)
+
+    Returns:
+        xi of each k-point, an (nao,nocc) array
+    '''
+    return get_j_ace_kpts(mydf, None, [mo_coeff_kpts], [mo_occ_kpts], kpts,
+                          with_j=False, exxdiv=exxdiv)[1][0]
+
+def apply_ace(xi, mo_coeff_kpts):
+    '''K C_k of the ACE operator for the orbitals C_k of each k-point'''
+    return [lib.dot(x, lib.dot(x.conj().T, c)) for x, c in zip(xi, mo_coeff_kpts)]
+
+def ace_to_vk(xi):
+    '''The AO matrices xi_k xi_k^\\dagger of the ACE operator'''
+    return numpy.asarray([lib.dot(x, x.conj().T) for x in xi])
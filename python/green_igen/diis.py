@@ -21,11 +21,12 @@ DIIS
 """
 
 import sys
+import tempfile
 import numpy
 import scipy.linalg
 from pyscf.lib import logger
 from pyscf.lib import misc
-from pyscf.lib import numpy_helper
+from pyscf.lib import param
 from pyscf import __config__
 
 INCORE_SIZE = getattr(__config__, 'lib_diis_incore_size', 10000000)  # 80 MB
@@ -113,30 +114,69 @@ class DIIS(object):
 # don't modify the following private variables, they are not input options
         self.filename = filename
         self._diisfile = None
-        self._buffer = {}
+        self._xbuf = None  # trial vectors, the last slot holds xprev
+        self._ebuf = None  # error vectors
         self._bookkeep = [] # keep the ordering of input vectors
         self._head = 0
         self._H = None
         self._xprev = None
         self._err_vec_touched = False
 
+    def _ring(self, key, value):
+        '''The ring buffer which holds the vector of key'''
+        if key[0] == 'e':
+            if self._ebuf is None:
+                incore = value.size < INCORE_SIZE or self.incore
+                self._ebuf = _RingBuffer(self.space, value.size, value.dtype, incore)
+            return self._ebuf, int(key[1:])
+        else:
+            if self._xbuf is None:
+                incore = value.size < INCORE_SIZE or self.incore
+                self._xbuf = _RingBuffer(self.space+1, value.size, value.dtype, incore)
+            if key == 'xprev':
+                return self._xbuf, self._xbuf.nslot - 1
+            else:
+                return self._xbuf, int(key[1:])
+
     def _store(self, key, value):
-        incore = value.size < INCORE_SIZE or self.incore
-        if incore:
-            self._buffer[key] = value
+        ring, slot = self._ring(key, value)
+        ring.put(slot, value)
 
         # save the error vector if filename is given, this file can be used to
         # restore the DIIS state
-        if (not incore) or isinstance(self.filename, str):
-            if self._diisfile is None:
-                self._diisfile = misc.H5TmpFile(self.filename, 'w')
-            if key in self._diisfile:
-                self._diisfile[key][:] = value
-            else:
-                self._diisfile[key] = value
+        if isinstance(self.filename, str):
+            self._checkpoint(key, value)
+        return ring.data[slot]
+
+    def _checkpoint(self, key, value):
+        if self._diisfile is None:
+            self._diisfile = misc.H5TmpFile(self.filename, 'w')
+        if key in self._diisfile:
+            self._diisfile[key][:] = value
+        else:
+            self._diisfile[key] = value
 # to avoid "Unable to find a valid file signature" error when reload the hdf5
 # file from a crashed claculation
-            self._diisfile.flush()
+        self._diisfile.flush()
+
+    def _update_H(self, slot, nd):
+        '''Fill the row of the overlap matrix which belongs to the error vector
+        in slot. The other elements of H are kept from the previous
+        iterations. One GEMV pass over the stored error vectors.'''
+        edat = self._ebuf.data
+        dt = edat[slot]
+        row = numpy.zeros(nd, dtype=edat.dtype)
+        for p0, p1 in misc.prange(0, dt.size, BLOCK_SIZE):
+            row += numpy.dot(edat[:nd,p0:p1], dt[p0:p1].conj())
+
+        if self._H is None:
+            space = max(self.space, nd)
+            self._H = numpy.zeros((space+1,space+1), row.dtype)
+            self._H[0,1:] = self._H[1:,0] = 1
+        elif self._H.dtype != numpy.result_type(self._H, row):
+            self._H = self._H.astype(numpy.result_type(self._H, row))
+        self._H[slot+1,1:nd+1] = row
+        self._H[1:nd+1,slot+1] = row.conj()
 
     def push_err_vec(self, xerr):
         self._err_vec_touched = True
@@ -144,6 +184,8 @@ class DIIS(object):
             self._head = 0
         key = 'e%d' % self._head
         self._store(key, xerr.ravel())
+        nd = min(len(self._bookkeep)+1, self.space)
+        self._update_H(self._head, nd)
 
     def push_vec(self, x):
         x = x.ravel()
@@ -161,10 +203,7 @@ class DIIS(object):
             # If push_err_vec is not called in advance, the error vector is generated
             # as the diff of the current vec and previous returned vec (._xprev)
             # So store the first trial vec as the previous returned vec
-            self._xprev = x
-            self._store('xprev', x)
-            if 'xprev' not in self._buffer:  # not incore
-                self._xprev = self._diisfile['xprev']
+            self._xprev = self._store('xprev', x)
 
         else:
             if self._head >= self.space:
@@ -173,28 +212,24 @@ class DIIS(object):
             ekey = 'e%d'%self._head
             xkey = 'x%d'%self._head
             self._store(xkey, x)
-            if x.size < INCORE_SIZE or self.incore:
-                self._store(ekey, x - numpy.asarray(self._xprev))
-            else:  # not call _store to reduce memory footprint
-                if ekey not in self._diisfile:
-                    self._diisfile.create_dataset(ekey, (x.size,), x.dtype)
-                edat = self._diisfile[ekey]
-                for p0, p1 in misc.prange(0, x.size, BLOCK_SIZE):
-                    edat[p0:p1] = x[p0:p1] - self._xprev[p0:p1]
-                self._diisfile.flush()
+            # Write the difference into the slot directly to avoid the
+            # temporary array of the full vector size
+            ering, slot = self._ring(ekey, x)
+            ering.reserve(x.dtype)
+            edat = ering.data[slot]
+            for p0, p1 in misc.prange(0, x.size, BLOCK_SIZE):
+                edat[p0:p1] = x[p0:p1] - self._xprev[p0:p1]
+            ering.flush()
+            if isinstance(self.filename, str):
+                self._checkpoint(ekey, edat)
+            self._update_H(self._head, len(self._bookkeep))
             self._head += 1
 
     def get_err_vec(self, idx):
-        if self._buffer:
-            return self._buffer['e%d'%idx]
-        else:
-            return self._diisfile['e%d'%idx]
+        return self._ebuf.data[idx]
 
     def get_vec(self, idx):
-        if self._buffer:
-            return self._buffer['x%d'%idx]
-        else:
-            return self._diisfile['x%d'%idx]
+        return self._xbuf.data[idx]
 
     def get_num_vec(self):
         return len(self._bookkeep)
@@ -217,28 +252,12 @@ class DIIS(object):
         if nd < self.min_space:
             return x
 
-        dt = numpy.array(self.get_err_vec(self._head-1), copy=False)
-        if self._H is None:
-            self._H = numpy.zeros((self.space+1,self.space+1), dt.dtype)
-            self._H[0,1:] = self._H[1:,0] = 1
-        for i in range(nd):
-            tmp = 0
-            dti = self.get_err_vec(i)
-            for p0, p1 in misc.prange(0, dt.size, BLOCK_SIZE):
-                tmp += numpy.dot(dt[p0:p1].conj(), dti[p0:p1])
-            self._H[self._head,i+1] = tmp
-            self._H[i+1,self._head] = tmp.conjugate()
-        dt = None
-
         if self._xprev is None:
             xnew = self.extrapolate(nd)
         else:
             self._xprev = None # release memory first
-            self._xprev = xnew = self.extrapolate(nd)
-
-            self._store('xprev', xnew)
-            if 'xprev' not in self._buffer:  # not incore
-                self._xprev = self._diisfile['xprev']
+            xnew = self.extrapolate(nd)
+            self._xprev = self._store('xprev', xnew)
         return xnew.reshape(x.shape)
 
     def extrapolate(self, nd=None):
@@ -264,13 +283,11 @@ class DIIS(object):
                 raise e
         logger.debug1(self, 'diis-c %s', c)
 
-        xnew = None
-        for i, ci in enumerate(c[1:]):
-            xi = self.get_vec(i)
-            if xnew is None:
-                xnew = numpy.zeros(xi.size, c.dtype)
-            for p0, p1 in misc.prange(0, xi.size, BLOCK_SIZE):
-                xnew[p0:p1] += xi[p0:p1] * ci
+        # xnew = sum_i c_i x_i in one GEMV pass over the stored vectors
+        xdat = self._xbuf.data
+        xnew = numpy.empty(xdat.shape[1], numpy.result_type(c, xdat))
+        for p0, p1 in misc.prange(0, xnew.size, BLOCK_SIZE):
+            numpy.dot(c[1:], xdat[:nd,p0:p1], out=xnew[p0:p1])
         return xnew
 
     def restore(self, filename, inplace=True):
@@ -291,50 +308,66 @@ class DIIS(object):
         if nd == 0:
             return self
 
-        if inplace:
-            if fdiis[x_keys[0]].size < INCORE_SIZE or self.incore:
-                for key in diis_keys:
-                    self._buffer[key] = numpy.asarray(fdiis[key])
-
-            if 'xprev' in diis_keys:
-                self._xprev = fdiis['xprev']
-
-        else:
+        self.space = max(nd, self.space)
+        self._xbuf = self._ebuf = None
+        for key in diis_keys:
+            if key == 'xprev' or int(key[1:]) < nd:
+                ring, slot = self._ring(key, fdiis[key])
+                ring.reserve(fdiis[key].dtype)
+                fdiis[key].read_direct(ring.data[slot])
+        if not inplace and isinstance(self.filename, str):
             for key in diis_keys:
-                self._store(key, fdiis[key][()])
-
-            if 'xprev' in diis_keys:
-                self._store('xprev', numpy.asarray(fdiis['xprev']))
-                if 'xprev' in self._buffer:  # incore
-                    self._xprev = self._buffer['xprev']
-                else:
-                    self._xprev = self._diisfile['xprev']
+                self._checkpoint(key, fdiis[key][()])
+        if 'xprev' in diis_keys:
+            self._xprev = self._xbuf.data[-1]
 
         self._bookkeep = list(range(nd))
         self._head = nd
-        vecsize = 0
-
-        e_mat = []
+        self._H = None
         for i in range(nd):
-            dti = numpy.asarray(self.get_err_vec(i))
-            vecsize = dti.size
-            for j in range(i+1):
-                dtj = self.get_err_vec(j)
-                assert(dtj.size == vecsize)
-                tmp = 0
-                for p0, p1 in misc.prange(0, vecsize, BLOCK_SIZE):
-                    tmp += numpy.dot(dti[p0:p1].conj(), dtj[p0:p1])
-                e_mat.append(tmp)
-            dti = dtj = None
-        e_mat = numpy_helper.unpack_tril(e_mat)
-
-        space = max(nd, self.space)
-        self._H = numpy.zeros((space+1,space+1), e_mat.dtype)
-        self._H[0,1:] = self._H[1:,0] = 1
-        self._H[1:nd+1,1:nd+1] = e_mat
+            self._update_H(i, i+1)
         return self
 
 
+class _RingBuffer(object):
+    '''Fixed number of slots of the same length. Slots are overwritten in
+    place. Large buffers are memory-mapped to a scratch file in TMPDIR.'''
+    def __init__(self, nslot, size, dtype, incore=True):
+        self.nslot = nslot
+        self.incore = incore
+        self._swapfile = None
+        self.data = self._allocate(nslot, size, dtype)
+
+    def _allocate(self, nslot, size, dtype):
+        if self.incore:
+            return numpy.zeros((nslot,size), dtype)
+        else:
+            self._swapfile = tempfile.NamedTemporaryFile(dir=param.TMPDIR)
+            return numpy.memmap(self._swapfile, dtype=dtype, mode='w+',
+                                shape=(nslot,size))
+
+    def reserve(self, dtype):
+        '''Promote the storage (e.g. real to complex) if needed'''
+        dtype = numpy.result_type(self.data.dtype, dtype)
+        if dtype != self.data.dtype:
+            old, swapfile = self.data, self._swapfile
+            self.data = self._allocate(self.nslot, old.shape[1], dtype)
+            for i in range(self.nslot):
+                self.data[i] = old[i]
+            old = swapfile = None
+
+    def put(self, slot, value):
+        self.reserve(value.dtype)
+        dat = self.data[slot]
+        for p0, p1 in misc.prange(0, dat.size, BLOCK_SIZE):
+            dat[p0:p1] = value[p0:p1]
+        self.flush()
+
+    def flush(self):
+        if not self.incore:
+            self.data.flush()
+
+
 def restore(filename):
     '''Restore/construct diis object based on a diis file'''
     return DIIS().restore(filename)
@@ -26,6 +26,20 @@ import pyscf.df
 from . import _vhf
 from . import _pbcintor
 from pyscf.pbc.lib.kpts_helper import is_zero, gamma_point, unique, KPT_DIFF_TOL
+from pyscf import __config__
+
+# Restrict the lattice sum of each shell pair to the images within its
+# overlap range (see _pbcintor.PBCOpt.init_pair_images)
+PAIR_IMAGES = getattr(__config__, 'pbc_df_incore_pair_images', True)
+# Evaluate the far-field part of the int3c2e and int2c2e lattice sums from
+# the multipoles of the charge distributions (see _pbcintor.PBCOpt.init_multipole).
+# Each far-field integral is accurate to cell.precision relative to the sum of
+# the magnitudes of its multipole terms, for any angular momentum (see
+# _pbcintor.multipole_rr_near). The absolute error is below cell.precision
+# only where these terms (moment products over distance^{n+1}) are <= 1,
+# diffuse shells of large norm exceed it. Opt-in, as the other lattice sums
+# are truncated on absolute integral values.
+MULTIPOLE = getattr(__config__, 'pbc_df_incore_multipole', False)
 
 libpbc = load_library('libpbc0')
 
@@ -187,21 +201,51 @@ def aux_e2(cell, auxcell_or_auxbasis, intor='int3c2e', aosym='s1', comp=None,
         out = out[0]
     return out
 
-def wrap_int3c(cell, auxcell, intor='int3c2e', aosym='s1', comp=1,
-               kptij_lst=numpy.zeros((1,2,3)), cintopt=None, pbcopt=None):
-    intor = cell._add_suffix(intor)
+def _conc_int3c_env(cell, auxcell):
+    '''The (cell, cell, auxcell) environment used by the 3-center lattice sum'''
     pcell = copy.copy(cell)
     pcell._atm, pcell._bas, pcell._env = \
             atm, bas, env = gto.conc_env(cell._atm, cell._bas, cell._env,
                                          cell._atm, cell._bas, cell._env)
-    ao_loc = gto.moleintor.make_loc(bas, intor)
+    atm, bas, env = gto.conc_env(atm, bas, env,
+                                 auxcell._atm, auxcell._bas, auxcell._env)
+    return pcell, atm, bas, env
+
+def make_int3c_opt(cell, auxcell, intor='int3c2e'):
+    '''Integral optimizer and PBC rcut screening for wrap_int3c. Both only
+    depend on the basis sets and not on the atomic positions.'''
+    intor = cell._add_suffix(intor)
+    pcell, atm, bas, env = _conc_int3c_env(cell, auxcell)
+    if cell.nbas > 0:
+        cintopt = _vhf.make_cintopt(atm, bas, env, intor)
+    else:
+        cintopt = pyscf.lib.c_null_ptr()
+# Remove the precomputed pair data because the pair data corresponds to the
+# integral of cell #0 while the lattice sum moves shls to all repeated images.
+    if intor[:3] != 'ECP':
+        libpbc.CINTdel_pairdata_optimizer(cintopt)
+    pbcopt = _pbcintor.PBCOpt(pcell).init_rcut_cond(pcell)
+    return cintopt, pbcopt
+
+def wrap_int3c(cell, auxcell, intor='int3c2e', aosym='s1', comp=1,
+               kptij_lst=numpy.zeros((1,2,3)), cintopt=None, pbcopt=None,
+               Ls=None, pair_mask=None):
+    '''
+    Kwargs:
+        pair_mask : (nbas,nbas) bool array
+            If given, only the shell pairs with pair_mask[ish,jsh] == True
+            are computed. The AO-pair columns of the other shell pairs in
+            the output array are not touched.
+    '''
+    intor = cell._add_suffix(intor)
+    pcell, atm, bas, env = _conc_int3c_env(cell, auxcell)
+    ao_loc = gto.moleintor.make_loc(pcell._bas, intor)
     aux_loc = auxcell.ao_loc_nr(auxcell.cart or 'ssc' in intor)
     ao_loc = numpy.asarray(numpy.hstack([ao_loc, ao_loc[-1]+aux_loc[1:]]),
                            dtype=numpy.int32)
-    atm, bas, env = gto.conc_env(atm, bas, env,
-                                 auxcell._atm, auxcell._bas, auxcell._env)
-    rcut = max(cell.rcut, auxcell.rcut)
-    Ls = get_lattice_Ls(cell, rcut=rcut)
+    if Ls is None:
+        rcut = max(cell.rcut, auxcell.rcut)
+        Ls = get_lattice_Ls(cell, rcut=rcut)
     nimgs = len(Ls)
     nbas = cell.nbas
 
@@ -230,20 +274,28 @@ def wrap_int3c(cell, auxcell, intor='int3c2e', aosym='s1', comp=1,
     fill = 'PBCnr3c_fill_%s%s' % (kk_type, aosym[:2])
     drv = libpbc.PBCnr3c_drv
     if cintopt is None:
-        if nbas > 0:
-            cintopt = _vhf.make_cintopt(atm, bas, env, intor)
-        else:
-            cintopt = lib.c_null_ptr()
-# Remove the precomputed pair data because the pair data corresponds to the
-# integral of cell #0 while the lattice sum moves shls to all repeated images.
-        if intor[:3] != 'ECP':
-            libpbc.CINTdel_pairdata_optimizer(cintopt)
-    if pbcopt is None:
+        cintopt, pbcopt0 = make_int3c_opt(cell, auxcell, intor)
+        if pbcopt is None:
+            pbcopt = pbcopt0
+    elif pbcopt is None:
         pbcopt = _pbcintor.PBCOpt(pcell).init_rcut_cond(pcell)
     if isinstance(pbcopt, _pbcintor.PBCOpt):
+        if PAIR_IMAGES and cell.dimension > 0:
+            pbcopt.init_pair_images(cell, Ls)
+        if (MULTIPOLE and cell.dimension > 0 and comp == 1 and
+                intor in ('int3c2e_sph', 'int3c2e_cart')):
+            mcell = copy.copy(pcell)
+            mcell._atm, mcell._bas, mcell._env = atm, bas, env
+            pbcopt.init_multipole(mcell, cell.precision, intor.endswith('_cart'))
+        else:
+            pbcopt.del_multipole()
+        if pair_mask is not None:
+            pbcopt.init_pair_mask(pair_mask)
+        else:
+            pbcopt.del_pair_mask()
         cpbcopt = pbcopt._this
     else:
-        cpbcopt = lib.c_null_ptr()
+        cpbcopt = pyscf.lib.c_null_ptr()
 
     def int3c(shls_slice, out):
         shls_slice = (shls_slice[0], shls_slice[1],
@@ -280,3 +332,86 @@ def fill_2c2e(cell, auxcell_or_auxbasis, intor='int2c2e', hermi=0, kpt=numpy.zer
 # summation.  Pass NULL pointer to pbcopt to prevent the prescreening
     return auxcell.pbc_intor(intor, 1, hermi, kpt, pbcopt=lib.c_null_ptr())
 
+
+
+def lattice_int2c(cell, intor='int1e_ovlp', hermi=0, kpts=numpy.zeros((1,3)),
+                  comp=None, Ls=None):
+    '''Lattice-summed 2-center integrals \\sum_L <i|O|j(L)> exp(ikL) of all
+    k-points, computed in one sweep over the images. For hermi != 0, only the
+    lower triangles are computed and the upper triangles are filled in C.
+
+    Returns:
+        A list of [comp,nao,nao] arrays (comp axis dropped if comp == 1) for
+        kpts, or a single array if kpts is one k-point of shape (3,). The
+        integrals of gamma point are real.
+    '''
+    return lattice_int2c_multi(cell, (intor,), hermi, kpts, (comp,), Ls)[0]
+
+def lattice_int2c_multi(cell, intors=('int1e_ovlp', 'int1e_kin'), hermi=0,
+                        kpts=numpy.zeros((1,3)), comps=None, Ls=None):
+    '''lattice_int2c for several operators. The integrals of all operators
+    are evaluated in the same sweep over shell pairs and images, sharing the
+    basis shifts and the exp(ikL) contractions.
+
+    Returns:
+        A list with the lattice_int2c result of each operator in intors.
+    '''
+    if comps is None:
+        comps = [None] * len(intors)
+    intors, comps = zip(*[gto.moleintor._get_intor_and_comp(cell._add_suffix(i), c)
+                          for i, c in zip(intors, comps)])
+    nop = len(intors)
+    kpts_lst = numpy.reshape(kpts, (-1,3))
+    nkpts = len(kpts_lst)
+    pcell = copy.copy(cell)
+    pcell._atm, pcell._bas, pcell._env = atm, bas, env = \
+            gto.conc_env(cell._atm, cell._bas, cell._env,
+                         cell._atm, cell._bas, cell._env)
+    ao_loc = gto.moleintor.make_loc(bas, intors[0])
+    nbas = cell.nbas
+    shls_slice = (0, nbas, nbas, nbas*2)
+    nao = ao_loc[nbas]
+    if Ls is None:
+        Ls = get_lattice_Ls(cell, rcut=cell.rcut)
+    expkL = numpy.asarray(numpy.exp(1j*numpy.dot(kpts_lst, Ls.T)), order='C')
+    out = numpy.empty((nkpts,sum(comps),nao,nao), dtype=numpy.complex128)
+    cintopts = [_vhf.make_cintopt(atm, bas, env, i) for i in intors]
+
+    if (MULTIPOLE and cell.dimension > 0 and nop == 1 and
+        intors[0] in ('int2c2e_sph', 'int2c2e_cart')):
+        pbcopt = _pbcintor.PBCOpt(pcell).init_multipole(
+            pcell, cell.precision, intors[0].endswith('_cart'))
+        cpbcopt = pbcopt._this
+    else:
+        cpbcopt = pyscf.lib.c_null_ptr()
+
+    c_intors = (ctypes.c_void_p*nop)(*[ctypes.cast(getattr(libpbc, i), ctypes.c_void_p)
+                                       for i in intors])
+    c_cintopts = (ctypes.c_void_p*nop)(*[ctypes.cast(opt, ctypes.c_void_p)
+                                         for opt in cintopts])
+    libpbc.PBCnr2c_multi_drv(
+        c_intors, (ctypes.c_int*nop)(*comps), ctypes.c_int(nop), ctypes.c_int(hermi),
+        out.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(nkpts), ctypes.c_int(len(Ls)),
+        Ls.ctypes.data_as(ctypes.c_void_p),
+        expkL.ctypes.data_as(ctypes.c_void_p), (ctypes.c_int*4)(*shls_slice),
+        ao_loc.ctypes.data_as(ctypes.c_void_p), c_cintopts, cpbcopt,
+        atm.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(pcell.natm),
+        bas.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(pcell.nbas),
+        env.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(env.size))
+
+    mats = []
+    c0 = 0
+    for comp in comps:
+        mat = []
+        for k, kpt in enumerate(kpts_lst):
+            v = out[k,c0:c0+comp]
+            if comp == 1:
+                v = v[0]
+            if abs(kpt).sum() < 1e-9:  # gamma_point
+                v = v.real
+            mat.append(v)
+        if numpy.ndim(kpts) == 1:
+            mat = mat[0]
+        mats.append(mat)
+        c0 += comp
+    return mats
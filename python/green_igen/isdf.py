@@ -0,0 +1,358 @@
+#!/usr/bin/env python
+# Copyright 2014-2021 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+'''
+Interpolative separable density fitting (ISDF)
+
+The pair densities are interpolated on a small set of points {r_P}
+
+    phi_p^{k1}(r)^* phi_q^{k2}(r) ~= \\sum_P phi_p^{k1}(r_P)^* phi_q^{k2}(r_P) zeta_P^q(r)
+
+with q = k2 - k1, which gives the tensor hypercontraction form of the ERIs
+
+    (p k1, q k2|r k3, s k4) ~= \\sum_{PQ} X_{Pp}^{k1*} X_{Pq}^{k2} V_{PQ}^q X_{Qr}^{k3*} X_{Qs}^{k4}
+
+X^k are the AO values at the interpolation points. V^q is the Coulomb
+matrix of the interpolation functions zeta^q, evaluated with FFT on the
+uniform grids of the cell.
+
+Ref:
+J. Lu, L. Ying, J. Comput. Phys. 302, 329 (2015)
+K. Dong, W. Hu, L. Lin, J. Chem. Theory Comput. 14, 1311 (2018)
+'''
+
+import ctypes
+import numpy
+import scipy.linalg
+import h5py
+from pyscf import lib
+from pyscf.lib import logger
+from pyscf.pbc import tools
+from pyscf.pbc.lib.kpts_helper import unique_with_wrap_around
+from .misc import load_library
+from . import incore
+from pyscf import __config__
+
+libpbc = load_library('libpbc0')
+
+# Number of interpolation points per AO
+ISDF_C = getattr(__config__, 'pbc_df_isdf_ISDF_c', 10)
+# Eigenvalues of the fitting metric below LINDEP_THR * max are discarded
+LINDEP_THR = getattr(__config__, 'pbc_df_isdf_lindep', 1e-12)
+BLKSIZE = 104 * 16
+EXTRA_PREC = 1e-2
+
+def _shell_rcut(cell):
+    '''Radius of each shell where the AO values drop below cell.precision'''
+    log_prec = numpy.log(cell.precision * EXTRA_PREC)
+    rcut = []
+    for ib in range(cell.nbas):
+        l = cell.bas_angular(ib)
+        es = cell.bas_exp(ib)
+        cs = abs(cell.bas_ctr_coeff(ib)).max(axis=1)
+        r = 5.
+        r = (((l+2)*numpy.log(r)+numpy.log(cs) - log_prec) / es)**.5
+        r[r < 1.] = 1.
+        r = (((l+2)*numpy.log(r)+numpy.log(cs) - log_prec) / es)**.5
+        rcut.append(r.max())
+    return numpy.array(rcut)
+
+def eval_ao(cell, coords, kpts=numpy.zeros((1,3)), rcut=None, Ls=None):
+    '''Bloch AO values ao[nkpts,ngrids,nao] on coords with the lattice sum
+    of PBCGTOval_sph/PBCGTOval_cart'''
+    coords = numpy.asarray(coords, order='F')
+    ngrids = coords.shape[0]
+    kpts = numpy.reshape(kpts, (-1,3))
+    nkpts = len(kpts)
+    if rcut is None:
+        rcut = _shell_rcut(cell)
+    if Ls is None:
+        Ls = incore.get_lattice_Ls(cell, rcut=rcut.max())
+        Ls = numpy.asarray(Ls[numpy.argsort(lib.norm(Ls, axis=1))], order='C')
+    expLk = numpy.asarray(numpy.exp(1j * numpy.dot(Ls, kpts.T)), order='C')
+    ao_loc = cell.ao_loc_nr()
+    nao = ao_loc[-1]
+    nblk = (ngrids + 103) // 104
+    non0tab = numpy.empty((nblk,cell.nbas), dtype=numpy.uint8)
+    non0tab[:] = 0xff
+
+    if cell.cart:
+        drv = libpbc.PBCGTOval_cart_deriv0
+    else:
+        drv = libpbc.PBCGTOval_sph_deriv0
+    ao = numpy.empty((nkpts,nao,ngrids), dtype=numpy.complex128)
+    drv(ctypes.c_int(ngrids), (ctypes.c_int*2)(0, cell.nbas),
+        ao_loc.ctypes.data_as(ctypes.c_void_p),
+        Ls.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(Ls)),
+        expLk.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(nkpts),
+        ao.ctypes.data_as(ctypes.c_void_p), coords.ctypes.data_as(ctypes.c_void_p),
+        rcut.ctypes.data_as(ctypes.c_void_p), non0tab.ctypes.data_as(ctypes.c_void_p),
+        cell._atm.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(cell.natm),
+        cell._bas.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(cell.nbas),
+        cell._env.ctypes.data_as(ctypes.c_void_p))
+    return ao.transpose(0,2,1)
+
+def select_points_qr(cell, coords, kpts, npoints, oversample=2., seed=1,
+                     max_memory=None, verbose=None):
+    '''Interpolation points by the column pivoted QR decomposition of a
+    randomly sketched product-density matrix
+
+        M_{(a,b),r} = (\\sum_k phi^k(r) G_k)_a^* (\\sum_k phi^k(r) H_k)_b
+
+    with Gaussian random matrices G_k, H_k. Returns the indices of the
+    selected grids.
+
+    If M does not fit in max_memory, the grids are processed in blocks
+    (tournament pivoting): the points selected so far compete with the next
+    block of grids in the QR of their combined columns.
+    '''
+    log = logger.new_logger(cell, verbose)
+    if max_memory is None:
+        max_memory = cell.max_memory
+    kpts = numpy.reshape(kpts, (-1,3))
+    nao = cell.nao_nr()
+    m = int(numpy.ceil((npoints * oversample)**.5))
+    rng = numpy.random.RandomState(seed)
+    G = rng.randn(len(kpts), nao, m) + rng.randn(len(kpts), nao, m) * 1j
+    H = rng.randn(len(kpts), nao, m) + rng.randn(len(kpts), nao, m) * 1j
+    ngrids = len(coords)
+
+    def sketch(p0, p1):
+        mat = numpy.empty((m*m, p1-p0), dtype=numpy.complex128)
+        for q0, q1 in lib.prange(p0, p1, BLKSIZE):
+            ao = eval_ao(cell, coords[q0:q1], kpts)
+            a = numpy.einsum('kgp,kpa->ga', ao, G)
+            b = numpy.einsum('kgp,kpb->gb', ao, H)
+            mat[:,q0-p0:q1-p0] = (a.conj()[:,:,None] * b[:,None,:]).reshape(q1-q0, m*m).T
+        return mat
+
+    # mat and the copy made by the QR
+    mem_avail = max(500, max_memory - lib.current_memory()[0])
+    ncol = int(mem_avail*.4e6/16/(m*m*2))
+    if ncol >= ngrids:
+        piv = scipy.linalg.qr(sketch(0, ngrids), mode='r', pivoting=True)[1]
+        idx = piv[:npoints]
+    elif ncol >= npoints + BLKSIZE:
+        blksize = ncol - npoints
+        log.debug('ISDF QR: %d blocks of %d grids',
+                  (ngrids + blksize - 1) // blksize, blksize)
+        idx = numpy.zeros(0, dtype=int)
+        cand = numpy.zeros((m*m,0), dtype=numpy.complex128)
+        for p0, p1 in lib.prange(0, ngrids, blksize):
+            mat = numpy.hstack([cand, sketch(p0, p1)])
+            grids = numpy.append(idx, numpy.arange(p0, p1))
+            piv = scipy.linalg.qr(mat, mode='r', pivoting=True)[1][:npoints]
+            idx = grids[piv]
+            cand = mat[:,piv]
+            mat = None
+    else:
+        raise MemoryError('ISDF QR selection needs %.0f MB for %d points. '
+                          'Increase max_memory or use method="kmeans"'
+                          % ((npoints+BLKSIZE)*m*m*2*16/.4e6, npoints))
+    log.debug('ISDF QR: %d points from %d grids', npoints, ngrids)
+    return numpy.sort(idx)
+
+def select_points_kmeans(cell, coords, kpts, npoints, max_cycle=100, tol=1e-6,
+                         seed=1, verbose=None):
+    '''Interpolation points by the k-means clustering of the grids weighted
+    by the AO density \\sum_{k,p} |phi_p^k(r)|^2. The centroids are moved to
+    the nearest grids. Returns the indices of the selected grids.
+    '''
+    log = logger.new_logger(cell, verbose)
+    ngrids = len(coords)
+    weight = numpy.empty(ngrids)
+    for p0, p1 in lib.prange(0, ngrids, BLKSIZE):
+        ao = eval_ao(cell, coords[p0:p1], kpts)
+        weight[p0:p1] = numpy.einsum('kgp,kgp->g', ao.real, ao.real)
+        weight[p0:p1] += numpy.einsum('kgp,kgp->g', ao.imag, ao.imag)
+
+    rng = numpy.random.RandomState(seed)
+    prob = weight / weight.sum()
+    idx = rng.choice(ngrids, npoints, replace=False, p=prob)
+    centers = coords[idx].copy()
+    for cycle in range(max_cycle):
+        label = numpy.empty(ngrids, dtype=int)
+        for p0, p1 in lib.prange(0, ngrids, BLKSIZE):
+            d = lib.direct_sum('gx,px->gpx', coords[p0:p1], -centers)
+            label[p0:p1] = numpy.einsum('gpx,gpx->gp', d, d).argmin(axis=1)
+        wsum = numpy.bincount(label, weight, minlength=npoints)
+        new = numpy.empty_like(centers)
+        for x in range(3):
+            new[:,x] = numpy.bincount(label, weight*coords[:,x], minlength=npoints)
+        mask = wsum > 0
+        new[mask] /= wsum[mask,None]
+        new[~mask] = centers[~mask]
+        shift = abs(new - centers).max()
+        centers = new
+        log.debug1('ISDF k-means cycle %d  max shift %g', cycle, shift)
+        if shift < tol:
+            break
+
+    idx = numpy.empty(npoints, dtype=int)
+    for p0, p1 in lib.prange(0, npoints, BLKSIZE):
+        d = lib.direct_sum('px,gx->pgx', centers[p0:p1], -coords)
+        idx[p0:p1] = numpy.einsum('pgx,pgx->pg', d, d).argmin(axis=1)
+    idx = numpy.unique(idx)
+    log.debug('ISDF k-means: %d points from %d grids', len(idx), ngrids)
+    return idx
+
+def _kpt_pairs(cell, kpts):
+    '''Group the k-point pairs (k1,k2) by the momentum transfer q = k2 - k1'''
+    nkpts = len(kpts)
+    kpt_ji = (kpts[None,:,:] - kpts[:,None,:]).reshape(-1,3)
+    uniq_q, uniq_index, uniq_inverse = unique_with_wrap_around(cell, kpt_ji)
+    pairs = [numpy.argwhere(uniq_inverse.reshape(nkpts,nkpts) == iq)
+             for iq in range(len(uniq_q))]
+    return uniq_q, uniq_inverse.reshape(nkpts,nkpts), pairs
+
+class ISDF(lib.StreamObject):
+    '''Interpolative separable density fitting of the ERIs for k-points
+
+    Attributes:
+        npoints : int
+            Number of interpolation points. Default is ISDF_C * nao.
+        method : str
+            'kmeans' or 'qr' for the selection of the interpolation points.
+        mesh : the uniform grids of zeta and the FFT
+
+    Saved results:
+        ip_coords : (npoints,3) interpolation points
+        X : (nkpts,npoints,nao) AO values at the interpolation points
+        V : (nq,npoints,npoints) Coulomb matrices of zeta^q
+        qpts : (nq,3) momentum transfers, q_index[k1,k2] is the q of (k1,k2)
+    '''
+    def __init__(self, cell, kpts=numpy.zeros((1,3))):
+        self.cell = cell
+        self.stdout = cell.stdout
+        self.verbose = cell.verbose
+        self.max_memory = cell.max_memory
+        self.kpts = numpy.reshape(kpts, (-1,3))
+        self.mesh = cell.mesh
+        self.npoints = None
+        self.method = getattr(__config__, 'pbc_df_isdf_ISDF_method', 'kmeans')
+        self.lindep = LINDEP_THR
+
+        self.ip_coords = None
+        self.X = None
+        self.V = None
+        self.qpts = None
+        self.q_index = None
+        self._keys = set(self.__dict__.keys())
+
+    def dump_flags(self, verbose=None):
+        log = logger.new_logger(self, verbose)
+        log.info('\n')
+        log.info('******** %s ********', self.__class__)
+        log.info('mesh = %s (%d PWs)', self.mesh, numpy.prod(self.mesh))
+        log.info('npoints = %s  method = %s', self.npoints, self.method)
+        log.info('len(kpts) = %d', len(self.kpts))
+        return self
+
+    def build(self):
+        log = logger.new_logger(self)
+        t0 = t1 = (logger.process_clock(), logger.perf_counter())
+        cell = self.cell
+        kpts = self.kpts
+        nkpts = len(kpts)
+        nao = cell.nao_nr()
+        if self.npoints is None:
+            self.npoints = ISDF_C * nao
+        self.dump_flags()
+
+        mesh = numpy.asarray(self.mesh)
+        coords = cell.gen_uniform_grids(mesh)
+        ngrids = len(coords)
+        npoints = min(self.npoints, ngrids)
+        if self.method == 'qr':
+            idx = select_points_qr(cell, coords, kpts, npoints,
+                                   max_memory=self.max_memory, verbose=log)
+        else:
+            idx = select_points_kmeans(cell, coords, kpts, npoints, verbose=log)
+        npoints = len(idx)
+        self.ip_coords = coords[idx]
+        self.X = X = numpy.asarray(eval_ao(cell, self.ip_coords, kpts), order='C')
+        t1 = log.timer_debug1('ISDF interpolation points', *t1)
+
+        # G^k_{PQ} = \sum_p X_{Pp}^{k*} X_{Qp}^k
+        G = numpy.asarray([lib.dot(x.conj(), x.T) for x in X])
+
+        self.qpts, self.q_index, pairs = _kpt_pairs(cell, kpts)
+        nq = len(self.qpts)
+        self.V = numpy.empty((nq,npoints,npoints), dtype=numpy.complex128)
+        mem_avail = max(500, self.max_memory - lib.current_memory()[0])
+        blksize = int(mem_avail*.2e6/16/(nkpts*nao + npoints*2))
+        blksize = max(BLKSIZE, min(blksize, ngrids))
+        for iq, q in enumerate(self.qpts):
+            k1, k2 = pairs[iq].T
+            # Least-squares metric C^H C = \sum_{k1} G^{k1*} o G^{k2}
+            metric = numpy.einsum('kpq,kpq->pq', G[k1].conj(), G[k2])
+            w, v = scipy.linalg.eigh(metric)
+            mask = w > w[-1] * self.lindep
+            log.debug1('q = %s  metric rank %d / %d', q, mask.sum(), npoints)
+            metric_inv = lib.dot(v[:,mask] / w[mask], v[:,mask].conj().T)
+
+            zeta = numpy.empty((npoints,ngrids), dtype=numpy.complex128)
+            for p0, p1 in lib.prange(0, ngrids, blksize):
+                ao = eval_ao(cell, coords[p0:p1], kpts)
+                # H^k_{P,r} = \sum_p X_{Pp}^{k*} phi_p^k(r)
+                rhs = 0
+                for i, j in zip(k1, k2):
+                    rhs += lib.dot(X[i].conj(), ao[i].T).conj() * lib.dot(X[j].conj(), ao[j].T)
+                zeta[:,p0:p1] = lib.dot(metric_inv, rhs)
+                ao = rhs = None
+
+            # zeta^q(r) = exp(iqr) u(r). V_PQ = Omega/N^2 \sum_G u_P(G) v(G+q) u_Q(G)^*
+            phase = numpy.exp(-1j * numpy.dot(coords, q))
+            coulG = tools.get_coulG(cell, q, mesh=mesh)
+            for p0, p1 in lib.prange(0, npoints, 64):
+                zeta[p0:p1] = tools.fft(zeta[p0:p1] * phase, mesh)
+            fac = cell.vol / ngrids**2
+            self.V[iq] = lib.dot(zeta * coulG, zeta.conj().T) * fac
+            zeta = None
+            t1 = log.timer_debug1('ISDF q = %s' % q, *t1)
+        log.timer('ISDF build', *t0)
+        return self
+
+    def get_eri(self, kpts4):
+        '''(pq|rs) of the k-point quartet kpts4 = (k1,k2,k3,k4) from the ISDF
+        factors, for checks and small systems'''
+        k1, k2, k3, k4 = [numpy.where(abs(self.kpts - k).sum(axis=1) < 1e-9)[0][0]
+                          for k in kpts4]
+        V = self.V[self.q_index[k1,k2]]
+        X = self.X
+        rho_pq = numpy.einsum('Pp,Pq->Ppq', X[k1].conj(), X[k2])
+        rho_rs = numpy.einsum('Qr,Qs->Qrs', X[k3].conj(), X[k4])
+        return numpy.einsum('Ppq,PQ,Qrs->pqrs', rho_pq, V, rho_rs)
+
+    def save(self, filename):
+        with h5py.File(filename, 'w') as f:
+            f['ip_coords'] = self.ip_coords
+            f['kpts'] = self.kpts
+            f['X'] = self.X
+            f['V'] = self.V
+            f['qpts'] = self.qpts
+            f['q_index'] = self.q_index
+        return self
+
+    def load(self, filename):
+        with h5py.File(filename, 'r') as f:
+            self.ip_coords = f['ip_coords'][()]
+            self.kpts = f['kpts'][()]
+            self.X = f['X'][()]
+            self.V = f['V'][()]
+            self.qpts = f['qpts'][()]
+            self.q_index = f['q_index'][()]
+        return self
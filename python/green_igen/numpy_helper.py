@@ -25,9 +25,11 @@ import ctypes
 import math
 import numpy
 from pyscf.lib import misc
+from .misc import load_library
 from numpy import asarray  # For backward compatibility
 
 EINSUM_MAX_SIZE = getattr(misc.__config__, 'lib_einsum_max_size', 2000)
+EINSUM_PLAN_CACHE_SIZE = getattr(misc.__config__, 'lib_einsum_plan_cache_size', 512)
 
 try:
     # Import tblis before libnp_helper to avoid potential dl-loading conflicts
@@ -37,6 +39,8 @@ except (ImportError, OSError):
     FOUND_TBLIS = False
 
 _np_helper = misc.load_library('libnp_helper')
+# NPdgemm_batch and NPzgemm_batch of src/npdot.c
+_np_batch = load_library('libpbc0')
 
 BLOCK_DIM = 192
 PLAIN = 0
@@ -115,111 +119,215 @@ def _contract(subscripts, *tensors, **kwargs):
         # tblis is slow for complex type
         return tblis_einsum.contract(idx_str, A, B, **kwargs)
 
-    indices  = idx_str.replace(',', '').replace('->', '')
-    if '->' not in idx_str or any(indices.count(x) != 2 for x in set(indices)):
+    if C_dtype != numpy.double and C_dtype != numpy.complex128:
         return _numpy_einsum(idx_str, A, B)
-
-    # Split the strings into a list of idx char's
-    idxA, idxBC = idx_str.split(',')
-    idxB, idxC = idxBC.split('->')
-    assert len(idxA) == A.ndim
-    assert len(idxB) == B.ndim
-
-    uniq_idxA = set(idxA)
-    uniq_idxB = set(idxB)
-    # Find the shared indices being summed over
-    shared_idxAB = uniq_idxA.intersection(uniq_idxB)
-
-    if ((not shared_idxAB) or  # Indices must overlap
-        # one operand is a subset of the other one (e.g. 'ijkl,jk->il')
-        uniq_idxA == shared_idxAB or uniq_idxB == shared_idxAB or
-        # repeated indices (e.g. 'iijk,kl->jl')
-        len(idxA) != len(uniq_idxA) or len(idxB) != len(uniq_idxB)):
-        return _numpy_einsum(idx_str, A, B)
-
-    DEBUG = kwargs.get('DEBUG', False)
-
-    if DEBUG:
+    if (A.dtype != C_dtype or
+        any(x < 0 or x % A.itemsize for x in A.strides)):
+        A = numpy.asarray(A, dtype=C_dtype, order='C')
+    if (B.dtype != C_dtype or
+        any(x < 0 or x % B.itemsize for x in B.strides)):
+        B = numpy.asarray(B, dtype=C_dtype, order='C')
+
+    key = (idx_str, A.shape, B.shape, A.strides, B.strides, C_dtype.char)
+    plan = _contract_plans.get(key)
+    if plan is None:
+        plan = _ContractPlan(idx_str, A, B)
+        if len(_contract_plans) >= EINSUM_PLAN_CACHE_SIZE:
+            _contract_plans.clear()
+        _contract_plans[key] = plan
+    if kwargs.get('DEBUG', False):
         print("*** Einsum for", idx_str)
-        print(" idxA =", idxA)
-        print(" idxB =", idxB)
-        print(" idxC =", idxC)
-
-    # Get the range for each index and put it in a dictionary
-    rangeA = dict(zip(idxA, A.shape))
-    rangeB = dict(zip(idxB, B.shape))
-    #rangeC = dict(zip(idxC, C.shape))
-    if DEBUG:
-        print("rangeA =", rangeA)
-        print("rangeB =", rangeB)
-
-    idxAt = list(idxA)
-    idxBt = list(idxB)
-    inner_shape = 1
-    insert_B_loc = 0
-    for n in shared_idxAB:
-        if rangeA[n] != rangeB[n]:
-            err = ('ERROR: In index string %s, the range of index %s is '
-                   'different in A (%d) and B (%d)' %
-                   (idx_str, n, rangeA[n], rangeB[n]))
-            raise ValueError(err)
-
-        # Bring idx all the way to the right for A
-        # and to the left (but preserve order) for B
-        idxA_n = idxAt.index(n)
-        idxAt.insert(len(idxAt)-1, idxAt.pop(idxA_n))
-
-        idxB_n = idxBt.index(n)
-        idxBt.insert(insert_B_loc, idxBt.pop(idxB_n))
-        insert_B_loc += 1
-
-        inner_shape *= rangeA[n]
-
-    if DEBUG:
-        print("shared_idxAB =", shared_idxAB)
-        print("inner_shape =", inner_shape)
-
-    # Transpose the tensors into the proper order and reshape into matrices
-    new_orderA = [idxA.index(idx) for idx in idxAt]
-    new_orderB = [idxB.index(idx) for idx in idxBt]
-
-    if DEBUG:
-        print("Transposing A as", new_orderA)
-        print("Transposing B as", new_orderB)
-        print("Reshaping A as (-1,", inner_shape, ")")
-        print("Reshaping B as (", inner_shape, ",-1)")
-
-    shapeCt = list()
-    idxCt = list()
-    for idx in idxAt:
-        if idx in shared_idxAB:
-            break
-        shapeCt.append(rangeA[idx])
-        idxCt.append(idx)
-    for idx in idxBt:
-        if idx in shared_idxAB:
-            continue
-        shapeCt.append(rangeB[idx])
-        idxCt.append(idx)
-    new_orderCt = [idxCt.index(idx) for idx in idxC]
-
-    if A.size == 0 or B.size == 0:
-        shapeCt = [shapeCt[i] for i in new_orderCt]
-        return numpy.zeros(shapeCt, dtype=C_dtype)
-
-    At = A.transpose(new_orderA)
-    Bt = B.transpose(new_orderB)
-
-    if At.flags.f_contiguous:
-        At = numpy.asarray(At.reshape(-1,inner_shape), order='F')
-    else:
-        At = numpy.asarray(At.reshape(-1,inner_shape), order='C')
-    if Bt.flags.f_contiguous:
-        Bt = numpy.asarray(Bt.reshape(inner_shape,-1), order='F')
-    else:
-        Bt = numpy.asarray(Bt.reshape(inner_shape,-1), order='C')
-
-    return dot(At,Bt).reshape(shapeCt, order='A').transpose(new_orderCt)
+        print(plan)
+    if plan.fallback:
+        return _numpy_einsum(idx_str, A, B)
+    return plan.run(A, B)
+
+# The plans of _contract, keyed by the subscripts and the shapes, strides and
+# dtype of the operands
+_contract_plans = {}
+
+def _merged_stride(idx, strides, ranges):
+    '''Stride of the indices idx merged into one dimension, None if they
+    cannot be merged without a copy. idx are ordered by descending strides.'''
+    for x, y in zip(idx[:-1], idx[1:]):
+        if strides[x] != strides[y] * ranges[y]:
+            return None
+    return strides[idx[-1]]
+
+def _matrix_layout(rows, cols, strides, ranges):
+    '''The GEMM operand of the view whose rows and cols indices are merged.
+    Returns (trans, ld) of the row-major matrix or None.'''
+    nrow = max(1, _prod([ranges[x] for x in rows]))
+    ncol = max(1, _prod([ranges[x] for x in cols]))
+    srow = scol = None
+    if rows:
+        srow = _merged_stride(rows, strides, ranges)
+        if srow is None:
+            return None
+    if cols:
+        scol = _merged_stride(cols, strides, ranges)
+        if scol is None:
+            return None
+    if scol in (None, 1) and (srow is None or srow >= ncol):
+        return 'N', (ncol if srow is None else srow)
+    if srow in (None, 1) and (scol is None or scol >= nrow):
+        return 'T', (nrow if scol is None else scol)
+    return None
+
+def _prod(x):
+    n = 1
+    for i in x:
+        n *= i
+    return n
+
+class _ContractPlan(object):
+    '''Transpose-GEMM-transpose plan of a pairwise contraction.
+
+    The indices are grouped into batch (in A, B and C), m (A and C), n (B and
+    C) and k (A and B). An operand is used in place if its m (n) and k
+    indices can be merged into a strided matrix with a unit stride. The order
+    of the k indices follows the strides of A or B, whichever leaves more
+    data in place; an operand that cannot be used in place is copied.
+    C is allocated as [batch,m,n] and returned as a transposed view. The
+    GEMMs of the batch are done by NPdgemm_batch or NPzgemm_batch.
+
+    The plan is made in Python, once per key of _contract_plans, from the
+    shapes and strides numpy already holds. Only run() is on the per-call
+    path: its copies are numpy transposes and its GEMMs are in npdot.c.
+    '''
+    def __init__(self, idx_str, A, B):
+        self.fallback = True
+        self.idx_str = idx_str
+        if '->' not in idx_str:
+            return
+        idxA, idxBC = idx_str.split(',')
+        idxB, idxC = idxBC.split('->')
+        assert len(idxA) == A.ndim
+        assert len(idxB) == B.ndim
+        setA, setB, setC = set(idxA), set(idxB), set(idxC)
+        if (len(setA) != len(idxA) or len(setB) != len(idxB) or
+            len(setC) != len(idxC) or
+            # an index summed in one operand or not in any operand
+            setA - setB - setC or setB - setA - setC or setC - setA - setB):
+            return
+
+        rangeA = dict(zip(idxA, A.shape))
+        rangeB = dict(zip(idxB, B.shape))
+        for n in setA.intersection(setB):
+            if rangeA[n] != rangeB[n]:
+                err = ('ERROR: In index string %s, the range of index %s is '
+                       'different in A (%d) and B (%d)' %
+                       (idx_str, n, rangeA[n], rangeB[n]))
+                raise ValueError(err)
+        ranges = dict(rangeA)
+        ranges.update(rangeB)
+        self.fallback = False
+
+        batch = [x for x in idxC if x in setA and x in setB]
+        m_idx = [x for x in idxA if x in setC and x not in setB]
+        n_idx = [x for x in idxB if x in setC and x not in setA]
+        k_idx = [x for x in idxA if x in setB and x not in setC]
+        stA = dict(zip(idxA, [x // A.itemsize for x in A.strides]))
+        stB = dict(zip(idxB, [x // B.itemsize for x in B.strides]))
+
+        # Indices of range 1 (or 0) do not change the layout
+        def by_stride(idx, strides):
+            return sorted([x for x in idx if ranges[x] > 1],
+                          key=lambda x: -strides[x])
+        m_ord = by_stride(m_idx, stA)
+        n_ord = by_stride(n_idx, stB)
+        candidates = []
+        for k_ord in (by_stride(k_idx, stA), by_stride(k_idx, stB)):
+            la = _matrix_layout(m_ord, k_ord, stA, ranges)
+            lb = _matrix_layout(k_ord, n_ord, stB, ranges)
+            copied = (la is None) * A.size + (lb is None) * B.size
+            candidates.append((copied, k_ord, la, lb))
+        copied, k_ord, la, lb = min(candidates, key=lambda x: x[0])
+
+        m_ord += [x for x in m_idx if ranges[x] <= 1]
+        n_ord += [x for x in n_idx if ranges[x] <= 1]
+        k_ord += [x for x in k_idx if ranges[x] <= 1]
+        self.M = max(1, _prod([ranges[x] for x in m_ord]))
+        self.N = max(1, _prod([ranges[x] for x in n_ord]))
+        self.K = max(1, _prod([ranges[x] for x in k_ord]))
+        if (self.M > 1) + (self.N > 1) + (self.K > 1) < 2:
+            # Element-wise products (e.g. 'ij,ij->ij') are not GEMMs
+            self.fallback = True
+            return
+
+        # Operands which are copied to [batch,m,k] and [batch,k,n]
+        self.permA = self.permB = None
+        if la is None:
+            self.permA = [idxA.index(x) for x in batch + m_ord + k_ord]
+            stA = dict(zip(batch + m_ord + k_ord,
+                           _c_strides([ranges[x] for x in batch + m_ord + k_ord])))
+            la = ('N', self.K)
+        if lb is None:
+            self.permB = [idxB.index(x) for x in batch + k_ord + n_ord]
+            stB = dict(zip(batch + k_ord + n_ord,
+                           _c_strides([ranges[x] for x in batch + k_ord + n_ord])))
+            lb = ('N', self.N)
+        (self.transA, self.lda), (self.transB, self.ldb) = la, lb
+
+        batch_shape = [ranges[x] for x in batch]
+        self.nbatch = _prod(batch_shape)
+        def offsets(strides):
+            off = numpy.zeros(batch_shape, dtype=numpy.uintp)
+            for i, x in enumerate(batch):
+                shape = [1] * len(batch)
+                shape[i] = ranges[x]
+                off = off + (numpy.arange(ranges[x], dtype=numpy.uintp)
+                             * strides[x]).reshape(shape)
+            return numpy.asarray(off.ravel(), order='C')
+        self.offA = offsets(stA)
+        self.offB = offsets(stB)
+        self.offC = numpy.arange(self.nbatch, dtype=numpy.uintp) * (self.M * self.N)
+
+        idxCt = batch + m_ord + n_ord
+        self.shapeCt = [ranges[x] for x in idxCt]
+        self.shapeC = [ranges[x] for x in idxC]
+        self.orderC = [idxCt.index(x) for x in idxC]
+
+    def __repr__(self):
+        if self.fallback:
+            return '_ContractPlan(%s): numpy.einsum' % self.idx_str
+        return ('_ContractPlan(%s): %d GEMMs (%s,%s) m=%d n=%d k=%d, copy A %s, '
+                'copy B %s' % (self.idx_str, self.nbatch, self.transA, self.transB,
+                               self.M, self.N, self.K, self.permA, self.permB))
+
+    def run(self, A, B):
+        if A.size == 0 or B.size == 0:
+            return numpy.zeros(self.shapeC, dtype=A.dtype)
+        if self.permA is not None:
+            A = numpy.asarray(A.transpose(self.permA), order='C')
+        if self.permB is not None:
+            B = numpy.asarray(B.transpose(self.permB), order='C')
+        C = numpy.empty(self.shapeCt, dtype=A.dtype)
+
+        # C^T = B^T A^T in the column-major GEMM
+        args = (ctypes.c_char(self.transB.encode('ascii')),
+                ctypes.c_char(self.transA.encode('ascii')),
+                ctypes.c_int(self.N), ctypes.c_int(self.M), ctypes.c_int(self.K),
+                ctypes.c_int(self.ldb), ctypes.c_int(self.lda),
+                ctypes.c_int(self.N), ctypes.c_int(self.nbatch),
+                self.offB.ctypes.data_as(ctypes.c_void_p),
+                self.offA.ctypes.data_as(ctypes.c_void_p),
+                self.offC.ctypes.data_as(ctypes.c_void_p),
+                B.ctypes.data_as(ctypes.c_void_p),
+                A.ctypes.data_as(ctypes.c_void_p),
+                C.ctypes.data_as(ctypes.c_void_p))
+        if A.dtype == numpy.double:
+            _np_batch.NPdgemm_batch(*args, ctypes.c_double(1), ctypes.c_double(0))
+        else:
+            _np_batch.NPzgemm_batch(*args, (ctypes.c_double*2)(1, 0),
+                                    (ctypes.c_double*2)(0, 0))
+        return C.transpose(self.orderC)
+
+def _c_strides(shape):
+    strides = [1] * len(shape)
+    for i in reversed(range(len(shape)-1)):
+        strides[i] = strides[i+1] * shape[i+1]
+    return strides
 
 def einsum(subscripts, *tensors, **kwargs):
     '''Perform a more efficient einsum via reshaping to a matrix multiply.
@@ -151,7 +151,7 @@ def aux_e1(cell, auxcell_or_auxbasis, erifile, intor='int3c2e', aosym='s2ij', co
 
 def _aux_e2(cell, auxcell_or_auxbasis, erifile, intor='int3c2e', aosym='s2ij', comp=None,
             kptij_lst=None, dataname='eri_mo', shls_slice=None, max_memory=2000,
-            verbose=0):
+            verbose=0, pair_blocks=None, pair_idx=None, **int3c_opts):
     r'''3-center AO integrals (ij|L) with double lattice sum:
     \sum_{lm} (i[l]j[m]|L[0]), where L is the auxiliary basis.
     Three-index integral tensor (kptij_idx, nao_pair, naux) or four-index
@@ -163,6 +163,21 @@ def _aux_e2(cell, auxcell_or_auxbasis, erifile, intor='int3c2e', aosym='s2ij', c
     Args:
         kptij_lst : (*,2,3) array
             A list of (kpti, kptj)
+
+    Kwargs:
+        pair_blocks : (s2 offsets, s1 offsets)
+            AO-pair column offsets of the kpti == kptj pairs (s2 packed) and
+            of the other k-point pairs. If given, the integrals of the
+            k-point pair k are stored in the datasets dataname/k/b of shape
+            (comp, naux, p1-p0) for the AO-pair columns [p0:p1] of block b,
+            instead of one (comp, nao_pair, nrow) dataset per aux shell range.
+        pair_idx : 1D int array
+            Packed (s2) AO-pair indices of the columns which are stored for
+            the kpti == kptj pairs (pair-sparse DF tensor). The offsets of
+            pair_blocks[0] refer to these columns.
+        int3c_opts :
+            cintopt, pbcopt, Ls and pair_mask passed to wrap_int3c. cintopt,
+            pbcopt and Ls can be reused between calls for the same basis sets.
     '''
     #if isinstance(auxcell_or_auxbasis, gto.Mole):
     auxcell = auxcell_or_auxbasis
@@ -223,7 +238,7 @@ def _aux_e2(cell, auxcell_or_auxbasis, erifile, intor='int3c2e', aosym='s2ij', c
     buflen = max([x[2] for x in auxranges])
     buf = numpy.zeros(nkptij*comp*ni*nj*buflen, dtype=dtype)
     bufs = [buf, numpy.zeros_like(buf)]
-    int3c = wrap_int3c(cell, auxcell, intor, aosym, comp, kptij_lst)
+    int3c = wrap_int3c(cell, auxcell, intor, aosym, comp, kptij_lst, **int3c_opts)
 
     def process(aux_range):
         sh0, sh1, nrow = aux_range
@@ -249,6 +264,16 @@ def _aux_e2(cell, auxcell_or_auxbasis, erifile, intor='int3c2e', aosym='s2ij', c
     tril_idx = numpy.tril_indices(ni)
     tril_idx = tril_idx[0] * ni + tril_idx[1]
 
+    if pair_blocks is not None:
+        naux = aux_loc[shls_slice[5]] - aux_loc[shls_slice[4]]
+        for k in sorted_ij_idx:
+            locs = pair_blocks[0] if aosym_ks2[k] else pair_blocks[1]
+            kdtype = numpy.double if gamma_point(kptij_lst[k]) else dtype
+            for b, (p0, p1) in enumerate(zip(locs[:-1], locs[1:])):
+                feri.create_dataset('%s/%d/%d' % (dataname,k,b),
+                                    (comp,naux,p1-p0), kdtype)
+
+    row0 = 0
     for istep, mat in enumerate(lib.map_with_prefetch(process, auxranges)):
         for k in sorted_ij_idx:
             v = mat[k]
@@ -256,7 +281,17 @@ def _aux_e2(cell, auxcell_or_auxbasis, erifile, intor='int3c2e', aosym='s2ij', c
                 v = v.real
             if aosym_ks2[k] and nao_pair == ni**2:
                 v = v[:,tril_idx]
-            feri['%s/%d/%d' % (dataname,k,istep)] = v
+            if aosym_ks2[k] and pair_idx is not None:
+                v = v[:,pair_idx]
+            if pair_blocks is None:
+                feri['%s/%d/%d' % (dataname,k,istep)] = v
+            else:
+                row1 = row0 + v.shape[2]
+                locs = pair_blocks[0] if aosym_ks2[k] else pair_blocks[1]
+                for b, (p0, p1) in enumerate(zip(locs[:-1], locs[1:])):
+                    feri['%s/%d/%d' % (dataname,k,b)][:,row0:row1] = \
+                            v[:,p0:p1].transpose(0,2,1)
+        row0 += auxranges[istep][2]
         mat = None
 
     if not isinstance(erifile, h5py.Group):
@@ -27,6 +27,7 @@ import numpy
 # With older versions of scipy, we use our own implementation instead.
 try:
     from scipy.linalg.lapack import dpstrf as _dpstrf
+    from scipy.linalg.lapack import zpstrf as _zpstrf
 except ImportError:
     def _pivoted_cholesky_wrapper(A, tol, lower):
         return pivoted_cholesky_python(A, tol=tol, lower=lower)
@@ -34,7 +35,10 @@ else:
     def _pivoted_cholesky_wrapper(A, tol, lower):
         N = A.shape[0]
         assert(A.shape == (N, N))
-        L, piv, rank, info = _dpstrf(A, tol=tol, lower=lower)
+        if numpy.iscomplexobj(A):
+            L, piv, rank, info = _zpstrf(A, tol=tol, lower=lower)
+        else:
+            L, piv, rank, info = _dpstrf(A, tol=tol, lower=lower)
         if info < 0:
             raise RuntimeError('Pivoted Cholesky factorization failed.')
         if lower:
@@ -49,10 +53,11 @@ else:
 def pivoted_cholesky(A, tol=-1.0, lower=False):
     '''
     Performs a Cholesky factorization of A with full pivoting.
-    A can be a (singular) positive semidefinite matrix.
+    A can be a (singular) positive semidefinite real symmetric or complex
+    hermitian matrix.
 
-    P.T * A * P = L * L.T   if   lower is True
-    P.T * A * P = U.T * U   if   lower if False
+    P.T * A * P = L * L.H   if   lower is True
+    P.T * A * P = U.H * U   if   lower if False
 
     Use regular Cholesky factorization for positive definite matrices instead.
 
@@ -84,12 +89,12 @@ def pivoted_cholesky_python(A, tol=-1.0, lower=False):
     N = A.shape[0]
     assert(A.shape == (N, N))
 
-    D = numpy.diag(A).copy()
+    D = numpy.diag(A).real.copy()
     if tol < 0:
-        machine_epsilon = numpy.finfo(numpy.float).eps
-        tol = N * machine_epsilon * numpy.amax(numpy.diag(A))
+        machine_epsilon = numpy.finfo(float).eps
+        tol = N * machine_epsilon * numpy.amax(D)
 
-    L = numpy.zeros((N, N))
+    L = numpy.zeros((N, N), dtype=A.dtype)
     piv = numpy.arange(N)
     rank = 0
     for k in range(N):
@@ -101,10 +106,10 @@ def pivoted_cholesky_python(A, tol=-1.0, lower=False):
             break
         rank += 1
         L[k, k] = numpy.sqrt(D[k])
-        L[k+1:, k] = (A[piv[k+1:], piv[k]] - numpy.dot(L[k+1:, :k], L[k, :k])) / L[k, k]
-        D[k+1:] -= L[k+1:, k] ** 2
+        L[k+1:, k] = (A[piv[k+1:], piv[k]] - numpy.dot(L[k+1:, :k], L[k, :k].conj())) / L[k, k]
+        D[k+1:] -= abs(L[k+1:, k]) ** 2
 
     if lower:
         return L, piv, rank
     else:
-        return L.T, piv, rank
+        return L.conj().T, piv, rank
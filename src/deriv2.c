@@ -1134,3 +1134,64 @@ void GTOval_spinor_deriv1(int ngrids, int *shls_slice, int *ao_loc,
                            ao, coord, non0table, atm, natm, bas, nbas, env);
 }
 
+
+/*
+ * Spinor AOs and derivatives in the planar layout of
+ * GTOeval_spinor_planar_drv, ao[4,ncomp,nao,ngrids] for Re(alpha),
+ * Im(alpha), Re(beta), Im(beta)
+ */
+void GTOshell_eval_grid_cart(double *gto, double *ri, double *exps,
+                             double *coord, double *alpha, double *coeff,
+                             double *env, int l, int np, int nc,
+                             size_t nao, size_t ngrids, size_t bgrids);
+
+void GTOval_spinor_planar_deriv0(int ngrids, int *shls_slice, int *ao_loc,
+                                 double *ao, double *coord, char *non0table,
+                                 int *atm, int natm, int *bas, int nbas, double *env)
+{
+        int param[] = {1, 1};
+        GTOeval_spinor_planar_drv(GTOshell_eval_grid_cart, GTOcontract_exp0,
+                                  CINTc2s_ket_spinor_sf1, 1,
+                                  ngrids, param, shls_slice, ao_loc,
+                                  ao, coord, non0table, atm, natm, bas, nbas, env);
+}
+void GTOval_spinor_planar_deriv1(int ngrids, int *shls_slice, int *ao_loc,
+                                 double *ao, double *coord, char *non0table,
+                                 int *atm, int natm, int *bas, int nbas, double *env)
+{
+        int param[] = {1, 4};
+        GTOeval_spinor_planar_drv(GTOshell_eval_grid_cart_deriv1, GTOcontract_exp1,
+                                  CINTc2s_ket_spinor_sf1, 1,
+                                  ngrids, param, shls_slice, ao_loc,
+                                  ao, coord, non0table, atm, natm, bas, nbas, env);
+}
+void GTOval_spinor_planar_deriv2(int ngrids, int *shls_slice, int *ao_loc,
+                                 double *ao, double *coord, char *non0table,
+                                 int *atm, int natm, int *bas, int nbas, double *env)
+{
+        int param[] = {1, 10};
+        GTOeval_spinor_planar_drv(GTOshell_eval_grid_cart_deriv2, GTOprim_exp,
+                                  CINTc2s_ket_spinor_sf1, 1,
+                                  ngrids, param, shls_slice, ao_loc,
+                                  ao, coord, non0table, atm, natm, bas, nbas, env);
+}
+void GTOval_spinor_planar_deriv3(int ngrids, int *shls_slice, int *ao_loc,
+                                 double *ao, double *coord, char *non0table,
+                                 int *atm, int natm, int *bas, int nbas, double *env)
+{
+        int param[] = {1, 20};
+        GTOeval_spinor_planar_drv(GTOshell_eval_grid_cart_deriv3, GTOprim_exp,
+                                  CINTc2s_ket_spinor_sf1, 1,
+                                  ngrids, param, shls_slice, ao_loc,
+                                  ao, coord, non0table, atm, natm, bas, nbas, env);
+}
+void GTOval_spinor_planar_deriv4(int ngrids, int *shls_slice, int *ao_loc,
+                                 double *ao, double *coord, char *non0table,
+                                 int *atm, int natm, int *bas, int nbas, double *env)
+{
+        int param[] = {1, 35};
+        GTOeval_spinor_planar_drv(GTOshell_eval_grid_cart_deriv4, GTOprim_exp,
+                                  CINTc2s_ket_spinor_sf1, 1,
+                                  ngrids, param, shls_slice, ao_loc,
+                                  ao, coord, non0table, atm, natm, bas, nbas, env);
+}
@@ -0,0 +1,278 @@
+/* Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+
+ *
+ * J and K matrices of the GDF tensor j3c, one block of aux rows at a time.
+ * The rows are passed as they are stored in the cderi file: real (cplx = 0)
+ * or complex (cplx = 1), packed lower triangle of the AO pairs for
+ * kpti == kptj (s2) or all nao**2 AO pairs (s1).
+ */
+
+#include <stdlib.h>
+#include <complex.h>
+#include "config.h"
+#include "fblas.h"
+
+#define MIN(X,Y)        ((X) < (Y) ? (X) : (Y))
+#define PAIRBLK         256
+
+#define LPQ(i)  (cplx ? ((double complex *)Lpq)[i] : Lpq[i])
+
+/*
+ * rho[x,L] += fac * \sum_{p>=q} L[L,pq] dmA[x,pq] + conj(L[L,pq]) dmB[x,pq]
+ *
+ * dmA is the packed lower triangle of dm[x].T and dmB the packed lower
+ * triangle of dm[x] without the diagonal, so that rho[x,L] is
+ * \sum_{pq} L[L,p,q] dm[x,q,p] of the hermitian L[L,p,q].
+ */
+void PBCDFj_rho_s2(double complex *rho, double *Lpq, int cplx,
+                   double complex *dmA, double complex *dmB, double fac,
+                   int nset, int nrow, int npair)
+{
+#pragma omp parallel
+{
+        size_t l, pq;
+        int i;
+        double complex s;
+        double complex *pA, *pB;
+        double complex *zL;
+        double *dL;
+#pragma omp for schedule(static)
+        for (l = 0; l < nrow; l++) {
+                for (i = 0; i < nset; i++) {
+                        pA = dmA + i * (size_t)npair;
+                        pB = dmB + i * (size_t)npair;
+                        s = 0;
+                        if (cplx) {
+                                zL = (double complex *)Lpq + l * npair;
+                                for (pq = 0; pq < npair; pq++) {
+                                        s += zL[pq] * pA[pq] + conj(zL[pq]) * pB[pq];
+                                }
+                        } else {
+                                dL = Lpq + l * npair;
+                                for (pq = 0; pq < npair; pq++) {
+                                        s += dL[pq] * (pA[pq] + pB[pq]);
+                                }
+                        }
+                        rho[i*(size_t)nrow+l] += fac * s;
+                }
+        }
+}
+}
+
+/*
+ * vjL[x,pq] += \sum_L rho[x,L] L[L,pq]        (vj[x,p,q], p >= q)
+ * vjU[x,pq] += \sum_L rho[x,L] conj(L[L,pq])  (vj[x,q,p], p >= q)
+ *
+ * vjU can be NULL when rho is real, i.e. vj is hermitian.
+ */
+void PBCDFj_vj_s2(double complex *vjL, double complex *vjU,
+                  double *Lpq, int cplx, double complex *rho,
+                  int nset, int nrow, int npair)
+{
+#pragma omp parallel
+{
+        size_t l, pq, p0, p1;
+        int i;
+        double complex r, v;
+        double complex *pL, *pU;
+#pragma omp for schedule(static)
+        for (p0 = 0; p0 < npair; p0 += PAIRBLK) {
+                p1 = MIN(p0 + PAIRBLK, npair);
+                for (i = 0; i < nset; i++) {
+                        pL = vjL + i * (size_t)npair;
+                        pU = vjU;
+                        if (vjU != NULL) {
+                                pU += i * (size_t)npair;
+                        }
+                        for (l = 0; l < nrow; l++) {
+                                r = rho[i*(size_t)nrow+l];
+                                for (pq = p0; pq < p1; pq++) {
+                                        v = LPQ(l*npair+pq);
+                                        pL[pq] += r * v;
+                                        if (pU != NULL) {
+                                                pU[pq] += r * conj(v);
+                                        }
+                                }
+                        }
+                }
+        }
+}
+}
+
+/*
+ * pLq[p,L-l0,q] = L[L,p,q] for the rows [l0:l1]
+ */
+static void _gather_pLq(double complex *pLq, double *Lpq, int cplx, int s2,
+                        int l0, int l1, int nao)
+{
+        const size_t nl = l1 - l0;
+        const size_t ncol = s2 ? (size_t)nao*(nao+1)/2 : (size_t)nao*nao;
+        const size_t ldp = nl * nao;
+        size_t pq;
+        int l, p, q;
+        double complex v;
+        double complex *out;
+        for (l = l0; l < l1; l++) {
+                out = pLq + (l - l0) * (size_t)nao;
+                pq = l * ncol;
+                if (s2) {
+                        for (p = 0; p < nao; p++) {
+                        for (q = 0; q <= p; q++, pq++) {
+                                v = LPQ(pq);
+                                out[p*ldp+q] = v;
+                                out[q*ldp+p] = conj(v);
+                        } }
+                } else {
+                        for (p = 0; p < nao; p++) {
+                        for (q = 0; q < nao; q++, pq++) {
+                                out[p*ldp+q] = LPQ(pq);
+                        } }
+                }
+        }
+}
+
+/*
+ * Exchange of the k-point pair (ki,kj) of the rows of j3c(ki,kj)
+ *      vk[x,r,s] += fac * \sum_{Lpq} conj(L[L,p,r]) dm[x,p,q] L[L,q,s]
+ * and the exchange of the pair (kj,ki) whose tensor is
+ * j3c(kj,ki)[L,p,q] = conj(L[L,q,p])
+ *      vk_swap[x,r,s] += fac * \sum_{Lpq} L[L,r,p] dm_swap[x,p,q] conj(L[L,s,q])
+ *
+ * Either of vk and vk_swap can be NULL to skip that pair.
+ * The rows are distributed over threads. Each thread contracts its rows with
+ * two ZGEMMs per density matrix.
+ */
+void PBCDFk_kpt(double complex *vk, double complex *vk_swap,
+                double *Lpq, int cplx, int s2,
+                double complex *dm, double complex *dm_swap, double fac,
+                int nset, int nrow, int nao)
+{
+        const size_t nao2 = (size_t)nao * nao;
+        const double complex Z0 = 0;
+        const double complex Z1 = 1;
+        const double complex zfac = fac;
+#pragma omp parallel
+{
+        int nthreads = omp_get_num_threads();
+        int thread_id = omp_get_thread_num();
+        int blk = (nrow + nthreads - 1) / nthreads;
+        int l0 = MIN(thread_id * blk, nrow);
+        int l1 = MIN(l0 + blk, nrow);
+        int nl = l1 - l0;
+        int m = nl * nao;
+        int i;
+        size_t n;
+        double complex *pLq, *tmp, *vpriv, *vswap;
+        if (nl > 0) {
+                pLq = malloc(sizeof(double complex) * nao2 * nl * 2);
+                tmp = pLq + nao2 * nl;
+                vpriv = calloc(nao2 * nset * 2, sizeof(double complex));
+                vswap = vpriv + nao2 * nset;
+                _gather_pLq(pLq, Lpq, cplx, s2, l0, l1, nao);
+                for (i = 0; i < nset; i++) {
+                        if (vk != NULL) {
+                                // tmp[p,L,s] = dm[p,q] pLq[q,L,s]
+                                zgemm_("N", "N", &m, &nao, &nao,
+                                       &Z1, pLq, &m, dm+i*nao2, &nao, &Z0, tmp, &m);
+                                // vk[r,s] = conj(pLq[p,L,r]) tmp[p,L,s]
+                                zgemm_("N", "C", &nao, &nao, &m,
+                                       &zfac, tmp, &nao, pLq, &nao, &Z1, vpriv+i*nao2, &nao);
+                        }
+                        if (vk_swap != NULL) {
+                                // tmp[r,L,q] = pLq[r,L,p] dm_swap[p,q]
+                                zgemm_("N", "N", &nao, &m, &nao,
+                                       &Z1, dm_swap+i*nao2, &nao, pLq, &nao, &Z0, tmp, &nao);
+                                // vk_swap[r,s] = tmp[r,L,q] conj(pLq[s,L,q])
+                                zgemm_("C", "N", &nao, &nao, &m,
+                                       &zfac, pLq, &m, tmp, &m, &Z1, vswap+i*nao2, &nao);
+                        }
+                }
+#pragma omp critical
+                {
+                        if (vk != NULL) {
+                                for (n = 0; n < nao2 * nset; n++) {
+                                        vk[n] += vpriv[n];
+                                }
+                        }
+                        if (vk_swap != NULL) {
+                                for (n = 0; n < nao2 * nset; n++) {
+                                        vk_swap[n] += vswap[n];
+                                }
+                        }
+                }
+                free(pLq);
+                free(vpriv);
+        }
+}
+}
+
+/*
+ * PBCDFk_kpt for the real j3c and real density matrices of the gamma point
+ *      vk[x,r,s] += fac * \sum_{Lpq} L[L,p,r] dm[x,p,q] L[L,q,s]
+ */
+void PBCDFk_gamma(double *vk, double *Lpq, int s2, double *dm, double fac,
+                  int nset, int nrow, int nao)
+{
+        const size_t nao2 = (size_t)nao * nao;
+        const size_t ncol = s2 ? (size_t)nao*(nao+1)/2 : nao2;
+        const double D0 = 0;
+        const double D1 = 1;
+#pragma omp parallel
+{
+        int nthreads = omp_get_num_threads();
+        int thread_id = omp_get_thread_num();
+        int blk = (nrow + nthreads - 1) / nthreads;
+        int l0 = MIN(thread_id * blk, nrow);
+        int l1 = MIN(l0 + blk, nrow);
+        int nl = l1 - l0;
+        int m = nl * nao;
+        int i, l, p, q;
+        size_t n, pq;
+        double *pLq, *tmp, *vpriv, *out;
+        if (nl > 0) {
+                pLq = malloc(sizeof(double) * nao2 * nl * 2);
+                tmp = pLq + nao2 * nl;
+                vpriv = calloc(nao2 * nset, sizeof(double));
+                for (l = l0; l < l1; l++) {
+                        out = pLq + (l - l0) * (size_t)nao;
+                        pq = l * ncol;
+                        if (s2) {
+                                for (p = 0; p < nao; p++) {
+                                for (q = 0; q <= p; q++, pq++) {
+                                        out[(size_t)p*m+q] = Lpq[pq];
+                                        out[(size_t)q*m+p] = Lpq[pq];
+                                } }
+                        } else {
+                                for (p = 0; p < nao; p++) {
+                                for (q = 0; q < nao; q++, pq++) {
+                                        out[(size_t)p*m+q] = Lpq[pq];
+                                } }
+                        }
+                }
+                for (i = 0; i < nset; i++) {
+                        dgemm_("N", "N", &m, &nao, &nao,
+                               &D1, pLq, &m, dm+i*nao2, &nao, &D0, tmp, &m);
+                        dgemm_("N", "T", &nao, &nao, &m,
+                               &fac, tmp, &nao, pLq, &nao, &D1, vpriv+i*nao2, &nao);
+                }
+#pragma omp critical
+                for (n = 0; n < nao2 * nset; n++) {
+                        vk[n] += vpriv[n];
+                }
+                free(pLq);
+                free(vpriv);
+        }
+}
+}
@@ -17,6 +17,7 @@
  */
 
 #include <stdlib.h>
+#include <math.h>
 #include <complex.h>
 #include "config.h"
 #include "cint.h"
@@ -45,6 +46,8 @@ void GTOint2c(int (*intor)(), double *mat, int comp, int hermi,
         const size_t naoj = ao_loc[jsh1] - ao_loc[jsh0];
         const int cache_size = GTOmax_cache_size(intor, shls_slice, 2,
                                                  atm, natm, bas, nbas, env);
+        // Triangular task space for hermi != PLAIN (requires nish == njsh)
+        const int npair = (hermi != PLAIN) ? nish * (nish + 1) / 2 : nish * njsh;
 #pragma omp parallel
 {
         int dims[] = {naoi, naoj};
@@ -52,12 +55,14 @@ void GTOint2c(int (*intor)(), double *mat, int comp, int hermi,
         int shls[2];
         double *cache = malloc(sizeof(double) * cache_size);
 #pragma omp for schedule(dynamic, 4)
-        for (ij = 0; ij < nish*njsh; ij++) {
-                ish = ij / njsh;
-                jsh = ij % njsh;
-                if (hermi != PLAIN && ish > jsh) {
+        for (ij = 0; ij < npair; ij++) {
+                if (hermi != PLAIN) {
                         // fill up only upper triangle of F-array
-                        continue;
+                        jsh = (int)(sqrt(2*ij+.25) - .5 + 1e-7);
+                        ish = ij - jsh * (jsh + 1) / 2;
+                } else {
+                        ish = ij / njsh;
+                        jsh = ij % njsh;
                 }
 
                 ish += ish0;
@@ -72,10 +77,7 @@ void GTOint2c(int (*intor)(), double *mat, int comp, int hermi,
         free(cache);
 }
         if (hermi != PLAIN) { // lower triangle of F-array
-                int ic;
-                for (ic = 0; ic < comp; ic++) {
-                        NPdsymm_triu(naoi, mat+ic*naoi*naoi, hermi);
-                }
+                NPdsymm_triu_nmat(comp, naoi, mat, hermi);
         }
 }
 
@@ -93,6 +95,8 @@ void GTOint2c_spinor(int (*intor)(), double complex *mat, int comp, int hermi,
         const size_t naoj = ao_loc[jsh1] - ao_loc[jsh0];
         const int cache_size = GTOmax_cache_size(intor, shls_slice, 2,
                                                  atm, natm, bas, nbas, env);
+        // Triangular task space for hermi != PLAIN (requires nish == njsh)
+        const int npair = (hermi != PLAIN) ? nish * (nish + 1) / 2 : nish * njsh;
 
 #pragma omp parallel
 {
@@ -101,11 +105,14 @@ void GTOint2c_spinor(int (*intor)(), double complex *mat, int comp, int hermi,
         int shls[2];
         double *cache = malloc(sizeof(double) * cache_size);
 #pragma omp for schedule(dynamic, 4)
-        for (ij = 0; ij < nish*njsh; ij++) {
-                ish = ij / njsh;
-                jsh = ij % njsh;
-                if (hermi != PLAIN && ish > jsh) {
-                        continue;
+        for (ij = 0; ij < npair; ij++) {
+                if (hermi != PLAIN) {
+                        // fill up only upper triangle of F-array
+                        jsh = (int)(sqrt(2*ij+.25) - .5 + 1e-7);
+                        ish = ij - jsh * (jsh + 1) / 2;
+                } else {
+                        ish = ij / njsh;
+                        jsh = ij % njsh;
                 }
 
                 ish += ish0;
@@ -120,10 +127,7 @@ void GTOint2c_spinor(int (*intor)(), double complex *mat, int comp, int hermi,
         free(cache);
 }
         if (hermi != PLAIN) {
-                int ic;
-                for (ic = 0; ic < comp; ic++) {
-                        NPzhermi_triu(naoi, mat+ic*naoi*naoi, hermi);
-                }
+                NPzhermi_triu_nmat(comp, naoi, mat, hermi);
         }
 }
 
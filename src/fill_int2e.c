@@ -567,3 +567,291 @@ void GTOnr2e_fill_drv(int (*intor)(), void (*fill)(), int (*fprescreen)(),
 }
 }
 
+
+/*
+ *************************************************
+ * Screened 2e driver with multiple outputs.
+ *
+ * aosyms[n] selects the packing of eris[n]: 1 = s1, 2 = s2ij, 3 = s2kl,
+ * 4 = s4.  shls_slices[n*8:n*8+8] is the shell range of eris[n]; the
+ * quartets of all outputs are evaluated once and scattered to every output
+ * which holds them, e.g. an s4 array for storage together with an s1
+ * sub-block of fragment shells.
+ *
+ * q_cond[nbas*nbas] is the Schwarz bound sqrt((ij|ij)) as produced by
+ * CVHFset_int2e_q_cond.  For each (ish,jsh) only the (ksh,lsh) pairs with
+ * q_ij*q_kl >= cutoff are passed to intor.  The (ksh,lsh) pairs are sorted
+ * by q_kl once, so the significant pairs of any (ish,jsh) are the leading
+ * part of the list.  Blocks of screened quartets are zeroed in the outputs.
+ * q_cond = NULL disables the screening.
+ */
+
+#define NR2E_S1         1
+#define NR2E_S2IJ       2
+#define NR2E_S2KL       3
+#define NR2E_S4         4
+
+typedef struct {
+        double q;
+        int ksh;
+        int lsh;
+} NR2EPair;
+
+typedef struct {
+        double cost;
+        int ish;
+        int jsh;
+        int nkl;
+} NR2ETask;
+
+static int _pair_q_descend(const void *a, const void *b)
+{
+        double qa = ((NR2EPair *)a)->q;
+        double qb = ((NR2EPair *)b)->q;
+        return (qa < qb) - (qa > qb);
+}
+
+static int _task_cost_descend(const void *a, const void *b)
+{
+        double ca = ((NR2ETask *)a)->cost;
+        double cb = ((NR2ETask *)b)->cost;
+        return (ca < cb) - (ca > cb);
+}
+
+static int _ij_in_output(int aosym, int *slice, int ish, int jsh)
+{
+        if (ish < slice[0] || ish >= slice[1] ||
+            jsh < slice[2] || jsh >= slice[3]) {
+                return 0;
+        }
+        if ((aosym == NR2E_S2IJ || aosym == NR2E_S4) &&
+            ish - slice[0] < jsh - slice[2]) {
+                return 0;
+        }
+        return 1;
+}
+
+static int _in_output(int aosym, int *slice, int ish, int jsh, int ksh, int lsh)
+{
+        if (ish < slice[0] || ish >= slice[1] ||
+            jsh < slice[2] || jsh >= slice[3] ||
+            ksh < slice[4] || ksh >= slice[5] ||
+            lsh < slice[6] || lsh >= slice[7]) {
+                return 0;
+        }
+        if ((aosym == NR2E_S2IJ || aosym == NR2E_S4) &&
+            ish - slice[0] < jsh - slice[2]) {
+                return 0;
+        }
+        if ((aosym == NR2E_S2KL || aosym == NR2E_S4) &&
+            ksh - slice[4] < lsh - slice[6]) {
+                return 0;
+        }
+        return 1;
+}
+
+/*
+ * Scatter the quartet in buf (libcint order, i fastest) to eri.  buf = NULL
+ * writes zeros.
+ */
+static void _sort_quartet(int aosym, double *eri, double *buf, int comp,
+                          int ish, int jsh, int ksh, int lsh,
+                          int *slice, int *ao_loc)
+{
+        const int ntrij = (aosym == NR2E_S2IJ || aosym == NR2E_S4);
+        const int ntrkl = (aosym == NR2E_S2KL || aosym == NR2E_S4);
+        int ni = ao_loc[slice[1]] - ao_loc[slice[0]];
+        int nj = ao_loc[slice[3]] - ao_loc[slice[2]];
+        int nk = ao_loc[slice[5]] - ao_loc[slice[4]];
+        int nl = ao_loc[slice[7]] - ao_loc[slice[6]];
+        size_t nij = ntrij ? (size_t)ni * (ni+1) / 2 : (size_t)ni * nj;
+        size_t nkl = ntrkl ? (size_t)nk * (nk+1) / 2 : (size_t)nk * nl;
+        size_t neri = nij * nkl;
+        int i0 = ao_loc[ish] - ao_loc[slice[0]];
+        int j0 = ao_loc[jsh] - ao_loc[slice[2]];
+        int k0 = ao_loc[ksh] - ao_loc[slice[4]];
+        int l0 = ao_loc[lsh] - ao_loc[slice[6]];
+        int di = ao_loc[ish+1] - ao_loc[ish];
+        int dj = ao_loc[jsh+1] - ao_loc[jsh];
+        int dk = ao_loc[ksh+1] - ao_loc[ksh];
+        int dl = ao_loc[lsh+1] - ao_loc[lsh];
+        int dij = di * dj;
+        int dijk = dij * dk;
+        int dijkl = dijk * dl;
+        int diag_ij = ntrij && (i0 == j0);
+        int diag_kl = ntrkl && (k0 == l0);
+        int i, j, k, l, j1, l1, icomp;
+        size_t ij, kl;
+        double *peri, *pbuf;
+
+        for (icomp = 0; icomp < comp; icomp++) {
+                for (i = 0; i < di; i++) {
+                        j1 = diag_ij ? i+1 : dj;
+                        for (j = 0; j < j1; j++) {
+                                if (ntrij) {
+                                        ij = (size_t)(i0+i)*(i0+i+1)/2 + j0+j;
+                                } else {
+                                        ij = (size_t)(i0+i)*nj + j0+j;
+                                }
+                                peri = eri + icomp * neri + ij * nkl;
+                                for (k = 0; k < dk; k++) {
+                                        if (ntrkl) {
+                                                kl = (size_t)(k0+k)*(k0+k+1)/2 + l0;
+                                        } else {
+                                                kl = (size_t)(k0+k)*nl + l0;
+                                        }
+                                        l1 = diag_kl ? k+1 : dl;
+                                        if (buf == NULL) {
+                                                for (l = 0; l < l1; l++) {
+                                                        peri[kl+l] = 0;
+                                                }
+                                        } else {
+                                                pbuf = buf + icomp*dijkl + k*dij + j*di + i;
+                                                for (l = 0; l < l1; l++) {
+                                                        peri[kl+l] = pbuf[l*dijk];
+                                                }
+                                        }
+                                }
+                        }
+                }
+        }
+}
+
+void GTOnr2e_fill_screen_drv(int (*intor)(), int (*fprescreen)(),
+                             double **eris, int *aosyms, int nout, int comp,
+                             int *shls_slices, int *ao_loc, CINTOpt *cintopt,
+                             double *q_cond, double cutoff,
+                             int *atm, int natm, int *bas, int nbas, double *env)
+{
+        if (fprescreen == NULL) {
+                fprescreen = no_prescreen;
+        }
+
+        int shls_slice[8];
+        int n, m;
+        for (m = 0; m < 8; m++) {
+                shls_slice[m] = shls_slices[m];
+        }
+        for (n = 1; n < nout; n++) {
+                for (m = 0; m < 8; m += 2) {
+                        shls_slice[m  ] = MIN(shls_slice[m  ], shls_slices[n*8+m  ]);
+                        shls_slice[m+1] = MAX(shls_slice[m+1], shls_slices[n*8+m+1]);
+                }
+        }
+        const int ish0 = shls_slice[0];
+        const int ish1 = shls_slice[1];
+        const int jsh0 = shls_slice[2];
+        const int jsh1 = shls_slice[3];
+        const int ksh0 = shls_slice[4];
+        const int ksh1 = shls_slice[5];
+        const int lsh0 = shls_slice[6];
+        const int lsh1 = shls_slice[7];
+        const int nksh = ksh1 - ksh0;
+        const int nlsh = lsh1 - lsh0;
+        const int npair = nksh * nlsh;
+        const int di = GTOmax_shell_dim(ao_loc, shls_slice, 4);
+        const int cache_size = GTOmax_cache_size(intor, shls_slice, 4,
+                                                 atm, natm, bas, nbas, env);
+        const int screen = (q_cond != NULL && cutoff > 0);
+
+        NR2EPair *pairs = malloc(sizeof(NR2EPair) * MAX(npair, 1));
+        int ksh, lsh;
+        for (ksh = ksh0; ksh < ksh1; ksh++) {
+        for (lsh = lsh0; lsh < lsh1; lsh++) {
+                m = (ksh - ksh0) * nlsh + lsh - lsh0;
+                pairs[m].q = screen ? q_cond[ksh*nbas+lsh] : 1;
+                pairs[m].ksh = ksh;
+                pairs[m].lsh = lsh;
+        } }
+        if (screen) {
+                qsort(pairs, npair, sizeof(NR2EPair), _pair_q_descend);
+        }
+
+        // the significant (ksh,lsh) of each (ish,jsh) are pairs[:nkl]
+        const int nijsh = (ish1 - ish0) * (jsh1 - jsh0);
+        NR2ETask *tasks = malloc(sizeof(NR2ETask) * MAX(nijsh, 1));
+        int ntask = 0;
+        int ish, jsh, lo, hi, mid;
+        double qij;
+        for (ish = ish0; ish < ish1; ish++) {
+        for (jsh = jsh0; jsh < jsh1; jsh++) {
+                for (n = 0; n < nout; n++) {
+                        if (_ij_in_output(aosyms[n], shls_slices+n*8, ish, jsh)) {
+                                break;
+                        }
+                }
+                if (n == nout) {
+                        continue;
+                }
+                lo = npair;
+                if (screen) {
+                        qij = q_cond[ish*nbas+jsh];
+                        lo = 0;
+                        hi = npair;
+                        while (lo < hi) {
+                                mid = (lo + hi) / 2;
+                                if (qij * pairs[mid].q >= cutoff) {
+                                        lo = mid + 1;
+                                } else {
+                                        hi = mid;
+                                }
+                        }
+                }
+                tasks[ntask].ish = ish;
+                tasks[ntask].jsh = jsh;
+                tasks[ntask].nkl = lo;
+                tasks[ntask].cost = (double)lo
+                        * (ao_loc[ish+1] - ao_loc[ish])
+                        * (ao_loc[jsh+1] - ao_loc[jsh]);
+                ntask++;
+        } }
+        qsort(tasks, ntask, sizeof(NR2ETask), _task_cost_descend);
+
+#pragma omp parallel
+{
+        int it, p, n, ish, jsh, ksh, lsh, needed;
+        int shls[4];
+        double *buf = malloc(sizeof(double) * (di*di*di*di*comp + cache_size));
+        double *cache = buf + di*di*di*di*comp;
+        double *pbuf;
+#pragma omp for nowait schedule(dynamic)
+        for (it = 0; it < ntask; it++) {
+                ish = tasks[it].ish;
+                jsh = tasks[it].jsh;
+                shls[0] = ish;
+                shls[1] = jsh;
+                for (p = 0; p < npair; p++) {
+                        ksh = pairs[p].ksh;
+                        lsh = pairs[p].lsh;
+                        needed = 0;
+                        for (n = 0; n < nout; n++) {
+                                needed |= _in_output(aosyms[n], shls_slices+n*8,
+                                                     ish, jsh, ksh, lsh);
+                        }
+                        if (!needed) {
+                                continue;
+                        }
+                        shls[2] = ksh;
+                        shls[3] = lsh;
+                        pbuf = NULL;
+                        if (p < tasks[it].nkl &&
+                            (*fprescreen)(shls, atm, bas, env) &&
+                            (*intor)(buf, NULL, shls, atm, natm, bas, nbas, env,
+                                     cintopt, cache)) {
+                                pbuf = buf;
+                        }
+                        for (n = 0; n < nout; n++) {
+                                if (_in_output(aosyms[n], shls_slices+n*8,
+                                               ish, jsh, ksh, lsh)) {
+                                        _sort_quartet(aosyms[n], eris[n], pbuf, comp,
+                                                      ish, jsh, ksh, lsh,
+                                                      shls_slices+n*8, ao_loc);
+                                }
+                        }
+                }
+        }
+        free(buf);
+}
+        free(tasks);
+        free(pairs);
+}
@@ -29,10 +29,16 @@
 #define INTBUFMAX10     8000
 #define IMGBLK          80
 #define OF_CMPLX        2
+// PBCnr3c_drv splits the aux shells if there are fewer shell pairs per thread
+#define TASKS_PER_THREAD 4
 
 int GTOmax_shell_dim(int *ao_loc, int *shls_slice, int ncenter);
 int GTOmax_cache_size(int (*intor)(), int *shls_slice, int ncenter,
                       int *atm, int natm, int *bas, int nbas, double *env);
+void PBCnr2c_multipole_fill(double complex *out, int nkpts, int nimgs, int hermi,
+                            double *Ls, double *expkL_r, double *expkL_i,
+                            int *shls_slice, int *ao_loc, PBCOpt *opt,
+                            int *atm, int natm, int *bas, int nbas, double *env);
 
 static int shloc_partition(int *kshloc, int *ao_loc, int ksh0, int ksh1, int dkmax)
 {
@@ -53,6 +59,27 @@ static int shloc_partition(int *kshloc, int *ao_loc, int ksh0, int ksh1, int dkm
         return nloc;
 }
 
+/*
+ * Split the aux shells [ksh0:ksh1] into at most nblk segments with about
+ * the same number of AOs
+ */
+static int kshblk_partition(int *kshblk, int *ao_loc, int ksh0, int ksh1, int nblk)
+{
+        const size_t naok = ao_loc[ksh1] - ao_loc[ksh0];
+        int ksh;
+        int n = 0;
+        kshblk[0] = ksh0;
+        for (ksh = ksh0+1; ksh < ksh1; ksh++) {
+                if ((size_t)(ao_loc[ksh] - ao_loc[ksh0]) * nblk >= naok * (n+1)) {
+                        n += 1;
+                        kshblk[n] = ksh;
+                }
+        }
+        n += 1;
+        kshblk[n] = ksh1;
+        return n;
+}
+
 static void shift_bas(double *env_loc, double *env, double *Ls, int ptr, int iL)
 {
         env_loc[ptr+0] = env[ptr+0] + Ls[iL*3+0];
@@ -122,6 +149,7 @@ static void sort3c_kks1(double complex *out, double *bufr, double *bufi,
 static void _nr3c_fill_kk(int (*intor)(), void (*fsort)(),
                           double complex *out, int nkpts_ij,
                           int nkpts, int comp, int nimgs, int ish, int jsh,
+                          int ksh_start, int ksh_end,
                           double *buf, double *env_loc, double *Ls,
                           double *expkL_r, double *expkL_i, int *kptij_idx,
                           int *shls_slice, int *ao_loc,
@@ -130,8 +158,6 @@ static void _nr3c_fill_kk(int (*intor)(), void (*fsort)(),
 {
         const int ish0 = shls_slice[0];
         const int jsh0 = shls_slice[2];
-        const int ksh0 = shls_slice[4];
-        const int ksh1 = shls_slice[5];
 
         const char TRANS_N = 'N';
         const double D0 = 0;
@@ -146,12 +172,15 @@ static void _nr3c_fill_kk(int (*intor)(), void (*fsort)(),
         const int dj = ao_loc[jsh+1] - ao_loc[jsh];
         const int dij = di * dj;
         int dkmax = INTBUFMAX / dij;
-        int kshloc[ksh1-ksh0+1];
-        int nkshloc = shloc_partition(kshloc, ao_loc, ksh0, ksh1, dkmax);
+        int kshloc[ksh_end-ksh_start+1];
+        int nkshloc = shloc_partition(kshloc, ao_loc, ksh_start, ksh_end, dkmax);
 
         int i, m, msh0, msh1, dijm, dijmc, dijmk, empty;
-        int ksh, dk, iL0, iL, jL, iLcount;
+        int ksh, dk, iL0, iL, jL, iLcount, jLcount, n, njL;
+        int jLs[nimgs];
         int shls[3];
+        double *bufexp_r = buf;
+        double *bufexp_i = bufexp_r + nimgs * nkpts;
         double *bufkk_r, *bufkk_i, *bufkL_r, *bufkL_i, *bufL, *pbuf, *cache;
         int (*fprescreen)();
         if (pbcopt != NULL) {
@@ -159,6 +188,13 @@ static void _nr3c_fill_kk(int (*intor)(), void (*fsort)(),
         } else {
                 fprescreen = PBCnoscreen;
         }
+        // far-field integrals from multipoles (see multipole.c)
+        int mpair;
+        double *mpbuf = NULL;
+        size_t mpsize = PBCmp_int3c2e_bufsize(pbcopt, ish, jsh, bas);
+        if (mpsize > 0) {
+                mpbuf = malloc(sizeof(double) * mpsize);
+        }
 
         shls[0] = ish;
         shls[1] = jsh;
@@ -169,7 +205,7 @@ static void _nr3c_fill_kk(int (*intor)(), void (*fsort)(),
                 dijm = dij * dkmax;
                 dijmc = dijm * comp;
                 dijmk = dijmc * nkpts;
-                bufkk_r = buf;
+                bufkk_r = bufexp_i + nimgs * nkpts;
                 bufkk_i = bufkk_r + (size_t)nkpts * dijmk;
                 bufkL_r = bufkk_i + (size_t)nkpts * dijmk;
                 bufkL_i = bufkL_r + (size_t)MIN(nimgs,IMGBLK) * dijmk;
@@ -183,32 +219,54 @@ static void _nr3c_fill_kk(int (*intor)(), void (*fsort)(),
                         iLcount = MIN(IMGBLK, nimgs - iL0);
                         for (iL = iL0; iL < iL0+iLcount; iL++) {
                                 shift_bas(env_loc, env, Ls, iptrxyz, iL);
-                                pbuf = bufL;
-        for (jL = 0; jL < nimgs; jL++) {
+                                njL = PBCpair_images(jLs, pbcopt, ish, jsh, iL, nimgs);
+                                jLcount = 0;
+        // The integrals of the images jL in the pair list are gathered in
+        // bufL[jLcount] and the phases in the matching columns of bufexp, so
+        // that the GEMMs run over the listed images only
+        for (n = 0; n < njL; n++) {
+                jL = jLs[n];
                 shift_bas(env_loc, env, Ls, jptrxyz, jL);
                 if ((*fprescreen)(shls, pbcopt, atm, bas, env_loc)) {
+                        pbuf = bufL + (size_t)jLcount * dijmc;
+                        mpair = -1;
                         for (ksh = msh0; ksh < msh1; ksh++) {
                                 shls[2] = ksh;
-                                if ((*intor)(pbuf, NULL, shls, atm, natm, bas, nbas,
-                                             env_loc, cintopt, cache)) {
+                                if (mpbuf != NULL &&
+                                    PBCmp_int3c2e(pbuf, shls, pbcopt, atm, bas,
+                                                  env_loc, mpbuf, &mpair)) {
+                                        empty = 0;
+                                } else if ((*intor)(pbuf, NULL, shls, atm, natm, bas, nbas,
+                                                    env_loc, cintopt, cache)) {
                                         empty = 0;
                                 }
                                 dk = ao_loc[ksh+1] - ao_loc[ksh];
                                 pbuf += dij*dk * comp;
                         }
-                } else {
-                        for (i = 0; i < dijmc; i++) {
-                                pbuf[i] = 0;
+                        for (i = 0; i < nkpts; i++) {
+                                bufexp_r[i*nimgs+jLcount] = expkL_r[i*nimgs+jL];
+                                bufexp_i[i*nimgs+jLcount] = expkL_i[i*nimgs+jL];
                         }
-                        pbuf += dijmc;
+                        jLcount++;
+                }
+        }
+        if (jLcount > 0) {
+                dgemm_(&TRANS_N, &TRANS_N, &dijmc, &nkpts, &jLcount,
+                       &D1, bufL, &dijmc, bufexp_r, &nimgs,
+                       &D0, bufkL_r+(iL-iL0)*(size_t)dijmk, &dijmc);
+                dgemm_(&TRANS_N, &TRANS_N, &dijmc, &nkpts, &jLcount,
+                       &D1, bufL, &dijmc, bufexp_i, &nimgs,
+                       &D0, bufkL_i+(iL-iL0)*(size_t)dijmk, &dijmc);
+        } else {
+                pbuf = bufkL_r + (iL-iL0)*(size_t)dijmk;
+                for (i = 0; i < dijmk; i++) {
+                        pbuf[i] = 0;
+                }
+                pbuf = bufkL_i + (iL-iL0)*(size_t)dijmk;
+                for (i = 0; i < dijmk; i++) {
+                        pbuf[i] = 0;
                 }
         }
-        dgemm_(&TRANS_N, &TRANS_N, &dijmc, &nkpts, &nimgs,
-               &D1, bufL, &dijmc, expkL_r, &nimgs,
-               &D0, bufkL_r+(iL-iL0)*(size_t)dijmk, &dijmc);
-        dgemm_(&TRANS_N, &TRANS_N, &dijmc, &nkpts, &nimgs,
-               &D1, bufL, &dijmc, expkL_i, &nimgs,
-               &D0, bufkL_i+(iL-iL0)*(size_t)dijmk, &dijmc);
 
                         } // iL in range(0, nimgs)
                         // conj(exp(1j*dot(h,k)))
@@ -229,11 +287,15 @@ static void _nr3c_fill_kk(int (*intor)(), void (*fsort)(),
                          ao_loc, nkpts, nkpts_ij, comp, ish, jsh,
                          msh0, msh1);
         }
+        if (mpbuf != NULL) {
+                free(mpbuf);
+        }
 }
 
 /* ('...LM,kL,lM->...kl', int3c, exp_kL, exp_kL) */
 void PBCnr3c_fill_kks1(int (*intor)(), double complex *out, int nkpts_ij,
                        int nkpts, int comp, int nimgs, int ish, int jsh,
+                       int ksh_start, int ksh_end,
                        double *buf, double *env_loc, double *Ls,
                        double *expkL_r, double *expkL_i, int *kptij_idx,
                        int *shls_slice, int *ao_loc,
@@ -242,6 +304,7 @@ void PBCnr3c_fill_kks1(int (*intor)(), double complex *out, int nkpts_ij,
 {
         _nr3c_fill_kk(intor, &sort3c_kks1, out,
                       nkpts_ij, nkpts, comp, nimgs, ish, jsh,
+                      ksh_start, ksh_end,
                       buf, env_loc, Ls, expkL_r, expkL_i, kptij_idx,
                       shls_slice, ao_loc, cintopt, pbcopt, atm, natm, bas, nbas, env);
 }
@@ -320,6 +383,7 @@ static void sort3c_kks2_igtj(double complex *out, double *bufr, double *bufi,
 /* ('...LM,kL,lM->...kl', int3c, exp_kL, exp_kL) */
 void PBCnr3c_fill_kks2(int (*intor)(), double complex *out, int nkpts_ij,
                        int nkpts, int comp, int nimgs, int ish, int jsh,
+                       int ksh_start, int ksh_end,
                        double *buf, double *env_loc, double *Ls,
                        double *expkL_r, double *expkL_i, int *kptij_idx,
                        int *shls_slice, int *ao_loc,
@@ -331,11 +395,13 @@ void PBCnr3c_fill_kks2(int (*intor)(), double complex *out, int nkpts_ij,
         if (ip > jp) {
                 _nr3c_fill_kk(intor, &sort3c_kks2_igtj, out,
                               nkpts_ij, nkpts, comp, nimgs, ish, jsh,
+                              ksh_start, ksh_end,
                               buf, env_loc, Ls, expkL_r, expkL_i, kptij_idx,
                               shls_slice, ao_loc, cintopt, pbcopt, atm, natm, bas, nbas, env);
         } else if (ip == jp) {
                 _nr3c_fill_kk(intor, &sort3c_kks1, out,
                               nkpts_ij, nkpts, comp, nimgs, ish, jsh,
+                              ksh_start, ksh_end,
                               buf, env_loc, Ls, expkL_r, expkL_i, kptij_idx,
                               shls_slice, ao_loc, cintopt, pbcopt, atm, natm, bas, nbas, env);
         }
@@ -400,6 +466,7 @@ static void sort3c_ks1(double complex *out, double *bufr, double *bufi,
 static void _nr3c_fill_k(int (*intor)(), void (*fsort)(),
                          double complex *out, int nkpts_ij,
                          int nkpts, int comp, int nimgs, int ish, int jsh,
+                         int ksh_start, int ksh_end,
                          double *buf, double *env_loc, double *Ls,
                          double *expkL_r, double *expkL_i, int *kptij_idx,
                          int *shls_slice, int *ao_loc,
@@ -408,8 +475,6 @@ static void _nr3c_fill_k(int (*intor)(), void (*fsort)(),
 {
         const int ish0 = shls_slice[0];
         const int jsh0 = shls_slice[2];
-        const int ksh0 = shls_slice[4];
-        const int ksh1 = shls_slice[5];
 
         const char TRANS_N = 'N';
         const double D1 = 1;
@@ -422,12 +487,13 @@ static void _nr3c_fill_k(int (*intor)(), void (*fsort)(),
         const int dj = ao_loc[jsh+1] - ao_loc[jsh];
         const int dij = di * dj;
         int dkmax = INTBUFMAX10 / dij;
-        int kshloc[ksh1-ksh0+1];
-        int nkshloc = shloc_partition(kshloc, ao_loc, ksh0, ksh1, dkmax);
+        int kshloc[ksh_end-ksh_start+1];
+        int nkshloc = shloc_partition(kshloc, ao_loc, ksh_start, ksh_end, dkmax);
 
         int i, m, msh0, msh1, dijmc, empty;
         size_t dijmk;
-        int ksh, dk, iL, jL, jLcount;
+        int ksh, dk, iL, jL, jLcount, n, njL;
+        int jLs[nimgs];
         int shls[3];
         double *bufexp_r = buf;
         double *bufexp_i = bufexp_r + nimgs * nkpts;
@@ -439,6 +505,13 @@ static void _nr3c_fill_k(int (*intor)(), void (*fsort)(),
         } else {
                 fprescreen = PBCnoscreen;
         }
+        // far-field integrals from multipoles (see multipole.c)
+        int mpair;
+        double *mpbuf = NULL;
+        size_t mpsize = PBCmp_int3c2e_bufsize(pbcopt, ish, jsh, bas);
+        if (mpsize > 0) {
+                mpbuf = malloc(sizeof(double) * mpsize);
+        }
 
         shls[0] = ish;
         shls[1] = jsh;
@@ -459,14 +532,21 @@ static void _nr3c_fill_k(int (*intor)(), void (*fsort)(),
                         shift_bas(env_loc, env, Ls, iptrxyz, iL);
                         pbuf = bufL;
                         jLcount = 0;
-                        for (jL = 0; jL < nimgs; jL++) {
+                        njL = PBCpair_images(jLs, pbcopt, ish, jsh, iL, nimgs);
+                        for (n = 0; n < njL; n++) {
+                                jL = jLs[n];
                                 shift_bas(env_loc, env, Ls, jptrxyz, jL);
 
         if ((*fprescreen)(shls, pbcopt, atm, bas, env_loc)) {
+                mpair = -1;
                 for (ksh = msh0; ksh < msh1; ksh++) {
                         shls[2] = ksh;
-                        if ((*intor)(pbuf, NULL, shls, atm, natm, bas, nbas,
-                                     env_loc, cintopt, cache)) {
+                        if (mpbuf != NULL &&
+                            PBCmp_int3c2e(pbuf, shls, pbcopt, atm, bas,
+                                          env_loc, mpbuf, &mpair)) {
+                                empty = 0;
+                        } else if ((*intor)(pbuf, NULL, shls, atm, natm, bas, nbas,
+                                            env_loc, cintopt, cache)) {
                                 empty = 0;
                         }
                         dk = ao_loc[ksh+1] - ao_loc[ksh];
@@ -491,10 +571,14 @@ static void _nr3c_fill_k(int (*intor)(), void (*fsort)(),
                 (*fsort)(out, bufk_r, bufk_i, shls_slice, ao_loc,
                          nkpts, comp, ish, jsh, msh0, msh1);
         }
+        if (mpbuf != NULL) {
+                free(mpbuf);
+        }
 }
 /* ('...LM,kL,kM->...k', int3c, exp_kL, exp_kL) */
 void PBCnr3c_fill_ks1(int (*intor)(), double complex *out, int nkpts_ij,
                       int nkpts, int comp, int nimgs, int ish, int jsh,
+                      int ksh_start, int ksh_end,
                       double *buf, double *env_loc, double *Ls,
                       double *expkL_r, double *expkL_i, int *kptij_idx,
                       int *shls_slice, int *ao_loc,
@@ -503,6 +587,7 @@ void PBCnr3c_fill_ks1(int (*intor)(), double complex *out, int nkpts_ij,
 {
         _nr3c_fill_k(intor, sort3c_ks1, out,
                      nkpts_ij, nkpts, comp, nimgs, ish, jsh,
+                     ksh_start, ksh_end,
                      buf, env_loc, Ls, expkL_r, expkL_i, kptij_idx,
                      shls_slice, ao_loc, cintopt, pbcopt, atm, natm, bas, nbas, env);
 }
@@ -613,6 +698,7 @@ static void sort3c_ks2_ieqj(double complex *out, double *bufr, double *bufi,
 /* ('...LM,kL,kM->...k', int3c, exp_kL, exp_kL) */
 void PBCnr3c_fill_ks2(int (*intor)(), double complex *out, int nkpts_ij,
                       int nkpts, int comp, int nimgs, int ish, int jsh,
+                      int ksh_start, int ksh_end,
                       double *buf, double *env_loc, double *Ls,
                       double *expkL_r, double *expkL_i, int *kptij_idx,
                       int *shls_slice, int *ao_loc,
@@ -624,11 +710,13 @@ void PBCnr3c_fill_ks2(int (*intor)(), double complex *out, int nkpts_ij,
         if (ip > jp) {
                 _nr3c_fill_k(intor, &sort3c_ks2_igtj, out,
                              nkpts_ij, nkpts, comp, nimgs, ish, jsh,
+                             ksh_start, ksh_end,
                              buf, env_loc, Ls, expkL_r, expkL_i, kptij_idx,
                              shls_slice, ao_loc, cintopt, pbcopt, atm, natm, bas, nbas, env);
         } else if (ip == jp) {
                 _nr3c_fill_k(intor, &sort3c_ks2_ieqj, out,
                              nkpts_ij, nkpts, comp, nimgs, ish, jsh,
+                             ksh_start, ksh_end,
                              buf, env_loc, Ls, expkL_r, expkL_i, kptij_idx,
                              shls_slice, ao_loc, cintopt, pbcopt, atm, natm, bas, nbas, env);
         }
@@ -680,6 +768,7 @@ static void sort3c_gs1(double *out, double *in, int *shls_slice, int *ao_loc,
 
 static void _nr3c_fill_g(int (*intor)(), void (*fsort)(), double *out, int nkpts_ij,
                          int nkpts, int comp, int nimgs, int ish, int jsh,
+                         int ksh_start, int ksh_end,
                          double *buf, double *env_loc, double *Ls,
                          double *expkL_r, double *expkL_i, int *kptij_idx,
                          int *shls_slice, int *ao_loc,
@@ -688,8 +777,6 @@ static void _nr3c_fill_g(int (*intor)(), void (*fsort)(), double *out, int nkpts
 {
         const int ish0 = shls_slice[0];
         const int jsh0 = shls_slice[2];
-        const int ksh0 = shls_slice[4];
-        const int ksh1 = shls_slice[5];
 
         jsh += jsh0;
         ish += ish0;
@@ -699,11 +786,12 @@ static void _nr3c_fill_g(int (*intor)(), void (*fsort)(), double *out, int nkpts
         const int dj = ao_loc[jsh+1] - ao_loc[jsh];
         const int dij = di * dj;
         int dkmax = INTBUFMAX10 / dij / 2 * MIN(IMGBLK,nimgs);
-        int kshloc[ksh1-ksh0+1];
-        int nkshloc = shloc_partition(kshloc, ao_loc, ksh0, ksh1, dkmax);
+        int kshloc[ksh_end-ksh_start+1];
+        int nkshloc = shloc_partition(kshloc, ao_loc, ksh_start, ksh_end, dkmax);
 
         int i, m, msh0, msh1, dijm;
-        int ksh, dk, iL, jL, dijkc;
+        int ksh, dk, iL, jL, dijkc, n, njL;
+        int jLs[nimgs];
         int shls[3];
 
         int dijmc = dij * dkmax * comp;
@@ -716,6 +804,13 @@ static void _nr3c_fill_g(int (*intor)(), void (*fsort)(), double *out, int nkpts
         } else {
                 fprescreen = PBCnoscreen;
         }
+        // far-field integrals from multipoles (see multipole.c)
+        int mpair;
+        double *mpbuf = NULL;
+        size_t mpsize = PBCmp_int3c2e_bufsize(pbcopt, ish, jsh, bas);
+        if (mpsize > 0) {
+                mpbuf = malloc(sizeof(double) * mpsize);
+        }
 
         shls[0] = ish;
         shls[1] = jsh;
@@ -731,16 +826,22 @@ static void _nr3c_fill_g(int (*intor)(), void (*fsort)(), double *out, int nkpts
 
                 for (iL = 0; iL < nimgs; iL++) {
                         shift_bas(env_loc, env, Ls, iptrxyz, iL);
-                        for (jL = 0; jL < nimgs; jL++) {
+                        njL = PBCpair_images(jLs, pbcopt, ish, jsh, iL, nimgs);
+                        for (n = 0; n < njL; n++) {
+                                jL = jLs[n];
                                 shift_bas(env_loc, env, Ls, jptrxyz, jL);
 
         if ((*fprescreen)(shls, pbcopt, atm, bas, env_loc)) {
                 pbuf = bufL;
+                mpair = -1;
                 for (ksh = msh0; ksh < msh1; ksh++) {
                         shls[2] = ksh;
                         dk = ao_loc[ksh+1] - ao_loc[ksh];
                         dijkc = dij*dk * comp;
-                        if ((*intor)(buf, NULL, shls, atm, natm, bas, nbas,
+                        if ((mpbuf != NULL &&
+                             PBCmp_int3c2e(buf, shls, pbcopt, atm, bas,
+                                           env_loc, mpbuf, &mpair)) ||
+                            (*intor)(buf, NULL, shls, atm, natm, bas, nbas,
                                      env_loc, cintopt, cache)) {
                                 for (i = 0; i < dijkc; i++) {
                                         pbuf[i] += buf[i];
@@ -753,10 +854,14 @@ static void _nr3c_fill_g(int (*intor)(), void (*fsort)(), double *out, int nkpts
                 } // iL in range(0, nimgs)
                 (*fsort)(out, bufL, shls_slice, ao_loc, comp, ish, jsh, msh0, msh1);
         }
+        if (mpbuf != NULL) {
+                free(mpbuf);
+        }
 }
 /* ('...LM->...', int3c) */
 void PBCnr3c_fill_gs1(int (*intor)(), double *out, int nkpts_ij,
                       int nkpts, int comp, int nimgs, int ish, int jsh,
+                      int ksh_start, int ksh_end,
                       double *buf, double *env_loc, double *Ls,
                       double *expkL_r, double *expkL_i, int *kptij_idx,
                       int *shls_slice, int *ao_loc,
@@ -764,6 +869,7 @@ void PBCnr3c_fill_gs1(int (*intor)(), double *out, int nkpts_ij,
                       int *atm, int natm, int *bas, int nbas, double *env)
 {
      _nr3c_fill_g(intor, &sort3c_gs1, out, nkpts_ij, nkpts, comp, nimgs, ish, jsh,
+                  ksh_start, ksh_end,
                   buf, env_loc, Ls, expkL_r, expkL_i, kptij_idx,
                   shls_slice, ao_loc, cintopt, pbcopt, atm, natm, bas, nbas, env);
 }
@@ -853,6 +959,7 @@ static void sort3c_gs2_ieqj(double *out, double *in, int *shls_slice, int *ao_lo
 /* ('...LM->...', int3c) */
 void PBCnr3c_fill_gs2(int (*intor)(), double *out, int nkpts_ij,
                       int nkpts, int comp, int nimgs, int ish, int jsh,
+                      int ksh_start, int ksh_end,
                       double *buf, double *env_loc, double *Ls,
                       double *expkL_r, double *expkL_i, int *kptij_idx,
                       int *shls_slice, int *ao_loc,
@@ -864,11 +971,13 @@ void PBCnr3c_fill_gs2(int (*intor)(), double *out, int nkpts_ij,
         if (ip > jp) {
              _nr3c_fill_g(intor, &sort3c_gs2_igtj, out,
                           nkpts_ij, nkpts, comp, nimgs, ish, jsh,
+                          ksh_start, ksh_end,
                           buf, env_loc, Ls, expkL_r, expkL_i, kptij_idx,
                           shls_slice, ao_loc, cintopt, pbcopt, atm, natm, bas, nbas, env);
         } else if (ip == jp) {
              _nr3c_fill_g(intor, &sort3c_gs2_ieqj, out,
                           nkpts_ij, nkpts, comp, nimgs, ish, jsh,
+                          ksh_start, ksh_end,
                           buf, env_loc, Ls, expkL_r, expkL_i, kptij_idx,
                           shls_slice, ao_loc, cintopt, pbcopt, atm, natm, bas, nbas, env);
         }
@@ -922,24 +1031,49 @@ void PBCnr3c_drv(int (*intor)(), void (*fill)(), double complex *eri,
                         nkpts*MIN(nimgs,IMGBLK) * OF_CMPLX + nimgs;
 // MAX(INTBUFMAX, dijk) to ensure buffer is enough for at least one (i,j,k) shell
                 count*= MAX(INTBUFMAX, dijk) * comp;
+                count+= nimgs * nkpts * OF_CMPLX;
         } else {
                 count = (nkpts * OF_CMPLX + nimgs) * INTBUFMAX10 * comp;
                 count+= nimgs * nkpts * OF_CMPLX;
         }
         const int cache_size = GTOmax_cache_size(intor, shls_slice, 3,
                                                  atm, natm, bas, nbas, env);
+        // Shell pairs outside the mask are skipped. Their AO-pair columns in
+        // eri are left untouched.
+        char *pair_mask = NULL;
+        if (pbcopt != NULL && pbcopt->pair_nbas == nbas) {
+                pair_mask = pbcopt->pair_mask;
+        }
 
 #pragma omp parallel
 {
-        int ish, jsh, ij;
+        int ish, jsh, ij, kb, task;
+        // Small cells have too few shell pairs to keep all threads busy.
+        // The aux shells of each pair are then split into nkblk segments
+        // and the tasks run over (shell pair, aux segment).
+        const int nthreads = omp_get_num_threads();
+        const int nij = nish * njsh;
+        int nkblk = 1;
+        if (nij < nthreads * TASKS_PER_THREAD) {
+                nkblk = (nthreads * TASKS_PER_THREAD + nij - 1) / nij;
+        }
+        int kshblk[shls_slice[5]-shls_slice[4]+1];
+        nkblk = kshblk_partition(kshblk, ao_loc, shls_slice[4], shls_slice[5], nkblk);
         double *env_loc = malloc(sizeof(double)*nenv);
         NPdcopy(env_loc, env, nenv);
         double *buf = malloc(sizeof(double)*(count+cache_size));
 #pragma omp for schedule(dynamic)
-        for (ij = 0; ij < nish*njsh; ij++) {
+        for (task = 0; task < nij*nkblk; task++) {
+                ij = task / nkblk;
+                kb = task % nkblk;
                 ish = ij / njsh;
                 jsh = ij % njsh;
+                if (pair_mask != NULL &&
+                    !pair_mask[(size_t)(ish0+ish)*nbas + jsh0+jsh-nbas]) {
+                        continue;
+                }
                 (*fill)(intor, eri, nkpts_ij, nkpts, comp, nimgs, ish, jsh,
+                        kshblk[kb], kshblk[kb+1],
                         buf, env_loc, Ls, expkL_r, expkL_i, kptij_idx,
                         shls_slice, ao_loc, cintopt, pbcopt, atm, natm, bas, nbas, env);
         }
@@ -993,12 +1127,17 @@ static void sort2c_ks1(double complex *out, double *bufr, double *bufi,
                 out += nij * comp;
         }
 }
-static void _nr2c_fill(int (*intor)(), double complex *out,
+/*
+ * The integrals of the nop operators intors[n] are stacked along the comp
+ * axis, comp = sum(comps). All operators share the basis shifts and the
+ * phase GEMMs of the lattice sum.
+ */
+static void _nr2c_fill(int (**intors)(), int *comps, int nop, double complex *out,
                        int nkpts, int comp, int nimgs, int jsh, int ish0,
                        double *buf, double *env_loc, double *Ls,
                        double *expkL_r, double *expkL_i,
                        int *shls_slice, int *ao_loc,
-                       CINTOpt *cintopt, PBCOpt *pbcopt,
+                       CINTOpt **cintopts, PBCOpt *pbcopt,
                        int *atm, int natm, int *bas, int nbas, double *env)
 {
         const int ish1 = shls_slice[1];
@@ -1017,8 +1156,10 @@ static void _nr2c_fill(int (*intor)(), double complex *out,
         int nishloc = shloc_partition(ishloc, ao_loc, ish0, ish1, dimax);
 
         int m, msh0, msh1, dmjc, ish, di, empty;
-        int jL;
+        int jL, n;
         int shls[2];
+        // far-field images of int2c2e are evaluated from the multipoles
+        const int mp_far = (nop == 1 && pbcopt != NULL && pbcopt->mp_moments != NULL);
         double *bufk_r = buf;
         double *bufk_i, *bufL, *pbuf, *cache;
 
@@ -1038,11 +1179,21 @@ static void _nr2c_fill(int (*intor)(), double complex *out,
                         for (ish = msh0; ish < msh1; ish++) {
                                 shls[0] = ish;
                                 di = ao_loc[ish+1] - ao_loc[ish];
-                                if ((*intor)(pbuf, NULL, shls, atm, natm, bas, nbas,
-                                             env_loc, cintopt, cache)) {
-                                        empty = 0;
+                                if (mp_far && PBCmp_far2c(shls, pbcopt, atm, bas, env_loc)) {
+                                        // added by PBCnr2c_multipole_fill
+                                        for (n = 0; n < di * dj * comp; n++) {
+                                                pbuf[n] = 0;
+                                        }
+                                        pbuf += di * dj * comp;
+                                        continue;
+                                }
+                                for (n = 0; n < nop; n++) {
+                                        if ((*intors[n])(pbuf, NULL, shls, atm, natm, bas, nbas,
+                                                         env_loc, cintopts[n], cache)) {
+                                                empty = 0;
+                                        }
+                                        pbuf += di * dj * comps[n];
                                 }
-                                pbuf += di * dj * comp;
                         }
                 }
                 dgemm_(&TRANS_N, &TRANS_N, &dmjc, &nkpts, &nimgs,
@@ -1064,9 +1215,9 @@ void PBCnr2c_fill_ks1(int (*intor)(), double complex *out,
                       CINTOpt *cintopt, PBCOpt *pbcopt,
                       int *atm, int natm, int *bas, int nbas, double *env)
 {
-        _nr2c_fill(intor, out, nkpts, comp, nimgs, jsh, 0,
+        _nr2c_fill(&intor, &comp, 1, out, nkpts, comp, nimgs, jsh, 0,
                    buf, env_loc, Ls, expkL_r, expkL_i, shls_slice, ao_loc,
-                   cintopt, pbcopt, atm, natm, bas, nbas, env);
+                   &cintopt, pbcopt, atm, natm, bas, nbas, env);
 }
 
 void PBCnr2c_fill_ks2(int (*intor)(), double complex *out,
@@ -1077,9 +1228,9 @@ void PBCnr2c_fill_ks2(int (*intor)(), double complex *out,
                       CINTOpt *cintopt, PBCOpt *pbcopt,
                       int *atm, int natm, int *bas, int nbas, double *env)
 {
-        _nr2c_fill(intor, out, nkpts, comp, nimgs, jsh, jsh,
+        _nr2c_fill(&intor, &comp, 1, out, nkpts, comp, nimgs, jsh, jsh,
                    buf, env_loc, Ls, expkL_r, expkL_i, shls_slice, ao_loc,
-                   cintopt, pbcopt, atm, natm, bas, nbas, env);
+                   &cintopt, pbcopt, atm, natm, bas, nbas, env);
 }
 
 void PBCnr2c_drv(int (*intor)(), void (*fill)(), double complex *out,
@@ -1118,6 +1269,93 @@ void PBCnr2c_drv(int (*intor)(), void (*fill)(), double complex *out,
         free(buf);
         free(env_loc);
 }
+        if (pbcopt != NULL && pbcopt->mp_moments != NULL) {
+                PBCnr2c_multipole_fill(out, nkpts, nimgs, (fill == &PBCnr2c_fill_ks2),
+                                       Ls, expkL_r, expkL_i, shls_slice, ao_loc, pbcopt,
+                                       atm, natm, bas, nbas, env);
+        }
         free(expkL_r);
 }
 
+
+/*
+ * PBCnr2c_drv for hermi != 0. fill is PBCnr2c_fill_ks2 which computes the
+ * lower triangle of out[nkpts,comp,naoi,naoi] for all k-points in one sweep
+ * over the images. The upper triangles are filled in parallel afterwards.
+ */
+void PBCnr2c_hermi_drv(int (*intor)(), void (*fill)(), double complex *out,
+                       int nkpts, int comp, int nimgs, int hermi,
+                       double *Ls, double complex *expkL,
+                       int *shls_slice, int *ao_loc,
+                       CINTOpt *cintopt, PBCOpt *pbcopt,
+                       int *atm, int natm, int *bas, int nbas, double *env, int nenv)
+{
+        PBCnr2c_drv(intor, fill, out, nkpts, comp, nimgs, Ls, expkL,
+                    shls_slice, ao_loc, cintopt, pbcopt,
+                    atm, natm, bas, nbas, env, nenv);
+        const int naoi = ao_loc[shls_slice[1]] - ao_loc[shls_slice[0]];
+        NPzhermi_triu_nmat(nkpts * comp, naoi, out, hermi);
+}
+
+/*
+ * Lattice sums of several 2-center operators (e.g. int1e_ovlp and int1e_kin)
+ * for all k-points in one sweep over shell pairs and images.
+ * out[nkpts,comp,naoi,naoj] with the components of intors[0], intors[1], ...
+ * stacked along comp = sum(comps). hermi != 0 computes the lower triangles
+ * only and fills the upper triangles as PBCnr2c_hermi_drv does.
+ */
+void PBCnr2c_multi_drv(int (**intors)(), int *comps, int nop, int hermi,
+                       double complex *out, int nkpts, int nimgs,
+                       double *Ls, double complex *expkL,
+                       int *shls_slice, int *ao_loc,
+                       CINTOpt **cintopts, PBCOpt *pbcopt,
+                       int *atm, int natm, int *bas, int nbas, double *env, int nenv)
+{
+        const int jsh0 = shls_slice[2];
+        const int jsh1 = shls_slice[3];
+        const int njsh = jsh1 - jsh0;
+        double *expkL_r = malloc(sizeof(double) * nimgs*nkpts * OF_CMPLX);
+        double *expkL_i = expkL_r + nimgs*nkpts;
+        int i, n;
+        for (i = 0; i < nimgs*nkpts; i++) {
+                expkL_r[i] = creal(expkL[i]);
+                expkL_i[i] = cimag(expkL[i]);
+        }
+        int comp = 0;
+        int cache_size = 0;
+        for (n = 0; n < nop; n++) {
+                comp += comps[n];
+                cache_size = MAX(cache_size,
+                                 GTOmax_cache_size(intors[n], shls_slice, 2,
+                                                   atm, natm, bas, nbas, env));
+        }
+
+#pragma omp parallel
+{
+        int jsh;
+        double *env_loc = malloc(sizeof(double)*nenv);
+        NPdcopy(env_loc, env, nenv);
+        size_t count = nkpts * OF_CMPLX + nimgs;
+        double *buf = malloc(sizeof(double)*(count*INTBUFMAX10*comp+cache_size));
+#pragma omp for schedule(dynamic)
+        for (jsh = 0; jsh < njsh; jsh++) {
+                _nr2c_fill(intors, comps, nop, out, nkpts, comp, nimgs, jsh,
+                           (hermi ? jsh : 0), buf, env_loc, Ls, expkL_r, expkL_i,
+                           shls_slice, ao_loc, cintopts, pbcopt,
+                           atm, natm, bas, nbas, env);
+        }
+        free(buf);
+        free(env_loc);
+}
+        if (nop == 1 && pbcopt != NULL && pbcopt->mp_moments != NULL) {
+                PBCnr2c_multipole_fill(out, nkpts, nimgs, hermi, Ls, expkL_r, expkL_i,
+                                       shls_slice, ao_loc, pbcopt,
+                                       atm, natm, bas, nbas, env);
+        }
+        free(expkL_r);
+
+        if (hermi) {
+                const int naoi = ao_loc[shls_slice[1]] - ao_loc[shls_slice[0]];
+                NPzhermi_triu_nmat(nkpts * comp, naoi, out, hermi);
+        }
+}
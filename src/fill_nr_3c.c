@@ -18,6 +18,8 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <math.h>
+#include <assert.h>
 #include "config.h"
 #include "cint.h"
 #include "np_helper.h"
@@ -25,12 +27,128 @@
 
 #define BLKSIZE 8
 
+/*
+ * Cost estimate of the integrals of one shell: the number of functions
+ * times the number of primitives
+ */
+double GTO3c_shell_cost(int sh, int *ao_loc, int *bas)
+{
+        return (double)(ao_loc[sh+1] - ao_loc[sh]) * bas[NPRIM_OF+sh*BAS_SLOTS];
+}
+
+typedef struct {
+        double cost;
+        int id;
+} _Task3c;
+
+static int _task_cost_cmp(const void *a, const void *b)
+{
+        double ca = ((_Task3c *)a)->cost;
+        double cb = ((_Task3c *)b)->cost;
+        // descending order
+        return (ca < cb) - (ca > cb);
+}
+
+/*
+ * Sort the job ids by descending cost so that the dynamic schedule hands out
+ * the expensive jobs first.
+ */
+void GTO3c_sort_jobs(int *jobs, double *cost, int njobs)
+{
+        _Task3c *tasks = malloc(sizeof(_Task3c) * njobs);
+        int n;
+        for (n = 0; n < njobs; n++) {
+                tasks[n].cost = cost[n];
+                tasks[n].id = n;
+        }
+        qsort(tasks, njobs, sizeof(_Task3c), _task_cost_cmp);
+        for (n = 0; n < njobs; n++) {
+                jobs[n] = tasks[n].id;
+        }
+        free(tasks);
+}
+
+/*
+ * Schwarz bounds for the 3-center integrals (ij|k) of shls_slice,
+ *      |(ij|k)| <= q_ij[ish,jsh] * q_k[ksh]
+ * q_ij = sqrt(max|(ij|ij)|) of intor2e, q_k = sqrt(max|(k|k)|) of intor2c.
+ * The indices are counted from the beginning of each range of shls_slice.
+ */
+void GTOnr3c_q_cond(int (*intor2e)(), int (*intor2c)(),
+                    double *q_ij, double *q_k, int *shls_slice, int *ao_loc,
+                    int *atm, int natm, int *bas, int nbas, double *env)
+{
+        const int ish0 = shls_slice[0];
+        const int ish1 = shls_slice[1];
+        const int jsh0 = shls_slice[2];
+        const int jsh1 = shls_slice[3];
+        const int ksh0 = shls_slice[4];
+        const int ksh1 = shls_slice[5];
+        const int nish = ish1 - ish0;
+        const int njsh = jsh1 - jsh0;
+        const int di = GTOmax_shell_dim(ao_loc, shls_slice, 3);
+        int cache_size = GTOmax_cache_size(intor2e, shls_slice, 2,
+                                           atm, natm, bas, nbas, env);
+        cache_size = MAX(cache_size, GTOmax_cache_size(intor2c, shls_slice+4, 1,
+                                                       atm, natm, bas, nbas, env));
+#pragma omp parallel
+{
+        int ish, jsh, ksh, i, j, dij, dk;
+        size_t ij;
+        int shls[4];
+        double qtmp;
+        double *buf = malloc(sizeof(double) * (di*di*di*di + cache_size));
+        double *cache = buf + di*di*di*di;
+#pragma omp for schedule(dynamic, 4)
+        for (ij = 0; ij < (size_t)nish*njsh; ij++) {
+                ish = ij / njsh + ish0;
+                jsh = ij % njsh + jsh0;
+                shls[0] = ish;
+                shls[1] = jsh;
+                shls[2] = ish;
+                shls[3] = jsh;
+                dij = (ao_loc[ish+1] - ao_loc[ish]) * (ao_loc[jsh+1] - ao_loc[jsh]);
+                qtmp = 0;
+                if ((*intor2e)(buf, NULL, shls, atm, natm, bas, nbas, env,
+                               NULL, cache)) {
+                        for (i = 0; i < dij; i++) {
+                                qtmp = MAX(qtmp, fabs(buf[i*dij+i]));
+                        }
+                }
+                q_ij[ij] = sqrt(qtmp);
+        }
+#pragma omp for schedule(dynamic, 4)
+        for (ksh = ksh0; ksh < ksh1; ksh++) {
+                shls[0] = ksh;
+                shls[1] = ksh;
+                dk = ao_loc[ksh+1] - ao_loc[ksh];
+                qtmp = 0;
+                if ((*intor2c)(buf, NULL, shls, atm, natm, bas, nbas, env,
+                               NULL, cache)) {
+                        for (j = 0; j < dk; j++) {
+                                qtmp = MAX(qtmp, fabs(buf[j*dk+j]));
+                        }
+                }
+                q_k[ksh-ksh0] = sqrt(qtmp);
+        }
+        free(buf);
+}
+}
+
+static int _3c_screened(double *q_ij, double *q_k, double cutoff,
+                        int ij, int k)
+{
+        return (q_ij != NULL && q_ij[ij] * q_k[k] < cutoff);
+}
+
 /*
  * out[naoi,naoj,naok,comp] in F-order
+ * Fill the block ksh of jsh in [jstart, jend)
  */
 void GTOnr3c_fill_s1(int (*intor)(), double *out, double *buf,
-                     int comp, int jobid,
+                     int comp, int ksh, int jstart, int jend,
                      int *shls_slice, int *ao_loc, CINTOpt *cintopt,
+                     double *q_ij, double *q_k, double cutoff,
                      int *atm, int natm, int *bas, int nbas, double *env)
 {
         const int ish0 = shls_slice[0];
@@ -39,32 +157,42 @@ void GTOnr3c_fill_s1(int (*intor)(), double *out, double *buf,
         const int jsh1 = shls_slice[3];
         const int ksh0 = shls_slice[4];
         const int ksh1 = shls_slice[5];
-        const int nksh = ksh1 - ksh0;
-
-        const int ksh = jobid % nksh + ksh0;
-        const int jstart = jobid / nksh * BLKSIZE + jsh0;
-        const int jend = MIN(jstart + BLKSIZE, jsh1);
-        if (jstart >= jend) {
-                return;
-        }
+        const int njsh = jsh1 - jsh0;
 
         const size_t naoi = ao_loc[ish1] - ao_loc[ish0];
         const size_t naoj = ao_loc[jsh1] - ao_loc[jsh0];
         const size_t naok = ao_loc[ksh1] - ao_loc[ksh0];
+        const size_t nijk = naoi * naoj * naok;
         const int dims[] = {naoi, naoj, naok};
 
         const int k0 = ao_loc[ksh] - ao_loc[ksh0];
+        const int dk = ao_loc[ksh+1] - ao_loc[ksh];
         out += naoi * naoj * k0;
 
-        int ish, jsh, i0, j0;
+        int ish, jsh, i0, j0, di, dj, i, j, k, ic;
         int shls[3] = {0, 0, ksh};
+        double *pout;
 
         for (jsh = jstart; jsh < jend; jsh++) {
         for (ish = ish0; ish < ish1; ish++) {
-                shls[0] = ish;
-                shls[1] = jsh;
                 i0 = ao_loc[ish] - ao_loc[ish0];
                 j0 = ao_loc[jsh] - ao_loc[jsh0];
+                if (_3c_screened(q_ij, q_k, cutoff, (ish-ish0)*njsh+jsh-jsh0,
+                                 ksh-ksh0)) {
+                        di = ao_loc[ish+1] - ao_loc[ish];
+                        dj = ao_loc[jsh+1] - ao_loc[jsh];
+                        for (ic = 0; ic < comp; ic++) {
+                        for (k = 0; k < dk; k++) {
+                        for (j = 0; j < dj; j++) {
+                                pout = out + ic * nijk + (k*naoj+j0+j) * naoi + i0;
+                                for (i = 0; i < di; i++) {
+                                        pout[i] = 0;
+                                }
+                        } } }
+                        continue;
+                }
+                shls[0] = ish;
+                shls[1] = jsh;
                 (*intor)(out+j0*naoi+i0, dims, shls, atm, natm, bas, nbas, env,
                          cintopt, buf);
         } }
@@ -123,10 +251,12 @@ static void dcopy_s2_ieqj(double *out, double *in, int comp,
  *     [*****  ]
  *     [*****. ]  <= . may not be filled, if jsh-upper-bound < ish-upper-bound
  *     [      \]
+ * Fill the block ksh of ish in [istart, iend)
  */
 void GTOnr3c_fill_s2ij(int (*intor)(), double *out, double *buf,
-                       int comp, int jobid,
+                       int comp, int ksh, int istart, int iend,
                        int *shls_slice, int *ao_loc, CINTOpt *cintopt,
+                       double *q_ij, double *q_k, double cutoff,
                        int *atm, int natm, int *bas, int nbas, double *env)
 {
         const int ish0 = shls_slice[0];
@@ -135,14 +265,7 @@ void GTOnr3c_fill_s2ij(int (*intor)(), double *out, double *buf,
         const int jsh1 = shls_slice[3];
         const int ksh0 = shls_slice[4];
         const int ksh1 = shls_slice[5];
-        const int nksh = ksh1 - ksh0;
-
-        const int ksh = jobid % nksh + ksh0;
-        const int istart = jobid / nksh * BLKSIZE + ish0;
-        const int iend = MIN(istart + BLKSIZE, ish1);
-        if (istart >= iend) {
-                return;
-        }
+        const int njsh = jsh1 - jsh0;
 
         const int i0 = ao_loc[ish0];
         const int i1 = ao_loc[ish1];
@@ -155,7 +278,7 @@ void GTOnr3c_fill_s2ij(int (*intor)(), double *out, double *buf,
         const int k0 = ao_loc[ksh] - ao_loc[ksh0];
         out += nij * k0;
 
-        int ish, jsh, ip, jp, di, dj;
+        int ish, jsh, ip, jp, di, dj, i;
         int shls[3] = {0, 0, ksh};
         di = GTOmax_shell_dim(ao_loc, shls_slice, 2);
         double *cache = buf + di * di * dk * comp;
@@ -173,7 +296,15 @@ void GTOnr3c_fill_s2ij(int (*intor)(), double *out, double *buf,
                 di = ao_loc[ish+1] - ao_loc[ish];
                 dj = ao_loc[jsh+1] - ao_loc[jsh];
 
-                (*intor)(buf, NULL, shls, atm, natm, bas, nbas, env, cintopt, cache);
+                if (_3c_screened(q_ij, q_k, cutoff, (ish-ish0)*njsh+jsh-jsh0,
+                                 ksh-ksh0)) {
+                        for (i = 0; i < di*dj*dk*comp; i++) {
+                                buf[i] = 0;
+                        }
+                } else {
+                        (*intor)(buf, NULL, shls, atm, natm, bas, nbas, env,
+                                 cintopt, cache);
+                }
 
                 pout = out + ip * (ip + 1) / 2 - off + jp;
                 if (ip != jp) {
@@ -184,18 +315,111 @@ void GTOnr3c_fill_s2ij(int (*intor)(), double *out, double *buf,
         } }
 }
 
+/*
+ * (i|jk) with jk symmetric, out[comp,naoi,njk] in C-order, the (k|ij)-style
+ * layout of the auxiliary index in front of the pair index
+ * njk = j1*(j1+1)/2 - j0*(j0+1)/2
+ *
+ * As in GTOnr3c_fill_s2ij, the two indices of the symmetric pair are counted
+ * differently: j from the first AO of the environment, k from the first AO of
+ * ksh0. j and k have to be the same basis, either one set of shells
+ * (ksh0 = 0) or the two copies of conc_env(bas, bas) (ksh0 >= jsh1).
+ */
+static void dcopy_s2jk(double *out, double *in, int comp, int i0,
+                       int jp, int kp, size_t off, size_t njk, size_t nijk,
+                       int di, int dj, int dk, int jeqk)
+{
+        const size_t dijk = (size_t)di * dj * dk;
+        int i, j, k, ic, kmax;
+        size_t jk0;
+        double *pout, *pin;
+        for (ic = 0; ic < comp; ic++) {
+                for (j = 0; j < dj; j++) {
+                        jk0 = (size_t)(jp + j) * (jp + j + 1) / 2 - off + kp;
+                        kmax = jeqk ? j + 1 : dk;
+                        for (k = 0; k < kmax; k++) {
+                                pout = out + (size_t)i0 * njk + jk0 + k;
+                                pin = in + ((size_t)k * dj + j) * di;
+                                for (i = 0; i < di; i++) {
+                                        pout[i*njk] = pin[i];
+                                }
+                        }
+                }
+                out += nijk;
+                in  += dijk;
+        }
+}
+/*
+ * out[comp,naoi,njk] in C-order, the (k|ij) layout of (i|jk) with j >= k.
+ * Fill the block ish of jsh in [jstart, jend)
+ */
 void GTOnr3c_fill_s2jk(int (*intor)(), double *out, double *buf,
-                       int comp, int jobid,
+                       int comp, int ish, int jstart, int jend,
                        int *shls_slice, int *ao_loc, CINTOpt *cintopt,
+                       double *q_ij, double *q_k, double cutoff,
                        int *atm, int natm, int *bas, int nbas, double *env)
 {
-        fprintf(stderr, "GTOnr3c_fill_s2jk not implemented\n");
-        exit(1);
+        const int ish0 = shls_slice[0];
+        const int ish1 = shls_slice[1];
+        const int jsh0 = shls_slice[2];
+        const int jsh1 = shls_slice[3];
+        const int ksh0 = shls_slice[4];
+        const int ksh1 = shls_slice[5];
+        const int njsh = jsh1 - jsh0;
+
+        const int j0 = ao_loc[jsh0];
+        const int j1 = ao_loc[jsh1];
+        const size_t naoi = ao_loc[ish1] - ao_loc[ish0];
+        const size_t off = (size_t)j0 * (j0 + 1) / 2;
+        const size_t njk = (size_t)j1 * (j1 + 1) / 2 - off;
+        const size_t nijk = njk * naoi;
+        const int i0 = ao_loc[ish] - ao_loc[ish0];
+        const int di = ao_loc[ish+1] - ao_loc[ish];
+
+        assert(ksh0 == 0 || ksh0 >= jsh1);
+
+        int jsh, ksh, jp, kp, dj, dk, i;
+        int shls[3] = {ish, 0, 0};
+        dj = GTOmax_shell_dim(ao_loc, shls_slice+2, 2);
+        double *cache = buf + di * dj * dj * comp;
+
+        for (jsh = jstart; jsh < jend; jsh++) {
+        for (ksh = ksh0; ksh < ksh1; ksh++) {
+                jp = ao_loc[jsh];
+                kp = ao_loc[ksh] - ao_loc[ksh0];
+                if (jp < kp) {
+                        continue;
+                }
+                shls[1] = jsh;
+                shls[2] = ksh;
+                dj = ao_loc[jsh+1] - ao_loc[jsh];
+                dk = ao_loc[ksh+1] - ao_loc[ksh];
+
+                if (_3c_screened(q_ij, q_k, cutoff, (ish-ish0)*njsh+jsh-jsh0,
+                                 ksh-ksh0)) {
+                        for (i = 0; i < di*dj*dk*comp; i++) {
+                                buf[i] = 0;
+                        }
+                } else {
+                        (*intor)(buf, NULL, shls, atm, natm, bas, nbas, env,
+                                 cintopt, cache);
+                }
+                dcopy_s2jk(out, buf, comp, i0, jp, kp, off, njk, nijk,
+                           di, dj, dk, jp == kp);
+        } }
 }
 
-void GTOnr3c_drv(int (*intor)(), void (*fill)(), double *eri, int comp,
-                 int *shls_slice, int *ao_loc, CINTOpt *cintopt,
-                 int *atm, int natm, int *bas, int nbas, double *env)
+/*
+ * Cost-balanced jobs for GTOnr3c_screen_drv. A job is a block of the outer
+ * shells [sh0, sh1) for one fixed shell. The outer shells are split into
+ * blocks of about equal cost (including the screening of q_ij); the job cost
+ * is the block cost times the cost of the fixed shell.
+ *
+ * For s1 and s2ij the fixed shell is ksh, the outer shells are jsh (s1) or
+ * ish (s2ij). For s2jk the fixed shell is ish, the outer shells are jsh.
+ */
+static int _nr3c_jobs(int **pjob_loc, void (*fill)(), int *shls_slice, int *ao_loc,
+                      double *q_ij, double *q_k, double cutoff, int *bas)
 {
         const int ish0 = shls_slice[0];
         const int ish1 = shls_slice[1];
@@ -205,11 +429,138 @@ void GTOnr3c_drv(int (*intor)(), void (*fill)(), double *eri, int comp,
         const int ksh1 = shls_slice[5];
         const int nish = ish1 - ish0;
         const int njsh = jsh1 - jsh0;
-        const int nksh = ksh1 - ksh0;
+        int p0, p1, q0, q1, f0, f1;
+        if (fill == &GTOnr3c_fill_s2jk) {
+                f0 = ish0; f1 = ish1;
+                p0 = jsh0; p1 = jsh1;
+                q0 = ksh0; q1 = ksh1;
+        } else if (fill == &GTOnr3c_fill_s2ij) {
+                f0 = ksh0; f1 = ksh1;
+                p0 = ish0; p1 = ish1;
+                q0 = jsh0; q1 = jsh1;
+        } else {
+                f0 = ksh0; f1 = ksh1;
+                p0 = jsh0; p1 = jsh1;
+                q0 = ish0; q1 = ish1;
+        }
+        const int np = p1 - p0;
+        double *row_cost = malloc(sizeof(double) * (np + 1));
+        double qk_max = 0;
+        int p, q, n;
+        if (q_ij != NULL) {
+                for (n = 0; n < ksh1 - ksh0; n++) {
+                        qk_max = MAX(qk_max, q_k[n]);
+                }
+        }
+
+        double total = 0;
+        double c;
+        double qmax = 0;
+        for (p = p0; p < p1; p++) {
+                if (q_ij != NULL && fill == &GTOnr3c_fill_s2jk) {
+                        // bound over all ish of the pair (jsh, ksh)
+                        qmax = 0;
+                        for (n = 0; n < nish; n++) {
+                                qmax = MAX(qmax, q_ij[n*njsh+p-jsh0]);
+                        }
+                }
+                c = 0;
+                for (q = q0; q < q1; q++) {
+                        if (fill == &GTOnr3c_fill_s2ij &&
+                            ao_loc[p] < ao_loc[q] - ao_loc[jsh0]) {
+                                continue;
+                        }
+                        if (fill == &GTOnr3c_fill_s2jk &&
+                            ao_loc[p] < ao_loc[q] - ao_loc[ksh0]) {
+                                continue;
+                        }
+                        if (q_ij != NULL) {
+                                if (fill == &GTOnr3c_fill_s2jk) {
+                                        if (qmax * q_k[q-ksh0] < cutoff) {
+                                                continue;
+                                        }
+                                } else if (fill == &GTOnr3c_fill_s2ij) {
+                                        if (q_ij[(p-ish0)*njsh+q-jsh0] * qk_max < cutoff) {
+                                                continue;
+                                        }
+                                } else {
+                                        if (q_ij[(q-ish0)*njsh+p-jsh0] * qk_max < cutoff) {
+                                                continue;
+                                        }
+                                }
+                        }
+                        c += GTO3c_shell_cost(q, ao_loc, bas);
+                }
+                row_cost[p-p0] = c * GTO3c_shell_cost(p, ao_loc, bas);
+                total += row_cost[p-p0];
+        }
+
+        // About as many blocks as the fixed size BLKSIZE would give
+        int nblk_target = np / BLKSIZE + 1;
+        double target = total / nblk_target;
+        int *blk_loc = malloc(sizeof(int) * (np + 2));
+        int nblk = 0;
+        blk_loc[0] = p0;
+        c = 0;
+        for (p = p0; p < p1; p++) {
+                c += row_cost[p-p0];
+                if (c >= target || p == p1 - 1) {
+                        nblk++;
+                        blk_loc[nblk] = p + 1;
+                        c = 0;
+                }
+        }
+        if (nblk == 0) {
+                nblk = 1;
+                blk_loc[1] = p1;
+        }
+
+        const int nf = f1 - f0;
+        const int njobs = nblk * nf;
+        double *job_cost = malloc(sizeof(double) * njobs);
+        int *jobs = malloc(sizeof(int) * njobs);
+        int *job_loc = malloc(sizeof(int) * njobs * 3);
+        int f, b;
+        for (f = 0; f < nf; f++) {
+        for (b = 0; b < nblk; b++) {
+                c = 0;
+                for (p = blk_loc[b]; p < blk_loc[b+1]; p++) {
+                        c += row_cost[p-p0];
+                }
+                job_cost[f*nblk+b] = c * GTO3c_shell_cost(f+f0, ao_loc, bas);
+        } }
+        GTO3c_sort_jobs(jobs, job_cost, njobs);
+        for (n = 0; n < njobs; n++) {
+                f = jobs[n] / nblk;
+                b = jobs[n] % nblk;
+                job_loc[n*3+0] = f + f0;
+                job_loc[n*3+1] = blk_loc[b];
+                job_loc[n*3+2] = blk_loc[b+1];
+        }
+        free(row_cost);
+        free(blk_loc);
+        free(job_cost);
+        free(jobs);
+        *pjob_loc = job_loc;
+        return njobs;
+}
+
+/*
+ * 3-center integrals with Schwarz screening. Integrals with
+ * q_ij[ish,jsh] * q_k[ksh] < cutoff are set to zero. q_ij and q_k can be
+ * generated by GTOnr3c_q_cond. Without screening, q_ij = NULL.
+ */
+void GTOnr3c_screen_drv(int (*intor)(), void (*fill)(), double *eri, int comp,
+                        int *shls_slice, int *ao_loc, CINTOpt *cintopt,
+                        double *q_ij, double *q_k, double cutoff,
+                        int *atm, int natm, int *bas, int nbas, double *env)
+{
         const int di = GTOmax_shell_dim(ao_loc, shls_slice, 3);
         const int cache_size = GTOmax_cache_size(intor, shls_slice, 3,
                                                  atm, natm, bas, nbas, env);
-        const int njobs = (MAX(nish,njsh) / BLKSIZE + 1) * nksh;
+        int *job_loc;
+        const int njobs = _nr3c_jobs(&job_loc, fill, shls_slice, ao_loc,
+                                     q_ij, q_k, cutoff, bas);
 
 #pragma omp parallel
 {
@@ -217,10 +568,20 @@ void GTOnr3c_drv(int (*intor)(), void (*fill)(), double *eri, int comp,
         double *buf = malloc(sizeof(double) * (di*di*di*comp + cache_size));
 #pragma omp for nowait schedule(dynamic)
         for (jobid = 0; jobid < njobs; jobid++) {
-                (*fill)(intor, eri, buf, comp, jobid, shls_slice, ao_loc,
-                        cintopt, atm, natm, bas, nbas, env);
+                (*fill)(intor, eri, buf, comp, job_loc[jobid*3],
+                        job_loc[jobid*3+1], job_loc[jobid*3+2],
+                        shls_slice, ao_loc, cintopt, q_ij, q_k, cutoff,
+                        atm, natm, bas, nbas, env);
         }
         free(buf);
 }
+        free(job_loc);
 }
 
+void GTOnr3c_drv(int (*intor)(), void (*fill)(), double *eri, int comp,
+                 int *shls_slice, int *ao_loc, CINTOpt *cintopt,
+                 int *atm, int natm, int *bas, int nbas, double *env)
+{
+        GTOnr3c_screen_drv(intor, fill, eri, comp, shls_slice, ao_loc, cintopt,
+                           NULL, NULL, 0, atm, natm, bas, nbas, env);
+}
@@ -19,16 +19,28 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <complex.h>
+#include <assert.h>
 #include "config.h"
 #include "cint.h"
+#include "np_helper.h"
 #include "gto.h"
 
+double GTO3c_shell_cost(int sh, int *ao_loc, int *bas);
+void GTO3c_sort_jobs(int *jobs, double *cost, int njobs);
+
+static int _3c_screened(double *q_ij, double *q_k, double cutoff,
+                        int ij, int k)
+{
+        return (q_ij != NULL && q_ij[ij] * q_k[k] < cutoff);
+}
+
 /*
  * out[naoi,naoj,naok,comp] in F-order
  */
 void GTOr3c_fill_s1(int (*intor)(), double complex *out, double complex *buf,
                     int comp, int ish, int jsh,
                     int *shls_slice, int *ao_loc, CINTOpt *cintopt,
+                    double *q_ij, double *q_k, double cutoff,
                     int *atm, int natm, int *bas, int nbas, double *env)
 {
         const int ish0 = shls_slice[0];
@@ -41,16 +53,21 @@ void GTOr3c_fill_s1(int (*intor)(), double complex *out, double complex *buf,
         const size_t naoj = ao_loc[jsh1] - ao_loc[jsh0];
         const size_t naok = ao_loc[ksh1] - ao_loc[ksh0];
         const size_t nij = naoi * naoj;
+        const size_t nijk = nij * naok;
         const int dims[] = {naoi, naoj, naok};
+        const int ij = ish * (jsh1 - jsh0) + jsh;
 
         ish += ish0;
         jsh += jsh0;
         const int ip = ao_loc[ish] - ao_loc[ish0];
         const int jp = ao_loc[jsh] - ao_loc[jsh0];
+        const int di = ao_loc[ish+1] - ao_loc[ish];
+        const int dj = ao_loc[jsh+1] - ao_loc[jsh];
         out += jp * naoi + ip;
 
-        int ksh, k0;
+        int ksh, k0, dk, i, j, k, ic;
         int shls[3];
+        double complex *pout;
 
         shls[0] = ish;
         shls[1] = jsh;
@@ -58,6 +75,18 @@ void GTOr3c_fill_s1(int (*intor)(), double complex *out, double complex *buf,
         for (ksh = ksh0; ksh < ksh1; ksh++) {
                 shls[2] = ksh;
                 k0 = ao_loc[ksh  ] - ao_loc[ksh0];
+                if (_3c_screened(q_ij, q_k, cutoff, ij, ksh-ksh0)) {
+                        dk = ao_loc[ksh+1] - ao_loc[ksh];
+                        for (ic = 0; ic < comp; ic++) {
+                        for (k = 0; k < dk; k++) {
+                        for (j = 0; j < dj; j++) {
+                                pout = out + ic * nijk + (k0+k) * nij + j * naoi;
+                                for (i = 0; i < di; i++) {
+                                        pout[i] = 0;
+                                }
+                        } } }
+                        continue;
+                }
                 (*intor)(out+k0*nij, dims, shls, atm, natm, bas, nbas, env, cintopt, buf);
         }
 }
@@ -119,11 +148,13 @@ static void zcopy_s2_ieqj(double complex *out, double complex *in, int comp,
 void GTOr3c_fill_s2ij(int (*intor)(), double complex *out, double complex *buf,
                       int comp, int ish, int jsh,
                       int *shls_slice, int *ao_loc, CINTOpt *cintopt,
+                      double *q_ij, double *q_k, double cutoff,
                       int *atm, int natm, int *bas, int nbas, double *env)
 {
         const int ish0 = shls_slice[0];
         const int ish1 = shls_slice[1];
         const int jsh0 = shls_slice[2];
+        const int ij = ish * (shls_slice[3] - jsh0) + jsh;
         ish += ish0;
         jsh += jsh0;
         const int ip = ao_loc[ish];
@@ -145,7 +176,7 @@ void GTOr3c_fill_s2ij(int (*intor)(), double complex *out, double complex *buf,
         const int dj = ao_loc[jsh+1] - ao_loc[jsh];
         out += ip * (ip + 1) / 2 - off + jp;
 
-        int ksh, dk, k0;
+        int ksh, dk, k0, i;
         int shls[3];
         dk = GTOmax_shell_dim(ao_loc, shls_slice, 3);
         double *cache = (double *)(buf + di * dj * dk * comp);
@@ -157,7 +188,14 @@ void GTOr3c_fill_s2ij(int (*intor)(), double complex *out, double complex *buf,
                 shls[2] = ksh;
                 dk = ao_loc[ksh+1] - ao_loc[ksh];
                 k0 = ao_loc[ksh  ] - ao_loc[ksh0];
-                (*intor)(buf, NULL, shls, atm, natm, bas, nbas, env, cintopt, cache);
+                if (_3c_screened(q_ij, q_k, cutoff, ij, ksh-ksh0)) {
+                        for (i = 0; i < di*dj*dk*comp; i++) {
+                                buf[i] = 0;
+                        }
+                } else {
+                        (*intor)(buf, NULL, shls, atm, natm, bas, nbas, env,
+                                 cintopt, cache);
+                }
                 if (ip != jp) {
                         zcopy_s2_igtj(out+k0*nij, buf, comp, ip, nij, nijk, di, dj, dk);
                 } else {
@@ -166,40 +204,145 @@ void GTOr3c_fill_s2ij(int (*intor)(), double complex *out, double complex *buf,
         }
 }
 
+/*
+ * out[comp,naoi,njk] in C-order, the (k|ij) layout of (i|jk) with j >= k
+ * njk = j1*(j1+1)/2 - j0*(j0+1)/2
+ * j is counted from the first AO of the environment and k from the first AO
+ * of ksh0, see GTOnr3c_fill_s2jk. Requires ksh0 = 0 or ksh0 >= jsh1.
+ */
 void GTOr3c_fill_s2jk(int (*intor)(), double complex *out, double complex *buf,
                       int comp, int ish, int jsh,
                       int *shls_slice, int *ao_loc, CINTOpt *cintopt,
+                      double *q_ij, double *q_k, double cutoff,
                       int *atm, int natm, int *bas, int nbas, double *env)
 {
-        fprintf(stderr, "GTOr3c_fill_s2jk not implemented\n");
-        exit(1);
+        const int ish0 = shls_slice[0];
+        const int ish1 = shls_slice[1];
+        const int jsh0 = shls_slice[2];
+        const int jsh1 = shls_slice[3];
+        const int ksh0 = shls_slice[4];
+        const int ksh1 = shls_slice[5];
+        const int ij = ish * (jsh1 - jsh0) + jsh;
+        ish += ish0;
+        jsh += jsh0;
+        assert(ksh0 == 0 || ksh0 >= jsh1);
+
+        const int j0 = ao_loc[jsh0];
+        const int j1 = ao_loc[jsh1];
+        const size_t naoi = ao_loc[ish1] - ao_loc[ish0];
+        const size_t off = (size_t)j0 * (j0 + 1) / 2;
+        const size_t njk = (size_t)j1 * (j1 + 1) / 2 - off;
+        const size_t nijk = njk * naoi;
+        const int i0 = ao_loc[ish] - ao_loc[ish0];
+        const int jp = ao_loc[jsh];
+        const int di = ao_loc[ish+1] - ao_loc[ish];
+        const int dj = ao_loc[jsh+1] - ao_loc[jsh];
+
+        int ksh, kp, dk, i, j, k, ic, kmax;
+        size_t jk0, dijk;
+        int shls[3] = {ish, jsh, 0};
+        dk = GTOmax_shell_dim(ao_loc, shls_slice, 3);
+        double *cache = (double *)(buf + di * dj * dk * comp);
+        double complex *pout, *pin;
+
+        for (ksh = ksh0; ksh < ksh1; ksh++) {
+                kp = ao_loc[ksh] - ao_loc[ksh0];
+                if (jp < kp) {
+                        break;
+                }
+                shls[2] = ksh;
+                dk = ao_loc[ksh+1] - ao_loc[ksh];
+                dijk = (size_t)di * dj * dk;
+                if (_3c_screened(q_ij, q_k, cutoff, ij, ksh-ksh0)) {
+                        for (i = 0; i < dijk*comp; i++) {
+                                buf[i] = 0;
+                        }
+                } else {
+                        (*intor)(buf, NULL, shls, atm, natm, bas, nbas, env,
+                                 cintopt, cache);
+                }
+                for (ic = 0; ic < comp; ic++) {
+                        for (j = 0; j < dj; j++) {
+                                jk0 = (size_t)(jp + j) * (jp + j + 1) / 2 - off + kp;
+                                kmax = (jp == kp) ? j + 1 : dk;
+                                for (k = 0; k < kmax; k++) {
+                                        pout = out + ic * nijk + (size_t)i0 * njk + jk0 + k;
+                                        pin = buf + ic * dijk + ((size_t)k * dj + j) * di;
+                                        for (i = 0; i < di; i++) {
+                                                pout[i*njk] = pin[i];
+                                        }
+                                }
+                        }
+                }
+        }
 }
 
-void GTOr3c_drv(int (*intor)(), void (*fill)(), double complex *eri, int comp,
-                int *shls_slice, int *ao_loc, CINTOpt *cintopt,
-                int *atm, int natm, int *bas, int nbas, double *env)
+/*
+ * Complex 3-center integrals with Schwarz screening. Integrals with
+ * q_ij[ish,jsh] * q_k[ksh] < cutoff are set to zero (see GTOnr3c_q_cond).
+ * Without screening, q_ij = NULL. The (ish, jsh) jobs are distributed in
+ * descending order of their estimated cost.
+ */
+void GTOr3c_screen_drv(int (*intor)(), void (*fill)(), double complex *eri, int comp,
+                       int *shls_slice, int *ao_loc, CINTOpt *cintopt,
+                       double *q_ij, double *q_k, double cutoff,
+                       int *atm, int natm, int *bas, int nbas, double *env)
 {
         const int ish0 = shls_slice[0];
         const int ish1 = shls_slice[1];
         const int jsh0 = shls_slice[2];
         const int jsh1 = shls_slice[3];
+        const int ksh0 = shls_slice[4];
+        const int ksh1 = shls_slice[5];
         const int nish = ish1 - ish0;
         const int njsh = jsh1 - jsh0;
         const int di = GTOmax_shell_dim(ao_loc, shls_slice, 3);
         const int cache_size = GTOmax_cache_size(intor, shls_slice, 3,
                                                  atm, natm, bas, nbas, env);
+        const int npair = nish * njsh;
+        int *jobs = malloc(sizeof(int) * npair);
+        double *cost = malloc(sizeof(double) * npair);
+        double kcost = 0;
+        double qk_max = 0;
+        int ij, ksh;
+        for (ksh = ksh0; ksh < ksh1; ksh++) {
+                kcost += GTO3c_shell_cost(ksh, ao_loc, bas);
+                if (q_ij != NULL) {
+                        qk_max = MAX(qk_max, q_k[ksh-ksh0]);
+                }
+        }
+        for (ij = 0; ij < npair; ij++) {
+                if (q_ij != NULL && q_ij[ij] * qk_max < cutoff) {
+                        cost[ij] = 0;
+                } else {
+                        cost[ij] = GTO3c_shell_cost(ij/njsh+ish0, ao_loc, bas) *
+                                GTO3c_shell_cost(ij%njsh+jsh0, ao_loc, bas) * kcost;
+                }
+        }
+        GTO3c_sort_jobs(jobs, cost, npair);
+        free(cost);
+
 #pragma omp parallel
 {
-        int ish, jsh, ij;
+        int ish, jsh, n;
         double complex *buf = malloc(sizeof(double complex) *
                                      (di*di*di*comp + cache_size/2));
 #pragma omp for schedule(dynamic)
-        for (ij = 0; ij < nish*njsh; ij++) {
-                ish = ij / njsh;
-                jsh = ij % njsh;
+        for (n = 0; n < npair; n++) {
+                ish = jobs[n] / njsh;
+                jsh = jobs[n] % njsh;
                 (*fill)(intor, eri, buf, comp, ish, jsh, shls_slice, ao_loc,
-                        cintopt, atm, natm, bas, nbas, env);
+                        cintopt, q_ij, q_k, cutoff, atm, natm, bas, nbas, env);
         }
         free(buf);
 }
+        free(jobs);
+}
+
+void GTOr3c_drv(int (*intor)(), void (*fill)(), double complex *eri, int comp,
+                int *shls_slice, int *ao_loc, CINTOpt *cintopt,
+                int *atm, int natm, int *bas, int nbas, double *env)
+{
+        GTOr3c_screen_drv(intor, fill, eri, comp, shls_slice, ao_loc, cintopt,
+                          NULL, NULL, 0, atm, natm, bas, nbas, env);
 }
@@ -39,6 +39,10 @@
 #define INTBUFMAX       16000
 #define IMGBLK          80
 #define OF_CMPLX        2
+// PBC_ft_latsum_drv splits the G vectors if there are fewer shell pairs per thread
+#define TASKS_PER_THREAD 4
+// G vectors per tile in the cartesian to spherical transform
+#define GTILE           64
 
 
 #define SQRTPI          1.7724538509055160272981674833411451
@@ -63,6 +67,7 @@ static void shift_bas(double *env_loc, double *env, double *Ls, int ptr, int iL)
 static void _ft_fill_k(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)(),
                        void (*fsort)(), double complex *out, int nkpts,
                        int comp, int nimgs, int blksize, int ish, int jsh,
+                       int gs_start, int gs_end,
                        double complex *buf, double *env_loc, double *Ls,
                        double complex *expkL, int *shls_slice, int *ao_loc,
                        double *sGv, double *b, int *sgxyz, int *gs, int nGv,
@@ -89,8 +94,13 @@ static void _ft_fill_k(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)(),
         int jL0, jLcount, jL;
         int i;
 
-        for (gs0 = 0; gs0 < nGv; gs0 += blksize) {
-                gs1 = MIN(gs0+blksize, nGv);
+        // G vectors [gs_start:gs_end], gs_start is a multiple of blksize
+        sGv += gs_start * 3;
+        if (sgxyz != NULL) {
+                sgxyz += gs_start * 3;
+        }
+        for (gs0 = gs_start; gs0 < gs_end; gs0 += blksize) {
+                gs1 = MIN(gs0+blksize, gs_end);
                 dg = gs1 - gs0;
                 dijg = dij * dg * comp;
                 NPzset0(bufk, ((size_t)dijg) * nkpts);
@@ -131,6 +141,7 @@ static void _ft_fill_k(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)(),
 static void _ft_fill_nk1(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)(),
                          void (*fsort)(), double complex *out, int nkpts,
                          int comp, int nimgs, int blksize, int ish, int jsh,
+                         int gs_start, int gs_end,
                          double complex *buf, double *env_loc, double *Ls,
                          double complex *expkL, int *shls_slice, int *ao_loc,
                          double *sGv, double *b, int *sgxyz, int *gs, int nGv,
@@ -153,8 +164,13 @@ static void _ft_fill_nk1(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)()
         int gs0, gs1, dg, jL;
         size_t i, dijg;
 
-        for (gs0 = 0; gs0 < nGv; gs0 += blksize) {
-                gs1 = MIN(gs0+blksize, nGv);
+        // G vectors [gs_start:gs_end], gs_start is a multiple of blksize
+        sGv += gs_start * 3;
+        if (sgxyz != NULL) {
+                sgxyz += gs_start * 3;
+        }
+        for (gs0 = gs_start; gs0 < gs_end; gs0 += blksize) {
+                gs1 = MIN(gs0+blksize, gs_end);
                 dg = gs1 - gs0;
                 dijg = dij * dg * comp;
                 for (i = 0; i < dijg; i++) {
@@ -444,6 +460,7 @@ static void sort_s2_ieqj(double complex *out, double complex *in,
 void PBC_ft_fill_ks1(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)(),
                      double complex *out, int nkpts, int comp, int nimgs,
                      int blksize, int ish, int jsh,
+                     int gs_start, int gs_end,
                      double complex *buf, double *env_loc, double *Ls,
                      double complex *expkL, int *shls_slice, int *ao_loc,
                      double *sGv, double *b, int *sgxyz, int *gs, int nGv,
@@ -451,6 +468,7 @@ void PBC_ft_fill_ks1(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)(),
 {
         _ft_fill_k(intor, eval_aopair, eval_gz, &sort_s1,
                    out, nkpts, comp, nimgs, blksize, ish, jsh,
+                   gs_start, gs_end,
                    buf, env_loc, Ls, expkL, shls_slice, ao_loc,
                    sGv, b, sgxyz, gs, nGv, atm, natm, bas, nbas, env);
 }
@@ -458,6 +476,7 @@ void PBC_ft_fill_ks1(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)(),
 void PBC_ft_fill_ks2(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)(),
                      double complex *out, int nkpts, int comp, int nimgs,
                      int blksize, int ish, int jsh,
+                     int gs_start, int gs_end,
                      double complex *buf, double *env_loc, double *Ls,
                      double complex *expkL, int *shls_slice, int *ao_loc,
                      double *sGv, double *b, int *sgxyz, int *gs, int nGv,
@@ -468,11 +487,13 @@ void PBC_ft_fill_ks2(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)(),
         if (ip > jp) {
                 _ft_fill_k(intor, eval_aopair, eval_gz, &sort_s2_igtj,
                            out, nkpts, comp, nimgs, blksize, ish, jsh,
+                           gs_start, gs_end,
                            buf, env_loc, Ls, expkL, shls_slice, ao_loc,
                            sGv, b, sgxyz, gs, nGv, atm, natm, bas, nbas, env);
         } else if (ip == jp) {
                 _ft_fill_k(intor, eval_aopair, eval_gz, &sort_s2_ieqj,
                            out, nkpts, comp, nimgs, blksize, ish, jsh,
+                           gs_start, gs_end,
                            buf, env_loc, Ls, expkL, shls_slice, ao_loc,
                            sGv, b, sgxyz, gs, nGv, atm, natm, bas, nbas, env);
         }
@@ -481,6 +502,7 @@ void PBC_ft_fill_ks2(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)(),
 void PBC_ft_fill_nk1s1(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)(),
                        double complex *out, int nkpts, int comp, int nimgs,
                        int blksize, int ish, int jsh,
+                       int gs_start, int gs_end,
                        double complex *buf, double *env_loc, double *Ls,
                        double complex *expkL, int *shls_slice, int *ao_loc,
                        double *sGv, double *b, int *sgxyz, int *gs, int nGv,
@@ -488,6 +510,7 @@ void PBC_ft_fill_nk1s1(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)(),
 {
         _ft_fill_nk1(intor, eval_aopair, eval_gz, &sort_s1,
                      out, nkpts, comp, nimgs, blksize, ish, jsh,
+                     gs_start, gs_end,
                      buf, env_loc, Ls, expkL, shls_slice, ao_loc,
                      sGv, b, sgxyz, gs, nGv, atm, natm, bas, nbas, env);
 }
@@ -495,6 +518,7 @@ void PBC_ft_fill_nk1s1(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)(),
 void PBC_ft_fill_nk1s1hermi(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)(),
                             double complex *out, int nkpts, int comp, int nimgs,
                             int blksize, int ish, int jsh,
+                            int gs_start, int gs_end,
                             double complex *buf, double *env_loc, double *Ls,
                             double complex *expkL, int *shls_slice, int *ao_loc,
                             double *sGv, double *b, int *sgxyz, int *gs, int nGv,
@@ -505,6 +529,7 @@ void PBC_ft_fill_nk1s1hermi(int (*intor)(), int (*eval_aopair)(), void (*eval_gz
         if (ip >= jp) {
                 _ft_fill_nk1(intor, eval_aopair, eval_gz, &sort_s1,
                              out, nkpts, comp, nimgs, blksize, ish, jsh,
+                             gs_start, gs_end,
                              buf, env_loc, Ls, expkL, shls_slice, ao_loc,
                              sGv, b, sgxyz, gs, nGv, atm, natm, bas, nbas, env);
         }
@@ -513,6 +538,7 @@ void PBC_ft_fill_nk1s1hermi(int (*intor)(), int (*eval_aopair)(), void (*eval_gz
 void PBC_ft_fill_nk1s2(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)(),
                        double complex *out, int nkpts, int comp, int nimgs,
                        int blksize, int ish, int jsh,
+                       int gs_start, int gs_end,
                        double complex *buf, double *env_loc, double *Ls,
                        double complex *expkL, int *shls_slice, int *ao_loc,
                        double *sGv, double *b, int *sgxyz, int *gs, int nGv,
@@ -523,11 +549,13 @@ void PBC_ft_fill_nk1s2(int (*intor)(), int (*eval_aopair)(), void (*eval_gz)(),
         if (ip > jp) {
                 _ft_fill_nk1(intor, eval_aopair, eval_gz, &sort_s2_igtj,
                              out, nkpts, comp, nimgs, blksize, ish, jsh,
+                             gs_start, gs_end,
                              buf, env_loc, Ls, expkL, shls_slice, ao_loc,
                              sGv, b, sgxyz, gs, nGv, atm, natm, bas, nbas, env);
         } else if (ip == jp) {
                 _ft_fill_nk1(intor, eval_aopair, eval_gz, &sort_s2_ieqj,
                              out, nkpts, comp, nimgs, blksize, ish, jsh,
+                             gs_start, gs_end,
                              buf, env_loc, Ls, expkL, shls_slice, ao_loc,
                              sGv, b, sgxyz, gs, nGv, atm, natm, bas, nbas, env);
         }
@@ -710,7 +738,17 @@ void PBC_ft_latsum_drv(int (*intor)(), void (*eval_gz)(), void (*fill)(),
 
 #pragma omp parallel
 {
-        int i, j, ij;
+        int i, j, ij, ig, task;
+        // Too few shell pairs for the threads: the G vectors of each pair
+        // are split into ngseg segments of whole G blocks.
+        const int nthreads = omp_get_num_threads();
+        const int nij = nish * njsh;
+        const int ngblk = (nGv + blksize - 1) / blksize;
+        int ngseg = 1;
+        if (nij < nthreads * TASKS_PER_THREAD) {
+                ngseg = (nthreads * TASKS_PER_THREAD + nij - 1) / nij;
+                ngseg = MAX(MIN(ngseg, ngblk), 1);
+        }
         int nenv = PBCsizeof_env(shls_slice, atm, natm, bas, nbas, env);
         nenv = MAX(nenv, PBCsizeof_env(shls_slice+2, atm, natm, bas, nbas, env));
         double *env_loc = malloc(sizeof(double)*nenv+400);
@@ -718,11 +756,15 @@ void PBC_ft_latsum_drv(int (*intor)(), void (*eval_gz)(), void (*fill)(),
         size_t count = nkpts + IMGBLK;
         double complex *buf = malloc(sizeof(double complex)*count*INTBUFMAX*comp+400);
 #pragma omp for schedule(dynamic)
-        for (ij = 0; ij < nish*njsh; ij++) {
+        for (task = 0; task < nij*ngseg; task++) {
+                ij = task / ngseg;
+                ig = task % ngseg;
                 i = ij / njsh;
                 j = ij % njsh;
                 (*fill)(intor, eval_aopair, eval_gz,
                         out, nkpts, comp, nimgs, blksize, i, j,
+                        MIN(ngblk*ig/ngseg*blksize, nGv),
+                        MIN(ngblk*(ig+1)/ngseg*blksize, nGv),
                         buf, env_loc, Ls, expkL, shls_slice, ao_loc,
                         sGv, b, sgxyz, gs, nGv, atm, natm, bas, nbas, env);
         }
@@ -1667,6 +1709,12 @@ int GTO_aopair_early_contract(double complex *out, CINTEnvVars *envs,
         return !*jempty;
 }
 
+/*
+ * exp(-eij) and eval_gz are evaluated for each primitive pair of each shell
+ * pair. Unlike the grid kernels (GTOexp_family_end), shells of the same
+ * exponent family do not share them: green_igen takes its FT AO pairs from
+ * pyscf.pbc.df.ft_ao, and no production path calls these drivers.
+ */
 int GTO_aopair_lazy_contract(double complex *gctr, CINTEnvVars *envs,
                              FPtr_eval_gz eval_gz, double complex fac,
                              double *Gv, double *b, int *gxyz, int *gs,
@@ -2008,9 +2056,29 @@ void GTO_ft_c2s_cart(double complex *out, double complex *gctr,
 }
 
 
-#define C2S(sph, nket, cart, l) \
-        (double complex *)CINTc2s_ket_sph((double *)(sph), nket, (double *)(cart), l)
-#define OF_CMPLX        2
+double *CINTc2s_ket_sph(double *gsph, int nket, double *gcart, int l);
+/*
+ * Cartesian to spherical coefficients of shell l, c2s[(l*2+1),nf]
+ */
+static double *_c2s_matrix(double *c2s, int l)
+{
+        const int nf = (l+1)*(l+2)/2;
+        double *eye = c2s + (l*2+1) * nf;
+        int i;
+        for (i = 0; i < nf*nf; i++) {
+                eye[i] = 0;
+        }
+        for (i = 0; i < nf; i++) {
+                eye[i*nf+i] = 1;
+        }
+        return CINTc2s_ket_sph(c2s, nf, eye, l);
+}
+
+/*
+ * The contracted cartesian block is transformed tile by tile in G.  The
+ * j-transform of a tile is held in a small buffer and the i-transform is
+ * written to the output location directly.
+ */
 void GTO_ft_c2s_sph(double complex *out, double complex *gctr,
                     int *dims, CINTEnvVars *envs, size_t NGv)
 {
@@ -2023,26 +2091,75 @@ void GTO_ft_c2s_sph(double complex *out, double complex *gctr,
         const int ni = di*i_ctr;
         const int nj = dj*j_ctr;
         const int nfi = envs->nfi;
+        const int nfj = envs->nfj;
         const int nf = envs->nf;
-        int ic, jc, k;
-        const int buflen = nfi*dj;
-        double complex *buf1 = malloc(sizeof(double complex) * buflen*2 * NGv);
-        double complex *buf2 = buf1 + buflen * NGv;
-        double complex *pout, *pij, *buf;
+        const size_t nrow = dims[0];
+        const int leni = (di + nfi) * nfi;
+        const int lenj = (dj + nfj) * nfj;
+        double *cbuf = malloc(sizeof(double) * (leni + lenj) +
+                              sizeof(double complex) * nfi * GTILE);
+        double *ci = _c2s_matrix(cbuf, i_l);
+        double *cj = _c2s_matrix(cbuf+leni, j_l);
+        double complex *tmp = (double complex *)(cbuf + leni + lenj);
+        double complex *pij, *pj, *pg, *pout;
+        size_t k0, jstride;
+        int ic, jc, id, jd, i, j, k, dk;
+        double c;
 
         for (jc = 0; jc < nj; jc += dj) {
         for (ic = 0; ic < ni; ic += di) {
-                buf = C2S(buf1, nfi*NGv*OF_CMPLX, gctr, j_l);
-                pij = C2S(buf2, NGv*OF_CMPLX, buf, i_l);
-                for (k = NGv; k < dj*NGv; k+=NGv) {
-                        pout = C2S(buf2+k*di, NGv*OF_CMPLX, buf+k*nfi, i_l);
-                }
+        for (k0 = 0; k0 < NGv; k0 += GTILE) {
+                pij = gctr + ((jc/dj) * i_ctr + ic/di) * nf * NGv;
+                dk = MIN(GTILE, NGv-k0);
+                for (jd = 0; jd < dj; jd++) {
+                        if (j_l < 2) {
+                                pj = pij + jd * nfi * NGv + k0;
+                                jstride = NGv;
+                        } else {
+                                for (i = 0; i < nfi; i++) {
+                                for (k = 0; k < dk; k++) {
+                                        tmp[i*GTILE+k] = 0;
+                                } }
+                                for (j = 0; j < nfj; j++) {
+                                        c = cj[jd*nfj+j];
+                                        if (c == 0) {
+                                                continue;
+                                        }
+                                        pg = pij + j * nfi * NGv + k0;
+                                        for (i = 0; i < nfi; i++) {
+                                        for (k = 0; k < dk; k++) {
+                                                tmp[i*GTILE+k] += c * pg[i*NGv+k];
+                                        } }
+                                }
+                                pj = tmp;
+                                jstride = GTILE;
+                        }
 
-                pout = out + (dims[0] * jc + ic) * NGv;
-                zcopy_ij(pout, pij, di, dj, dims[0], NGv);
-                gctr += nf * NGv;
-        } }
-        free(buf1);
+                        pout = out + ((jc+jd) * nrow + ic) * NGv + k0;
+                        if (i_l < 2) {
+                                for (id = 0; id < di; id++) {
+                                for (k = 0; k < dk; k++) {
+                                        pout[id*NGv+k] = pj[id*jstride+k];
+                                } }
+                                continue;
+                        }
+                        for (id = 0; id < di; id++) {
+                                for (k = 0; k < dk; k++) {
+                                        pout[id*NGv+k] = 0;
+                                }
+                                for (i = 0; i < nfi; i++) {
+                                        c = ci[id*nfi+i];
+                                        if (c == 0) {
+                                                continue;
+                                        }
+                                        for (k = 0; k < dk; k++) {
+                                                pout[id*NGv+k] += c * pj[i*jstride+k];
+                                        }
+                                }
+                        }
+                }
+        } } }
+        free(cbuf);
 }
 
 static void _ft_zset0(double complex *out, int *dims, int *counts,
@@ -68,6 +68,13 @@ int GTOcontract_exp0(double *ectr, double *coord, double *alpha, double *coeff,
 int GTOcontract_exp1(double *ectr, double *coord, double *alpha, double *coeff,
                      int l, int nprim, int nctr, size_t ngrids, double fac);
 
+int GTOexp_family_end(FPtr_exp fexp, int ish, int sh1, int *bas, double *env);
+void GTOfamily_logcoeff(double *logcoeff, int ish, int ish1, int *bas, double *env);
+int GTOfamily_prim_exp(double *eprim, double *coord, double *alpha,
+                       double *logcoeff, int np, size_t bgrids);
+void GTOfamily_contract(double *ectr, double *eprim, double *alpha, double *coeff,
+                        int np, int nc, size_t bgrids, double fac, int deriv);
+
 void GTOeval_sph_drv(FPtr_eval feval, FPtr_exp fexp, double fac,
                      int ngrids, int param[], int *shls_slice, int *ao_loc,
                      double *ao, double *coord, char *non0table,
@@ -83,6 +90,11 @@ void GTOeval_spinor_drv(FPtr_eval feval, FPtr_exp fexp, void (*c2s)(), double fa
                         double complex *ao, double *coord, char *non0table,
                         int *atm, int natm, int *bas, int nbas, double *env);
 
+void GTOeval_spinor_planar_drv(FPtr_eval feval, FPtr_exp fexp, void (*c2s)(), double fac,
+                               int ngrids, int param[], int *shls_slice, int *ao_loc,
+                               double *ao, double *coord, char *non0table,
+                               int *atm, int natm, int *bas, int nbas, double *env);
+
 #define GTO_D_I(o, i, l) \
         GTOnabla1(fx##o, fy##o, fz##o, fx##i, fy##i, fz##i, l, alpha[k])
 /* r-R_0, R_0 is (0,0,0) */
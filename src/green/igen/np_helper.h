@@ -34,6 +34,8 @@
 
 void NPdsymm_triu(int n, double *mat, int hermi);
 void NPzhermi_triu(int n, double complex *mat, int hermi);
+void NPdsymm_triu_nmat(int nmat, int n, double *mat, int hermi);
+void NPzhermi_triu_nmat(int nmat, int n, double complex *mat, int hermi);
 void NPdunpack_tril(int n, double *tril, double *mat, int hermi);
 void NPdunpack_row(int ndim, int row_id, double *tril, double *row);
 void NPzunpack_tril(int n, double complex *tril, double complex *mat,
@@ -22,6 +22,41 @@ typedef struct PBCOpt_struct {
     double *rrcut;
     int (*fprescreen)(int *shls, struct PBCOpt_struct *opt,
                       int *atm, int *bas, double *env);
+    // Per shell-pair image lists in CSR format. For the pair (ish, jsh) the
+    // images L in img_idx[img_loc[ij]:img_loc[ij+1]] are those with
+    // |Ri - Rj - L| < rcut_ij, sorted by distance. img_nbas is the number of
+    // shells of the unit cell; jsh is counted from img_nbas.
+    int img_nbas;
+    int nimgs;
+    int *img_loc;
+    int *img_idx;
+    // Integer translations of the images and the look-up table from the
+    // translation (shifted by img_tmin) to the image id (-1 if not in Ls)
+    int *img_T;
+    int *img_table;
+    int img_tmin[3];
+    int img_tdim[3];
+    // Far-field multipoles of the Coulomb integrals (see multipole.c).
+    // mp_moments[mp_loc[ish]:mp_loc[ish+1]] are the Hermite multipoles
+    // M[nfunc,(l+1)^3] of shell ish, mp_ainv the inverse of its smallest
+    // exponent. Charge distributions of total angular momentum L farther
+    // apart than sqrt(mp_rr_near[L]*(1/a+1/b)) interact through their
+    // multipoles only, L = 0 ... 3*mp_lmax.
+    int mp_nbas;
+    int mp_cart;
+    int mp_lmax;
+    int mp_dmax;
+    double *mp_rr_near;
+    double *mp_ainv;
+    int *mp_loc;
+    double *mp_moments;
+    // Compact index of the Hermite functions (t,u,v), t+u+v <= 3*mp_lmax
+    int *mp_hidx;
+    // Significant shell pairs of the unit cell (pair-sparse DF tensor).
+    // Shell pairs (ish, jsh) with pair_mask[ish*pair_nbas+jsh] == 0 are not
+    // computed by PBCnr3c_drv.
+    int pair_nbas;
+    char *pair_mask;
 } PBCOpt;
 #endif
 
@@ -43,6 +78,14 @@ typedef struct CVHFOpt_struct {
 
 int PBCnoscreen(int *shls, PBCOpt *opt, int *atm, int *bas, double *env);
 int PBCrcut_screen(int *shls, PBCOpt *opt, int *atm, int *bas, double *env);
+int PBCpair_images(int *jLs, PBCOpt *opt, int ish, int jsh, int iL, int nimgs);
+void PBCdel_pair_images(PBCOpt *opt);
+void PBCdel_multipole(PBCOpt *opt);
+void PBCdel_pair_mask(PBCOpt *opt);
+size_t PBCmp_int3c2e_bufsize(PBCOpt *opt, int ish, int jsh, int *bas);
+int PBCmp_int3c2e(double *out, int *shls, PBCOpt *opt,
+                  int *atm, int *bas, double *env, double *buf, int *npair);
+int PBCmp_far2c(int *shls, PBCOpt *opt, int *atm, int *bas, double *env);
 
 /* Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
   
@@ -190,15 +190,18 @@ void PBCeval_cart_iter(FPtr_eval feval,  FPtr_exp fexp,
         const char TRANS_T = 'T';
         const double D1 = 1;
         const int nkpts2 = nkpts * OF_CMPLX;
+        const int deriv = (fexp == &GTOcontract_exp1);
 
         int i, j, k, l, np, nc, atm_id, bas_id, deg, ao_id;
-        int iL, iL0, iLcount, dimc;
+        int iL, iL0, iLcount, dimc, nfam, ish, ish1, non0;
         int grid2atm_atm_id, count;
-        double fac;
-        double *p_exp, *pcoeff, *pcoord, *pao, *ri;
+        double fac, rcut_fam;
+        double logcoeff[NPRIMAX];
+        double *p_exp, *pcoeff, *pcoord, *pao, *pfam, *ri;
         double *grid2atm = buf; // shape [nimgs,3,bgrids]
         double *eprim = grid2atm + nimgs*3*BLKSIZE;
-        double *aobuf = eprim + NPRIMAX*BLKSIZE*2;
+        double *ectr = eprim + NPRIMAX*BLKSIZE;
+        double *aobuf = eprim + NPRIMAX*BLKSIZE*3;
         double *aobufk = aobuf + IMGBLK*ncomp*di_max*bgrids;
         double *Lk_buf = aobufk + nkpts*ncomp*di_max*bgrids * OF_CMPLX;
         double complex *zLk_buf = (double complex *)Lk_buf;
@@ -216,18 +219,29 @@ void PBCeval_cart_iter(FPtr_eval feval,  FPtr_exp fexp,
         }
 
         grid2atm_atm_id = -1;
-        for (bas_id = sh0; bas_id < sh1; bas_id++) {
+        for (bas_id = sh0; bas_id < sh1; bas_id = ish1) {
+                ish1 = GTOexp_family_end(fexp, bas_id, sh1, bas, env);
                 np = bas[bas_id*BAS_SLOTS+NPRIM_OF];
                 nc = bas[bas_id*BAS_SLOTS+NCTR_OF ];
                 l  = bas[bas_id*BAS_SLOTS+ANG_OF  ];
                 deg = (l+1)*(l+2)/2;
-                dimc = nc*deg * ncomp * bgrids;
+                nfam = ao_loc[ish1] - ao_loc[bas_id];
+                dimc = nfam * ncomp * bgrids;
                 fac = CINTcommon_fac_sp(l);
                 p_exp  = env + bas[bas_id*BAS_SLOTS+PTR_EXP];
                 pcoeff = env + bas[bas_id*BAS_SLOTS+PTR_COEFF];
                 atm_id = bas[bas_id*BAS_SLOTS+ATOM_OF];
                 ri = env + atm[PTR_COORD+atm_id*ATM_SLOTS];
                 ao_id = ao_loc[bas_id] - ao_loc[sh0];
+                non0 = 0;
+                rcut_fam = 0;
+                for (ish = bas_id; ish < ish1; ish++) {
+                        non0 = MAX(non0, non0table[ish]);
+                        rcut_fam = MAX(rcut_fam, rcut[ish]);
+                }
+                if (ish1 > bas_id+1) {
+                        GTOfamily_logcoeff(logcoeff, bas_id, ish1, bas, env);
+                }
 
                 if (grid2atm_atm_id != atm_id) {
                         _fill_grid2atm(grid2atm, min_grid2atm, coord, Ls, ri,
@@ -245,12 +259,29 @@ void PBCeval_cart_iter(FPtr_eval feval,  FPtr_exp fexp,
                         for (iL = iL0; iL < iL0+iLcount; iL++) {
 
         pcoord = grid2atm + iL * 3*BLKSIZE;
-        if ((iL < non0table[bas_id] || non0table[bas_id] == ALL_IMAGES) &&
-            (min_grid2atm[iL] < rcut[bas_id]) &&
-            (*fexp)(eprim, pcoord, p_exp, pcoeff, l, np, nc, bgrids, fac)) {
-                pao = aobuf + count * dimc;
-                (*feval)(pao, ri, eprim, pcoord, p_exp, pcoeff, env,
-                         l, np, nc, nc*deg, bgrids, bgrids);
+        if (!((iL < non0 || non0 == ALL_IMAGES) &&
+              (min_grid2atm[iL] < rcut_fam))) {
+                continue;
+        }
+        pao = aobuf + count * dimc;
+        if (ish1 == bas_id+1) {
+                if ((*fexp)(eprim, pcoord, p_exp, pcoeff, l, np, nc, bgrids, fac)) {
+                        (*feval)(pao, ri, eprim, pcoord, p_exp, pcoeff, env,
+                                 l, np, nc, nc*deg, bgrids, bgrids);
+                        img_idx[count] = iL;
+                        count += 1;
+                }
+        } else if (GTOfamily_prim_exp(eprim, pcoord, p_exp, logcoeff, np, bgrids)) {
+                for (ish = bas_id; ish < ish1; ish++) {
+                        nc = bas[ish*BAS_SLOTS+NCTR_OF];
+                        l  = bas[ish*BAS_SLOTS+ANG_OF ];
+                        pcoeff = env + bas[ish*BAS_SLOTS+PTR_COEFF];
+                        pfam = pao + (ao_loc[ish] - ao_loc[bas_id]) * bgrids;
+                        GTOfamily_contract(ectr, eprim, p_exp, pcoeff, np, nc, bgrids,
+                                           CINTcommon_fac_sp(l), deriv);
+                        (*feval)(pfam, ri, ectr, pcoord, p_exp, pcoeff, env,
+                                 l, np, nc, nfam, bgrids, bgrids);
+                }
                 img_idx[count] = iL;
                 count += 1;
         }
@@ -275,7 +306,7 @@ void PBCeval_cart_iter(FPtr_eval feval,  FPtr_exp fexp,
                 }
 
                 _copy(ao+ao_id*ngrids+offao, aobufk,
-                      ngrids, bgrids, nkpts, ncomp, nao, nc*deg);
+                      ngrids, bgrids, nkpts, ncomp, nao, ao_loc[ish1]-ao_loc[bas_id]);
         }
 }
 
@@ -296,15 +327,18 @@ void PBCeval_sph_iter(FPtr_eval feval,  FPtr_exp fexp,
         const char TRANS_T = 'T';
         const double D1 = 1;
         const int nkpts2 = nkpts * OF_CMPLX;
+        const int deriv = (fexp == &GTOcontract_exp1);
 
         int i, j, k, l, np, nc, atm_id, bas_id, deg, dcart, ao_id;
-        int iL, iL0, iLcount, dimc;
+        int iL, iL0, iLcount, dimc, nfam, ish, ish1, non0;
         int grid2atm_atm_id, count;
-        double fac;
-        double *p_exp, *pcoeff, *pcoord, *pcart, *pao, *ri;
+        double fac, rcut_fam;
+        double logcoeff[NPRIMAX];
+        double *p_exp, *pcoeff, *pcoord, *pcart, *pao, *pfam, *ri;
         double *grid2atm = buf; // shape [nimgs,3,bgrids]
         double *eprim = grid2atm + nimgs*3*BLKSIZE;
-        double *aobuf = eprim + NPRIMAX*BLKSIZE*2;
+        double *ectr = eprim + NPRIMAX*BLKSIZE;
+        double *aobuf = eprim + NPRIMAX*BLKSIZE*3;
         double *aobufk = aobuf + IMGBLK*ncomp*di_max*bgrids;
         double *Lk_buf = aobufk + nkpts*ncomp*di_max*bgrids * OF_CMPLX;
         double complex *zLk_buf = (double complex *)Lk_buf;
@@ -323,19 +357,30 @@ void PBCeval_sph_iter(FPtr_eval feval,  FPtr_exp fexp,
         }
 
         grid2atm_atm_id = -1;
-        for (bas_id = sh0; bas_id < sh1; bas_id++) {
+        for (bas_id = sh0; bas_id < sh1; bas_id = ish1) {
+                ish1 = GTOexp_family_end(fexp, bas_id, sh1, bas, env);
                 np = bas[bas_id*BAS_SLOTS+NPRIM_OF];
                 nc = bas[bas_id*BAS_SLOTS+NCTR_OF ];
                 l  = bas[bas_id*BAS_SLOTS+ANG_OF  ];
                 deg = l * 2 + 1;
                 dcart = (l+1)*(l+2)/2;
-                dimc = nc*deg * ncomp * bgrids;
+                nfam = ao_loc[ish1] - ao_loc[bas_id];
+                dimc = nfam * ncomp * bgrids;
                 fac = CINTcommon_fac_sp(l);
                 p_exp  = env + bas[bas_id*BAS_SLOTS+PTR_EXP];
                 pcoeff = env + bas[bas_id*BAS_SLOTS+PTR_COEFF];
                 atm_id = bas[bas_id*BAS_SLOTS+ATOM_OF];
                 ri = env + atm[PTR_COORD+atm_id*ATM_SLOTS];
                 ao_id = ao_loc[bas_id] - ao_loc[sh0];
+                non0 = 0;
+                rcut_fam = 0;
+                for (ish = bas_id; ish < ish1; ish++) {
+                        non0 = MAX(non0, non0table[ish]);
+                        rcut_fam = MAX(rcut_fam, rcut[ish]);
+                }
+                if (ish1 > bas_id+1) {
+                        GTOfamily_logcoeff(logcoeff, bas_id, ish1, bas, env);
+                }
 
                 if (grid2atm_atm_id != atm_id) {
                         _fill_grid2atm(grid2atm, min_grid2atm, coord, Ls, ri,
@@ -351,10 +396,15 @@ void PBCeval_sph_iter(FPtr_eval feval,  FPtr_exp fexp,
                         for (iL = iL0; iL < iL0+iLcount; iL++) {
 
         pcoord = grid2atm + iL * 3*BLKSIZE;
-        if ((iL < non0table[bas_id] || non0table[bas_id] == ALL_IMAGES) &&
-            (min_grid2atm[iL] < rcut[bas_id]) &&
-            (*fexp)(eprim, pcoord, p_exp, pcoeff, l, np, nc, bgrids, fac)) {
-                pao = aobuf + ((size_t)count) * dimc;
+        if (!((iL < non0 || non0 == ALL_IMAGES) &&
+              (min_grid2atm[iL] < rcut_fam))) {
+                continue;
+        }
+        pao = aobuf + ((size_t)count) * dimc;
+        if (ish1 == bas_id+1) {
+                if (!(*fexp)(eprim, pcoord, p_exp, pcoeff, l, np, nc, bgrids, fac)) {
+                        continue;
+                }
                 if (l <= 1) { // s, p functions
                         (*feval)(pao, ri, eprim, pcoord, p_exp, pcoeff, env,
                                  l, np, nc, nc*dcart, bgrids, bgrids);
@@ -368,10 +418,38 @@ void PBCeval_sph_iter(FPtr_eval feval,  FPtr_exp fexp,
                                 pcart += dcart * bgrids;
                         }
                 }
+        } else if (GTOfamily_prim_exp(eprim, pcoord, p_exp, logcoeff, np, bgrids)) {
+                // aobuf[ncomp,nfam,bgrids] for the shells of the family
+                for (ish = bas_id; ish < ish1; ish++) {
+                        nc = bas[ish*BAS_SLOTS+NCTR_OF];
+                        l  = bas[ish*BAS_SLOTS+ANG_OF ];
+                        deg = l * 2 + 1;
+                        dcart = (l+1)*(l+2)/2;
+                        pcoeff = env + bas[ish*BAS_SLOTS+PTR_COEFF];
+                        pfam = pao + (ao_loc[ish] - ao_loc[bas_id]) * bgrids;
+                        GTOfamily_contract(ectr, eprim, p_exp, pcoeff, np, nc, bgrids,
+                                           CINTcommon_fac_sp(l), deriv);
+                        if (l <= 1) {
+                                (*feval)(pfam, ri, ectr, pcoord, p_exp, pcoeff, env,
+                                         l, np, nc, nfam, bgrids, bgrids);
+                        } else {
+                                (*feval)(cart_gto, ri, ectr, pcoord, p_exp, pcoeff, env,
+                                         l, np, nc, nc*dcart, bgrids, bgrids);
+                                pcart = cart_gto;
+                                for (i = 0; i < ncomp; i++) {
+                                for (k = 0; k < nc; k++) {
+                                        CINTc2s_ket_sph1(pfam + (i*nfam+k*deg)*bgrids,
+                                                         pcart, bgrids, bgrids, l);
+                                        pcart += dcart * bgrids;
+                                } }
+                        }
+                }
+        } else {
+                continue;
+        }
 
                 img_idx[count] = iL;
                 count++;
-        }
                         }
 
                         if (count > 0) {
@@ -393,7 +471,7 @@ void PBCeval_sph_iter(FPtr_eval feval,  FPtr_exp fexp,
                 }
 
                 _copy(ao+ao_id*ngrids+offao, aobufk,
-                      ngrids, bgrids, nkpts, ncomp, nao, nc*deg);
+                      ngrids, bgrids, nkpts, ncomp, nao, ao_loc[ish1]-ao_loc[bas_id]);
         }
 }
 
@@ -417,10 +495,11 @@ void PBCeval_loop(void (*fiter)(), FPtr_eval feval, FPtr_exp fexp,
         const int nblk = (ngrids+BLKSIZE-1) / BLKSIZE;
         const size_t Ngrids = ngrids;
 
-        int i;
+        int i, i1;
         int di_max = 0;
-        for (i = shls_slice[0]; i < shls_slice[1]; i++) {
-                di_max = MAX(di_max, ao_loc[i+1] - ao_loc[i]);
+        for (i = shls_slice[0]; i < shls_slice[1]; i = i1) {
+                i1 = GTOexp_family_end(fexp, i, shls_slice[1], bas, env);
+                di_max = MAX(di_max, ao_loc[i1] - ao_loc[i]);
         }
 
 #pragma omp parallel
@@ -430,7 +509,7 @@ void PBCeval_loop(void (*fiter)(), FPtr_eval feval, FPtr_exp fexp,
         const size_t nao = ao_loc[sh1] - ao_loc[sh0];
         int ip, ib, k, iloc, ish;
         size_t aoff, bgrids;
-        size_t bufsize =((nimgs*3 + NPRIMAX*2 +
+        size_t bufsize =((nimgs*3 + NPRIMAX*3 +
                           nkpts *param[POS_E1]*param[TENSOR]*di_max * OF_CMPLX +
                           IMGBLK*param[POS_E1]*param[TENSOR]*di_max +
                           param[POS_E1]*param[TENSOR]*NCTR_CART) * BLKSIZE
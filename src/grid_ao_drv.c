@@ -100,6 +100,167 @@ int GTOprim_exp(double *eprim, double *coord, double *alpha, double *coeff,
 }
 
 
+/*
+ * The shells [ish:end] on the same atom which have the same primitive
+ * exponents (an exponent family, e.g. the s and p shells of an SP basis or
+ * of GTH-DZVP). For GTOcontract_exp0 and GTOcontract_exp1, exp(-a r^2) is
+ * evaluated once for the family and contracted for each shell.
+ */
+int GTOexp_family_end(FPtr_exp fexp, int ish, int sh1, int *bas, double *env)
+{
+        if (fexp != &GTOcontract_exp0 && fexp != &GTOcontract_exp1) {
+                return ish + 1;
+        }
+        const int ia = bas[ish*BAS_SLOTS+ATOM_OF];
+        const int np = bas[ish*BAS_SLOTS+NPRIM_OF];
+        double *exps = env + bas[ish*BAS_SLOTS+PTR_EXP];
+        double *p_exp;
+        int jsh, k;
+        for (jsh = ish+1; jsh < sh1; jsh++) {
+                if (bas[jsh*BAS_SLOTS+ATOM_OF] != ia ||
+                    bas[jsh*BAS_SLOTS+NPRIM_OF] != np) {
+                        break;
+                }
+                p_exp = env + bas[jsh*BAS_SLOTS+PTR_EXP];
+                for (k = 0; k < np; k++) {
+                        if (p_exp[k] != exps[k]) {
+                                return jsh;
+                        }
+                }
+        }
+        return jsh;
+}
+
+// log of the largest coefficient of each primitive over the family
+void GTOfamily_logcoeff(double *logcoeff, int ish, int ish1, int *bas, double *env)
+{
+        const int np = bas[ish*BAS_SLOTS+NPRIM_OF];
+        int i, j, n, nc;
+        double maxc;
+        double *pcoeff;
+        for (j = 0; j < np; j++) {
+                maxc = 0;
+                for (n = ish; n < ish1; n++) {
+                        nc = bas[n*BAS_SLOTS+NCTR_OF];
+                        pcoeff = env + bas[n*BAS_SLOTS+PTR_COEFF];
+                        for (i = 0; i < nc; i++) {
+                                maxc = MAX(maxc, fabs(pcoeff[i*np+j]));
+                        }
+                }
+                logcoeff[j] = log(maxc);
+        }
+}
+
+// eprim[np,BLKSIZE] = exp(-a r^2) of the primitives of a family
+int GTOfamily_prim_exp(double *eprim, double *coord, double *alpha,
+                       double *logcoeff, int np, size_t bgrids)
+{
+        size_t i, j;
+        double arr;
+        double rr[bgrids];
+        double *gridx = coord;
+        double *gridy = coord+BLKSIZE;
+        double *gridz = coord+BLKSIZE*2;
+        int not0 = 0;
+
+        for (i = 0; i < bgrids; i++) {
+                rr[i] = gridx[i]*gridx[i] + gridy[i]*gridy[i] + gridz[i]*gridz[i];
+        }
+        for (j = 0; j < np; j++) {
+                for (i = 0; i < bgrids; i++) {
+                        arr = alpha[j] * rr[i];
+                        if (arr-logcoeff[j] < EXPCUTOFF) {
+                                eprim[j*BLKSIZE+i] = exp(-arr);
+                                not0 = 1;
+                        } else {
+                                eprim[j*BLKSIZE+i] = 0;
+                        }
+                }
+        }
+        return not0;
+}
+
+/*
+ * GTOcontract_exp0 (deriv = 0) or GTOcontract_exp1 (deriv = 1) of one shell
+ * of a family from the primitive exponentials of GTOfamily_prim_exp
+ */
+void GTOfamily_contract(double *ectr, double *eprim, double *alpha, double *coeff,
+                        int np, int nc, size_t bgrids, double fac, int deriv)
+{
+        size_t i, j, k;
+        double c, c2a;
+        double *ectr_2a = ectr + NPRIMAX*BLKSIZE;
+        for (k = 0; k < nc; k++) {
+                for (i = 0; i < bgrids; i++) {
+                        ectr[k*BLKSIZE+i] = 0;
+                }
+                for (j = 0; j < np; j++) {
+                        c = coeff[k*np+j] * fac;
+                        for (i = 0; i < bgrids; i++) {
+                                ectr[k*BLKSIZE+i] += c * eprim[j*BLKSIZE+i];
+                        }
+                }
+        }
+        if (!deriv) {
+                return;
+        }
+        // -2 alpha_i C_ij exp(-alpha_i r_k^2)
+        for (k = 0; k < nc; k++) {
+                for (i = 0; i < bgrids; i++) {
+                        ectr_2a[k*BLKSIZE+i] = 0;
+                }
+                for (j = 0; j < np; j++) {
+                        c2a = -2. * alpha[j] * coeff[k*np+j] * fac;
+                        for (i = 0; i < bgrids; i++) {
+                                ectr_2a[k*BLKSIZE+i] += c2a * eprim[j*BLKSIZE+i];
+                        }
+                }
+        }
+}
+
+/*
+ * exp(-a r^2) of the family [ish0:ish1] in efam. 0 if the family is a
+ * single shell or all its shells are screened.
+ */
+static int _family_exp(double *efam, double *coord, int ish0, int ish1,
+                       char *non0table, size_t bgrids, int *bas, double *env)
+{
+        double logcoeff[NPRIMAX];
+        int ish;
+        int non0 = 0;
+        for (ish = ish0; ish < ish1; ish++) {
+                non0 |= non0table[ish];
+        }
+        if (ish1 == ish0+1 || !non0) {
+                return 0;
+        }
+        GTOfamily_logcoeff(logcoeff, ish0, ish1, bas, env);
+        return GTOfamily_prim_exp(efam, coord, env+bas[ish0*BAS_SLOTS+PTR_EXP],
+                                  logcoeff, bas[ish0*BAS_SLOTS+NPRIM_OF], bgrids);
+}
+
+/*
+ * The contracted exponentials of the shell bas_id in ectr, by fexp for a
+ * single shell or from efam for a shell of an exponent family
+ */
+static int _shell_exp(double *ectr, double *efam, int famexp, int family,
+                      FPtr_exp fexp, double *coord, int bas_id, size_t bgrids,
+                      double fac, int *bas, double *env)
+{
+        const int np = bas[bas_id*BAS_SLOTS+NPRIM_OF];
+        const int nc = bas[bas_id*BAS_SLOTS+NCTR_OF ];
+        const int l  = bas[bas_id*BAS_SLOTS+ANG_OF  ];
+        double *p_exp  = env + bas[bas_id*BAS_SLOTS+PTR_EXP];
+        double *pcoeff = env + bas[bas_id*BAS_SLOTS+PTR_COEFF];
+        if (!family) {
+                return (*fexp)(ectr, coord, p_exp, pcoeff, l, np, nc, bgrids, fac);
+        } else if (famexp) {
+                GTOfamily_contract(ectr, efam, p_exp, pcoeff, np, nc, bgrids, fac,
+                                   fexp == &GTOcontract_exp1);
+        }
+        return famexp;
+}
+
 // grid2atm[atm_id,xyz,grid_id]
 static void _fill_grid2atm(double *grid2atm, double *coord, size_t bgrids, size_t ngrids,
                            int *atm, int natm, int *bas, int nbas, double *env)
@@ -156,17 +317,24 @@ void GTOeval_sph_iter(FPtr_eval feval,  FPtr_exp fexp, double fac,
         const int atmend = bas[(sh1-1)*BAS_SLOTS+ATOM_OF]+1;
         const int atmcount = atmend - atmstart;
         int i, k, l, np, nc, atm_id, bas_id, deg, dcart, ao_id;
+        int ish0, ish1, famexp;
         size_t di;
         double fac1;
         double *p_exp, *pcoeff, *pcoord, *pcart, *ri, *pao;
         double *grid2atm = ALIGN8_UP(buf); // [atm_id,xyz,grid]
         double *eprim = grid2atm + atmcount*3*BLKSIZE;
-        double *cart_gto = eprim + NPRIMAX*BLKSIZE*2;
+        double *efam = eprim + NPRIMAX*BLKSIZE*2;
+        double *cart_gto = efam + NPRIMAX*BLKSIZE;
 
         _fill_grid2atm(grid2atm, coord, bgrids, ngrids,
                        atm+atmstart*ATM_SLOTS, atmcount, bas, nbas, env);
 
-        for (bas_id = sh0; bas_id < sh1; bas_id++) {
+        for (ish0 = sh0; ish0 < sh1; ish0 = ish1) {
+        ish1 = GTOexp_family_end(fexp, ish0, sh1, bas, env);
+        atm_id = bas[ish0*BAS_SLOTS+ATOM_OF];
+        pcoord = grid2atm + (atm_id - atmstart) * 3*BLKSIZE;
+        famexp = _family_exp(efam, pcoord, ish0, ish1, non0table, bgrids, bas, env);
+        for (bas_id = ish0; bas_id < ish1; bas_id++) {
                 np = bas[bas_id*BAS_SLOTS+NPRIM_OF];
                 nc = bas[bas_id*BAS_SLOTS+NCTR_OF ];
                 l  = bas[bas_id*BAS_SLOTS+ANG_OF  ];
@@ -174,11 +342,10 @@ void GTOeval_sph_iter(FPtr_eval feval,  FPtr_exp fexp, double fac,
                 fac1 = fac * CINTcommon_fac_sp(l);
                 p_exp  = env + bas[bas_id*BAS_SLOTS+PTR_EXP];
                 pcoeff = env + bas[bas_id*BAS_SLOTS+PTR_COEFF];
-                atm_id = bas[bas_id*BAS_SLOTS+ATOM_OF];
-                pcoord = grid2atm + (atm_id - atmstart) * 3*BLKSIZE;
                 ao_id = ao_loc[bas_id] - ao_loc[sh0];
                 if (non0table[bas_id] &&
-                    (*fexp)(eprim, pcoord, p_exp, pcoeff, l, np, nc, bgrids, fac1)) {
+                    _shell_exp(eprim, efam, famexp, ish1 > ish0+1, fexp, pcoord,
+                               bas_id, bgrids, fac1, bas, env)) {
                         dcart = (l+1)*(l+2)/2;
                         di = nc * dcart;
                         ri = env + atm[PTR_COORD+atm_id*ATM_SLOTS];
@@ -204,7 +371,7 @@ void GTOeval_sph_iter(FPtr_eval feval,  FPtr_exp fexp, double fac,
                                 _dset0(ao+(i*nao+ao_id)*ngrids, ngrids, bgrids, nc*deg);
                         }
                 }
-        }
+        } }
 }
 
 void GTOeval_cart_iter(FPtr_eval feval,  FPtr_exp fexp, double fac,
@@ -220,15 +387,22 @@ void GTOeval_cart_iter(FPtr_eval feval,  FPtr_exp fexp, double fac,
         const int atmend = bas[(sh1-1)*BAS_SLOTS+ATOM_OF]+1;
         const int atmcount = atmend - atmstart;
         int i, l, np, nc, atm_id, bas_id, deg, ao_id;
+        int ish0, ish1, famexp;
         double fac1;
         double *p_exp, *pcoeff, *pcoord, *ri;
         double *grid2atm = ALIGN8_UP(buf); // [atm_id,xyz,grid]
         double *eprim = grid2atm + atmcount*3*BLKSIZE;
+        double *efam = eprim + NPRIMAX*BLKSIZE*2;
 
         _fill_grid2atm(grid2atm, coord, bgrids, ngrids,
                        atm+atmstart*ATM_SLOTS, atmcount, bas, nbas, env);
 
-        for (bas_id = sh0; bas_id < sh1; bas_id++) {
+        for (ish0 = sh0; ish0 < sh1; ish0 = ish1) {
+        ish1 = GTOexp_family_end(fexp, ish0, sh1, bas, env);
+        atm_id = bas[ish0*BAS_SLOTS+ATOM_OF];
+        pcoord = grid2atm + (atm_id - atmstart) * 3*BLKSIZE;
+        famexp = _family_exp(efam, pcoord, ish0, ish1, non0table, bgrids, bas, env);
+        for (bas_id = ish0; bas_id < ish1; bas_id++) {
                 np = bas[bas_id*BAS_SLOTS+NPRIM_OF];
                 nc = bas[bas_id*BAS_SLOTS+NCTR_OF ];
                 l  = bas[bas_id*BAS_SLOTS+ANG_OF  ];
@@ -236,11 +410,10 @@ void GTOeval_cart_iter(FPtr_eval feval,  FPtr_exp fexp, double fac,
                 fac1 = fac * CINTcommon_fac_sp(l);
                 p_exp  = env + bas[bas_id*BAS_SLOTS+PTR_EXP];
                 pcoeff = env + bas[bas_id*BAS_SLOTS+PTR_COEFF];
-                atm_id = bas[bas_id*BAS_SLOTS+ATOM_OF];
-                pcoord = grid2atm + (atm_id - atmstart) * 3*BLKSIZE;
                 ao_id = ao_loc[bas_id] - ao_loc[sh0];
                 if (non0table[bas_id] &&
-                    (*fexp)(eprim, pcoord, p_exp, pcoeff, l, np, nc, bgrids, fac1)) {
+                    _shell_exp(eprim, efam, famexp, ish1 > ish0+1, fexp, pcoord,
+                               bas_id, bgrids, fac1, bas, env)) {
                         ri = env + atm[PTR_COORD+atm_id*ATM_SLOTS];
                         (*feval)(ao+ao_id*ngrids, ri, eprim, pcoord, p_exp, pcoeff,
                                  env, l, np, nc, nao, ngrids, bgrids);
@@ -249,7 +422,7 @@ void GTOeval_cart_iter(FPtr_eval feval,  FPtr_exp fexp, double fac,
                                 _dset0(ao+(i*nao+ao_id)*ngrids, ngrids, bgrids, nc*deg);
                         }
                 }
-        }
+        } }
 }
 
 void GTOeval_spinor_iter(FPtr_eval feval, FPtr_exp fexp, void (*c2s)(), double fac,
@@ -266,6 +439,7 @@ void GTOeval_spinor_iter(FPtr_eval feval, FPtr_exp fexp, void (*c2s)(), double f
         const int atmend = bas[(sh1-1)*BAS_SLOTS+ATOM_OF]+1;
         const int atmcount = atmend - atmstart;
         int i, l, np, nc, atm_id, bas_id, deg, kappa, dcart, ao_id;
+        int ish0, ish1, famexp;
         size_t off, di;
         double fac1;
         double *p_exp, *pcoeff, *pcoord, *pcart, *ri;
@@ -273,12 +447,18 @@ void GTOeval_spinor_iter(FPtr_eval feval, FPtr_exp fexp, void (*c2s)(), double f
         double complex *aob = ao + ncomp*nao*ngrids;
         double *grid2atm = ALIGN8_UP(buf); // [atm_id,xyz,grid]
         double *eprim = grid2atm + atmcount*3*BLKSIZE;
-        double *cart_gto = eprim + NPRIMAX*BLKSIZE*2;
+        double *efam = eprim + NPRIMAX*BLKSIZE*2;
+        double *cart_gto = efam + NPRIMAX*BLKSIZE;
 
         _fill_grid2atm(grid2atm, coord, bgrids, ngrids,
                        atm+atmstart*ATM_SLOTS, atmcount, bas, nbas, env);
 
-        for (bas_id = sh0; bas_id < sh1; bas_id++) {
+        for (ish0 = sh0; ish0 < sh1; ish0 = ish1) {
+        ish1 = GTOexp_family_end(fexp, ish0, sh1, bas, env);
+        atm_id = bas[ish0*BAS_SLOTS+ATOM_OF];
+        pcoord = grid2atm + (atm_id - atmstart) * 3*BLKSIZE;
+        famexp = _family_exp(efam, pcoord, ish0, ish1, non0table, bgrids, bas, env);
+        for (bas_id = ish0; bas_id < ish1; bas_id++) {
                 np = bas[bas_id*BAS_SLOTS+NPRIM_OF];
                 nc = bas[bas_id*BAS_SLOTS+NCTR_OF ];
                 l  = bas[bas_id*BAS_SLOTS+ANG_OF  ];
@@ -286,11 +466,10 @@ void GTOeval_spinor_iter(FPtr_eval feval, FPtr_exp fexp, void (*c2s)(), double f
                 fac1 = fac * CINTcommon_fac_sp(l);
                 p_exp  = env + bas[bas_id*BAS_SLOTS+PTR_EXP];
                 pcoeff = env + bas[bas_id*BAS_SLOTS+PTR_COEFF];
-                atm_id = bas[bas_id*BAS_SLOTS+ATOM_OF];
-                pcoord = grid2atm + (atm_id - atmstart) * 3*BLKSIZE;
                 ao_id = ao_loc[bas_id] - ao_loc[sh0];
                 if (non0table[bas_id] &&
-                    (*fexp)(eprim, pcoord, p_exp, pcoeff, l, np, nc, bgrids, fac1)) {
+                    _shell_exp(eprim, efam, famexp, ish1 > ish0+1, fexp, pcoord,
+                               bas_id, bgrids, fac1, bas, env)) {
                         kappa = bas[bas_id*BAS_SLOTS+KAPPA_OF];
                         dcart = (l+1)*(l+2)/2;
                         di = nc * dcart;
@@ -310,7 +489,7 @@ void GTOeval_spinor_iter(FPtr_eval feval, FPtr_exp fexp, void (*c2s)(), double f
                                 _zset0(aob+off, ngrids, bgrids, nc*deg);
                         }
                 }
-        }
+        } }
 }
 
 int GTOshloc_by_atom(int *shloc, int *shls_slice, int *ao_loc, int *atm, int *bas)
@@ -354,7 +533,7 @@ void GTOeval_loop(void (*fiter)(), FPtr_eval feval, FPtr_exp fexp, double fac,
         int ip, ib, k, iloc, ish;
         size_t aoff, bgrids;
         int ncart = NCTR_CART * param[TENSOR] * param[POS_E1];
-        double *buf = malloc(sizeof(double) * BLKSIZE*(NPRIMAX*2+ncart));
+        double *buf = malloc(sizeof(double) * BLKSIZE*(NPRIMAX*3+ncart));
 #pragma omp for schedule(dynamic, 4)
         for (k = 0; k < nblk*nshblk; k++) {
                 iloc = k / nblk;
@@ -410,7 +589,7 @@ void GTOeval_spinor_drv(FPtr_eval feval, FPtr_exp fexp, void (*c2s)(), double fa
         int ip, ib, k, iloc, ish;
         size_t aoff, bgrids;
         int ncart = NCTR_CART * param[TENSOR] * param[POS_E1];
-        double *buf = malloc(sizeof(double) * BLKSIZE*(NPRIMAX*2+ncart));
+        double *buf = malloc(sizeof(double) * BLKSIZE*(NPRIMAX*3+ncart));
 #pragma omp for schedule(dynamic, 4)
         for (k = 0; k < nblk*nshblk; k++) {
                 iloc = k / nblk;
@@ -429,3 +608,235 @@ void GTOeval_spinor_drv(FPtr_eval feval, FPtr_exp fexp, void (*c2s)(), double fa
 }
 }
 
+
+/*
+ * Spinor AOs in planar layout ao[4,ncomp,nao,ngrids] for the real and
+ * imaginary parts of the alpha and beta components.  The cart->spinor
+ * transformation of each (l, kappa) is tabulated once by applying c2s to
+ * unit cartesian functions.  It is then applied to the cartesian GTOs of
+ * the block in one pass which produces all four outputs, so the radial and
+ * polynomial part of each cartesian function is loaded once for the two
+ * spinor components.  Only c2s of ncomp_e1 = 1 (the *_sf1 functions) is
+ * supported.
+ */
+#define SPINOR_KAPPA_TYPES      3
+
+static int _kappa_type(int kappa)
+{
+        return (kappa < 0) ? 0 : ((kappa == 0) ? 1 : 2);
+}
+
+static int _len_spinor(int l, int kappa)
+{
+        if (kappa == 0) {
+                return 4 * l + 2;
+        } else if (kappa < 0) {
+                return 2 * l + 2;
+        } else {
+                return 2 * l;
+        }
+}
+
+/*
+ * tab[4,nspinor,dcart]: Re(alpha), Im(alpha), Re(beta), Im(beta)
+ */
+static double *_spinor_c2s_table(void (*c2s)(), int l, int kappa)
+{
+        const int dcart = (l+1)*(l+2)/2;
+        const int nd = _len_spinor(l, kappa);
+        const int n = nd * dcart;
+        double *tab = malloc(sizeof(double) * n * 4);
+        double *unit = calloc(dcart*dcart, sizeof(double));
+        double complex *gspa = malloc(sizeof(double complex) * n * 2);
+        double complex *gspb = gspa + n;
+        int i;
+        for (i = 0; i < dcart; i++) {
+                unit[i*dcart+i] = 1;
+        }
+        // gsp[s*dcart+c] is the coefficient of cartesian c in spinor s
+        (*c2s)(gspa, gspb, unit, dcart, dcart, 1, kappa, l);
+        for (i = 0; i < n; i++) {
+                tab[      i] = creal(gspa[i]);
+                tab[  n + i] = cimag(gspa[i]);
+                tab[2*n + i] = creal(gspb[i]);
+                tab[3*n + i] = cimag(gspb[i]);
+        }
+        free(gspa);
+        free(unit);
+        return tab;
+}
+
+static void _spinor_planar_c2s(double *aoRa, double *aoIa, double *aoRb, double *aoIb,
+                               double *tab, double *gcart, size_t ngrids,
+                               size_t bgrids, int nc, int l, int kappa)
+{
+        const int dcart = (l+1)*(l+2)/2;
+        const int nd = _len_spinor(l, kappa);
+        const int n = nd * dcart;
+        int k, s, c, g;
+        double cra, cia, crb, cib, v;
+        double *pc, *ra, *ia, *rb, *ib;
+
+        for (k = 0; k < nc; k++) {
+                for (s = 0; s < nd; s++) {
+                        ra = aoRa + (k*nd+s) * ngrids;
+                        ia = aoIa + (k*nd+s) * ngrids;
+                        rb = aoRb + (k*nd+s) * ngrids;
+                        ib = aoIb + (k*nd+s) * ngrids;
+                        for (g = 0; g < bgrids; g++) {
+                                ra[g] = 0;
+                                ia[g] = 0;
+                                rb[g] = 0;
+                                ib[g] = 0;
+                        }
+                        for (c = 0; c < dcart; c++) {
+                                cra = tab[      s*dcart+c];
+                                cia = tab[  n + s*dcart+c];
+                                crb = tab[2*n + s*dcart+c];
+                                cib = tab[3*n + s*dcart+c];
+                                if (cra == 0 && cia == 0 && crb == 0 && cib == 0) {
+                                        continue;
+                                }
+                                pc = gcart + (k*dcart+c) * bgrids;
+#pragma GCC ivdep
+                                for (g = 0; g < bgrids; g++) {
+                                        v = pc[g];
+                                        ra[g] += cra * v;
+                                        ia[g] += cia * v;
+                                        rb[g] += crb * v;
+                                        ib[g] += cib * v;
+                                }
+                        }
+                }
+        }
+}
+
+static void _spinor_planar_iter(FPtr_eval feval, FPtr_exp fexp, double **tabs, double fac,
+                                size_t nao, size_t ngrids, size_t bgrids,
+                                int param[], int *shls_slice, int *ao_loc, double *buf,
+                                double *ao, double *coord, char *non0table,
+                                int *atm, int natm, int *bas, int nbas, double *env)
+{
+        const int ncomp = param[TENSOR];
+        const size_t nblk = ncomp * nao * ngrids;
+        const int sh0 = shls_slice[0];
+        const int sh1 = shls_slice[1];
+        const int atmstart = bas[sh0*BAS_SLOTS+ATOM_OF];
+        const int atmend = bas[(sh1-1)*BAS_SLOTS+ATOM_OF]+1;
+        const int atmcount = atmend - atmstart;
+        int i, l, np, nc, atm_id, bas_id, deg, kappa, dcart, ao_id;
+        int ish0, ish1, famexp;
+        size_t off, di;
+        double fac1;
+        double *p_exp, *pcoeff, *pcoord, *ri;
+        double *grid2atm = ALIGN8_UP(buf); // [atm_id,xyz,grid]
+        double *eprim = grid2atm + atmcount*3*BLKSIZE;
+        double *efam = eprim + NPRIMAX*BLKSIZE*2;
+        double *cart_gto = efam + NPRIMAX*BLKSIZE;
+
+        _fill_grid2atm(grid2atm, coord, bgrids, ngrids,
+                       atm+atmstart*ATM_SLOTS, atmcount, bas, nbas, env);
+
+        for (ish0 = sh0; ish0 < sh1; ish0 = ish1) {
+        ish1 = GTOexp_family_end(fexp, ish0, sh1, bas, env);
+        atm_id = bas[ish0*BAS_SLOTS+ATOM_OF];
+        pcoord = grid2atm + (atm_id - atmstart) * 3*BLKSIZE;
+        famexp = _family_exp(efam, pcoord, ish0, ish1, non0table, bgrids, bas, env);
+        for (bas_id = ish0; bas_id < ish1; bas_id++) {
+                np = bas[bas_id*BAS_SLOTS+NPRIM_OF];
+                nc = bas[bas_id*BAS_SLOTS+NCTR_OF ];
+                l  = bas[bas_id*BAS_SLOTS+ANG_OF  ];
+                kappa = bas[bas_id*BAS_SLOTS+KAPPA_OF];
+                deg = _len_spinor(l, kappa);
+                fac1 = fac * CINTcommon_fac_sp(l);
+                p_exp  = env + bas[bas_id*BAS_SLOTS+PTR_EXP];
+                pcoeff = env + bas[bas_id*BAS_SLOTS+PTR_COEFF];
+                ao_id = ao_loc[bas_id] - ao_loc[sh0];
+                if (non0table[bas_id] &&
+                    _shell_exp(eprim, efam, famexp, ish1 > ish0+1, fexp, pcoord,
+                               bas_id, bgrids, fac1, bas, env)) {
+                        dcart = (l+1)*(l+2)/2;
+                        di = nc * dcart;
+                        ri = env + atm[PTR_COORD+atm_id*ATM_SLOTS];
+                        (*feval)(cart_gto, ri, eprim, pcoord, p_exp, pcoeff,
+                                 env, l, np, nc, di, bgrids, bgrids);
+                        for (i = 0; i < ncomp; i++) {
+                                off = (i*nao+ao_id)*ngrids;
+                                _spinor_planar_c2s(ao+off, ao+nblk+off,
+                                                   ao+nblk*2+off, ao+nblk*3+off,
+                                                   tabs[l*SPINOR_KAPPA_TYPES+_kappa_type(kappa)],
+                                                   cart_gto+i*di*bgrids,
+                                                   ngrids, bgrids, nc, l, kappa);
+                        }
+                } else {
+                        for (i = 0; i < ncomp; i++) {
+                                off = (i*nao+ao_id)*ngrids;
+                                _dset0(ao+off       , ngrids, bgrids, nc*deg);
+                                _dset0(ao+nblk+off  , ngrids, bgrids, nc*deg);
+                                _dset0(ao+nblk*2+off, ngrids, bgrids, nc*deg);
+                                _dset0(ao+nblk*3+off, ngrids, bgrids, nc*deg);
+                        }
+                }
+        } }
+}
+
+void GTOeval_spinor_planar_drv(FPtr_eval feval, FPtr_exp fexp, void (*c2s)(), double fac,
+                               int ngrids, int param[], int *shls_slice, int *ao_loc,
+                               double *ao, double *coord, char *non0table,
+                               int *atm, int natm, int *bas, int nbas, double *env)
+{
+        int shloc[shls_slice[1]-shls_slice[0]+1];
+        const int nshblk = GTOshloc_by_atom(shloc, shls_slice, ao_loc, atm, bas);
+        const int nblk = (ngrids+BLKSIZE-1) / BLKSIZE;
+        const size_t Ngrids = ngrids;
+        int ish, l, t;
+        int lmax = 0;
+        for (ish = shls_slice[0]; ish < shls_slice[1]; ish++) {
+                lmax = MAX(lmax, bas[ish*BAS_SLOTS+ANG_OF]);
+        }
+        const int ntab = (lmax+1) * SPINOR_KAPPA_TYPES;
+        double *tabs[ntab];
+        for (t = 0; t < ntab; t++) {
+                tabs[t] = NULL;
+        }
+        int kappa;
+        for (ish = shls_slice[0]; ish < shls_slice[1]; ish++) {
+                l = bas[ish*BAS_SLOTS+ANG_OF];
+                kappa = bas[ish*BAS_SLOTS+KAPPA_OF];
+                t = l * SPINOR_KAPPA_TYPES + _kappa_type(kappa);
+                if (tabs[t] == NULL) {
+                        tabs[t] = _spinor_c2s_table(c2s, l, kappa);
+                }
+        }
+
+#pragma omp parallel
+{
+        const int sh0 = shls_slice[0];
+        const int sh1 = shls_slice[1];
+        const size_t nao = ao_loc[sh1] - ao_loc[sh0];
+        int ip, ib, k, iloc, ish;
+        size_t aoff, bgrids;
+        int ncart = NCTR_CART * param[TENSOR] * param[POS_E1];
+        double *buf = malloc(sizeof(double) * BLKSIZE*(NPRIMAX*3+ncart));
+#pragma omp for schedule(dynamic, 4)
+        for (k = 0; k < nblk*nshblk; k++) {
+                iloc = k / nblk;
+                ish = shloc[iloc];
+                aoff = ao_loc[ish] - ao_loc[sh0];
+                ib = k - iloc * nblk;
+                ip = ib * BLKSIZE;
+                bgrids = MIN(ngrids-ip, BLKSIZE);
+                _spinor_planar_iter(feval, fexp, tabs, fac,
+                                    nao, Ngrids, bgrids,
+                                    param, shloc+iloc, ao_loc, buf, ao+aoff*Ngrids+ip,
+                                    coord+ip, non0table+ib*nbas,
+                                    atm, natm, bas, nbas, env);
+        }
+        free(buf);
+}
+        for (t = 0; t < ntab; t++) {
+                if (tabs[t] != NULL) {
+                        free(tabs[t]);
+                }
+        }
+}
@@ -382,3 +382,157 @@ void CVHFipvip1_direct_scf_dm(CVHFOpt *opt, double *dm, int nset, int *ao_loc,
         CVHFgrad_jk_direct_scf_dm(opt, dm, nset, ao_loc, atm, natm, bas, nbas, env);
 }
 
+
+
+/*
+ * Fused nuclear Hessian JK engine.
+ *
+ * Each derivative quartet (ij|kl) is evaluated once. All ncomp components
+ * are contracted with all n_dm pairs of densities and all nterm patterns,
+ * and accumulated into the per-atom blocks
+ *
+ *      out[term,iset,atom_a,atom_b,comp] +=
+ *              sum_{ijkl} (ij|kl)_comp dm_ket[iset][p,q] dm_bra[iset][r,s]
+ *
+ * term_desc[term*6:term*6+6] = (p, q, r, s, a, b) are positions (0..3) in
+ * the quartet (i, j, k, l). a and b are the derivative centers; b = -1 for
+ * one-center terms (then the second atom dimension of out is 1).
+ * For example the ipip1 J and K terms of hessian/rhf.py are
+ *      lk->s1ij contracted with dm over ij: (3, 2, 0, 1, 0, -1)
+ *      jk->s1il contracted with dm over il: (1, 2, 0, 3, 0, -1)
+ *
+ * aosym = 1 for intor symmetric in k and l (ipip1, ipvip1): only k >= l is
+ * evaluated and the (lk) counterpart is accumulated from the same buffer.
+ * The prescreen of vhfopt (CVHFipip1_prescreen etc.) is applied if given.
+ */
+void CVHFhess_jk_drv(int (*intor)(), double *out, double *dm_ket, double *dm_bra,
+                     int n_dm, int ncomp, int *term_desc, int nterm, int aosym,
+                     int *shls_slice, int *ao_loc, CINTOpt *cintopt, CVHFOpt *vhfopt,
+                     int *atm, int natm, int *bas, int nbas, double *env)
+{
+        const int ish0 = shls_slice[0];
+        const int ish1 = shls_slice[1];
+        const int jsh0 = shls_slice[2];
+        const int jsh1 = shls_slice[3];
+        const int ksh0 = shls_slice[4];
+        const int ksh1 = shls_slice[5];
+        const int lsh0 = shls_slice[6];
+        const int lsh1 = shls_slice[7];
+        const int nish = ish1 - ish0;
+        const int njsh = jsh1 - jsh0;
+        const size_t nao = ao_loc[nbas];
+        const size_t nao2 = nao * nao;
+        const int dmax = GTOmax_shell_dim(ao_loc, shls_slice, 4);
+        const int cache_size = GTOmax_cache_size(intor, shls_slice, 4,
+                                                 atm, natm, bas, nbas, env);
+        int t;
+        size_t term_size[nterm];
+        size_t out_size = 0;
+        for (t = 0; t < nterm; t++) {
+                term_size[t] = (size_t)n_dm * natm * ncomp;
+                if (term_desc[t*6+5] >= 0) {
+                        term_size[t] *= natm;
+                }
+                out_size += term_size[t];
+        }
+        int (*fprescreen)();
+        if (vhfopt != NULL) {
+                fprescreen = vhfopt->fprescreen;
+        } else {
+                fprescreen = CVHFnoscreen;
+        }
+
+#pragma omp parallel
+{
+        int ish, jsh, ksh, lsh, ij, i, j, k, l, ic, iset, swap;
+        int di, dj, dk, dl, p, q, r, s, a, b, nb;
+        int i0, j0, k0, l0;
+        int shls[4];
+        int idx[4];
+        size_t n, dijkl;
+        double v, fac;
+        double *pout, *dk_set, *db_set;
+        double *out_priv = calloc(out_size, sizeof(double));
+        double *buf = malloc(sizeof(double) * (dmax*dmax*dmax*dmax*ncomp + cache_size));
+        double *cache = buf + dmax*dmax*dmax*dmax*ncomp;
+#pragma omp for schedule(dynamic)
+        for (ij = 0; ij < nish*njsh; ij++) {
+                ish = ij / njsh + ish0;
+                jsh = ij % njsh + jsh0;
+                i0 = ao_loc[ish];
+                j0 = ao_loc[jsh];
+                di = ao_loc[ish+1] - i0;
+                dj = ao_loc[jsh+1] - j0;
+                shls[0] = ish;
+                shls[1] = jsh;
+        for (ksh = ksh0; ksh < ksh1; ksh++) {
+        for (lsh = lsh0; lsh < lsh1; lsh++) {
+                if (aosym && lsh > ksh) {
+                        break;
+                }
+                shls[2] = ksh;
+                shls[3] = lsh;
+                if (!(*fprescreen)(shls, vhfopt, atm, bas, env) ||
+                    !(*intor)(buf, NULL, shls, atm, natm, bas, nbas, env,
+                              cintopt, cache)) {
+                        continue;
+                }
+                k0 = ao_loc[ksh];
+                l0 = ao_loc[lsh];
+                dk = ao_loc[ksh+1] - k0;
+                dl = ao_loc[lsh+1] - l0;
+                dijkl = (size_t)di * dj * dk * dl;
+
+                pout = out_priv;
+                for (t = 0; t < nterm; t++) {
+                        p = term_desc[t*6+0];
+                        q = term_desc[t*6+1];
+                        r = term_desc[t*6+2];
+                        s = term_desc[t*6+3];
+                        a = term_desc[t*6+4];
+                        b = term_desc[t*6+5];
+                        nb = (b >= 0) ? natm : 1;
+                        for (swap = 0; swap <= (aosym && ksh != lsh); swap++) {
+                        for (iset = 0; iset < n_dm; iset++) {
+                                dk_set = dm_ket + iset * nao2;
+                                db_set = dm_bra + iset * nao2;
+                        for (ic = 0; ic < ncomp; ic++) {
+                                fac = 0;
+                                n = ic * dijkl;
+                                for (l = 0; l < dl; l++) {
+                                for (k = 0; k < dk; k++) {
+                                for (j = 0; j < dj; j++) {
+                                for (i = 0; i < di; i++, n++) {
+                                        v = buf[n];
+                                        idx[0] = i0 + i;
+                                        idx[1] = j0 + j;
+                                        idx[2] = swap ? l0 + l : k0 + k;
+                                        idx[3] = swap ? k0 + k : l0 + l;
+                                        fac += v * dk_set[idx[p]*nao+idx[q]]
+                                                 * db_set[idx[r]*nao+idx[s]];
+                                } } } }
+                                // The derivative centers are the atoms of the
+                                // shells at positions a and b
+                                idx[0] = bas[ATOM_OF+ish*BAS_SLOTS];
+                                idx[1] = bas[ATOM_OF+jsh*BAS_SLOTS];
+                                idx[2] = bas[ATOM_OF+(swap?lsh:ksh)*BAS_SLOTS];
+                                idx[3] = bas[ATOM_OF+(swap?ksh:lsh)*BAS_SLOTS];
+                                if (b >= 0) {
+                                        pout[((iset*natm+idx[a])*nb+idx[b])*ncomp+ic] += fac;
+                                } else {
+                                        pout[(iset*natm+idx[a])*ncomp+ic] += fac;
+                                }
+                        } }
+                        }
+                        pout += term_size[t];
+                }
+        } }
+        }
+#pragma omp critical
+        for (n = 0; n < out_size; n++) {
+                out[n] += out_priv[n];
+        }
+        free(out_priv);
+        free(buf);
+}
+}
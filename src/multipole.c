@@ -0,0 +1,881 @@
+/* Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+
+ *
+ * Far-field part of the lattice sums of the Coulomb integrals.
+ *
+ * A shell pair (or a single shell) is expanded in Hermite Gaussians
+ * (McMurchie-Davidson). Outside of their overlap, the Coulomb interaction of
+ * two Hermite Gaussians Lambda_t(r-P), Lambda_s(r-Q) is that of point
+ * multipoles, (pi/p)^{3/2} (pi/q)^{3/2} (-1)^{|s|} T_{t+s}(P-Q) with
+ * T_{tuv}(R) = d^t/dX^t d^u/dY^u d^v/dZ^v 1/|R|. The error is the erfc tail
+ * of the Boys function. For the order n = |t+s| term, relative to the
+ * multipole term n!/|P-Q|^{n+1}, it is bounded by
+ * 2^n x^{2n-1} exp(-x^2) / (sqrt(pi) n!), x^2 = a |P-Q|^2, 1/a = 1/p + 1/q.
+ * Beyond the near-field radius |P-Q|^2 > mp_rr_near[L] * (1/p + 1/q), L the
+ * total angular momentum of the charge distributions (the highest order of
+ * the expansion), the integrals are evaluated from the multipoles:
+ *
+ * - (ij|k): the multipoles of each primitive pair of ij (exact up to order
+ *   li+lj about its product center) contracted with the precomputed
+ *   multipoles of the auxiliary shell k.
+ * - (i|j): the interaction tensors of all far images of an atom pair are
+ *   lattice-summed with the k-point phases once, then contracted with the
+ *   multipoles of all shell pairs on that atom pair.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include "config.h"
+#include "cint.h"
+#include "fblas.h"
+#include "optimizer.h"
+#include "np_helper.h"
+
+#define SQUARE(r)       (r[0]*r[0]+r[1]*r[1]+r[2]*r[2])
+#define LEN_CART(l)     (((l)+1)*((l)+2)/2)
+#define LEN_HERMITE(n)  (((n)+1)*((n)+2)*((n)+3)/6)
+// primitive pairs below this value are dropped from the pair multipoles
+#define MP_PRIM_CUTOFF  1e-16
+
+double CINTcommon_fac_sp(int l);
+void CINTc2s_ket_sph(double *gsph, int nbra, double *gcart, int l);
+
+static int _nfunc(int ish, int cart, int *bas)
+{
+        const int l = bas[ANG_OF+ish*BAS_SLOTS];
+        const int nctr = bas[NCTR_OF+ish*BAS_SLOTS];
+        if (cart) {
+                return LEN_CART(l) * nctr;
+        } else {
+                return (l * 2 + 1) * nctr;
+        }
+}
+
+static void _cart_powers(int *lx, int *ly, int *lz, int l)
+{
+        int x, y, n = 0;
+        for (x = l; x >= 0; x--) {
+        for (y = l - x; y >= 0; y--, n++) {
+                lx[n] = x;
+                ly[n] = y;
+                lz[n] = l - x - y;
+        } }
+}
+
+/*
+ * 1D Hermite expansion coefficients E[i,j,t] of x_A^i x_B^j exp(-p x_P^2)
+ * (without the Gaussian product prefactor), i <= li, j <= lj.
+ */
+static void _hermite_E(double *E, int li, int lj, double p, double xpa, double xpb)
+{
+        const int nt = li + lj + 1;
+        const int dj = lj + 1;
+        const double a2 = .5 / p;
+        int i, j, t;
+        double *e0, *e1;
+        for (i = 0; i < (li+1)*dj*nt; i++) {
+                E[i] = 0;
+        }
+        E[0] = 1;
+        for (i = 0; i < li; i++) {
+                e0 = E + i * dj * nt;
+                e1 = e0 + dj * nt;
+                for (t = 0; t <= i+1; t++) {
+                        e1[t] = xpa * e0[t];
+                        if (t > 0) {
+                                e1[t] += a2 * e0[t-1];
+                        }
+                        if (t < i) {
+                                e1[t] += (t+1) * e0[t+1];
+                        }
+                }
+        }
+        for (i = 0; i <= li; i++) {
+                for (j = 0; j < lj; j++) {
+                        e0 = E + (i * dj + j) * nt;
+                        e1 = e0 + nt;
+                        for (t = 0; t <= i+j+1; t++) {
+                                e1[t] = xpb * e0[t];
+                                if (t > 0) {
+                                        e1[t] += a2 * e0[t-1];
+                                }
+                                if (t < i+j) {
+                                        e1[t] += (t+1) * e0[t+1];
+                                }
+                        }
+                }
+        }
+}
+
+/*
+ * T[hidx[t,u,v]] = d^t/dX^t d^u/dY^u d^v/dZ^v 1/|r| for t+u+v <= nmax. The
+ * McMurchie-Davidson recursion of the Coulomb Hermite integrals for point
+ * charges, R^n_000 = (-1)^n (2n-1)!! / |r|^{2n+1}. hidx is the compact index
+ * of the (t,u,v) cube of side d1.
+ */
+static void _coulomb_T(double *T, double *r, int nmax, int *hidx, int d1,
+                       double *work)
+{
+        const int nher = LEN_HERMITE(nmax);
+        const double rinv2 = 1. / SQUARE(r);
+        double fac = sqrt(rinv2);
+        double *Rn, *Rn1;
+        int n, l, t, u, v, idx;
+        for (n = 0; n <= nmax; n++) {
+                work[n*nher] = fac;
+                fac *= -(2 * n + 1) * rinv2;
+        }
+        for (l = 1; l <= nmax; l++) {
+        for (t = l; t >= 0; t--) {
+        for (u = l - t; u >= 0; u--) {
+                v = l - t - u;
+                idx = hidx[(t*d1+u)*d1+v];
+                for (n = 0; n <= nmax - l; n++) {
+                        Rn = work + n * nher;
+                        Rn1 = Rn + nher;
+                        if (t > 0) {
+                                Rn[idx] = r[0] * Rn1[hidx[((t-1)*d1+u)*d1+v]];
+                                if (t > 1) {
+                                        Rn[idx] += (t-1) * Rn1[hidx[((t-2)*d1+u)*d1+v]];
+                                }
+                        } else if (u > 0) {
+                                Rn[idx] = r[1] * Rn1[hidx[(t*d1+u-1)*d1+v]];
+                                if (u > 1) {
+                                        Rn[idx] += (u-1) * Rn1[hidx[(t*d1+u-2)*d1+v]];
+                                }
+                        } else {
+                                Rn[idx] = r[2] * Rn1[hidx[(t*d1+u)*d1+v-1]];
+                                if (v > 1) {
+                                        Rn[idx] += (v-1) * Rn1[hidx[(t*d1+u)*d1+v-2]];
+                                }
+                        }
+                }
+        } } }
+        NPdcopy(T, work, nher);
+}
+
+/*
+ * Hermite multipoles M[nfunc,(l+1)^3] of shell ish about its center,
+ * M_tuv = \int chi(r) (pi/a)^{-3/2} Lambda_tuv(r) summed over primitives,
+ * in the cartesian or spherical functions of the integrals.
+ */
+static void _shell_multipoles(double *M, int ish, int cart, int *bas, double *env)
+{
+        const int l = bas[ANG_OF+ish*BAS_SLOTS];
+        const int nprim = bas[NPRIM_OF+ish*BAS_SLOTS];
+        const int nctr = bas[NCTR_OF+ish*BAS_SLOTS];
+        const double *ai = env + bas[PTR_EXP+ish*BAS_SLOTS];
+        const double *ci = env + bas[PTR_COEFF+ish*BAS_SLOTS];
+        const int nf = LEN_CART(l);
+        const int d1 = l + 1;
+        const int cube = d1 * d1 * d1;
+        const double fac = CINTcommon_fac_sp(l);
+        int lx[nf], ly[nf], lz[nf];
+        double E[d1*d1];
+        double *gcart;
+        int ip, n, ic, t, u, v;
+        double pref, c;
+
+        _cart_powers(lx, ly, lz, l);
+        if (cart) {
+                gcart = M;
+        } else {
+                gcart = malloc(sizeof(double) * nctr * nf * cube);
+        }
+        for (n = 0; n < nctr*nf*cube; n++) {
+                gcart[n] = 0;
+        }
+        for (ip = 0; ip < nprim; ip++) {
+                _hermite_E(E, l, 0, ai[ip], 0., 0.);
+                pref = fac * pow(M_PI / ai[ip], 1.5);
+                for (n = 0; n < nctr; n++) {
+                        c = ci[n*nprim+ip] * pref;
+                        for (ic = 0; ic < nf; ic++) {
+        for (t = 0; t <= lx[ic]; t++) {
+        for (u = 0; u <= ly[ic]; u++) {
+        for (v = 0; v <= lz[ic]; v++) {
+                gcart[(n*nf+ic)*cube+(t*d1+u)*d1+v] +=
+                        c * E[lx[ic]*d1+t] * E[ly[ic]*d1+u] * E[lz[ic]*d1+v];
+        } } }
+                        }
+                }
+        }
+        if (!cart) {
+                for (n = 0; n < nctr; n++) {
+                        CINTc2s_ket_sph(M+n*(l*2+1)*cube, cube, gcart+n*nf*cube, l);
+                }
+                free(gcart);
+        }
+}
+
+void PBCdel_multipole(PBCOpt *opt)
+{
+        if (opt->mp_moments) {
+                free(opt->mp_ainv);
+                free(opt->mp_loc);
+                free(opt->mp_moments);
+                free(opt->mp_hidx);
+                free(opt->mp_rr_near);
+        }
+        opt->mp_nbas = 0;
+        opt->mp_rr_near = NULL;
+        opt->mp_ainv = NULL;
+        opt->mp_loc = NULL;
+        opt->mp_moments = NULL;
+        opt->mp_hidx = NULL;
+}
+
+/*
+ * Multipoles of all shells in bas for the far-field integrals. cart selects
+ * the cartesian functions of the *_cart integrals. rr_near[L] is the
+ * near-field radius (see above) for the total angular momentum L of the
+ * charge distributions, L = 0 ... 3*lmax.
+ */
+void PBCset_multipole(PBCOpt *opt, double *rr_near, int cart,
+                      int *atm, int natm, int *bas, int nbas, double *env)
+{
+        PBCdel_multipole(opt);
+        int ish, ip, l, nprim, d1;
+        size_t size = 0;
+        double *ai;
+        opt->mp_lmax = 0;
+        opt->mp_dmax = 0;
+        opt->mp_loc = malloc(sizeof(int) * (nbas+1));
+        opt->mp_ainv = malloc(sizeof(double) * nbas);
+        for (ish = 0; ish < nbas; ish++) {
+                l = bas[ANG_OF+ish*BAS_SLOTS];
+                nprim = bas[NPRIM_OF+ish*BAS_SLOTS];
+                ai = env + bas[PTR_EXP+ish*BAS_SLOTS];
+                opt->mp_loc[ish] = size;
+                size += (size_t)_nfunc(ish, cart, bas) * (l+1)*(l+1)*(l+1);
+                opt->mp_lmax = MAX(opt->mp_lmax, l);
+                opt->mp_dmax = MAX(opt->mp_dmax, _nfunc(ish, cart, bas));
+                opt->mp_ainv[ish] = 0;
+                for (ip = 0; ip < nprim; ip++) {
+                        opt->mp_ainv[ish] = MAX(opt->mp_ainv[ish], 1./ai[ip]);
+                }
+        }
+        opt->mp_loc[nbas] = size;
+        opt->mp_moments = malloc(sizeof(double) * size);
+#pragma omp parallel for schedule(dynamic)
+        for (ish = 0; ish < nbas; ish++) {
+                _shell_multipoles(opt->mp_moments+opt->mp_loc[ish], ish, cart, bas, env);
+        }
+
+        // compact index of the Hermite functions in the order of t+u+v
+        d1 = opt->mp_lmax * 3 + 1;
+        opt->mp_hidx = malloc(sizeof(int) * d1*d1*d1);
+        int t, u, n = 0;
+        for (ish = 0; ish < d1*d1*d1; ish++) {
+                opt->mp_hidx[ish] = -1;
+        }
+        for (l = 0; l < d1; l++) {
+                for (t = l; t >= 0; t--) {
+                for (u = l - t; u >= 0; u--, n++) {
+                        opt->mp_hidx[(t*d1+u)*d1+l-t-u] = n;
+                } }
+        }
+        opt->mp_rr_near = malloc(sizeof(double) * d1);
+        for (l = 0; l < d1; l++) {
+                opt->mp_rr_near[l] = rr_near[l];
+        }
+        opt->mp_nbas = nbas;
+        opt->mp_cart = cart;
+}
+
+/*
+ * Multipoles of the charge distributions of shells ish and jsh at the
+ * coordinates in env, q[g,dj,di,(li+lj+1)^3] about the product centers
+ * coords[g]. Primitive pairs of the same product center are summed into one
+ * group. Returns the number of groups.
+ */
+static int _pair_multipoles(double *q, double *coords, int *shls, int cart,
+                            int *atm, int *bas, double *env, double *buf)
+{
+        const int ish = shls[0];
+        const int jsh = shls[1];
+        const int li = bas[ANG_OF+ish*BAS_SLOTS];
+        const int lj = bas[ANG_OF+jsh*BAS_SLOTS];
+        const int iprim = bas[NPRIM_OF+ish*BAS_SLOTS];
+        const int jprim = bas[NPRIM_OF+jsh*BAS_SLOTS];
+        const int ictr = bas[NCTR_OF+ish*BAS_SLOTS];
+        const int jctr = bas[NCTR_OF+jsh*BAS_SLOTS];
+        const double *ai = env + bas[PTR_EXP+ish*BAS_SLOTS];
+        const double *aj = env + bas[PTR_EXP+jsh*BAS_SLOTS];
+        const double *ci = env + bas[PTR_COEFF+ish*BAS_SLOTS];
+        const double *cj = env + bas[PTR_COEFF+jsh*BAS_SLOTS];
+        const double *ri = env + atm[PTR_COORD+bas[ATOM_OF+ish*BAS_SLOTS]*ATM_SLOTS];
+        const double *rj = env + atm[PTR_COORD+bas[ATOM_OF+jsh*BAS_SLOTS]*ATM_SLOTS];
+        const int nfi = LEN_CART(li);
+        const int nfj = LEN_CART(lj);
+        const int dic = nfi * ictr;
+        const int djc = nfj * jctr;
+        const int lij = li + lj;
+        const int d1 = lij + 1;
+        const int cube = d1 * d1 * d1;
+        const size_t dijc = (size_t)dic * djc * cube;
+        const int di = _nfunc(ish, cart, bas);
+        const int dj = _nfunc(jsh, cart, bas);
+        const double fac = CINTcommon_fac_sp(li) * CINTcommon_fac_sp(lj);
+        const int nE = (li+1) * (lj+1) * d1;
+        int lxi[nfi], lyi[nfi], lzi[nfi];
+        int lxj[nfj], lyj[nfj], lzj[nfj];
+        double Ex[nE], Ey[nE], Ez[nE];
+        double rirj[3], pa[3], pb[3];
+        double *gc, *pg;
+        int ip, jp, m, n, ic, jc, t, u, v, i, j, ngroup;
+        double aij, eij, pref, cimax, cjmax, c, ex, exy;
+        int same_center;
+
+        _cart_powers(lxi, lyi, lzi, li);
+        _cart_powers(lxj, lyj, lzj, lj);
+        rirj[0] = ri[0] - rj[0];
+        rirj[1] = ri[1] - rj[1];
+        rirj[2] = ri[2] - rj[2];
+        const double rr = SQUARE(rirj);
+        same_center = (rr < 1e-24);
+
+        if (cart) {
+                gc = q;
+        } else {
+                gc = buf;
+        }
+        ngroup = 0;
+        for (ip = 0; ip < iprim; ip++) {
+        for (jp = 0; jp < jprim; jp++) {
+                aij = ai[ip] + aj[jp];
+                eij = exp(-ai[ip] * aj[jp] / aij * rr);
+                cimax = 0;
+                cjmax = 0;
+                for (m = 0; m < ictr; m++) {
+                        cimax = MAX(cimax, fabs(ci[m*iprim+ip]));
+                }
+                for (n = 0; n < jctr; n++) {
+                        cjmax = MAX(cjmax, fabs(cj[n*jprim+jp]));
+                }
+                pref = fac * eij * pow(M_PI / aij, 1.5);
+                if (pref * cimax * cjmax < MP_PRIM_CUTOFF) {
+                        continue;
+                }
+                for (i = 0; i < 3; i++) {
+                        pa[i] = -aj[jp] / aij * rirj[i];
+                        pb[i] =  ai[ip] / aij * rirj[i];
+                }
+                if (!same_center || ngroup == 0) {
+                        pg = gc + dijc * ngroup;
+                        for (i = 0; i < dijc; i++) {
+                                pg[i] = 0;
+                        }
+                        coords[ngroup*3+0] = ri[0] + pa[0];
+                        coords[ngroup*3+1] = ri[1] + pa[1];
+                        coords[ngroup*3+2] = ri[2] + pa[2];
+                        ngroup++;
+                }
+                _hermite_E(Ex, li, lj, aij, pa[0], pb[0]);
+                _hermite_E(Ey, li, lj, aij, pa[1], pb[1]);
+                _hermite_E(Ez, li, lj, aij, pa[2], pb[2]);
+                for (n = 0; n < jctr; n++) {
+                for (m = 0; m < ictr; m++) {
+                        c = ci[m*iprim+ip] * cj[n*jprim+jp] * pref;
+                        for (jc = 0; jc < nfj; jc++) {
+                        for (ic = 0; ic < nfi; ic++) {
+                                i = (n * nfj + jc) * dic + m * nfi + ic;
+                                double *pE = pg + (size_t)i * cube;
+                                double *ex1 = Ex + (lxi[ic]*(lj+1)+lxj[jc]) * d1;
+                                double *ey1 = Ey + (lyi[ic]*(lj+1)+lyj[jc]) * d1;
+                                double *ez1 = Ez + (lzi[ic]*(lj+1)+lzj[jc]) * d1;
+        for (t = 0; t <= lxi[ic]+lxj[jc]; t++) {
+                ex = c * ex1[t];
+                for (u = 0; u <= lyi[ic]+lyj[jc]; u++) {
+                        exy = ex * ey1[u];
+                        for (v = 0; v <= lzi[ic]+lzj[jc]; v++) {
+                                pE[(t*d1+u)*d1+v] += exy * ez1[v];
+                        }
+                }
+        }
+                        } }
+                } }
+        } }
+
+        if (!cart) {
+                // cart -> sph of the i functions, then of the j functions
+                double *tmp = buf + dijc * ngroup;
+                size_t dij1 = (size_t)di * djc * cube;
+                for (m = 0; m < ngroup; m++) {
+                        for (j = 0; j < djc; j++) {
+                        for (n = 0; n < ictr; n++) {
+                                CINTc2s_ket_sph(tmp + m*dij1 + ((size_t)j*di + n*(li*2+1))*cube,
+                                                cube, gc + m*dijc + ((size_t)j*dic + n*nfi)*cube, li);
+                        } }
+                        for (n = 0; n < jctr; n++) {
+                                CINTc2s_ket_sph(q + (size_t)m*di*dj*cube + (size_t)n*(lj*2+1)*di*cube,
+                                                di*cube, tmp + m*dij1 + (size_t)n*nfj*di*cube, lj);
+                        }
+                }
+        }
+        return ngroup;
+}
+
+/*
+ * Whether the charge distribution of shells ish, jsh (any point on the
+ * segment between their centers) and shell ksh are in the far field.
+ */
+static int _far3c(int *shls, PBCOpt *opt, int *atm, int *bas, double *env)
+{
+        const int ish = shls[0];
+        const int jsh = shls[1];
+        const int ksh = shls[2];
+        const double *ri = env + atm[PTR_COORD+bas[ATOM_OF+ish*BAS_SLOTS]*ATM_SLOTS];
+        const double *rj = env + atm[PTR_COORD+bas[ATOM_OF+jsh*BAS_SLOTS]*ATM_SLOTS];
+        const double *rk = env + atm[PTR_COORD+bas[ATOM_OF+ksh*BAS_SLOTS]*ATM_SLOTS];
+        double rij[3], rik[3], d[3];
+        double s, rr;
+        int i;
+        for (i = 0; i < 3; i++) {
+                rij[i] = rj[i] - ri[i];
+                rik[i] = rk[i] - ri[i];
+        }
+        rr = SQUARE(rij);
+        s = 0;
+        if (rr > 1e-24) {
+                s = (rij[0]*rik[0] + rij[1]*rik[1] + rij[2]*rik[2]) / rr;
+                s = MIN(MAX(s, 0.), 1.);
+        }
+        for (i = 0; i < 3; i++) {
+                d[i] = rik[i] - s * rij[i];
+        }
+        // the most diffuse primitive pair has the exponent 1/ainv_i + 1/ainv_j
+        double pinv = opt->mp_ainv[ish] * opt->mp_ainv[jsh] /
+                     (opt->mp_ainv[ish] + opt->mp_ainv[jsh]);
+        const int L = bas[ANG_OF+ish*BAS_SLOTS] + bas[ANG_OF+jsh*BAS_SLOTS] +
+                      bas[ANG_OF+ksh*BAS_SLOTS];
+        return SQUARE(d) > opt->mp_rr_near[L] * (pinv + opt->mp_ainv[ksh]);
+}
+
+/*
+ * The buffer size of PBCmp_int3c2e for the shell pair (ish, jsh). 0 if the
+ * multipoles are not initialized.
+ */
+size_t PBCmp_int3c2e_bufsize(PBCOpt *opt, int ish, int jsh, int *bas)
+{
+        if (opt == NULL || opt->mp_moments == NULL) {
+                return 0;
+        }
+        const int li = bas[ANG_OF+ish*BAS_SLOTS];
+        const int lj = bas[ANG_OF+jsh*BAS_SLOTS];
+        const size_t nprim2 = bas[NPRIM_OF+ish*BAS_SLOTS] * bas[NPRIM_OF+jsh*BAS_SLOTS];
+        const size_t dijc = LEN_CART(li) * bas[NCTR_OF+ish*BAS_SLOTS] *
+                            LEN_CART(lj) * bas[NCTR_OF+jsh*BAS_SLOTS];
+        const int d1 = li + lj + 1;
+        const size_t cube = d1 * d1 * d1;
+        const int nmax = li + lj + opt->mp_lmax;
+        const size_t nher = LEN_HERMITE(nmax);
+        // q, coords, the cached T, the atom of T, then the c2s scratch of
+        // _pair_multipoles or the work space of _coulomb_T and W
+        return nprim2 * (dijc * cube + 3 + nher) + 1 +
+                MAX(nprim2 * dijc * cube * 2,
+                    nher * (nmax + 1) + cube * opt->mp_dmax);
+}
+
+/*
+ * (ij|k) from the multipoles if the shells are in the far field, in the
+ * layout of int3c2e out[dk,dj,di]. Returns 0 (and leaves out untouched) for
+ * near-field shells. The pair multipoles are built in buf on the first call
+ * for the current images of ish and jsh; set *npair = -1 whenever the
+ * images are changed. The interaction tensors T(P-Rk) of all product centers
+ * P are kept in buf up to order li+lj+mp_lmax and reused by the following
+ * shells k on the same atom.
+ */
+int PBCmp_int3c2e(double *out, int *shls, PBCOpt *opt,
+                  int *atm, int *bas, double *env, double *buf, int *npair)
+{
+        const int ish = shls[0];
+        const int jsh = shls[1];
+        const int ksh = shls[2];
+        if (ksh >= opt->mp_nbas || !_far3c(shls, opt, atm, bas, env)) {
+                return 0;
+        }
+        const char TRANS_T = 'T';
+        const char TRANS_N = 'N';
+        const double D1 = 1;
+        const int li = bas[ANG_OF+ish*BAS_SLOTS];
+        const int lj = bas[ANG_OF+jsh*BAS_SLOTS];
+        const int lk = bas[ANG_OF+ksh*BAS_SLOTS];
+        const int nprim2 = bas[NPRIM_OF+ish*BAS_SLOTS] * bas[NPRIM_OF+jsh*BAS_SLOTS];
+        const int dijc = LEN_CART(li) * bas[NCTR_OF+ish*BAS_SLOTS] *
+                         LEN_CART(lj) * bas[NCTR_OF+jsh*BAS_SLOTS];
+        const int di = _nfunc(ish, opt->mp_cart, bas);
+        const int dj = _nfunc(jsh, opt->mp_cart, bas);
+        const int dk = _nfunc(ksh, opt->mp_cart, bas);
+        const int dij = di * dj;
+        const int lij = li + lj;
+        const int d1 = lij + 1;
+        const int cube = d1 * d1 * d1;
+        const int dk1 = lk + 1;
+        const int cubek = dk1 * dk1 * dk1;
+        const int nmax = lij + opt->mp_lmax;
+        const int nher = LEN_HERMITE(nmax);
+        const int hd1 = opt->mp_lmax * 3 + 1;
+        const int *hidx = opt->mp_hidx;
+        const int katm = bas[ATOM_OF+ksh*BAS_SLOTS];
+        const double *rk = env + atm[PTR_COORD+katm*ATM_SLOTS];
+        const double *Mk = opt->mp_moments + opt->mp_loc[ksh];
+        double *q = buf;
+        double *coords = q + (size_t)nprim2 * dijc * cube;
+        double *Tg = coords + nprim2 * 3;
+        double *Tatm = Tg + (size_t)nprim2 * nher;
+        double *work = Tatm + 1;
+        double *W = work + (size_t)nher * (nmax + 1);
+        if (*npair < 0) {
+                // the c2s scratch of _pair_multipoles overlaps work and W
+                *npair = _pair_multipoles(q, coords, shls, opt->mp_cart,
+                                          atm, bas, env, work);
+                *Tatm = -1;
+        }
+
+        int g, t, u, v, s0, s1, s2, kf, n, tuv, sidx;
+        int sigma[cubek], sgn[cubek], nsigma;
+        double r[3], val;
+        double *T, *pW;
+        if (*Tatm != katm) {
+                for (g = 0; g < *npair; g++) {
+                        r[0] = coords[g*3+0] - rk[0];
+                        r[1] = coords[g*3+1] - rk[1];
+                        r[2] = coords[g*3+2] - rk[2];
+                        _coulomb_T(Tg+(size_t)g*nher, r, nmax, opt->mp_hidx, hd1, work);
+                }
+                *Tatm = katm;
+        }
+
+        // nonzero multipoles of shell k
+        nsigma = 0;
+        for (s0 = 0; s0 <= lk; s0++) {
+        for (s1 = 0; s1 <= lk-s0; s1++) {
+        for (s2 = 0; s2 <= lk-s0-s1; s2++) {
+                sidx = (s0*dk1+s1)*dk1+s2;
+                for (kf = 0; kf < dk; kf++) {
+                        if (Mk[kf*cubek+sidx] != 0) {
+                                sigma[nsigma] = sidx;
+                                sgn[nsigma] = ((s0 + s1 + s2) % 2) ? -1 : 1;
+                                nsigma++;
+                                break;
+                        }
+                }
+        } } }
+
+        for (n = 0; n < dij*dk; n++) {
+                out[n] = 0;
+        }
+        for (g = 0; g < *npair; g++) {
+                T = Tg + (size_t)g * nher;
+                for (n = 0; n < cube*dk; n++) {
+                        W[n] = 0;
+                }
+                // W[kf,tuv] = sum_s M_k[kf,s] (-1)^{|s|} T_{tuv+s}
+                for (t = 0; t <= lij; t++) {
+                for (u = 0; u <= lij-t; u++) {
+                for (v = 0; v <= lij-t-u; v++) {
+                        tuv = (t*d1+u)*d1+v;
+                        pW = W + tuv;
+                        for (n = 0; n < nsigma; n++) {
+                                sidx = sigma[n];
+                                s2 = sidx % dk1;
+                                s1 = sidx / dk1 % dk1;
+                                s0 = sidx / (dk1*dk1);
+                                val = sgn[n] * T[hidx[((t+s0)*hd1+u+s1)*hd1+v+s2]];
+                                for (kf = 0; kf < dk; kf++) {
+                                        pW[kf*cube] += Mk[kf*cubek+sidx] * val;
+                                }
+                        }
+                } } }
+                dgemm_(&TRANS_T, &TRANS_N, &dij, &dk, &cube,
+                       &D1, q+(size_t)g*dij*cube, &cube, W, &cube,
+                       &D1, out, &dij);
+        }
+        return 1;
+}
+
+/*
+ * Whether shell jsh (at the image in env) is in the far field of ish.
+ * Consistent with the image selection of PBCnr2c_multipole_fill.
+ */
+int PBCmp_far2c(int *shls, PBCOpt *opt, int *atm, int *bas, double *env)
+{
+        const int ish = shls[0];
+        const int jsh = shls[1];
+        const double *ri = env + atm[PTR_COORD+bas[ATOM_OF+ish*BAS_SLOTS]*ATM_SLOTS];
+        const double *rj = env + atm[PTR_COORD+bas[ATOM_OF+jsh*BAS_SLOTS]*ATM_SLOTS];
+        double d[3];
+        d[0] = ri[0] - rj[0];
+        d[1] = ri[1] - rj[1];
+        d[2] = ri[2] - rj[2];
+        const int L = bas[ANG_OF+ish*BAS_SLOTS] + bas[ANG_OF+jsh*BAS_SLOTS];
+        return SQUARE(d) > opt->mp_rr_near[L] * (opt->mp_ainv[ish] + opt->mp_ainv[jsh]);
+}
+
+typedef struct {
+        double rr;
+        int L;
+} _MPImg;
+
+static int _mp_img_cmp(const void *a, const void *b)
+{
+        double ra = ((_MPImg *)a)->rr;
+        double rb = ((_MPImg *)b)->rr;
+        return (ra < rb) - (ra > rb);  // descending
+}
+
+typedef struct {
+        double rr;
+        int ish;
+        int jsh;
+} _MPPair;
+
+static int _mp_pair_cmp(const void *a, const void *b)
+{
+        double ra = ((_MPPair *)a)->rr;
+        double rb = ((_MPPair *)b)->rr;
+        return (ra < rb) - (ra > rb);  // descending
+}
+
+/*
+ * out[k,i,j] += sum_{ts} M_i[t] M_j[s] (-1)^{|s|} S[k,t+s]
+ */
+static void _contract_2c(double complex *out, int naoj, int nkpts, size_t nij,
+                         double *Mi, int li, int di, double *Mj, int lj, int dj,
+                         double *Sr, double *Si, int nher, int *hidx, int hd1,
+                         double complex *X)
+{
+        const int ti = li + 1;
+        const int tj = lj + 1;
+        const int cubei = ti * ti * ti;
+        const int cubej = tj * tj * tj;
+        int k, i, j, t0, t1, t2, s0, s1, s2, tidx, sidx, n, sgn;
+        double complex s;
+        double *pSr, *pSi;
+
+        for (k = 0; k < nkpts; k++) {
+                pSr = Sr + (size_t)k * nher;
+                pSi = Si + (size_t)k * nher;
+                // X[i,s] = sum_t M_i[t] S[t+s]
+                for (n = 0; n < di*cubej; n++) {
+                        X[n] = 0;
+                }
+                for (s0 = 0; s0 <= lj; s0++) {
+                for (s1 = 0; s1 <= lj-s0; s1++) {
+                for (s2 = 0; s2 <= lj-s0-s1; s2++) {
+                        sidx = (s0*tj+s1)*tj+s2;
+                        for (t0 = 0; t0 <= li; t0++) {
+                        for (t1 = 0; t1 <= li-t0; t1++) {
+                        for (t2 = 0; t2 <= li-t0-t1; t2++) {
+                                tidx = (t0*ti+t1)*ti+t2;
+                                n = hidx[((t0+s0)*hd1+t1+s1)*hd1+t2+s2];
+                                s = pSr[n] + pSi[n] * _Complex_I;
+                                for (i = 0; i < di; i++) {
+                                        X[i*cubej+sidx] += Mi[i*cubei+tidx] * s;
+                                }
+                        } } }
+                } } }
+                for (i = 0; i < di; i++) {
+                for (j = 0; j < dj; j++) {
+                        s = 0;
+                        for (s0 = 0; s0 <= lj; s0++) {
+                        for (s1 = 0; s1 <= lj-s0; s1++) {
+                        for (s2 = 0; s2 <= lj-s0-s1; s2++) {
+                                sidx = (s0*tj+s1)*tj+s2;
+                                sgn = ((s0 + s1 + s2) % 2) ? -1 : 1;
+                                s += sgn * X[i*cubej+sidx] * Mj[j*cubej+sidx];
+                        } } }
+                        out[k*nij+i*naoj+j] += s;
+                } }
+        }
+}
+
+/*
+ * Far-field part of the lattice sum of int2c2e,
+ * out[k,i,j] += \sum_L exp(ik.L) (i|j(L)) over the images L which are in the
+ * far field of the shell pair (see PBCmp_far2c). For each atom pair the
+ * images are sorted by distance and the interaction tensors
+ * \sum_L exp(ik.L) T(Ri-Rj-L) are accumulated from the farthest image
+ * inwards, so that all shell pairs of the atom pair, in the order of their
+ * near-field radii, share one sweep over the images. hermi != 0 fills the
+ * lower triangle (ish >= jsh) only.
+ */
+void PBCnr2c_multipole_fill(double complex *out, int nkpts, int nimgs, int hermi,
+                            double *Ls, double *expkL_r, double *expkL_i,
+                            int *shls_slice, int *ao_loc, PBCOpt *opt,
+                            int *atm, int natm, int *bas, int nbas, double *env)
+{
+        const int ish0 = shls_slice[0];
+        const int ish1 = shls_slice[1];
+        const int jsh0 = shls_slice[2];
+        const int jsh1 = shls_slice[3];
+        const size_t naoi = ao_loc[ish1] - ao_loc[ish0];
+        const size_t naoj = ao_loc[jsh1] - ao_loc[jsh0];
+        const size_t nij = naoi * naoj;
+        const int hd1 = opt->mp_lmax * 3 + 1;
+        int *iatm = malloc(sizeof(int) * (natm * 2 + 2));
+        int *jatm = iatm + natm + 1;
+        int nia = 0;
+        int nja = 0;
+        int ish, jsh, ia;
+        // atoms of the shells of the two slices
+        for (ia = 0; ia < natm; ia++) {
+                for (ish = ish0; ish < ish1; ish++) {
+                        if (bas[ATOM_OF+ish*BAS_SLOTS] == ia) {
+                                iatm[nia++] = ia;
+                                break;
+                        }
+                }
+                for (jsh = jsh0; jsh < jsh1; jsh++) {
+                        if (bas[ATOM_OF+jsh*BAS_SLOTS] == ia) {
+                                jatm[nja++] = ia;
+                                break;
+                        }
+                }
+        }
+
+#pragma omp parallel private(ish, jsh)
+{
+        const char TRANS_N = 'N';
+        const double D1 = 1;
+        int ab, ia, ja, la, lb, nmax, nher, L, m, m1, nfar, npair, n, di, dj;
+        int nish = ish1 - ish0;
+        int njsh = jsh1 - jsh0;
+        _MPImg *imgs = malloc(sizeof(_MPImg) * nimgs);
+        _MPPair *pairs = malloc(sizeof(_MPPair) * nish * njsh);
+        int lmax = opt->mp_lmax;
+        int nher_max = LEN_HERMITE(lmax*2);
+        double *Tm = malloc(sizeof(double) * nher_max * nimgs);
+        double *er = malloc(sizeof(double) * nimgs * nkpts * 2);
+        double *ei = er + nimgs * nkpts;
+        double *Sr = malloc(sizeof(double) * nher_max * (nkpts * 2 + lmax*2 + 2));
+        double *Si = Sr + nher_max * nkpts;
+        double *work = Si + nher_max * nkpts;
+        size_t cube_max = (lmax+1) * (lmax+1) * (lmax+1);
+        double complex *X = malloc(sizeof(double complex) * opt->mp_dmax * cube_max);
+        double *ri, *rj;
+        double d[3], rrmin;
+
+#pragma omp for schedule(dynamic)
+        for (ab = 0; ab < nia*nja; ab++) {
+                ia = iatm[ab / nja];
+                ja = jatm[ab % nja];
+                ri = env + atm[PTR_COORD+ia*ATM_SLOTS];
+                rj = env + atm[PTR_COORD+ja*ATM_SLOTS];
+                la = 0;
+                lb = 0;
+                npair = 0;
+                rrmin = 1e300;
+                for (ish = ish0; ish < ish1; ish++) {
+                        if (bas[ATOM_OF+ish*BAS_SLOTS] != ia) {
+                                continue;
+                        }
+                        for (jsh = jsh0; jsh < jsh1; jsh++) {
+                                if (bas[ATOM_OF+jsh*BAS_SLOTS] != ja ||
+                                    (hermi && ish - ish0 < jsh - jsh0)) {
+                                        continue;
+                                }
+                                pairs[npair].ish = ish;
+                                pairs[npair].jsh = jsh;
+                                pairs[npair].rr = opt->mp_rr_near[
+                                        bas[ANG_OF+ish*BAS_SLOTS] + bas[ANG_OF+jsh*BAS_SLOTS]] *
+                                        (opt->mp_ainv[ish] + opt->mp_ainv[jsh]);
+                                rrmin = MIN(rrmin, pairs[npair].rr);
+                                la = MAX(la, bas[ANG_OF+ish*BAS_SLOTS]);
+                                lb = MAX(lb, bas[ANG_OF+jsh*BAS_SLOTS]);
+                                npair++;
+                        }
+                }
+                if (npair == 0) {
+                        continue;
+                }
+                qsort(pairs, npair, sizeof(_MPPair), _mp_pair_cmp);
+
+                // the same arithmetic as the shifted coordinates of
+                // PBCmp_far2c, ri - (rj + L)
+                nfar = 0;
+                for (L = 0; L < nimgs; L++) {
+                        d[0] = ri[0] - (rj[0] + Ls[L*3+0]);
+                        d[1] = ri[1] - (rj[1] + Ls[L*3+1]);
+                        d[2] = ri[2] - (rj[2] + Ls[L*3+2]);
+                        imgs[nfar].rr = SQUARE(d);
+                        if (imgs[nfar].rr > rrmin) {
+                                imgs[nfar].L = L;
+                                nfar++;
+                        }
+                }
+                if (nfar == 0) {
+                        continue;
+                }
+                qsort(imgs, nfar, sizeof(_MPImg), _mp_img_cmp);
+
+                nmax = la + lb;
+                nher = LEN_HERMITE(nmax);
+                for (m = 0; m < nfar; m++) {
+                        L = imgs[m].L;
+                        d[0] = ri[0] - (rj[0] + Ls[L*3+0]);
+                        d[1] = ri[1] - (rj[1] + Ls[L*3+1]);
+                        d[2] = ri[2] - (rj[2] + Ls[L*3+2]);
+                        _coulomb_T(Tm+(size_t)m*nher, d, nmax, opt->mp_hidx, hd1, work);
+                        for (n = 0; n < nkpts; n++) {
+                                er[n*nfar+m] = expkL_r[n*nimgs+L];
+                                ei[n*nfar+m] = expkL_i[n*nimgs+L];
+                        }
+                }
+                for (n = 0; n < nher*nkpts; n++) {
+                        Sr[n] = 0;
+                        Si[n] = 0;
+                }
+                m = 0;
+                for (n = 0; n < npair; n++) {
+                        ish = pairs[n].ish;
+                        jsh = pairs[n].jsh;
+                        for (m1 = m; m1 < nfar && imgs[m1].rr > pairs[n].rr; m1++);
+                        if (m1 > m) {
+                                L = m1 - m;
+                                dgemm_(&TRANS_N, &TRANS_N, &nher, &nkpts, &L,
+                                       &D1, Tm+(size_t)m*nher, &nher, er+m, &nfar,
+                                       &D1, Sr, &nher);
+                                dgemm_(&TRANS_N, &TRANS_N, &nher, &nkpts, &L,
+                                       &D1, Tm+(size_t)m*nher, &nher, ei+m, &nfar,
+                                       &D1, Si, &nher);
+                                m = m1;
+                        }
+                        if (m == 0) {
+                                continue;
+                        }
+                        di = ao_loc[ish+1] - ao_loc[ish];
+                        dj = ao_loc[jsh+1] - ao_loc[jsh];
+                        _contract_2c(out + (ao_loc[ish]-ao_loc[ish0]) * naoj
+                                     + ao_loc[jsh] - ao_loc[jsh0], naoj, nkpts, nij,
+                                     opt->mp_moments+opt->mp_loc[ish],
+                                     bas[ANG_OF+ish*BAS_SLOTS], di,
+                                     opt->mp_moments+opt->mp_loc[jsh],
+                                     bas[ANG_OF+jsh*BAS_SLOTS], dj,
+                                     Sr, Si, nher, opt->mp_hidx, hd1, X);
+                }
+        }
+        free(imgs);
+        free(pairs);
+        free(Tm);
+        free(er);
+        free(Sr);
+        free(X);
+}
+        free(iatm);
+}
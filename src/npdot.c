@@ -276,3 +276,70 @@ void NPzgemm(const char trans_a, const char trans_b,
 }
         }
 }
+
+/*
+ * A batch of NPdgemm with the same shapes,
+ *      c[offsetc[i]:] = alpha * a[offseta[i]:] * b[offsetb[i]:] + beta * c
+ * The offsets are in elements. The GEMMs are distributed over threads if
+ * there are enough of them, otherwise each GEMM is parallelized by NPdgemm.
+ */
+void NPdgemm_batch(const char trans_a, const char trans_b,
+                   const int m, const int n, const int k,
+                   const int lda, const int ldb, const int ldc,
+                   const int nbatch, size_t *offseta, size_t *offsetb,
+                   size_t *offsetc, double *a, double *b, double *c,
+                   const double alpha, const double beta)
+{
+        int nthreads = 1;
+        int i;
+#pragma omp parallel
+{
+#pragma omp master
+        nthreads = omp_get_num_threads();
+}
+        if (nbatch < nthreads || m == 0 || n == 0 || k == 0) {
+                for (i = 0; i < nbatch; i++) {
+                        NPdgemm(trans_a, trans_b, m, n, k, lda, ldb, ldc,
+                                0, 0, 0, a+offseta[i], b+offsetb[i],
+                                c+offsetc[i], alpha, beta);
+                }
+                return;
+        }
+#pragma omp parallel for schedule(dynamic)
+        for (i = 0; i < nbatch; i++) {
+                dgemm_(&trans_a, &trans_b, &m, &n, &k,
+                       &alpha, a+offseta[i], &lda, b+offsetb[i], &ldb,
+                       &beta, c+offsetc[i], &ldc);
+        }
+}
+
+void NPzgemm_batch(const char trans_a, const char trans_b,
+                   const int m, const int n, const int k,
+                   const int lda, const int ldb, const int ldc,
+                   const int nbatch, size_t *offseta, size_t *offsetb,
+                   size_t *offsetc, double complex *a, double complex *b,
+                   double complex *c,
+                   const double complex *alpha, const double complex *beta)
+{
+        int nthreads = 1;
+        int i;
+#pragma omp parallel
+{
+#pragma omp master
+        nthreads = omp_get_num_threads();
+}
+        if (nbatch < nthreads || m == 0 || n == 0 || k == 0) {
+                for (i = 0; i < nbatch; i++) {
+                        NPzgemm(trans_a, trans_b, m, n, k, lda, ldb, ldc,
+                                0, 0, 0, a+offseta[i], b+offsetb[i],
+                                c+offsetc[i], alpha, beta);
+                }
+                return;
+        }
+#pragma omp parallel for schedule(dynamic)
+        for (i = 0; i < nbatch; i++) {
+                zgemm_(&trans_a, &trans_b, &m, &n, &k,
+                       alpha, a+offseta[i], &lda, b+offsetb[i], &ldb,
+                       beta, c+offsetc[i], &ldc);
+        }
+}
@@ -55,9 +55,64 @@ void PBCinit_optimizer(PBCOpt **opt, int *atm, int natm,
         PBCOpt *opt0 = malloc(sizeof(PBCOpt));
         opt0->rrcut = NULL;
         opt0->fprescreen = &PBCnoscreen;
+        opt0->img_nbas = 0;
+        opt0->nimgs = 0;
+        opt0->img_loc = NULL;
+        opt0->img_idx = NULL;
+        opt0->img_T = NULL;
+        opt0->img_table = NULL;
+        opt0->mp_nbas = 0;
+        opt0->mp_rr_near = NULL;
+        opt0->mp_ainv = NULL;
+        opt0->mp_loc = NULL;
+        opt0->mp_moments = NULL;
+        opt0->mp_hidx = NULL;
+        opt0->pair_nbas = 0;
+        opt0->pair_mask = NULL;
         *opt = opt0;
 }
 
+void PBCdel_pair_images(PBCOpt *opt)
+{
+        if (opt->img_loc) {
+                free(opt->img_loc);
+                free(opt->img_idx);
+                free(opt->img_T);
+                free(opt->img_table);
+        }
+        opt->img_nbas = 0;
+        opt->nimgs = 0;
+        opt->img_loc = NULL;
+        opt->img_idx = NULL;
+        opt->img_T = NULL;
+        opt->img_table = NULL;
+}
+
+void PBCdel_pair_mask(PBCOpt *opt)
+{
+        if (opt->pair_mask) {
+                free(opt->pair_mask);
+        }
+        opt->pair_nbas = 0;
+        opt->pair_mask = NULL;
+}
+
+/*
+ * mask[ish*nbas+jsh] != 0 for the shell pairs of the unit cell that are
+ * computed by PBCnr3c_drv
+ */
+void PBCset_pair_mask(PBCOpt *opt, char *mask, int nbas)
+{
+        PBCdel_pair_mask(opt);
+        const size_t nbas2 = (size_t)nbas * nbas;
+        size_t ij;
+        opt->pair_mask = malloc(sizeof(char) * nbas2);
+        for (ij = 0; ij < nbas2; ij++) {
+                opt->pair_mask[ij] = mask[ij];
+        }
+        opt->pair_nbas = nbas;
+}
+
 void PBCdel_optimizer(PBCOpt **opt)
 {
         PBCOpt *opt0 = *opt;
@@ -65,9 +120,12 @@ void PBCdel_optimizer(PBCOpt **opt)
                 return;
         }
 
-        if (!opt0->rrcut) {
+        if (opt0->rrcut) {
                 free(opt0->rrcut);
         }
+        PBCdel_pair_images(opt0);
+        PBCdel_multipole(opt0);
+        PBCdel_pair_mask(opt0);
         free(opt0);
         *opt = NULL;
 }
@@ -110,6 +168,223 @@ void PBCset_rcut_cond(PBCOpt *opt, double *rcut,
         }
 }
 
+/*
+ * Radius beyond which the overlap distribution of shells ish and jsh is
+ * below precision, c_i c_j r^(li+lj) exp(-a_i a_j/(a_i+a_j) r^2) < precision,
+ * taking the largest value over all primitive pairs.
+ */
+static double pair_rcut(int ish, int jsh, double precision, int *bas, double *env)
+{
+        const int li = bas[ANG_OF+ish*BAS_SLOTS];
+        const int lj = bas[ANG_OF+jsh*BAS_SLOTS];
+        const int iprim = bas[NPRIM_OF+ish*BAS_SLOTS];
+        const int jprim = bas[NPRIM_OF+jsh*BAS_SLOTS];
+        const int ictr = bas[NCTR_OF+ish*BAS_SLOTS];
+        const int jctr = bas[NCTR_OF+jsh*BAS_SLOTS];
+        const double *ai = env + bas[PTR_EXP+ish*BAS_SLOTS];
+        const double *aj = env + bas[PTR_EXP+jsh*BAS_SLOTS];
+        const double *ci = env + bas[PTR_COEFF+ish*BAS_SLOTS];
+        const double *cj = env + bas[PTR_COEFF+jsh*BAS_SLOTS];
+        const int l = li + lj;
+        int ip, jp, n, it;
+        double cimax, cjmax, aij, log_fac, r, r2;
+        double rcut = 0;
+
+        for (ip = 0; ip < iprim; ip++) {
+                cimax = 0;
+                for (n = 0; n < ictr; n++) {
+                        cimax = MAX(cimax, fabs(ci[n*iprim+ip]));
+                }
+                for (jp = 0; jp < jprim; jp++) {
+                        cjmax = 0;
+                        for (n = 0; n < jctr; n++) {
+                                cjmax = MAX(cjmax, fabs(cj[n*jprim+jp]));
+                        }
+                        aij = ai[ip] * aj[jp] / (ai[ip] + aj[jp]);
+                        log_fac = log(cimax * cjmax / precision + 1e-300);
+                        if (log_fac <= 0) {
+                                continue;
+                        }
+                        r = sqrt(log_fac / aij);
+                        // fixed point iterations for the polynomial factor
+                        for (it = 0; it < 4; it++) {
+                                r2 = (log_fac + l * log(MAX(r, 1.))) / aij;
+                                r = sqrt(r2);
+                        }
+                        rcut = MAX(rcut, r);
+                }
+        }
+        return rcut;
+}
+
+typedef struct {
+        double rr;
+        int L;
+} _ImgDist;
+
+static int _img_dist_cmp(const void *a, const void *b)
+{
+        double ra = ((_ImgDist *)a)->rr;
+        double rb = ((_ImgDist *)b)->rr;
+        return (ra > rb) - (ra < rb);
+}
+
+/*
+ * Build the per shell-pair image lists. Ls are the nimgs lattice vectors of
+ * the lattice sum, Ts the integer translations of Ls (Ls = Ts.dot(a)). The
+ * first nbas shells in bas are the unit cell shells; the lists are computed
+ * for all (ish, jsh) pairs of them.
+ */
+void PBCset_pair_images(PBCOpt *opt, double *Ls, int *Ts, int nimgs,
+                        double precision,
+                        int *atm, int natm, int *bas, int nbas, double *env)
+{
+        PBCdel_pair_images(opt);
+        const size_t nbas2 = (size_t)nbas * nbas;
+        int i, n;
+        int tmax[3];
+        for (i = 0; i < 3; i++) {
+                opt->img_tmin[i] = Ts[i];
+                tmax[i] = Ts[i];
+        }
+        for (n = 1; n < nimgs; n++) {
+                for (i = 0; i < 3; i++) {
+                        opt->img_tmin[i] = MIN(opt->img_tmin[i], Ts[n*3+i]);
+                        tmax[i] = MAX(tmax[i], Ts[n*3+i]);
+                }
+        }
+        for (i = 0; i < 3; i++) {
+                // Translations of iL+jL range over twice the box of Ls
+                opt->img_tmin[i] *= 2;
+                opt->img_tdim[i] = tmax[i] * 2 - opt->img_tmin[i] + 1;
+        }
+        size_t ntable = (size_t)opt->img_tdim[0] * opt->img_tdim[1] * opt->img_tdim[2];
+        opt->img_table = malloc(sizeof(int) * ntable);
+        opt->img_T = malloc(sizeof(int) * nimgs * 3);
+        for (n = 0; n < ntable; n++) {
+                opt->img_table[n] = -1;
+        }
+        for (n = 0; n < nimgs; n++) {
+                opt->img_T[n*3+0] = Ts[n*3+0];
+                opt->img_T[n*3+1] = Ts[n*3+1];
+                opt->img_T[n*3+2] = Ts[n*3+2];
+                opt->img_table[((size_t)(Ts[n*3+0] - opt->img_tmin[0]) * opt->img_tdim[1]
+                                + Ts[n*3+1] - opt->img_tmin[1]) * opt->img_tdim[2]
+                               + Ts[n*3+2] - opt->img_tmin[2]] = n;
+        }
+
+        opt->img_loc = malloc(sizeof(int) * (nbas2 + 1));
+        int *counts = malloc(sizeof(int) * nbas2);
+#pragma omp parallel
+{
+        int ish, jsh, L;
+        size_t ij;
+        double rc, rr, d[3];
+        double *ri, *rj;
+#pragma omp for schedule(dynamic)
+        for (ij = 0; ij < nbas2; ij++) {
+                ish = ij / nbas;
+                jsh = ij % nbas;
+                ri = env + atm[PTR_COORD+bas[ATOM_OF+ish*BAS_SLOTS]*ATM_SLOTS];
+                rj = env + atm[PTR_COORD+bas[ATOM_OF+jsh*BAS_SLOTS]*ATM_SLOTS];
+                rc = pair_rcut(ish, jsh, precision, bas, env);
+                counts[ij] = 0;
+                for (L = 0; L < nimgs; L++) {
+                        d[0] = ri[0] - rj[0] - Ls[L*3+0];
+                        d[1] = ri[1] - rj[1] - Ls[L*3+1];
+                        d[2] = ri[2] - rj[2] - Ls[L*3+2];
+                        rr = SQUARE(d);
+                        if (rr < rc * rc) {
+                                counts[ij]++;
+                        }
+                }
+        }
+}
+        opt->img_loc[0] = 0;
+        for (n = 0; n < nbas2; n++) {
+                opt->img_loc[n+1] = opt->img_loc[n] + counts[n];
+        }
+        free(counts);
+        opt->img_idx = malloc(sizeof(int) * (opt->img_loc[nbas2] + 1));
+
+#pragma omp parallel
+{
+        int ish, jsh, L, k;
+        size_t ij;
+        double rc, rr, d[3];
+        double *ri, *rj;
+        _ImgDist *dist = malloc(sizeof(_ImgDist) * nimgs);
+#pragma omp for schedule(dynamic)
+        for (ij = 0; ij < nbas2; ij++) {
+                ish = ij / nbas;
+                jsh = ij % nbas;
+                ri = env + atm[PTR_COORD+bas[ATOM_OF+ish*BAS_SLOTS]*ATM_SLOTS];
+                rj = env + atm[PTR_COORD+bas[ATOM_OF+jsh*BAS_SLOTS]*ATM_SLOTS];
+                rc = pair_rcut(ish, jsh, precision, bas, env);
+                k = 0;
+                for (L = 0; L < nimgs; L++) {
+                        d[0] = ri[0] - rj[0] - Ls[L*3+0];
+                        d[1] = ri[1] - rj[1] - Ls[L*3+1];
+                        d[2] = ri[2] - rj[2] - Ls[L*3+2];
+                        rr = SQUARE(d);
+                        if (rr < rc * rc) {
+                                dist[k].rr = rr;
+                                dist[k].L = L;
+                                k++;
+                        }
+                }
+                qsort(dist, k, sizeof(_ImgDist), _img_dist_cmp);
+                for (L = 0; L < k; L++) {
+                        opt->img_idx[opt->img_loc[ij]+L] = dist[L].L;
+                }
+        }
+        free(dist);
+}
+        opt->img_nbas = nbas;
+        opt->nimgs = nimgs;
+}
+
+/*
+ * The images jL which contribute to the lattice sum of shell ish in image iL
+ * and shell jsh. Returns the number of images stored in jLs. Without pair
+ * image lists, all nimgs images are returned.
+ */
+int PBCpair_images(int *jLs, PBCOpt *opt, int ish, int jsh, int iL, int nimgs)
+{
+        int n;
+        if (opt == NULL || opt->img_loc == NULL || opt->nimgs != nimgs) {
+                for (n = 0; n < nimgs; n++) {
+                        jLs[n] = n;
+                }
+                return nimgs;
+        }
+
+        const int nbas = opt->img_nbas;
+        ish = ish % nbas;
+        jsh = jsh % nbas;
+        const size_t ij = (size_t)ish * nbas + jsh;
+        const int *idx = opt->img_idx + opt->img_loc[ij];
+        const int nL = opt->img_loc[ij+1] - opt->img_loc[ij];
+        const int *tmin = opt->img_tmin;
+        const int *tdim = opt->img_tdim;
+        const int *Ti = opt->img_T + iL * 3;
+        int *Td;
+        int count = 0;
+        int jL;
+        for (n = 0; n < nL; n++) {
+                // Rj + L_jL is within rcut of Ri + L_iL when L_jL = L_iL + L
+                Td = opt->img_T + idx[n] * 3;
+                jL = opt->img_table[((size_t)(Ti[0] + Td[0] - tmin[0]) * tdim[1]
+                                     + Ti[1] + Td[1] - tmin[1]) * tdim[2]
+                                    + Ti[2] + Td[2] - tmin[2]];
+                if (jL >= 0) {
+                        jLs[count] = jL;
+                        count++;
+                }
+        }
+        return count;
+}
+
 
 int int2e_sph();
 
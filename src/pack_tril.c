@@ -17,6 +17,7 @@
  */
 
 #include "stdlib.h"
+#include <math.h>
 #include <complex.h>
 #include "config.h"
 #include "np_helper.h"
@@ -56,6 +57,76 @@ void NPzhermi_triu(int n, double complex *mat, int hermi)
 }
 
 
+/*
+ * NPdsymm_triu for nmat matrices of size n*n. The (matrix, tile) tasks of
+ * the upper triangle are distributed over threads.
+ */
+void NPdsymm_triu_nmat(int nmat, int n, double *mat, int hermi)
+{
+        const int ntile = (n + BLOCK_DIM - 1) / BLOCK_DIM;
+        const size_t ntask = (size_t)nmat * ntile * (ntile + 1) / 2;
+        const size_t nn = (size_t)n * n;
+        const double fac = (hermi == HERMITIAN || hermi == SYMMETRIC) ? 1 : -1;
+#pragma omp parallel
+{
+        size_t task, t, i, j, i0, i1, j0, j1;
+        int im, ti, tj;
+        double *pmat;
+#pragma omp for schedule(dynamic, 4)
+        for (task = 0; task < ntask; task++) {
+                im = task / (ntile * (ntile + 1) / 2);
+                t = task % (ntile * (ntile + 1) / 2);
+                tj = (int)(sqrt(2*t+.25) - .5 + 1e-7);
+                ti = t - tj * (tj + 1) / 2;
+                pmat = mat + im * nn;
+                i0 = ti * BLOCK_DIM;
+                i1 = MIN(i0 + BLOCK_DIM, n);
+                j0 = tj * BLOCK_DIM;
+                j1 = MIN(j0 + BLOCK_DIM, n);
+                for (i = i0; i < i1; i++) {
+                for (j = MAX(i+1, j0); j < j1; j++) {
+                        pmat[i*n+j] = fac * pmat[j*n+i];
+                } }
+        }
+}
+}
+
+void NPzhermi_triu_nmat(int nmat, int n, double complex *mat, int hermi)
+{
+        const int ntile = (n + BLOCK_DIM - 1) / BLOCK_DIM;
+        const size_t ntask = (size_t)nmat * ntile * (ntile + 1) / 2;
+        const size_t nn = (size_t)n * n;
+#pragma omp parallel
+{
+        size_t task, t, i, j, i0, i1, j0, j1;
+        int im, ti, tj;
+        double complex *pmat;
+#pragma omp for schedule(dynamic, 4)
+        for (task = 0; task < ntask; task++) {
+                im = task / (ntile * (ntile + 1) / 2);
+                t = task % (ntile * (ntile + 1) / 2);
+                tj = (int)(sqrt(2*t+.25) - .5 + 1e-7);
+                ti = t - tj * (tj + 1) / 2;
+                pmat = mat + im * nn;
+                i0 = ti * BLOCK_DIM;
+                i1 = MIN(i0 + BLOCK_DIM, n);
+                j0 = tj * BLOCK_DIM;
+                j1 = MIN(j0 + BLOCK_DIM, n);
+                for (i = i0; i < i1; i++) {
+                for (j = MAX(i+1, j0); j < j1; j++) {
+                        if (hermi == HERMITIAN) {
+                                pmat[i*n+j] = conj(pmat[j*n+i]);
+                        } else if (hermi == SYMMETRIC) {
+                                pmat[i*n+j] = pmat[j*n+i];
+                        } else {
+                                pmat[i*n+j] = -conj(pmat[j*n+i]);
+                        }
+                } }
+        }
+}
+}
+
+
 void NPdunpack_tril(int n, double *tril, double *mat, int hermi)
 {
         size_t i, j, ij;
@@ -0,0 +1,120 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import unittest
+import numpy
+from pyscf import lib
+from pyscf.pbc import gto as pgto
+from green_igen import df
+from green_igen import df_jk
+
+cell = pgto.M(atom='He 0 0 0; He 1 1.2 .8', a=numpy.eye(3)*3.,
+              basis=[[0, (1.2, 1.)], [0, (.4, 1.)], [1, (.8, 1.)]])
+kpts = cell.make_kpts([2,1,2])
+nao = cell.nao
+rng = numpy.random.RandomState(3)
+
+mydf = df.GDF(cell, kpts).build()
+mydf_gamma = df.GDF(cell, numpy.zeros((1,3))).build()
+
+
+def rand_orbs(nkpts, real=False):
+    mo_coeff = []
+    for k in range(nkpts):
+        c = rng.random_sample((nao,nao))
+        if not real:
+            c = c + rng.random_sample((nao,nao)) * 1j
+        mo_coeff.append(numpy.linalg.qr(c)[0])
+    mo_occ = [numpy.array([2., 1.5] + [0.] * (nao-2))] * nkpts
+    return mo_coeff, mo_occ
+
+def make_dm(mo_coeff, mo_occ):
+    return numpy.asarray([lib.dot(c*o, c.conj().T)
+                          for c, o in zip(mo_coeff, mo_occ)])
+
+class KnownValues(unittest.TestCase):
+    def check_occupied(self, xi, vk, mo_coeff, nocc=2):
+        # K C and the exchange energy are exact on the occupied space
+        kc = df_jk.apply_ace(xi, [c[:,:nocc] for c in mo_coeff])
+        for k, c in enumerate(mo_coeff):
+            ref = lib.dot(vk[k], c[:,:nocc])
+            self.assertAlmostEqual(abs(kc[k] - ref).max(), 0, 9)
+        vk_ace = df_jk.ace_to_vk(xi)
+        for k, c in enumerate(mo_coeff):
+            c = c[:,:nocc]
+            e = lib.einsum('pi,pq,qi', c.conj(), vk_ace[k] - vk[k], c)
+            self.assertAlmostEqual(abs(e), 0, 9)
+
+    def test_ace_kpts(self):
+        mo_coeff, mo_occ = rand_orbs(len(kpts))
+        dm = make_dm(mo_coeff, mo_occ)
+        for exxdiv in (None, 'ewald'):
+            vk = df_jk.get_k_kpts(mydf, dm, 1, kpts, exxdiv=exxdiv)
+            xi = mydf.get_ace(mo_coeff, mo_occ, kpts, exxdiv)
+            self.check_occupied(xi, vk, mo_coeff)
+
+    def test_ace_gamma(self):
+        mo_coeff, mo_occ = rand_orbs(1, real=True)
+        dm = make_dm(mo_coeff, mo_occ)
+        vk = df_jk.get_k_kpts(mydf_gamma, dm, 1, numpy.zeros((1,3)))
+        xi = mydf_gamma.get_ace(mo_coeff, mo_occ, numpy.zeros((1,3)))
+        self.assertFalse(numpy.iscomplexobj(xi[0]))
+        self.check_occupied(xi, vk, mo_coeff)
+
+    def test_j_ace_one_pass(self):
+        # two sets of orbitals, J from the same pass
+        orbs = [rand_orbs(len(kpts)) for x in range(2)]
+        dms = numpy.asarray([make_dm(*x) for x in orbs])
+        vj, xi = df_jk.get_j_ace_kpts(mydf, dms, [x[0] for x in orbs],
+                                      [x[1] for x in orbs], kpts)
+        ref_j, ref_k = df_jk.get_jk_kpts(mydf, dms, 1, kpts)
+        self.assertAlmostEqual(abs(vj - ref_j).max(), 0, 9)
+        for x in range(2):
+            self.check_occupied(xi[x], ref_k[x], orbs[x][0])
+
+    def test_get_jk_rebuild(self):
+        mydf.ace_cycle = 3
+        try:
+            mo_coeff, mo_occ = rand_orbs(len(kpts))
+            dm = make_dm(mo_coeff, mo_occ)
+            dm = lib.tag_array(dm, mo_coeff=mo_coeff, mo_occ=mo_occ)
+            vj, vk = mydf.get_jk(dm, kpts=kpts)
+            ref_j, ref_k = df_jk.get_jk_kpts(mydf, dm, 1, kpts)
+            self.assertAlmostEqual(abs(vj - ref_j).max(), 0, 9)
+
+            # a large change of dm within ace_cycle keeps the operator
+            mo_coeff1, mo_occ1 = rand_orbs(len(kpts))
+            dm1 = make_dm(mo_coeff1, mo_occ1)
+            dm1 = lib.tag_array(dm1, mo_coeff=mo_coeff1, mo_occ=mo_occ1)
+            vj, vk = mydf.get_jk(dm1, kpts=kpts)
+            ref_j, ref_k = df_jk.get_jk_kpts(mydf, dm1, 1, kpts)
+            self.assertAlmostEqual(abs(vj - ref_j).max(), 0, 9)
+            self.assertTrue(abs(vk - df_jk.ace_to_vk(mydf._ace['xi'][0])).max() < 1e-12)
+            kc = [lib.dot(v, c[:,:2]) for v, c in zip(vk, mo_coeff1)]
+            ref = [lib.dot(v, c[:,:2]) for v, c in zip(ref_k, mo_coeff1)]
+            self.assertTrue(abs(numpy.asarray(kc) - numpy.asarray(ref)).max() > 1e-4)
+
+            # dm converged below ace_dm_tol: rebuilt, exact on the occupied space
+            vj, vk = mydf.get_jk(dm1, kpts=kpts)
+            self.assertEqual(mydf._ace['ncall'], 1)
+            self.check_occupied(mydf._ace['xi'][0], ref_k, mo_coeff1)
+        finally:
+            mydf.ace_cycle = 0
+            mydf._ace = None
+
+
+if __name__ == '__main__':
+    print("Full Tests for the ACE exchange of GDF")
+    unittest.main()
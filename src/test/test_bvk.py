@@ -0,0 +1,95 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import unittest
+import numpy
+import h5py
+from pyscf.pbc import gto as pgto
+from green_igen import df
+from green_igen import df_jk
+
+cell = pgto.M(atom='He 0 0 0; He 1 1.2 .8', a=numpy.eye(3)*3.,
+              basis=[[0, (1.2, 1.)], [0, (.4, 1.)], [1, (.8, 1.)]])
+kpts = cell.make_kpts([2,1,3])
+kband = numpy.array([[.1, .2, -.3]])
+rng = numpy.random.RandomState(4)
+
+
+def make_df(**kwargs):
+    mydf = df.GDF(cell, kpts)
+    mydf.kpts_band = kband
+    for key, val in kwargs.items():
+        setattr(mydf, key, val)
+    return mydf.build()
+
+def load_j3c(mydf, ki, kj):
+    return numpy.vstack([LpqR + LpqI * 1j for LpqR, LpqI, sign
+                         in mydf.sr_loop((ki,kj), compact=False)])
+
+class KnownValues(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.ref = make_df()
+        cls.bvk = make_df(bvk_j3c=True, bvk_threshold=1e-12)
+
+    def test_layout(self):
+        with h5py.File(self.bvk._cderi, 'r') as feri:
+            self.assertTrue('j3c-R' in feri)
+            # only the pairs of kpts_band are kept in k-space
+            kptij_lst = feri['j3c-kptij'][()]
+            self.assertEqual(len(kptij_lst), len(kpts) + 1)
+            self.assertTrue(all(abs(ki - kband[0]).sum() < 1e-9
+                                for ki, kj in kptij_lst))
+        self.assertEqual(self.bvk.get_naoaux(), self.ref.get_naoaux())
+
+    def test_round_trip(self):
+        for ki in kpts:
+            for kj in kpts:
+                ref = load_j3c(self.ref, ki, kj)
+                out = load_j3c(self.bvk, ki, kj)
+                self.assertAlmostEqual(abs(out - ref).max(), 0, 9)
+
+    def test_kpts_band(self):
+        # the pairs of kpts_band are read from k-space, not interpolated
+        for kj in kpts:
+            ref = load_j3c(self.ref, kband[0], kj)
+            out = load_j3c(self.bvk, kband[0], kj)
+            self.assertAlmostEqual(abs(out - ref).max(), 0, 12)
+        self.assertRaises(RuntimeError, load_j3c, self.bvk, kband[0]+.1, kpts[0])
+
+    def test_jk(self):
+        nao = cell.nao
+        dm = rng.random_sample((len(kpts),nao,nao)) * (1+.5j)
+        dm = dm + dm.conj().transpose(0,2,1)
+        for kpts_band in (None, kband):
+            ref_j, ref_k = df_jk.get_jk_kpts(self.ref, dm, 1, kpts, kpts_band)
+            vj, vk = df_jk.get_jk_kpts(self.bvk, dm, 1, kpts, kpts_band)
+            self.assertAlmostEqual(abs(vj - ref_j).max(), 0, 9)
+            self.assertAlmostEqual(abs(vk - ref_k).max(), 0, 9)
+
+    def test_threshold(self):
+        mydf = make_df(bvk_j3c=True, bvk_threshold=1e-6)
+        with h5py.File(mydf._cderi, 'r') as feri:
+            with h5py.File(self.bvk._cderi, 'r') as fref:
+                self.assertTrue(feri['j3c-R'].shape[0] <= fref['j3c-R'].shape[0])
+        for ki in kpts:
+            ref = load_j3c(self.ref, ki, kpts[1])
+            out = load_j3c(mydf, ki, kpts[1])
+            self.assertTrue(abs(out - ref).max() < 1e-6 * len(kpts)**2)
+
+
+if __name__ == '__main__':
+    print("Full Tests for the BvK j3c of GDF")
+    unittest.main()
@@ -0,0 +1,186 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import unittest
+from unittest import mock
+import numpy
+import h5py
+from pyscf.pbc import gto as pgto
+from green_igen import df
+
+
+def make_cell(dx=0):
+    return pgto.M(atom='He 0 0 0; He %.8f 1.2 .8' % (1+dx), a=numpy.eye(3)*3.,
+                  basis=[[0, (1.2, 1.)], [0, (.4, 1.)], [1, (.8, 1.)]])
+
+cell = make_cell()
+kpts = cell.make_kpts([2,1,1])
+nao = cell.nao
+rng = numpy.random.RandomState(11)
+dm = rng.random_sample((len(kpts),nao,nao)) * (1+.5j)
+dm = dm + dm.conj().transpose(0,2,1)
+
+
+def get_jk(mydf):
+    return numpy.asarray(mydf.get_jk(dm, 1, kpts))
+
+class KnownValues(unittest.TestCase):
+    def test_reuse_plan(self):
+        mydf = df.GDF(cell, kpts)
+        mydf.reuse_plan = True
+        mydf.build()
+        plan = mydf._plan
+        self.assertTrue(plan is not None)
+        ref = get_jk(df.GDF(cell, kpts).build())
+        self.assertAlmostEqual(abs(get_jk(mydf) - ref).max(), 0, 8)
+
+        # a geometry step within the margin keeps the plan
+        cell1 = make_cell(.05)
+        mydf.reset(cell1).build()
+        self.assertTrue(mydf._plan is plan)
+        ref = get_jk(df.GDF(cell1, kpts).build())
+        self.assertAlmostEqual(abs(get_jk(mydf) - ref).max(), 0, 8)
+
+        # beyond the margin the plan is regenerated
+        cell2 = make_cell(.05 + mydf.reuse_plan_margin)
+        mydf.reset(cell2).build()
+        self.assertTrue(mydf._plan is not plan)
+        ref = get_jk(df.GDF(cell2, kpts).build())
+        self.assertAlmostEqual(abs(get_jk(mydf) - ref).max(), 0, 8)
+
+    def test_reuse_tol(self):
+        mydf = df.GDF(cell, kpts)
+        mydf.reuse_plan = True
+        mydf.reuse_tol = 1e-3
+        mydf.build()
+        cderi = mydf._cderi
+        ref = get_jk(mydf)
+
+        # the estimated error is below reuse_tol: the integrals are not rebuilt
+        cell1 = make_cell(1e-5)
+        err = mydf._plan.skip_error(cell1, mydf.auxcell)
+        self.assertTrue(0 < err < mydf.reuse_tol)
+        mydf.reset(cell1).build()
+        self.assertEqual(mydf._cderi, cderi)
+        self.assertAlmostEqual(abs(get_jk(mydf) - ref).max(), 0, 12)
+        exact = get_jk(df.GDF(cell1, kpts).build())
+        # skip_error estimates the order of the error
+        self.assertTrue(abs(ref - exact).max() < 10 * err * abs(exact).max())
+
+        # a new build is written to a new file
+        cell1 = make_cell(.01)
+        self.assertTrue(mydf._plan.skip_error(cell1, mydf.auxcell) > mydf.reuse_tol)
+        mydf.reset(cell1).build()
+        self.assertNotEqual(mydf._cderi, cderi)
+        ref = get_jk(df.GDF(cell1, kpts).build())
+        self.assertAlmostEqual(abs(get_jk(mydf) - ref).max(), 0, 8)
+
+    def test_aux_ngrids(self):
+        # |G|-sorted columns with the decay of Gaussian model charges
+        G = numpy.arange(200.)
+        Gaux = numpy.exp(-numpy.outer(G**2, [.001, .01, .1, 1.])) * (1+.5j)
+        precision = 1e-8
+        ng = df._aux_ngrids(Gaux, precision)
+        self.assertTrue((ng[1:] < ng[:-1]).all())
+        self.assertTrue(ng[-1] < len(G))
+        for i, n in enumerate(ng):
+            self.assertTrue(abs(Gaux[n:,i]).sum() <= precision)
+            self.assertTrue(abs(Gaux[n-1:,i]).sum() > precision)
+
+    def test_truncated_correction(self):
+        ref = df.GDF(cell, kpts)
+        # all plane waves for every model charge
+        with mock.patch.object(df, '_aux_ngrids',
+                               lambda Gaux, precision: numpy.full(Gaux.shape[1], Gaux.shape[0])):
+            ref.build()
+        mydf = df.GDF(cell, kpts).build()
+        self.assertAlmostEqual(abs(get_jk(mydf) - get_jk(ref)).max(), 0, 7)
+
+    def test_eta_cost(self):
+        auxcell = df.GDF(cell, kpts).build().auxcell
+        costs = [df.estimate_eta_cost(cell, auxcell, eta) for eta in (.1, .4, 1.6, 6.4)]
+        for c0, c1 in zip(costs[:-1], costs[1:]):
+            # a larger eta needs more plane waves and fewer images
+            self.assertTrue(c0['ngrids'] <= c1['ngrids'])
+            self.assertTrue(c0['nimgs'] >= c1['nimgs'])
+
+        best = df.optimize_eta(cell, auxcell, neta=8)
+        self.assertTrue(best['total'] <= df.estimate_eta_cost(cell, auxcell, df.ETA_MIN)['total'])
+        # if one part dominates, eta minimizes its size
+        with mock.patch.object(df, 'COST_FT_AOPAIR', 1e3):
+            self.assertAlmostEqual(df.optimize_eta(cell, auxcell, neta=8)['eta'], df.ETA_MIN, 12)
+        with mock.patch.object(df, 'COST_INT3C', 1e3):
+            self.assertTrue(df.optimize_eta(cell, auxcell, neta=8)['eta'] > best['eta'] - 1e-12)
+
+        cost_int3c, cost_ft = df.calibrate_cost_model(cell, auxcell, kpts)
+        self.assertTrue(cost_int3c > 0 and cost_ft > 0)
+
+    def test_auto_eta(self):
+        ref = get_jk(df.GDF(cell, kpts).build())
+        mydf = df.GDF(cell, kpts)
+        mydf.auto_eta = True
+        mydf.build()
+        best = df.optimize_eta(cell, mydf.auxcell, verbose=0,
+                               nkptij=len(kpts)*(len(kpts)+1)//2)
+        self.assertAlmostEqual(mydf.eta, best['eta'], 12)
+        self.assertEqual(list(mydf.mesh), list(best['mesh']))
+        self.assertAlmostEqual(abs(get_jk(mydf) - ref).max(), 0, 6)
+
+        # _make_j3c takes eta and mesh of the GDF object
+        mydf = df.GDF(cell, kpts)
+        mydf.eta = .3
+        mydf.mesh = df._mesh_for_eta(cell, .3, cell.precision)
+        mydf.build()
+        self.assertAlmostEqual(abs(get_jk(mydf) - ref).max(), 0, 6)
+
+    def test_fragment(self):
+        def load(mydf, kpti_kptj):
+            return numpy.vstack([LpqR + LpqI*1j for LpqR, LpqI, sign
+                                 in mydf.sr_loop(kpti_kptj, compact=False)])
+        ref = df.GDF(cell, kpts).build()
+        # the p shell of the first and the first s shell of the second atom
+        mydf = df.GDF(cell, kpts).build(frag_orbs=[3, 5])
+        idx = mydf.frag_ao_idx
+        self.assertEqual(list(idx), [2, 3, 4, 5])
+        for kpti_kptj in ((kpts[0], kpts[0]), (kpts[1], kpts[0])):
+            Lpq = load(ref, kpti_kptj).reshape(-1,nao,nao)[:,idx[:,None],idx]
+            out = load(mydf, kpti_kptj).reshape(Lpq.shape)
+            self.assertAlmostEqual(abs(out - Lpq).max(), 0, 10)
+
+        self.assertRaises(NotImplementedError, mydf.get_jk, dm, 1, kpts)
+        self.assertRaises(NotImplementedError, mydf.get_eri)
+
+    def test_int1e_cache(self):
+        mydf = df.GDF(cell, kpts)
+        mydf.cache_int1e = True
+        mydf.build()
+        for intor in ('int1e_ovlp', 'int1e_kin'):
+            ref = numpy.asarray(cell.pbc_intor(intor, hermi=1, kpts=kpts))
+            out = numpy.asarray(mydf.get_int1e(intor, kpts))
+            self.assertAlmostEqual(abs(out - ref).max(), 0, 9)
+            out = mydf.get_int1e(intor, kpts[1])
+            self.assertAlmostEqual(abs(out - ref[1]).max(), 0, 9)
+
+        mydf = df.GDF(cell, kpts).build()
+        with h5py.File(mydf._cderi, 'r') as feri:
+            self.assertFalse('int1e_ovlp' in feri)
+            self.assertFalse('int1e_kin' in feri)
+        out = numpy.asarray(mydf.get_int1e('int1e_kin', kpts))
+        self.assertAlmostEqual(abs(out - ref).max(), 0, 9)
+
+
+if __name__ == '__main__':
+    print("Full Tests for the GDF build options")
+    unittest.main()
@@ -0,0 +1,148 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import unittest
+import numpy
+from pyscf.pbc import gto as pgto
+from pyscf.pbc.df import df_jk as pyscf_df_jk
+from green_igen import df
+from green_igen import df_jk
+from green_igen import incore
+
+cell = pgto.M(atom='He 0 0 0; He 1 1.2 .8', a=numpy.eye(3)*3.,
+              basis=[[0, (1.2, 1.)], [0, (.4, 1.)], [1, (.8, 1.)]])
+cell2d = pgto.M(atom='He 0 0 0; He 1 1.2 0', a=numpy.diag([3., 3., 10.]),
+                basis=[[0, (1.2, 1.)], [1, (.8, 1.)]], dimension=2)
+cell_sparse = pgto.M(atom='He 0 0 0; He 2.5 2.5 2.5', a=numpy.eye(3)*5.,
+                     basis=[[0, (2., 1.)], [0, (.3, 1.)], [1, (1.5, 1.)]])
+kpts = cell.make_kpts([2,1,2])
+kband = numpy.array([[.1, .2, -.3], [.05, 0., .1]])
+rng = numpy.random.RandomState(2)
+
+
+def make_df(cell, kpts, **kwargs):
+    mydf = df.GDF(cell, kpts)
+    for key, val in kwargs.items():
+        setattr(mydf, key, val)
+    return mydf.build()
+
+def rand_dm(nset, nkpts, nao, hermi=1, real=False):
+    dm = rng.random_sample((nset,nkpts,nao,nao))
+    if not real:
+        dm = dm + rng.random_sample((nset,nkpts,nao,nao)) * 1j
+    if hermi:
+        dm = dm + dm.conj().transpose(0,1,3,2)
+    return dm
+
+def pyscf_jk(mydf, dm, hermi, kpts, kpts_band=None, exxdiv=None):
+    vj = pyscf_df_jk.get_j_kpts(mydf, dm, hermi, kpts, kpts_band)
+    vk = pyscf_df_jk.get_k_kpts(mydf, dm, hermi, kpts, kpts_band, exxdiv)
+    return vj, vk
+
+class KnownValues(unittest.TestCase):
+    def check(self, mydf, dm, hermi, kpts, kpts_band=None, exxdiv=None):
+        vj, vk = df_jk.get_jk_kpts(mydf, dm, hermi, kpts, kpts_band, exxdiv=exxdiv)
+        ref_j, ref_k = pyscf_jk(mydf, dm, hermi, kpts, kpts_band, exxdiv)
+        self.assertEqual(vj.shape, ref_j.shape)
+        self.assertEqual(vk.shape, ref_k.shape)
+        self.assertAlmostEqual(abs(vj - ref_j).max(), 0, 9)
+        self.assertAlmostEqual(abs(vk - ref_k).max(), 0, 9)
+        return vj, vk
+
+    def test_gamma_real(self):
+        mydf = make_df(cell, numpy.zeros((1,3)))
+        dm = rand_dm(2, 1, cell.nao, real=True)
+        vj, vk = self.check(mydf, dm, 1, numpy.zeros((1,3)))
+        self.assertFalse(numpy.iscomplexobj(vj))
+        self.assertFalse(numpy.iscomplexobj(vk))
+        # single k-point interface of GDF.get_jk
+        vj, vk = mydf.get_jk(dm[0,0], kpts=numpy.zeros(3))
+        ref_j, ref_k = pyscf_df_jk.get_jk(mydf, dm[0,0], 1, numpy.zeros(3))
+        self.assertAlmostEqual(abs(vj - ref_j).max(), 0, 9)
+        self.assertAlmostEqual(abs(vk - ref_k).max(), 0, 9)
+
+    def test_kmesh(self):
+        mydf = make_df(cell, kpts)
+        dm = rand_dm(2, len(kpts), cell.nao)
+        self.check(mydf, dm, 1, kpts)
+        self.check(mydf, dm[0], 1, kpts, exxdiv='ewald')
+
+    def test_kpts_band(self):
+        mydf = make_df(cell, kpts, kpts_band=kband)
+        dm = rand_dm(1, len(kpts), cell.nao)
+        self.check(mydf, dm, 1, kpts, kband)
+        self.check(mydf, dm[0], 1, kpts, kband[0])
+
+    def test_hermi0(self):
+        mydf = make_df(cell, kpts)
+        dm = rand_dm(2, len(kpts), cell.nao, hermi=0)
+        self.check(mydf, dm, 0, kpts)
+        mydf = make_df(cell, numpy.zeros((1,3)))
+        dm = rand_dm(1, 1, cell.nao, hermi=0, real=True)
+        self.check(mydf, dm, 0, numpy.zeros((1,3)))
+
+    def test_pair_sparse(self):
+        mydf = make_df(cell_sparse, numpy.zeros((1,3)), pair_sparse=True)
+        nao = cell_sparse.nao
+        self.assertTrue(len(mydf.get_sparse_pairs()) < nao*(nao+1)//2)
+        dm = rand_dm(2, 1, nao, real=True)
+        self.check(mydf, dm, 1, numpy.zeros((1,3)))
+        dm = rand_dm(1, 1, nao, hermi=0, real=True)
+        self.check(mydf, dm, 0, numpy.zeros((1,3)))
+
+    def test_get_j_pair_sparse(self):
+        mydf = make_df(cell_sparse, numpy.zeros((1,3)), pair_sparse=True)
+        nao = cell_sparse.nao
+        dm = rand_dm(2, 1, nao, real=True)
+        vj = df.get_j_pair_sparse(mydf, dm)
+        ref = pyscf_df_jk.get_j_kpts(mydf, dm, 1, numpy.zeros((1,3)))
+        self.assertAlmostEqual(abs(vj - ref).max(), 0, 9)
+        # the dropped pairs are below cell.precision
+        ref = pyscf_df_jk.get_j_kpts(make_df(cell_sparse, numpy.zeros((1,3))),
+                                     dm, 1, numpy.zeros((1,3)))
+        self.assertAlmostEqual(abs(vj - ref).max(), 0, 6)
+
+    def test_pair_mask(self):
+        auxcell = incore.make_auxcell(cell_sparse, [[0, (1., 1.)], [1, (.8, 1.)]])
+        shl_mask = df.significant_pairs(cell_sparse)[0]
+        self.assertFalse(shl_mask.all())
+        ao_loc = cell_sparse.ao_loc_nr()
+        dims = ao_loc[1:] - ao_loc[:-1]
+        ao_mask = numpy.repeat(numpy.repeat(shl_mask, dims, axis=0), dims, axis=1).ravel()
+        ref = incore.aux_e2(cell_sparse, auxcell)
+        # the columns of the masked shell pairs are not written
+        out = incore.aux_e2(cell_sparse, auxcell, pair_mask=shl_mask)
+        self.assertAlmostEqual(abs(out[ao_mask] - ref[ao_mask]).max(), 0, 12)
+
+    def test_2d(self):
+        k2d = cell2d.make_kpts([2,2,1])
+        mydf = make_df(cell2d, k2d)
+        dm = rand_dm(1, len(k2d), cell2d.nao)
+        self.check(mydf, dm, 1, k2d)
+        mydf = make_df(cell2d, numpy.zeros((1,3)))
+        dm = rand_dm(1, 1, cell2d.nao, real=True)
+        self.check(mydf, dm, 1, numpy.zeros((1,3)))
+
+    def test_small_blocks(self):
+        # several aux blocks per k-point pair
+        mydf = make_df(cell, kpts)
+        mydf.blockdim = 7
+        dm = rand_dm(1, len(kpts), cell.nao)
+        self.check(mydf, dm, 1, kpts)
+
+
+if __name__ == '__main__':
+    print("Full Tests for the streaming GDF J/K")
+    unittest.main()
@@ -0,0 +1,90 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import unittest
+from unittest import mock
+import h5py
+import numpy
+import scipy.linalg
+from pyscf.pbc import gto as pgto
+from green_igen import df
+from green_igen import scipy_helper
+
+cell = pgto.M(atom='He 0 0 0; He 1 1.2 .8', a=numpy.eye(3)*3.,
+              basis=[[0, (1.2, 1.)], [0, (.4, 1.)], [1, (.8, 1.)]])
+kpts = cell.make_kpts([2,1,1])
+nao = cell.nao
+auxbasis = [[0, (2., 1.)], [0, (.6, 1.)], [1, (1., 1.)], [2, (1.2, 1.)]]
+rng = numpy.random.RandomState(5)
+dm = rng.random_sample((len(kpts),nao,nao)) * (1+.5j)
+dm = dm + dm.conj().transpose(0,2,1)
+
+
+def make_df(auxbasis, pivoted):
+    mydf = df.GDF(cell, kpts)
+    mydf.auxbasis = auxbasis
+    if pivoted:
+        # round-off may let the plain Cholesky of a singular metric pass
+        with mock.patch.object(scipy.linalg, 'cholesky',
+                               side_effect=scipy.linalg.LinAlgError):
+            mydf.build()
+    else:
+        mydf.build()
+    return mydf
+
+def get_jk(mydf):
+    return numpy.asarray(mydf.get_jk(dm, 1, kpts))
+
+def cderi_piv(mydf):
+    with h5py.File(mydf._cderi, 'r') as f:
+        if 'j3c-piv' not in f:
+            return None
+        return [f['j3c-piv/%s' % k][()] for k in f['j3c-piv']]
+
+class KnownValues(unittest.TestCase):
+    def test_pivoted_cholesky(self):
+        b = rng.random_sample((20,12)) + rng.random_sample((20,12)) * 1j
+        a = b.dot(b.conj().T)
+        for fchol in (scipy_helper.pivoted_cholesky,
+                      scipy_helper.pivoted_cholesky_python):
+            L, piv, rank = fchol(a, tol=1e-9, lower=True)
+            self.assertEqual(rank, 12)
+            self.assertAlmostEqual(abs(L.dot(L.conj().T) - a[piv][:,piv]).max(), 0, 9)
+            U, piv, rank = fchol(a, tol=1e-9, lower=False)
+            self.assertAlmostEqual(abs(U.conj().T.dot(U) - a[piv][:,piv]).max(), 0, 9)
+
+    def test_full_rank(self):
+        ref = make_df(auxbasis, False)
+        self.assertTrue(cderi_piv(ref) is None)
+        mydf = make_df(auxbasis, True)
+        self.assertTrue(cderi_piv(mydf) is not None)
+        self.assertAlmostEqual(abs(get_jk(mydf) - get_jk(ref)).max(), 0, 7)
+
+    def test_rank_deficient(self):
+        # a duplicated aux shell does not change the fitting space
+        ref = make_df(auxbasis, False)
+        with h5py.File(ref._cderi, 'r') as f:
+            naux = f['j3c/0/0'].shape[0]
+        mydf = make_df(auxbasis + [[0, (.6, 1.)]], True)
+        pivs = cderi_piv(mydf)
+        self.assertTrue(pivs is not None)
+        for piv in pivs:
+            self.assertTrue(len(piv) <= naux)
+        self.assertAlmostEqual(abs(get_jk(mydf) - get_jk(ref)).max(), 0, 7)
+
+
+if __name__ == '__main__':
+    print("Full Tests for the pivoted Cholesky DF metric")
+    unittest.main()
@@ -0,0 +1,89 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import tempfile
+import unittest
+from unittest import mock
+import numpy
+from pyscf.lib import diis as pyscf_diis
+from green_igen import diis
+
+
+def rand_vecs(n, shape, dtype=numpy.double, seed=7):
+    rng = numpy.random.RandomState(seed)
+    x = rng.random_sample((n,) + shape)
+    if dtype == numpy.complex128:
+        x = x + rng.random_sample((n,) + shape) * 1j
+    # a converging sequence, so that the error vectors are not degenerate
+    return [v * .5**i for i, v in enumerate(x)]
+
+def run(adiis, xs, errs=None):
+    adiis.space = 4
+    if errs is None:
+        return [adiis.update(x) for x in xs]
+    return [adiis.update(x, e) for x, e in zip(xs, errs)]
+
+class KnownValues(unittest.TestCase):
+    def check(self, xs, errs=None, **kwargs):
+        # more vectors than space: the ring buffer slots are overwritten
+        ref = run(pyscf_diis.DIIS(), xs, errs)
+        out = run(diis.DIIS(**kwargs), xs, errs)
+        for x, y in zip(out, ref):
+            self.assertEqual(x.shape, y.shape)
+            self.assertAlmostEqual(abs(x - y).max(), 0, 9)
+
+    def test_err_vec(self):
+        for dtype in (numpy.double, numpy.complex128):
+            xs = rand_vecs(10, (6,5), dtype)
+            errs = rand_vecs(10, (30,), dtype, seed=8)
+            self.check(xs, errs)
+
+    def test_diff_err_vec(self):
+        for dtype in (numpy.double, numpy.complex128):
+            self.check(rand_vecs(10, (6,5), dtype))
+
+    def test_real_to_complex(self):
+        xs = rand_vecs(4, (30,)) + rand_vecs(6, (30,), numpy.complex128)
+        errs = rand_vecs(4, (30,), seed=8) + rand_vecs(6, (30,), numpy.complex128, seed=9)
+        self.check(xs, errs)
+
+    def test_outcore(self):
+        # memory-mapped buffers, processed in blocks
+        with mock.patch.object(diis, 'INCORE_SIZE', 10), \
+                mock.patch.object(diis, 'BLOCK_SIZE', 7):
+            xs = rand_vecs(10, (6,5))
+            self.check(xs, rand_vecs(10, (30,), seed=8))
+            self.check(xs)
+            adiis = diis.DIIS()
+            run(adiis, xs)
+            self.assertFalse(adiis._xbuf.incore)
+
+    def test_restore(self):
+        xs = rand_vecs(10, (30,))
+        errs = rand_vecs(10, (30,), seed=8)
+        with tempfile.NamedTemporaryFile(suffix='.h5') as f:
+            adiis = diis.DIIS(filename=f.name)
+            run(adiis, xs[:3], errs[:3])
+            adiis._diisfile.close()
+            adiis = diis.restore(f.name)
+            out = run(adiis, xs[3:], errs[3:])
+        ref = run(pyscf_diis.DIIS(), xs, errs)[3:]
+        for x, y in zip(out, ref):
+            self.assertAlmostEqual(abs(x - y).max(), 0, 9)
+
+
+if __name__ == '__main__':
+    print("Full Tests for DIIS")
+    unittest.main()
@@ -0,0 +1,89 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import unittest
+import numpy
+from pyscf.pbc import gto as pgto
+from green_igen import df
+
+cell = pgto.M(atom='He 0 0 0; He 1 1.2 .8', a=numpy.eye(3)*3.,
+              basis=[[0, (1.2, 1.)], [0, (.4, 1.)], [1, (.8, 1.)]])
+kpts = cell.make_kpts([2,1,2])
+kband = numpy.array([[.1, .2, -.3]])
+nao = cell.nao
+rng = numpy.random.RandomState(8)
+
+mydf = df.GDF(cell, kpts)
+mydf.kpts_band = kband
+mydf.build()
+mydf_direct = df.GDF(cell, kpts, direct=True).build()
+
+
+def rand_dm(nset, nkpts):
+    dm = rng.random_sample((nset,nkpts,nao,nao)) * (1+.5j)
+    return dm + dm.conj().transpose(0,1,3,2)
+
+class KnownValues(unittest.TestCase):
+    def check(self, dm, kpts, kpts_band=None, exxdiv=None, with_j=True, with_k=True):
+        vj, vk = mydf_direct.get_jk(dm, 1, kpts, kpts_band, with_j, with_k, exxdiv=exxdiv)
+        ref_j, ref_k = mydf.get_jk(dm, 1, kpts, kpts_band, with_j, with_k, exxdiv=exxdiv)
+        if with_j:
+            self.assertEqual(vj.shape, ref_j.shape)
+            self.assertAlmostEqual(abs(vj - ref_j).max(), 0, 9)
+        else:
+            self.assertTrue(vj is None)
+        if with_k:
+            self.assertEqual(vk.shape, ref_k.shape)
+            self.assertAlmostEqual(abs(vk - ref_k).max(), 0, 9)
+        else:
+            self.assertTrue(vk is None)
+
+    def test_kmesh(self):
+        dm = rand_dm(2, len(kpts))
+        self.check(dm, kpts)
+        self.check(dm[0], kpts, exxdiv='ewald')
+        self.check(dm, kpts, with_k=False)
+        self.check(dm, kpts, with_j=False)
+
+    def test_kpts_band(self):
+        dm = rand_dm(1, len(kpts))
+        self.check(dm, kpts, kband)
+
+    def test_single_kpt(self):
+        dm = rand_dm(1, 1)[0,0]
+        self.check(dm, kpts[1])
+
+    def test_blocks(self):
+        j3c = df._DirectJ3c(mydf_direct, cell, mydf_direct.auxcell)
+        nbas = mydf_direct.auxcell.nbas
+        for kpti, kptj in [(kpts[0], kpts[0]), (kpts[3], kpts[3]), (kpts[2], kpts[1])]:
+            kpt = kptj - kpti
+            gen = j3c.generator(kpt, [(kpti, kptj)])
+            # the fitted rows from two blocks of aux shells
+            v = numpy.vstack([gen(0, nbas//2)[0], gen(nbas//2, nbas)[0]])
+            M, M_neg = j3c.metric(kpt)
+            ref = numpy.vstack([LpqR + LpqI * 1j for LpqR, LpqI, sign
+                                in mydf.sr_loop((kpti, kptj), compact=True)])
+            self.assertEqual(M.dot(v).shape, ref.shape)
+            self.assertAlmostEqual(abs(M.dot(v) - ref).max(), 0, 9)
+
+    def test_not_stored(self):
+        self.assertTrue(mydf_direct._cderi is None)
+        self.assertRaises(RuntimeError, next, mydf_direct.sr_loop((kpts[0],kpts[0])))
+
+
+if __name__ == '__main__':
+    print("Full Tests for the integral-direct GDF J/K")
+    unittest.main()
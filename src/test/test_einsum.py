@@ -0,0 +1,126 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import unittest
+from unittest import mock
+import numpy
+from pyscf import lib
+from green_igen import numpy_helper
+
+rng = numpy.random.RandomState(4)
+
+
+def rand(*shape, dtype=numpy.double):
+    a = rng.random_sample(shape) - .5
+    if dtype == numpy.complex128:
+        a = a + (rng.random_sample(shape) - .5) * 1j
+    return a
+
+# Operands smaller than EINSUM_MAX_SIZE go to numpy.einsum
+class KnownValues(unittest.TestCase):
+    def setUp(self):
+        # real operands would go to tblis otherwise
+        self.no_tblis = mock.patch.object(numpy_helper, 'FOUND_TBLIS', False)
+        self.no_tblis.start()
+
+    def tearDown(self):
+        self.no_tblis.stop()
+
+    def check(self, subscripts, a, b):
+        ref = numpy.einsum(subscripts, a, b)
+        out = numpy_helper.einsum(subscripts, a, b)
+        self.assertEqual(out.shape, ref.shape)
+        self.assertAlmostEqual(abs(out - ref).max(), 0, 11)
+
+    def test_strided_operands(self):
+        a = rand(60, 70)
+        b = rand(70, 50)
+        self.check('ij,jk->ik', a, b)
+        self.check('ij,jk->ik', rand(70, 60).T, b)
+        self.check('ij,jk->ik', a, rand(50, 70).T)
+        self.check('ij,jk->ki', a, b)
+        self.check('ji,jk->ik', rand(70, 60), b)
+        # non-unit strides and negative strides are copied
+        self.check('ij,jk->ik', rand(60, 140)[:,::2], b)
+        self.check('ij,jk->ik', a[::-1], b[:,::-1])
+        self.check('ij,jk->ik', rand(80, 90)[10:70,5:75], b)
+
+        # transposed views are used in place
+        plan = numpy_helper._ContractPlan('ij,jk->ik', rand(70, 60).T, rand(50, 70).T)
+        self.assertFalse(plan.fallback)
+        self.assertTrue(plan.permA is None and plan.permB is None)
+
+    def test_multi_index(self):
+        self.check('ijk,jl->ikl', rand(12, 50, 14), rand(50, 60))
+        self.check('abcd,cdef->abef', rand(6, 7, 8, 9), rand(8, 9, 7, 6))
+        self.check('abcd,cdef->afbe', rand(6, 7, 8, 9), rand(8, 9, 7, 6))
+        self.check('pqrs,qs->pr', rand(10, 40, 12, 60), rand(40, 60))
+        self.check('abcd,dcef->abef', rand(6, 7, 8, 9).transpose(0,2,1,3), rand(9, 7, 7, 6))
+        # outer product
+        self.check('ij,kl->ijkl', rand(30, 40), rand(40, 30))
+
+    def test_batch(self):
+        for dtype in (numpy.double, numpy.complex128):
+            # many small GEMMs over threads and a few large GEMMs
+            self.check('kij,kjl->kil', rand(300, 6, 7, dtype=dtype), rand(300, 7, 5, dtype=dtype))
+            self.check('kij,kjl->kil', rand(2, 60, 70, dtype=dtype), rand(2, 70, 50, dtype=dtype))
+            self.check('kij,jkl->lik', rand(20, 16, 17, dtype=dtype), rand(17, 20, 15, dtype=dtype))
+            self.check('abij,bjk->aik', rand(4, 5, 16, 17, dtype=dtype), rand(5, 17, 30, dtype=dtype))
+        plan = numpy_helper._ContractPlan('kij,kjl->kil', rand(300, 6, 7), rand(300, 7, 5))
+        self.assertFalse(plan.fallback)
+        self.assertEqual(plan.nbatch, 300)
+        with lib.with_omp_threads(1):
+            self.check('kij,kjl->kil', rand(300, 6, 7), rand(300, 7, 5))
+
+    def test_complex(self):
+        a = rand(60, 70, dtype=numpy.complex128)
+        b = rand(70, 50, dtype=numpy.complex128)
+        self.check('ij,jk->ik', a, b)
+        self.check('ij,jk->ik', a, b.T.copy().T)
+        self.check('ij,jk->ik', rand(60, 70), b)
+        self.check('ij,jk->ik', a, rand(70, 50))
+        self.check('ijk,jl->ikl', rand(20, 60, 30, dtype=numpy.complex128).transpose(0,2,1)[:,:,:50],
+                   rand(30, 70))
+
+    def test_fallback(self):
+        a = rand(60, 70)
+        self.check('ij,ij->ij', a, rand(60, 70))
+        self.check('ij,ij->i', a, rand(60, 70))
+        self.check('ii,ij->ij', rand(70, 70), a.T)
+        self.check('ij,jk->ik', rand(60, 0), rand(0, 50))
+        self.check('ij,jk->ik', numpy.arange(4200).reshape(60,70), numpy.arange(3500).reshape(70,50))
+
+    def test_plan_cache(self):
+        numpy_helper._contract_plans.clear()
+        a = rand(60, 70)
+        self.check('ij,jk->ik', a, rand(70, 50))
+        self.check('ij,jk->ik', a, rand(70, 50))
+        self.assertEqual(len(numpy_helper._contract_plans), 1)
+        # a transposed view has a different plan
+        self.check('ij,jk->ik', a, rand(50, 70).T)
+        self.assertEqual(len(numpy_helper._contract_plans), 2)
+
+    def test_three_operands(self):
+        a = rand(50, 60)
+        b = rand(60, 70, dtype=numpy.complex128)
+        c = rand(70, 50)
+        ref = numpy.einsum('ij,jk,kl->il', a, b, c)
+        out = numpy_helper.einsum('ij,jk,kl->il', a, b, c)
+        self.assertAlmostEqual(abs(out - ref).max(), 0, 11)
+
+
+if __name__ == '__main__':
+    print("Full Tests for the einsum contraction plans")
+    unittest.main()
@@ -0,0 +1,208 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import tempfile
+import unittest
+from unittest import mock
+import ctypes
+import numpy
+import h5py
+from pyscf import gto
+from pyscf import lib
+from pyscf.pbc import gto as pgto
+from green_igen import incore
+from green_igen import outcore
+from green_igen._pbcintor import libpbc
+
+mol = gto.M(atom='O 0 0 0; H 0 .8 .6; H 0 -.8 .6',
+            basis={'O': 'ccpvdz', 'H': 'sto3g'})
+cell = pgto.M(atom='C 0 0 0; O .5 .8 1.1', a=numpy.eye(3)*3.5,
+              basis={'C': [[0, (4., 1.)], [0, (.8, 1.)], [1, (1.5, 1.)], [2, (.9, 1.)]],
+                     'O': [[0, (6., .6), (1.2, .4)], [1, (2., 1.)]]})
+auxbasis = {'C': [[0, (3., 1.)], [0, (1., 1.)], [1, (2., 1.)], [2, (1.5, 1.)]],
+            'O': [[0, (4., 1.)], [1, (2.5, 1.)], [2, (1., 1.)], [3, (1.2, 1.)]]}
+
+
+def fill_nr3c(fill, shls_slice, atm, bas, env, intor='int3c2e_sph'):
+    ao_loc = gto.moleintor.make_loc(bas, intor)
+    i0, i1, j0, j1, k0, k1 = [ao_loc[x] for x in shls_slice]
+    if fill == 'GTOnr3c_fill_s1':
+        out = numpy.zeros((k1-k0,j1-j0,i1-i0))
+    else:
+        out = numpy.zeros((i1-i0,j1*(j1+1)//2-j0*(j0+1)//2))
+    libpbc.GTOnr3c_drv(getattr(libpbc, intor), getattr(libpbc, fill),
+                       out.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(1),
+                       (ctypes.c_int*6)(*shls_slice),
+                       ao_loc.ctypes.data_as(ctypes.c_void_p), None,
+                       atm.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(atm)),
+                       bas.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(bas)),
+                       env.ctypes.data_as(ctypes.c_void_p))
+    return out
+
+def fill_r3c(fill, shls_slice, atm, bas, env, intor='int3c2e_spinor'):
+    ao_loc = gto.moleintor.make_loc(bas, intor)
+    i0, i1, j0, j1, k0, k1 = [ao_loc[x] for x in shls_slice]
+    if fill == 'GTOr3c_fill_s1':
+        out = numpy.zeros((k1-k0,j1-j0,i1-i0), dtype=numpy.complex128)
+    else:
+        out = numpy.zeros((i1-i0,j1*(j1+1)//2-j0*(j0+1)//2),
+                          dtype=numpy.complex128)
+    libpbc.GTOr3c_drv(getattr(libpbc, intor), getattr(libpbc, fill),
+                      out.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(1),
+                      (ctypes.c_int*6)(*shls_slice),
+                      ao_loc.ctypes.data_as(ctypes.c_void_p), None,
+                      atm.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(atm)),
+                      bas.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(bas)),
+                      env.ctypes.data_as(ctypes.c_void_p))
+    return out
+
+def aux_e2_by_pairs(auxcell, kptij_lst):
+    # one shell pair per call: the aux shells of the pair are split into tasks
+    nbas = cell.nbas
+    ao_loc = cell.ao_loc_nr()
+    naux = auxcell.nao_nr()
+    blocks = []
+    for ish in range(nbas):
+        di = ao_loc[ish+1] - ao_loc[ish]
+        row = []
+        for jsh in range(nbas):
+            dj = ao_loc[jsh+1] - ao_loc[jsh]
+            out = incore.aux_e2(cell, auxcell, kptij_lst=kptij_lst,
+                                shls_slice=(ish, ish+1, jsh, jsh+1, 0, auxcell.nbas))
+            row.append(out.reshape(-1,di,dj,naux))
+        blocks.append(numpy.concatenate(row, axis=2))
+    return numpy.concatenate(blocks, axis=1)
+
+def s1_to_s2jk(s1):
+    # s1[k,j,i] -> s2jk[i,jk] with j >= k
+    nj = s1.shape[1]
+    idx, idy = numpy.tril_indices(nj)
+    return s1[idy,idx].T
+
+class KnownValues(unittest.TestCase):
+    def test_nr3c_fill_s2jk(self):
+        nbas = mol.nbas
+        shls_slice = (0, nbas, 0, nbas, 0, nbas)
+        ref = fill_nr3c('GTOnr3c_fill_s1', shls_slice, mol._atm, mol._bas, mol._env)
+        out = fill_nr3c('GTOnr3c_fill_s2jk', shls_slice, mol._atm, mol._bas, mol._env)
+        self.assertAlmostEqual(abs(out - s1_to_s2jk(ref)).max(), 0, 12)
+
+    def test_nr3c_fill_s2jk_conc_env(self):
+        # k on the second copy of the basis, counted from ksh0
+        nbas = mol.nbas
+        atm, bas, env = gto.conc_env(mol._atm, mol._bas, mol._env,
+                                     mol._atm, mol._bas, mol._env)
+        shls_slice = (nbas, nbas*2, 0, nbas, nbas, nbas*2)
+        ref = fill_nr3c('GTOnr3c_fill_s1', shls_slice, atm, bas, env)
+        out = fill_nr3c('GTOnr3c_fill_s2jk', shls_slice, atm, bas, env)
+        self.assertAlmostEqual(abs(out - s1_to_s2jk(ref)).max(), 0, 12)
+
+    def test_r3c_fill_s2jk(self):
+        nbas = mol.nbas
+        shls_slice = (0, nbas, 0, nbas, 0, nbas)
+        ref = fill_r3c('GTOr3c_fill_s1', shls_slice, mol._atm, mol._bas, mol._env)
+        out = fill_r3c('GTOr3c_fill_s2jk', shls_slice, mol._atm, mol._bas, mol._env)
+        self.assertAlmostEqual(abs(out - s1_to_s2jk(ref)).max(), 0, 12)
+
+    def test_nr3c_screen_drv(self):
+        nbas = mol.nbas
+        shls_slice = (0, nbas, 0, nbas, 0, nbas)
+        ao_loc = mol.ao_loc_nr()
+        atm, bas, env = mol._atm, mol._bas, mol._env
+        ref = fill_nr3c('GTOnr3c_fill_s1', shls_slice, atm, bas, env)
+        q_ij = numpy.empty((nbas,nbas))
+        q_k = numpy.empty(nbas)
+        libpbc.GTOnr3c_q_cond(libpbc.int2e_sph, libpbc.int2c2e_sph,
+                              q_ij.ctypes.data_as(ctypes.c_void_p),
+                              q_k.ctypes.data_as(ctypes.c_void_p),
+                              (ctypes.c_int*6)(*shls_slice),
+                              ao_loc.ctypes.data_as(ctypes.c_void_p),
+                              atm.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(atm)),
+                              bas.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(bas)),
+                              env.ctypes.data_as(ctypes.c_void_p))
+        cutoff = 1e-8
+        out = numpy.zeros_like(ref)
+        libpbc.GTOnr3c_screen_drv(libpbc.int3c2e_sph, libpbc.GTOnr3c_fill_s1,
+                                  out.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(1),
+                                  (ctypes.c_int*6)(*shls_slice),
+                                  ao_loc.ctypes.data_as(ctypes.c_void_p), None,
+                                  q_ij.ctypes.data_as(ctypes.c_void_p),
+                                  q_k.ctypes.data_as(ctypes.c_void_p),
+                                  ctypes.c_double(cutoff),
+                                  atm.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(atm)),
+                                  bas.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(bas)),
+                                  env.ctypes.data_as(ctypes.c_void_p))
+        self.assertTrue(abs(out - ref).max() < cutoff)
+
+    def test_pbc_aux_tasks(self):
+        auxcell = incore.make_auxcell(cell, auxbasis)
+        nao = cell.nao_nr()
+        naux = auxcell.nao_nr()
+        kpts = cell.make_kpts([2,1,1])
+        for kptij_lst in (numpy.zeros((1,2,3)),
+                          numpy.asarray([(k, k) for k in kpts]),
+                          numpy.asarray([(kpts[0], kpts[1]), (kpts[1], kpts[0])])):
+            with lib.with_omp_threads(1):
+                # 36 shell pairs: one task per pair
+                ref = incore.aux_e2(cell, auxcell, kptij_lst=kptij_lst)
+                ref = ref.reshape(-1,nao,nao,naux)
+                out = aux_e2_by_pairs(auxcell, kptij_lst)
+            self.assertAlmostEqual(abs(out - ref).max(), 0, 14)
+            out = incore.aux_e2(cell, auxcell, kptij_lst=kptij_lst)
+            self.assertAlmostEqual(abs(out.reshape(ref.shape) - ref).max(), 0, 14)
+
+
+    def test_pair_images(self):
+        auxcell = incore.make_auxcell(cell, auxbasis)
+        kpts = cell.make_kpts([2,1,1])
+        for kptij_lst, aosym in ((numpy.zeros((1,2,3)), 's1'), (numpy.zeros((1,2,3)), 's2'),
+                                 (numpy.asarray([(k, k) for k in kpts]), 's2'),
+                                 (numpy.asarray([(kpts[0], kpts[1])]), 's1')):
+            out = incore.aux_e2(cell, auxcell, aosym=aosym, kptij_lst=kptij_lst)
+            # all images for every shell pair
+            with mock.patch.object(incore, 'PAIR_IMAGES', False):
+                ref = incore.aux_e2(cell, auxcell, aosym=aosym, kptij_lst=kptij_lst)
+            self.assertAlmostEqual(abs(out - ref).max(), 0, 7)
+            self.assertTrue(abs(ref).max() > 1e-1)
+
+    def test_pair_blocks(self):
+        auxcell = incore.make_auxcell(cell, auxbasis)
+        nao = cell.nao_nr()
+        kpts = cell.make_kpts([2,1,1])
+        kptij_lst = numpy.asarray([(kpts[0], kpts[0]), (kpts[1], kpts[0]), (kpts[1], kpts[1])])
+        pair_blocks = [numpy.array([0, 40, 41, nao*(nao+1)//2]),
+                       numpy.array([0, 100, nao**2])]
+        with tempfile.NamedTemporaryFile(suffix='.h5') as ftmp:
+            with h5py.File(ftmp.name, 'w') as f:
+                # small max_memory: several aux shell ranges fill each block
+                outcore._aux_e2(cell, auxcell, f, aosym='s2', kptij_lst=kptij_lst,
+                                dataname='ref', max_memory=.01)
+                outcore._aux_e2(cell, auxcell, f, aosym='s2', kptij_lst=kptij_lst,
+                                dataname='out', max_memory=.01, pair_blocks=pair_blocks)
+                nsegs = len(f['ref/0'])
+                self.assertTrue(nsegs > 1)
+                for k in range(len(kptij_lst)):
+                    ref = numpy.vstack([f['ref/%d/%d'%(k,i)][0].T for i in range(nsegs)])
+                    locs = pair_blocks[0] if k != 1 else pair_blocks[1]
+                    self.assertEqual(len(f['out/%d'%k]), len(locs)-1)
+                    for b, (p0, p1) in enumerate(zip(locs[:-1], locs[1:])):
+                        out = f['out/%d/%d'%(k,b)][0]
+                        self.assertEqual(out.shape, (ref.shape[0], p1-p0))
+                        self.assertAlmostEqual(abs(out - ref[:,p0:p1]).max(), 0, 14)
+
+
+if __name__ == '__main__':
+    print("Full Tests for 3c fill functions")
+    unittest.main()
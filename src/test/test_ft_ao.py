@@ -0,0 +1,104 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import unittest
+import ctypes
+import numpy
+from pyscf import gto
+from pyscf import lib
+from pyscf.pbc import gto as pgto
+from green_igen._pbcintor import libpbc
+
+cell = pgto.M(atom='C 0 0 0; O .5 .8 1.1', a=numpy.eye(3)*3.5,
+              basis={'C': [[0, (4., 1.)], [0, (.8, 1.)], [1, (1.5, 1.)], [2, (.9, 1.)]],
+                     'O': [[0, (6., .6), (1.2, .4)], [1, (2., 1.)]]})
+# general contractions and l up to 4 for the cartesian to spherical transform
+cell_gc = pgto.M(atom='C 0 0 0; O .5 .8 1.1', a=numpy.eye(3)*3.5,
+                 basis={'C': [[0, (4., 1.)], [2, (.9, 1., .3), (.4, .5, 1.)], [3, (.8, 1.)]],
+                        'O': [[1, (2., .6, .2), (.7, .4, 1.)], [4, (1., 1.)]]})
+kpts = cell.make_kpts([2,1,1])
+# G = 0 first. A d-d pair takes G blocks of 640, so each pair has 4 of them
+Gv = numpy.vstack([numpy.zeros(3),
+                   numpy.random.RandomState(3).random_sample((2200,3)) * 4 - 2])
+
+
+def ft_aopair(kpts, shls_slice=None, intor='GTO_ft_ovlp_sph', fill='PBC_ft_fill_ks1',
+              cell=cell):
+    atm, bas, env = gto.conc_env(cell._atm, cell._bas, cell._env,
+                                 cell._atm, cell._bas, cell._env)
+    nbas = cell.nbas
+    if shls_slice is None:
+        shls_slice = (0, nbas, nbas, nbas*2)
+    ao_loc = gto.moleintor.make_loc(bas, intor)
+    ni = ao_loc[shls_slice[1]] - ao_loc[shls_slice[0]]
+    nj = ao_loc[shls_slice[3]] - ao_loc[shls_slice[2]]
+    kpts = numpy.reshape(kpts, (-1,3))
+    Ls = cell.get_lattice_Ls()
+    expkL = numpy.asarray(numpy.exp(1j*numpy.dot(kpts, Ls.T)), order='C')
+    GvT = numpy.asarray(Gv.T, order='C')
+    out = numpy.zeros((len(kpts),1,ni,nj,len(Gv)), dtype=numpy.complex128)
+    libpbc.PBC_ft_latsum_drv(
+        getattr(libpbc, intor), libpbc.GTO_Gv_general, getattr(libpbc, fill),
+        out.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(kpts)),
+        ctypes.c_int(1), ctypes.c_int(len(Ls)),
+        Ls.ctypes.data_as(ctypes.c_void_p), expkL.ctypes.data_as(ctypes.c_void_p),
+        (ctypes.c_int*4)(*shls_slice), ao_loc.ctypes.data_as(ctypes.c_void_p),
+        GvT.ctypes.data_as(ctypes.c_void_p), (ctypes.c_double*1)(0), None,
+        (ctypes.c_int*3)(0,0,0), ctypes.c_int(len(Gv)),
+        atm.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(atm)),
+        bas.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(bas)),
+        env.ctypes.data_as(ctypes.c_void_p))
+    return out[:,0]
+
+def ft_by_pairs(kpts, intor='GTO_ft_ovlp_sph', fill='PBC_ft_fill_ks1'):
+    # one shell pair per call: the G vectors of the pair are split into tasks
+    nbas = cell.nbas
+    blocks = []
+    for ish in range(nbas):
+        blocks.append([ft_aopair(kpts, (ish, ish+1, nbas+jsh, nbas+jsh+1), intor, fill)
+                       for jsh in range(nbas)])
+    return numpy.concatenate([numpy.concatenate(b, axis=2) for b in blocks], axis=1)
+
+class KnownValues(unittest.TestCase):
+    def test_ovlp_at_G0(self):
+        ref = numpy.asarray(cell.pbc_intor('int1e_ovlp', kpts=kpts))
+        out = ft_aopair(kpts)
+        self.assertAlmostEqual(abs(out[:,:,:,0] - ref).max(), 0, 8)
+
+    def test_gv_tasks(self):
+        for kpt, fill in ((kpts, 'PBC_ft_fill_ks1'), (numpy.zeros(3), 'PBC_ft_fill_nk1s1')):
+            with lib.with_omp_threads(1):
+                # 36 shell pairs: one task per pair
+                ref = ft_aopair(kpt, fill=fill)
+                out = ft_by_pairs(kpt, fill=fill)
+            self.assertAlmostEqual(abs(out - ref).max(), 0, 14)
+            out = ft_aopair(kpt, fill=fill)
+            self.assertAlmostEqual(abs(out - ref).max(), 0, 14)
+
+    def test_c2s(self):
+        c = cell_gc.cart2sph_coeff()
+        for kpt, fill in ((kpts, 'PBC_ft_fill_ks1'), (numpy.zeros(3), 'PBC_ft_fill_nk1s1')):
+            cart = ft_aopair(kpt, intor='GTO_ft_ovlp_cart', fill=fill, cell=cell_gc)
+            ref = numpy.einsum('kabg,ai,bj->kijg', cart, c, c)
+            out = ft_aopair(kpt, fill=fill, cell=cell_gc)
+            self.assertAlmostEqual(abs(out - ref).max(), 0, 12)
+        ref = numpy.asarray(cell_gc.pbc_intor('int1e_ovlp', kpts=kpts))
+        out = ft_aopair(kpts, cell=cell_gc)
+        self.assertAlmostEqual(abs(out[:,:,:,0] - ref).max(), 0, 8)
+
+
+if __name__ == '__main__':
+    print("Full Tests for the FT AO pairs")
+    unittest.main()
@@ -0,0 +1,119 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import unittest
+import ctypes
+import numpy
+from pyscf import gto
+from pyscf.pbc import gto as pgto
+from green_igen._pbcintor import libpbc
+
+# the shells of each atom share their exponents (exponent families)
+basis = {'C': [[0, (4., .3, .1), (1.2, .5, .7), (.35, .4, .2)],
+               [1, (4., .2), (1.2, .6), (.35, .3)],
+               [2, (4., .5), (1.2, .5), (.35, .1)]],
+         'O': [[0, (6., .6), (1.5, .4)],
+               [1, (6., .3, .5), (1.5, .8, .2)]]}
+mol = gto.M(atom='C 0 0 0; O .5 .8 1.1', basis=basis)
+cell = pgto.M(atom='C 0 0 0; O .5 .8 1.1', basis=basis, a=numpy.eye(3)*3.5)
+kpts = cell.make_kpts([2,1,1])
+coords = numpy.random.RandomState(5).random_sample((250,3)) * 3.5
+BLKSIZE = 104
+
+
+def split_families(bas, env):
+    # a copy of the exponents for each shell, slightly perturbed, so that
+    # every shell is evaluated on its own
+    bas = bas.copy()
+    env = [env]
+    ptr = len(env[0])
+    for ib in range(len(bas)):
+        nprim = bas[ib,gto.NPRIM_OF]
+        exps = env[0][bas[ib,gto.PTR_EXP]:bas[ib,gto.PTR_EXP]+nprim]
+        env.append(exps * (1 + 1e-14 * (ib+1)))
+        bas[ib,gto.PTR_EXP] = ptr
+        ptr += nprim
+    return bas, numpy.hstack(env)
+
+def eval_mol(eval_name, comp, atm, bas, env):
+    ngrids = len(coords)
+    ao_loc = gto.moleintor.make_loc(bas, eval_name)
+    nao = ao_loc[-1]
+    ao = numpy.zeros((comp,nao,ngrids))
+    non0tab = numpy.ones(((ngrids+BLKSIZE-1)//BLKSIZE,len(bas)), dtype=numpy.uint8)
+    c = numpy.asarray(coords.T, order='C')
+    getattr(libpbc, eval_name)(ctypes.c_int(ngrids),
+                               (ctypes.c_int*2)(0, len(bas)),
+                               ao_loc.ctypes.data_as(ctypes.c_void_p),
+                               ao.ctypes.data_as(ctypes.c_void_p),
+                               c.ctypes.data_as(ctypes.c_void_p),
+                               non0tab.ctypes.data_as(ctypes.c_void_p),
+                               atm.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(atm)),
+                               bas.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(bas)),
+                               env.ctypes.data_as(ctypes.c_void_p))
+    return ao
+
+def eval_pbc(eval_name, comp, atm, bas, env):
+    ngrids = len(coords)
+    ao_loc = gto.moleintor.make_loc(bas, eval_name)
+    nao = ao_loc[-1]
+    Ls = cell.get_lattice_Ls()
+    expLk = numpy.exp(1j * numpy.dot(Ls, kpts.T))
+    ao = numpy.zeros((len(kpts),comp,nao,ngrids), dtype=numpy.complex128)
+    rcut = numpy.full(len(bas), 50.)
+    non0tab = numpy.full(((ngrids+BLKSIZE-1)//BLKSIZE,len(bas)), 0xff,
+                         dtype=numpy.uint8)
+    c = numpy.asarray(coords.T, order='C')
+    getattr(libpbc, eval_name)(ctypes.c_int(ngrids),
+                               (ctypes.c_int*2)(0, len(bas)),
+                               ao_loc.ctypes.data_as(ctypes.c_void_p),
+                               Ls.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(Ls)),
+                               expLk.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(kpts)),
+                               ao.ctypes.data_as(ctypes.c_void_p),
+                               c.ctypes.data_as(ctypes.c_void_p),
+                               rcut.ctypes.data_as(ctypes.c_void_p),
+                               non0tab.ctypes.data_as(ctypes.c_void_p),
+                               atm.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(atm)),
+                               bas.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(bas)),
+                               env.ctypes.data_as(ctypes.c_void_p))
+    return ao
+
+class KnownValues(unittest.TestCase):
+    def test_mol_family(self):
+        bas1, env1 = split_families(mol._bas, mol._env)
+        for eval_name, comp in (('GTOval_sph', 1), ('GTOval_cart', 1),
+                                ('GTOval_sph_deriv1', 4), ('GTOval_cart_deriv1', 4),
+                                ('GTOval_ip_sph', 3)):
+            out = eval_mol(eval_name, comp, mol._atm, mol._bas, mol._env)
+            ref = eval_mol(eval_name, comp, mol._atm, bas1, env1)
+            self.assertAlmostEqual(abs(out - ref).max(), 0, 11)
+            ref = mol.eval_gto(eval_name, coords, comp=comp)
+            ref = ref.reshape(comp,len(coords),-1).transpose(0,2,1)
+            self.assertAlmostEqual(abs(out - ref).max(), 0, 11)
+
+    def test_pbc_family(self):
+        bas1, env1 = split_families(cell._bas, cell._env)
+        for eval_name, comp in (('PBCGTOval_sph_deriv0', 1), ('PBCGTOval_cart_deriv0', 1),
+                                ('PBCGTOval_sph_deriv1', 4), ('PBCGTOval_cart_deriv1', 4),
+                                ('PBCGTOval_ip_sph', 3)):
+            out = eval_pbc(eval_name, comp, cell._atm, cell._bas, cell._env)
+            ref = eval_pbc(eval_name, comp, cell._atm, bas1, env1)
+            self.assertTrue(abs(out).max() > 1e-3)
+            self.assertAlmostEqual(abs(out - ref).max(), 0, 10)
+
+
+if __name__ == '__main__':
+    print("Full Tests for the exponent families of the grid AO kernels")
+    unittest.main()
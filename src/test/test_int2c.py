@@ -0,0 +1,117 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import unittest
+import ctypes
+import numpy
+from pyscf import gto
+from pyscf.pbc import gto as pgto
+from green_igen import incore
+from green_igen import _vhf
+from green_igen._pbcintor import libpbc
+
+mol = gto.M(atom='O 0 0 0; H 0 .8 .6; H 0 -.8 .6',
+            basis={'O': 'ccpvdz', 'H': 'sto3g'})
+cell = pgto.M(atom='C 0 0 0; O .5 .8 1.1', a=numpy.eye(3)*3.5,
+              basis={'C': [[0, (4., 1.)], [0, (.8, 1.)], [1, (1.5, 1.)], [2, (.9, 1.)]],
+                     'O': [[0, (6., .6), (1.2, .4)], [1, (2., 1.)]]})
+kpts = cell.make_kpts([2,1,2])
+
+
+def int2c(intor, comp, hermi, dtype=numpy.double):
+    ao_loc = gto.moleintor.make_loc(mol._bas, intor)
+    nao = ao_loc[-1]
+    mat = numpy.zeros((comp,nao,nao), dtype=dtype)
+    fdrv = libpbc.GTOint2c_spinor if dtype == numpy.complex128 else libpbc.GTOint2c
+    fdrv(getattr(libpbc, intor), mat.ctypes.data_as(ctypes.c_void_p),
+         ctypes.c_int(comp), ctypes.c_int(hermi),
+         (ctypes.c_int*4)(0, mol.nbas, 0, mol.nbas),
+         ao_loc.ctypes.data_as(ctypes.c_void_p), None,
+         mol._atm.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(mol.natm),
+         mol._bas.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(mol.nbas),
+         mol._env.ctypes.data_as(ctypes.c_void_p))
+    # mat(naoi,naoj,comp) in F-order
+    return mat.transpose(0,2,1)
+
+def pbc_int2c(intor, hermi):
+    atm, bas, env = gto.conc_env(cell._atm, cell._bas, cell._env,
+                                 cell._atm, cell._bas, cell._env)
+    ao_loc = gto.moleintor.make_loc(bas, intor)
+    nao = ao_loc[cell.nbas]
+    Ls = cell.get_lattice_Ls()
+    expkL = numpy.asarray(numpy.exp(1j*numpy.dot(kpts, Ls.T)), order='C')
+    out = numpy.zeros((len(kpts),1,nao,nao), dtype=numpy.complex128)
+    cintopt = _vhf.make_cintopt(atm, bas, env, intor)
+    args = (out.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(kpts)),
+            ctypes.c_int(1), ctypes.c_int(len(Ls)))
+    if hermi:
+        fdrv = libpbc.PBCnr2c_hermi_drv
+        fill = libpbc.PBCnr2c_fill_ks2
+        args = args + (ctypes.c_int(hermi),)
+    else:
+        fdrv = libpbc.PBCnr2c_drv
+        fill = libpbc.PBCnr2c_fill_ks1
+    fdrv(getattr(libpbc, intor), fill, *args,
+         Ls.ctypes.data_as(ctypes.c_void_p), expkL.ctypes.data_as(ctypes.c_void_p),
+         (ctypes.c_int*4)(0, cell.nbas, cell.nbas, cell.nbas*2),
+         ao_loc.ctypes.data_as(ctypes.c_void_p), cintopt, None,
+         atm.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(atm)),
+         bas.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(bas)),
+         env.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(env.size))
+    return out[:,0]
+
+class KnownValues(unittest.TestCase):
+    def test_int2c_hermi(self):
+        # triangular task space and the parallel symmetrization
+        for intor, comp, hermi in (('int1e_ovlp_sph', 1, 1), ('int1e_kin_sph', 1, 1),
+                                   ('int1e_ipovlp_sph', 3, 2)):
+            ref = mol.intor(intor, comp=comp).reshape(comp,mol.nao,mol.nao)
+            self.assertAlmostEqual(abs(int2c(intor, comp, 0) - ref).max(), 0, 12)
+            out = int2c(intor, comp, hermi)
+            self.assertAlmostEqual(abs(out - ref).max(), 0, 12)
+        ref = mol.intor('int1e_ovlp_spinor')
+        out = int2c('int1e_ovlp_spinor', 1, 1, numpy.complex128)[0]
+        self.assertAlmostEqual(abs(out - ref).max(), 0, 12)
+
+    def test_pbc_hermi_drv(self):
+        for intor in ('int1e_ovlp_sph', 'int1e_kin_sph'):
+            ref = pbc_int2c(intor, 0)
+            out = pbc_int2c(intor, 1)
+            self.assertAlmostEqual(abs(out - ref).max(), 0, 12)
+            self.assertAlmostEqual(abs(out - out.conj().transpose(0,2,1)).max(), 0, 12)
+
+    def test_lattice_int2c(self):
+        for intor in ('int1e_ovlp', 'int1e_kin'):
+            out = numpy.asarray(incore.lattice_int2c(cell, intor, hermi=1, kpts=kpts))
+            ref = numpy.asarray(incore.lattice_int2c(cell, intor, hermi=0, kpts=kpts))
+            self.assertAlmostEqual(abs(out - ref).max(), 0, 12)
+            ref = numpy.asarray(cell.pbc_intor(intor, hermi=0, kpts=kpts))
+            self.assertAlmostEqual(abs(out - ref).max(), 0, 7)
+        # gamma point is real
+        out = incore.lattice_int2c(cell, 'int1e_ovlp', hermi=1, kpts=numpy.zeros(3))
+        self.assertFalse(numpy.iscomplexobj(out))
+
+    def test_lattice_int2c_multi(self):
+        ovlp, kin = incore.lattice_int2c_multi(cell, ('int1e_ovlp', 'int1e_kin'),
+                                               hermi=1, kpts=kpts)
+        ref = incore.lattice_int2c(cell, 'int1e_ovlp', hermi=1, kpts=kpts)
+        self.assertAlmostEqual(abs(numpy.asarray(ovlp) - numpy.asarray(ref)).max(), 0, 12)
+        ref = incore.lattice_int2c(cell, 'int1e_kin', hermi=1, kpts=kpts)
+        self.assertAlmostEqual(abs(numpy.asarray(kin) - numpy.asarray(ref)).max(), 0, 12)
+
+
+if __name__ == '__main__':
+    print("Full Tests for the 2c integral drivers")
+    unittest.main()
@@ -0,0 +1,158 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import unittest
+import ctypes
+import numpy
+from pyscf import gto
+from green_igen import _vhf
+from green_igen._pbcintor import libpbc
+
+# two distant fragments, so that the Schwarz screening removes quartets
+mol = gto.M(atom='O 0 0 0; H 0 .8 .6; H 0 -.8 .6; He 0 0 5',
+            basis={'O': 'sto3g', 'H': 'sto3g', 'He': [[0, (2., 1.)], [1, (1., 1.)]]})
+nao = mol.nao
+ao_loc = mol.ao_loc_nr()
+eri1 = mol.intor('int2e')
+
+
+def q_cond():
+    # sqrt(max |(ij|ij)|) of each shell pair
+    nbas = mol.nbas
+    q = numpy.empty((nbas,nbas))
+    for ish in range(nbas):
+        for jsh in range(nbas):
+            i0, i1 = ao_loc[ish], ao_loc[ish+1]
+            j0, j1 = ao_loc[jsh], ao_loc[jsh+1]
+            diag = numpy.einsum('ijij->ij', eri1[i0:i1,j0:j1,i0:i1,j0:j1])
+            q[ish,jsh] = abs(diag).max() ** .5
+    return q
+
+def ref_block(aosym, shls_slice):
+    i0, i1, j0, j1, k0, k1, l0, l1 = [ao_loc[x] for x in shls_slice]
+    eri = eri1[i0:i1,j0:j1,k0:k1,l0:l1]
+    if aosym in (2, 4):
+        idx, idy = numpy.tril_indices(i1-i0)
+        eri = eri[idx,idy]
+    else:
+        eri = eri.reshape((i1-i0)*(j1-j0),k1-k0,l1-l0)
+    if aosym in (3, 4):
+        idx, idy = numpy.tril_indices(k1-k0)
+        eri = eri[:,idx,idy]
+    else:
+        eri = eri.reshape(len(eri),-1)
+    return eri
+
+def fill_screen(aosyms, shls_slices, q=None, cutoff=0):
+    eris = [numpy.zeros(ref_block(s, slc).shape) for s, slc in zip(aosyms, shls_slices)]
+    nout = len(eris)
+    c_eris = (ctypes.c_void_p*nout)(*[x.ctypes.data for x in eris])
+    slices = numpy.asarray(shls_slices, dtype=numpy.int32).ravel()
+    if q is not None:
+        q = q.ctypes.data_as(ctypes.c_void_p)
+    libpbc.GTOnr2e_fill_screen_drv(
+        libpbc.int2e_sph, None, c_eris, (ctypes.c_int*nout)(*aosyms),
+        ctypes.c_int(nout), ctypes.c_int(1),
+        slices.ctypes.data_as(ctypes.c_void_p),
+        ao_loc.ctypes.data_as(ctypes.c_void_p), None,
+        q, ctypes.c_double(cutoff),
+        mol._atm.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(mol.natm),
+        mol._bas.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(mol.nbas),
+        mol._env.ctypes.data_as(ctypes.c_void_p))
+    return eris
+
+def hess_jk_ref(intor, terms, dm_ket, dm_bra):
+    eri = mol.intor(intor, comp=9)
+    aoatm = numpy.zeros((mol.natm,nao))
+    for ia, (sh0, sh1, p0, p1) in enumerate(mol.aoslice_by_atom()):
+        aoatm[ia,p0:p1] = 1
+    vs = []
+    for term in terms:
+        dms, centers = term.split('->')
+        ket, bra = dms.split(',')
+        v = [numpy.einsum('xijkl,%s,%s->%sx' % (ket, bra, centers), eri, dk, db)
+             for dk, db in zip(dm_ket, dm_bra)]
+        if len(centers) == 2:
+            vs.append(numpy.einsum('aq,bs,nqsx->nabx', aoatm, aoatm, v))
+        else:
+            vs.append(numpy.einsum('aq,nqx->nax', aoatm, v))
+    return vs
+
+class KnownValues(unittest.TestCase):
+    def test_packings(self):
+        nbas = mol.nbas
+        full = (0, nbas, 0, nbas, 0, nbas, 0, nbas)
+        for aosym in (1, 2, 3, 4):
+            out = fill_screen([aosym], [full])[0]
+            self.assertAlmostEqual(abs(out - ref_block(aosym, full)).max(), 0, 12)
+
+    def test_multi_output(self):
+        # an s4 array and an s1 fragment sub-block from the same quartets
+        nbas = mol.nbas
+        slices = [(0, nbas, 0, nbas, 0, nbas, 0, nbas),
+                  (1, 4, 0, 3, 2, nbas, 1, 3),
+                  (1, 4, 1, 4, 0, nbas, 0, nbas)]
+        aosyms = [4, 1, 2]
+        outs = fill_screen(aosyms, slices)
+        for aosym, slc, out in zip(aosyms, slices, outs):
+            self.assertAlmostEqual(abs(out - ref_block(aosym, slc)).max(), 0, 12)
+
+    def test_screen(self):
+        nbas = mol.nbas
+        full = (0, nbas, 0, nbas, 0, nbas, 0, nbas)
+        q = q_cond()
+        cutoff = 1e-9
+        self.assertTrue((numpy.einsum('ij,kl->ijkl', q, q) < cutoff).any())
+        for aosym in (1, 4):
+            out = fill_screen([aosym], [full], q, cutoff)[0]
+            ref = ref_block(aosym, full)
+            self.assertTrue(abs(out - ref).max() < cutoff)
+
+        # quartets below the cutoff are zero, the others are exact
+        out = fill_screen([1], [full], q, cutoff)[0].reshape([nao]*4)
+        dims = ao_loc[1:] - ao_loc[:-1]
+        qao = numpy.repeat(numpy.repeat(q, dims, axis=0), dims, axis=1)
+        mask = numpy.einsum('ij,kl->ijkl', qao, qao) < cutoff
+        self.assertTrue(mask.any())
+        self.assertTrue((out[mask] == 0).all())
+        self.assertAlmostEqual(abs(out[~mask] - eri1[~mask]).max(), 0, 12)
+
+    def test_hess_jk(self):
+        rng = numpy.random.RandomState(3)
+        dm_ket = rng.random_sample((2,nao,nao))
+        dm_ket = dm_ket + dm_ket.transpose(0,2,1)
+        dm_bra = rng.random_sample((2,nao,nao))
+        dm_bra = dm_bra + dm_bra.transpose(0,2,1)
+        args = (dm_ket, dm_bra, 9, mol.natm, mol._atm, mol._bas, mol._env)
+        # J and K of ipip1, with and without the k/l symmetry
+        terms = ('lk,ij->i', 'jk,il->i')
+        ref = hess_jk_ref('int2e_ipip1', terms, dm_ket, dm_bra)
+        for aosym in ('s1', 's2kl'):
+            out = _vhf.hess_jk('int2e_ipip1', terms, *args, aosym=aosym)
+            for x, y in zip(out, ref):
+                self.assertEqual(x.shape, (2,mol.natm,9))
+                self.assertAlmostEqual(abs(x - y).max(), 0, 10)
+        # atom-pair blocks of ip1ip2
+        terms = ('lk,ij->ik', 'jk,il->ik')
+        ref = hess_jk_ref('int2e_ip1ip2', terms, dm_ket, dm_bra)
+        out = _vhf.hess_jk('int2e_ip1ip2', terms, *args)
+        for x, y in zip(out, ref):
+            self.assertEqual(x.shape, (2,mol.natm,mol.natm,9))
+            self.assertAlmostEqual(abs(x - y).max(), 0, 10)
+
+
+if __name__ == '__main__':
+    print("Full Tests for the screened 2e fill driver")
+    unittest.main()
@@ -0,0 +1,89 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import tempfile
+import unittest
+import numpy
+from pyscf.pbc import gto as pgto
+from pyscf.pbc.df import fft
+from green_igen import isdf
+
+cell = pgto.M(atom='He 0 0 0; He 1 1.2 .8', a=numpy.eye(3)*3.,
+              basis=[[0, (.8, 1.)], [0, (.3, 1.)], [1, (.5, 1.)]], mesh=[9]*3)
+kpts = cell.make_kpts([2,1,1])
+nao = cell.nao
+
+
+def fftdf_eri(kpts4):
+    eri = fft.FFTDF(cell, kpts).get_eri(kpts4, compact=False)
+    return eri.reshape([nao]*4)
+
+class KnownValues(unittest.TestCase):
+    def test_eval_ao(self):
+        coords = cell.gen_uniform_grids([5]*3)
+        ao = isdf.eval_ao(cell, coords, kpts)
+        ref = numpy.asarray(cell.pbc_eval_gto('GTOval', coords, kpts=kpts))
+        self.assertAlmostEqual(abs(ao - ref).max(), 0, 7)
+
+    def test_all_points(self):
+        # all grids as interpolation points: exact on the FFTDF grids up to
+        # the lindep truncation of the metric
+        mydf = isdf.ISDF(cell, kpts)
+        mydf.npoints = numpy.prod(cell.mesh)
+        mydf.build()
+        for kpts4 in ((kpts[0], kpts[0], kpts[0], kpts[0]),
+                      (kpts[0], kpts[1], kpts[1], kpts[0])):
+            ref = fftdf_eri(kpts4)
+            self.assertAlmostEqual(abs(mydf.get_eri(kpts4) - ref).max(), 0, 5)
+
+    def test_convergence(self):
+        kpts4 = (kpts[0], kpts[1], kpts[1], kpts[0])
+        ref = fftdf_eri(kpts4)
+        for method in ('kmeans', 'qr'):
+            err = []
+            for c in (2, 10):
+                mydf = isdf.ISDF(cell, kpts)
+                mydf.method = method
+                mydf.npoints = c * nao
+                mydf.build()
+                err.append(abs(mydf.get_eri(kpts4) - ref).max())
+            self.assertTrue(err[1] < err[0], (method, err))
+            self.assertTrue(err[1] < 5e-2 * abs(ref).max(), (method, err))
+
+    def test_qr_blocks(self):
+        # 500 MB is not enough for the full sketch of 10000 grids: the QR
+        # runs over blocks of grids
+        coords = numpy.random.RandomState(9).random_sample((10000,3)) * 3.
+        idx = isdf.select_points_qr(cell, coords, kpts, 400, max_memory=1)
+        self.assertEqual(len(numpy.unique(idx)), 400)
+        idx = isdf.select_points_qr(cell, coords, kpts, 400, max_memory=1e6)
+        self.assertEqual(len(numpy.unique(idx)), 400)
+        self.assertRaises(MemoryError, isdf.select_points_qr,
+                          cell, coords, kpts, 3000, max_memory=1)
+
+    def test_save_load(self):
+        mydf = isdf.ISDF(cell, kpts)
+        mydf.npoints = 4 * nao
+        mydf.build()
+        with tempfile.NamedTemporaryFile(suffix='.h5') as f:
+            mydf.save(f.name)
+            mydf1 = isdf.ISDF(cell).load(f.name)
+        kpts4 = (kpts[1], kpts[0], kpts[0], kpts[1])
+        self.assertAlmostEqual(abs(mydf1.get_eri(kpts4) - mydf.get_eri(kpts4)).max(), 0, 14)
+
+
+if __name__ == '__main__':
+    print("Full Tests for ISDF")
+    unittest.main()
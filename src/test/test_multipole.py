@@ -0,0 +1,159 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import unittest
+import math
+import numpy
+from scipy.special import gammainc
+from pyscf.pbc import gto as pgto
+from green_igen import incore
+from green_igen import df
+from green_igen import _pbcintor
+
+def make_cell(precision):
+    return pgto.M(atom='C 0 0 0; O .5 .8 1.1', a=numpy.eye(3)*3.5,
+                  basis={'C': [[0, (4., 1.)], [0, (.8, 1.)],
+                               [1, (1.5, 1.)], [2, (.9, 1.)]],
+                         'O': [[0, (6., .6), (1.2, .4)], [1, (2., 1.)]]},
+                  precision=precision)
+
+kpts = numpy.array([[0., 0., 0.], [.1, -.2, .3]])
+kptij_lst = numpy.array([(ki, kj) for ki in kpts for kj in kpts])
+
+# f and g auxiliary shells, L = li+lj+lk up to 8
+auxbasis_fg = {'C': [[0, (.5, 1.)], [3, (.7, 1.)], [4, (1.1, 1.)]],
+               'O': [[2, (1., 1.)], [3, (.6, 1.)], [4, (.9, 1.)]]}
+
+
+def hermite_coulomb(r, nmax, alpha=None):
+    '''R_tuv(r) of McMurchie-Davidson for the Coulomb interaction of two
+    Gaussian charges, 1/a = alpha. The point multipoles if alpha is None.'''
+    rr = r.dot(r)
+    R = {}
+    for n in range(nmax+1):
+        if alpha is None:
+            R[0,0,0,n] = (-1)**n * numpy.prod(numpy.arange(2*n-1, 0, -2)) / rr**(n+.5)
+        else:
+            x2 = alpha * rr
+            boys = math.gamma(n+.5) * gammainc(n+.5, x2) / (2*x2**(n+.5))
+            R[0,0,0,n] = (-2*alpha)**n * boys * 2*numpy.sqrt(alpha/numpy.pi)
+    def get(t, u, v, n):
+        if t < 0 or u < 0 or v < 0:
+            return 0.
+        if (t, u, v, n) not in R:
+            if t > 0:
+                val = (t-1) * get(t-2, u, v, n+1) + r[0] * get(t-1, u, v, n+1)
+            elif u > 0:
+                val = (u-1) * get(t, u-2, v, n+1) + r[1] * get(t, u-1, v, n+1)
+            else:
+                val = (v-1) * get(t, u, v-2, n+1) + r[2] * get(t, u, v-1, n+1)
+            R[t,u,v,n] = val
+        return R[t,u,v,n]
+    return get
+
+
+def exact_and_multipole(fn):
+    multipole = incore.MULTIPOLE
+    try:
+        incore.MULTIPOLE = False
+        ref = fn()
+        incore.MULTIPOLE = True
+        out = fn()
+    finally:
+        incore.MULTIPOLE = multipole
+    return numpy.asarray(ref), numpy.asarray(out)
+
+class KnownValues(unittest.TestCase):
+    def test_int3c2e(self):
+        for precision in (1e-6, 1e-8, 1e-10):
+            cell = make_cell(precision)
+            auxcell = df.make_modrho_basis(cell, 'weigend')
+            ref, out = exact_and_multipole(
+                lambda: incore.aux_e2(cell, auxcell, 'int3c2e', aosym='s1',
+                                      kptij_lst=kptij_lst))
+            self.assertTrue(abs(out - ref).max() < precision, precision)
+
+    def test_rr_near(self):
+        # the tail of the Boys function at the near-field radius, relative to
+        # the order n multipole term n!/R^{n+1}
+        numpy.random.seed(2)
+        for precision in (1e-6, 1e-8, 1e-10):
+            rr_near = _pbcintor.multipole_rr_near(precision, 12)
+            self.assertTrue(numpy.all(numpy.diff(rr_near) > 0))
+            for L in range(13):
+                alpha = .7
+                R = numpy.sqrt(rr_near[L] / alpha)
+                for r in numpy.random.randn(4, 3):
+                    r *= R / numpy.linalg.norm(r)
+                    exact = hermite_coulomb(r, L, alpha)
+                    point = hermite_coulomb(r, L)
+                    for t in range(L+1):
+                        for u in range(L+1-t):
+                            for v in range(L+1-t-u):
+                                n = t + u + v
+                                err = abs(exact(t,u,v,0) - point(t,u,v,0))
+                                self.assertTrue(err * R**(n+1) / math.factorial(n)
+                                                < precision, (precision, L))
+
+    def test_int3c2e_fg(self):
+        for precision in (1e-6, 1e-8, 1e-10):
+            cell = make_cell(precision)
+            auxcell = df.make_modrho_basis(cell, auxbasis_fg)
+            ref, out = exact_and_multipole(
+                lambda: incore.aux_e2(cell, auxcell, 'int3c2e', aosym='s2ij',
+                                      kptij_lst=kptij_lst))
+            self.assertTrue(abs(out - ref).max() < precision, precision)
+
+    def test_int2c2e_fg(self):
+        cell = make_cell(1e-8)
+        auxcell = df.make_modrho_basis(cell, auxbasis_fg)
+        ref, out = exact_and_multipole(
+            lambda: incore.lattice_int2c(auxcell, 'int2c2e', hermi=1, kpts=kpts))
+        self.assertTrue(abs(out - ref).max() < cell.precision)
+
+    def test_j2c_fused(self):
+        # the metric of the GDF build, lattice_int2c vs pbc_intor
+        cell = make_cell(1e-8)
+        mydf = df.GDF(cell, kpts)
+        mydf.eta = .3
+        auxcell = df.make_modrho_basis(cell, 'weigend')
+        fused_cell, fuse = df.fuse_auxcell(mydf, auxcell)
+        ref = numpy.asarray(fused_cell.pbc_intor('int2c2e', hermi=0, kpts=kpts))
+        ref1, out = exact_and_multipole(
+            lambda: incore.lattice_int2c(fused_cell, 'int2c2e', hermi=0, kpts=kpts))
+        self.assertAlmostEqual(abs(ref1 - ref).max(), 0, 9)
+        self.assertTrue(abs(out - ref).max() < cell.precision)
+
+    def test_int3c2e_cart(self):
+        cell = make_cell(1e-8)
+        cell.cart = True
+        auxcell = df.make_modrho_basis(cell, 'weigend')
+        ref, out = exact_and_multipole(
+            lambda: incore.aux_e2(cell, auxcell, 'int3c2e', aosym='s2ij'))
+        self.assertTrue(abs(out - ref).max() < cell.precision)
+
+    def test_int2c2e(self):
+        for precision in (1e-6, 1e-8, 1e-10):
+            cell = make_cell(precision)
+            auxcell = df.make_modrho_basis(cell, 'weigend')
+            ref, out = exact_and_multipole(
+                lambda: incore.lattice_int2c(auxcell, 'int2c2e', hermi=1,
+                                             kpts=kpts))
+            self.assertTrue(abs(out - ref).max() < precision, precision)
+
+
+if __name__ == '__main__':
+    print("Full Tests for the multipole far field of the lattice sums")
+    unittest.main()
@@ -0,0 +1,75 @@
+#!/usr/bin/env python
+# Copyright 2014-2018 The PySCF Developers. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import unittest
+import ctypes
+import numpy
+from pyscf import gto
+from green_igen._pbcintor import libpbc
+
+mol = gto.M(atom='C 0 0 0; O .5 .8 1.1',
+            basis={'C': [[0, (4., .3, .1), (.8, .5, .7)], [1, (1.5, 1.)],
+                         [2, (.9, 1.)], [3, (.7, 1.)]],
+                   'O': [[0, (6., .6), (1.2, .4)], [1, (2., .5, .3), (.5, .5, .8)]]})
+coords = numpy.random.RandomState(6).random_sample((250,3)) * 3.
+BLKSIZE = 104
+
+# j = l+1/2 and j = l-1/2 only shells besides the kappa = 0 ones
+bas = mol._bas.copy()
+bas[1,gto.KAPPA_OF] = -1
+bas[2,gto.KAPPA_OF] = 1
+bas[5,gto.KAPPA_OF] = 1
+
+
+def eval_spinor(eval_name, comp, planar, bas=bas):
+    ngrids = len(coords)
+    ao_loc = gto.moleintor.make_loc(bas, 'spinor')
+    nao = ao_loc[-1]
+    if planar:
+        ao = numpy.zeros((4,comp,nao,ngrids))
+    else:
+        ao = numpy.zeros((2,comp,nao,ngrids), dtype=numpy.complex128)
+    non0tab = numpy.ones(((ngrids+BLKSIZE-1)//BLKSIZE,len(bas)), dtype=numpy.uint8)
+    c = numpy.asarray(coords.T, order='C')
+    getattr(libpbc, eval_name)(ctypes.c_int(ngrids),
+                               (ctypes.c_int*2)(0, len(bas)),
+                               ao_loc.ctypes.data_as(ctypes.c_void_p),
+                               ao.ctypes.data_as(ctypes.c_void_p),
+                               c.ctypes.data_as(ctypes.c_void_p),
+                               non0tab.ctypes.data_as(ctypes.c_void_p),
+                               mol._atm.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(mol.natm),
+                               bas.ctypes.data_as(ctypes.c_void_p), ctypes.c_int(len(bas)),
+                               mol._env.ctypes.data_as(ctypes.c_void_p))
+    if planar:
+        ao = numpy.asarray([ao[0] + ao[1] * 1j, ao[2] + ao[3] * 1j])
+    return ao
+
+class KnownValues(unittest.TestCase):
+    def test_planar(self):
+        for deriv, comp in ((0, 1), (1, 4), (2, 10)):
+            ref = eval_spinor('GTOval_spinor_deriv%d' % deriv, comp, False)
+            out = eval_spinor('GTOval_spinor_planar_deriv%d' % deriv, comp, True)
+            self.assertTrue(abs(ref).max() > 1e-2)
+            self.assertAlmostEqual(abs(out - ref).max(), 0, 12)
+
+    def test_interleaved_ref(self):
+        ref = mol.eval_gto('GTOval_spinor', coords)
+        out = eval_spinor('GTOval_spinor_planar_deriv0', 1, True, mol._bas)
+        self.assertAlmostEqual(abs(out[:,0].transpose(0,2,1) - ref).max(), 0, 12)
+
+
+if __name__ == '__main__':
+    print("Full Tests for the planar spinor AOs on grids")
+    unittest.main()